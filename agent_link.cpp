@@ -0,0 +1,210 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "agent_link.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+
+
+// longest message accepted from the peer
+static const size_t MAX_LINE_BYTES = 64*1024;
+
+
+// Address of the peer of a connected socket, for the messages
+static std::string peer_name(int fd)
+{
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	char host[NI_MAXHOST], port[NI_MAXSERV];
+	if (getpeername(fd, (struct sockaddr*)&addr, &len) != 0 or
+		getnameinfo((struct sockaddr*)&addr, len, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0){
+		return "unknown peer";
+	}
+	return str(boost::format("%s:%s") % host % port);
+}
+
+
+// control messages are a few bytes: send them right away
+static void set_no_delay(int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+
+
+agent_link::agent_link(int fd, const std::string& peer) :
+	_fd(fd), _peer(peer)
+{
+}
+
+
+agent_link::~agent_link()
+{
+	::close(_fd);
+}
+
+
+agent_link::sptr agent_link::listen(int port, std::function<bool()> stop_requested)
+{
+	int listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+	bool ipv6 = listen_fd >= 0;
+	if (not ipv6) listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot create the agent socket: %s") % std::strerror(errno)));
+	}
+	int one = 1, zero = 0;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	int err;
+	if (ipv6){
+		// IPv4 peers are accepted too
+		setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+		struct sockaddr_in6 addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin6_family = AF_INET6;
+		addr.sin6_addr 	 = in6addr_any;
+		addr.sin6_port 	 = htons(port);
+		err = bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+	}
+	else{
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family 	 = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port 		 = htons(port);
+		err = bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+	}
+	if (err != 0 or ::listen(listen_fd, 1) != 0){
+		std::string error = std::strerror(errno);
+		::close(listen_fd);
+		throw std::runtime_error(str(boost::format("Cannot listen on port %d: %s") % port % error));
+	}
+
+	int fd = -1;
+	while (fd < 0 and not stop_requested()){
+		struct pollfd pfd = {listen_fd, POLLIN, 0};
+		if (poll(&pfd, 1, 100) <= 0) continue;
+		fd = accept(listen_fd, NULL, NULL);
+	}
+	::close(listen_fd);
+	if (fd < 0) return sptr();
+	set_no_delay(fd);
+	return sptr(new agent_link(fd, peer_name(fd)));
+}
+
+
+agent_link::sptr agent_link::connect(const std::string& address, double timeout)
+{
+	// host:port
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos or colon == 0 or colon + 1 == address.size()){
+		throw std::runtime_error(str(boost::format("Bad agent address %s (host:port)") % address));
+	}
+	std::string host = address.substr(0, colon);
+	std::string port = address.substr(colon + 1);
+	if (host.size() > 2 and host[0] == '[' and host[host.size() - 1] == ']') host = host.substr(1, host.size() - 2);
+
+	struct addrinfo hints, *found;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+	if (err != 0){
+		throw std::runtime_error(str(boost::format("Agent %s: %s") % address % gai_strerror(err)));
+	}
+
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+	int fd = -1;
+	while (true){
+		for (struct addrinfo* ai = found; ai != NULL and fd < 0; ai = ai->ai_next){
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd >= 0 and ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0){
+				::close(fd);
+				fd = -1;
+			}
+		}
+		if (fd >= 0 or std::chrono::steady_clock::now() >= deadline) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+	freeaddrinfo(found);
+	if (fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot connect to agent %s: %s") % address % std::strerror(errno)));
+	}
+	set_no_delay(fd);
+	return sptr(new agent_link(fd, address));
+}
+
+
+void agent_link::send(const std::string& line)
+{
+	std::string message = line;
+	std::replace(message.begin(), message.end(), '\n', ' ');
+	message += "\n";
+	size_t sent = 0;
+	while (sent < message.size()){
+		ssize_t n = ::send(_fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+		if (n < 0 and errno == EINTR) continue;
+		if (n <= 0){
+			throw std::runtime_error(str(boost::format("Agent %s: %s") % _peer % std::strerror(errno)));
+		}
+		sent += n;
+	}
+}
+
+
+bool agent_link::receive(std::string& line, double timeout)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+	size_t eol;
+	while ((eol = _pending.find('\n')) == std::string::npos){
+		if (_pending.size() > MAX_LINE_BYTES){
+			throw std::runtime_error(str(boost::format("Agent %s: message longer than %u bytes") % _peer % MAX_LINE_BYTES));
+		}
+		int left_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		struct pollfd pfd = {_fd, POLLIN, 0};
+		int ready = poll(&pfd, 1, std::max(0, left_ms));
+		if (ready < 0 and errno == EINTR) continue;
+		if (ready <= 0) return false;
+
+		char buff[4096];
+		ssize_t n = recv(_fd, buff, sizeof(buff), 0);
+		if (n < 0 and errno == EINTR) continue;
+		if (n <= 0){
+			throw std::runtime_error(str(boost::format("Agent %s closed the connection") % _peer));
+		}
+		_pending.append(buff, n);
+	}
+	line = _pending.substr(0, eol);
+	_pending.erase(0, eol + 1);
+	return true;
+}
+
+
+
+std::vector<std::string> split_message(const std::string& line)
+{
+	std::vector<std::string> words;
+	std::string trimmed = boost::algorithm::trim_copy(line);
+	if (not trimmed.empty()){
+		boost::algorithm::split(words, trimmed, boost::algorithm::is_space(), boost::algorithm::token_compress_on);
+	}
+	return words;
+}
@@ -0,0 +1,57 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_AGENT_LINK_H
+#define INCLUDED_MMWAVE_AGENT_LINK_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * agent_link
+ * Control connection between the Tx and Rx agents of a split sweep
+ * (mmwave_agent): a TCP connection carrying text lines, one message per
+ * line ("start 1700000012.000000", "captured 3 5 ok", ...). The agents
+ * only exchange a few lines per beam pair, the samples never go through
+ * it. One agent listens, the other connects. A peer that goes away is an
+ * error (the sweep cannot go on without it), a silent one is a timeout.
+ **********************************************************************/
+class agent_link
+{
+public:
+	typedef std::shared_ptr<agent_link> sptr;
+
+	// Accept one peer on port (all interfaces), polling stop_requested every 100 ms (NULL if it returned true)
+	static sptr listen(int port, std::function<bool()> stop_requested);
+
+	// Connect to host:port, trying again until timeout (the peer may not be listening yet)
+	static sptr connect(const std::string& address, double timeout);
+
+	~agent_link();
+
+	const std::string& peer() const { return _peer; }
+
+	// Send one line (newlines in it become blanks)
+	void send(const std::string& line);
+
+	// Next line, false if none comes within timeout seconds; throws once the peer has closed the connection
+	bool receive(std::string& line, double timeout);
+
+private:
+	agent_link(int fd, const std::string& peer);
+
+	int 		_fd;
+	std::string _peer;
+	std::string _pending;
+};
+
+// Message split into its words, e.g. "captured 3 5 ok" -> {"captured", "3", "5", "ok"}
+std::vector<std::string> split_message(const std::string& line);
+
+#endif /* INCLUDED_MMWAVE_AGENT_LINK_H */
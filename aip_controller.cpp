@@ -0,0 +1,218 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "aip_controller.h"
+#include "aip_functions.h"
+#include <boost/algorithm/string/join.hpp>
+#include <boost/format.hpp>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+
+
+// Build a beam command from the arrays used throughout the executables
+aip_beam_t make_aip_beam(std::string degrees, std::string direction, int* gain_list, int gain, std::string* active_list, int mode)
+{
+	aip_beam_t beam;
+	beam.degrees 	= degrees;
+	beam.direction 	= direction;
+	beam.gain 		= gain;
+	beam.mode 		= mode;
+	for (int i=0; i<4; i++){
+		beam.gain_list[i] 	= gain_list[i];
+		beam.active_list[i] = active_list[i];
+	}
+	return beam;
+}
+
+
+
+/***********************************************************************
+ * aip_controller
+ **********************************************************************/
+struct aip_controller::aip_port_t
+{
+	std::string 							name;
+	std::unique_ptr<aip_transport> 			serial_port;
+	std::thread 							io_thread;
+	std::mutex 								mutex;
+	std::condition_variable 				cond;
+	std::deque<std::packaged_task<void()>> 	queue;
+	bool 									stop;
+};
+
+
+aip_controller::aip_controller(int ver_aip) : _ver_aip(ver_aip)
+{
+}
+
+
+aip_controller::~aip_controller()
+{
+	close();
+}
+
+
+size_t aip_controller::add_array(const std::string& name_serial_port, const aip_transport_config_t& config)
+{
+	std::unique_ptr<aip_port_t> port(new aip_port_t);
+	port->name = name_serial_port;
+	port->serial_port = aip_transport::open(name_serial_port, config);
+	port->stop = false;
+	aip_port_t* raw_port = port.get();
+	port->io_thread = std::thread([raw_port](){ io_loop(raw_port); });
+	_ports.push_back(std::move(port));
+	return _ports.size() - 1;
+}
+
+
+size_t aip_controller::size() const
+{
+	return _ports.size();
+}
+
+
+const std::string& aip_controller::name(size_t array) const
+{
+	return _ports.at(array)->name;
+}
+
+
+std::future<void> aip_controller::submit(size_t array, std::function<void(aip_transport*)> task)
+{
+	aip_port_t* port = _ports.at(array).get();
+	aip_transport* serial_port = port->serial_port.get();
+	std::packaged_task<void()> job([task, serial_port](){ task(serial_port); });
+	std::future<void> done = job.get_future();
+	{
+		std::lock_guard<std::mutex> lock(port->mutex);
+		if (port->stop){
+			throw std::runtime_error(str(boost::format("AiP controller: serial port %s is closed") % port->name));
+		}
+		port->queue.push_back(std::move(job));
+	}
+	port->cond.notify_one();
+	return done;
+}
+
+
+std::future<void> aip_controller::configure(size_t array, const aip_beam_t& beam)
+{
+	int ver_aip = _ver_aip;
+	return submit(array, [beam, ver_aip](aip_transport* serial_port){
+		aip_beam_t b = beam;
+		send_to_aip(serial_port, b.degrees, b.direction, b.gain_list, b.gain, b.active_list, b.mode, ver_aip);
+	});
+}
+
+
+std::future<void> aip_controller::configure_verified(size_t array, const aip_beam_t& beam, int attempts)
+{
+	int ver_aip = _ver_aip;
+	std::string port_name = name(array);
+	return submit(array, [beam, attempts, port_name, ver_aip](aip_transport* serial_port){
+		aip_beam_t b = beam;
+		std::vector<std::string> failures;
+		for (int attempt = 1; attempt <= attempts; attempt++){
+			failures = send_to_aip_verified(serial_port, b.degrees, b.direction, b.gain_list, b.gain, b.active_list, b.mode, ver_aip);
+			if (failures.empty()) return;
+			std::cerr << boost::format("AiP on %s: %u command(s) not acknowledged (first: %s), attempt %d of %d") 
+				% port_name % failures.size() % failures.front() % attempt % attempts << std::endl;
+		}
+		throw std::runtime_error(str(boost::format("AiP on %s not configured: %s") % port_name % boost::algorithm::join(failures, ", ")));
+	});
+}
+
+
+std::future<void> aip_controller::steer(size_t array, const aip_beam_t& beam)
+{
+	int ver_aip = _ver_aip;
+	return submit(array, [beam, ver_aip](aip_transport* serial_port){
+		aip_beam_t b = beam;
+		send_to_aip_fast(serial_port, b.degrees, b.direction, b.gain_list, b.gain, b.active_list, b.mode, ver_aip);
+	});
+}
+
+
+std::future<void> aip_controller::steer_frames(size_t array, const std::vector<std::string>& frames, int mode)
+{
+	int ver_aip = _ver_aip;
+	return submit(array, [frames, mode, ver_aip](aip_transport* serial_port){
+		send_frames_fast(serial_port, frames, mode, ver_aip);
+	});
+}
+
+
+std::future<void> aip_controller::init(size_t array)
+{
+	int ver_aip = _ver_aip;
+	return submit(array, [ver_aip](aip_transport* serial_port){ init_aip(serial_port, ver_aip); });
+}
+
+
+std::future<void> aip_controller::read_temperature(size_t array, std::function<void(const std::vector<std::string>&)> done)
+{
+	int ver_aip = _ver_aip;
+	return submit(array, [done, ver_aip](aip_transport* serial_port){ done(read_aip_temperature(serial_port, ver_aip)); });
+}
+
+
+std::future<void> aip_controller::disable(size_t array)
+{
+	int ver_aip = _ver_aip;
+	return submit(array, [ver_aip](aip_transport* serial_port){ disable_aip(serial_port, ver_aip); });
+}
+
+
+void aip_controller::close()
+{
+	for (size_t i = 0; i < _ports.size(); i++){
+		{
+			std::lock_guard<std::mutex> lock(_ports[i]->mutex);
+			_ports[i]->stop = true;
+		}
+		_ports[i]->cond.notify_one();
+	}
+	for (size_t i = 0; i < _ports.size(); i++){
+		if (_ports[i]->io_thread.joinable()){
+			_ports[i]->io_thread.join();
+			_ports[i]->serial_port->close();
+		}
+	}
+}
+
+
+void aip_controller::io_loop(aip_port_t* port)
+{
+	while (true){
+		std::packaged_task<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(port->mutex);
+			port->cond.wait(lock, [port](){ return port->stop or not port->queue.empty(); });
+			if (port->queue.empty()) return;
+			job = std::move(port->queue.front());
+			port->queue.pop_front();
+		}
+		job(); // exceptions are stored in the future
+	}
+}
+
+
+
+// Wait for a set of array commands and re-throw the first error
+void wait_all(std::vector<std::future<void>>& pending)
+{
+	for (size_t i = 0; i < pending.size(); i++){
+		pending[i].wait();
+	}
+	for (size_t i = 0; i < pending.size(); i++){
+		pending[i].get();
+	}
+	pending.clear();
+}
@@ -0,0 +1,95 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_AIP_CONTROLLER_H
+#define INCLUDED_MMWAVE_AIP_CONTROLLER_H
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "aip_transport.h"
+
+
+
+/***********************************************************************
+ * Beam command for one mmWave array
+ **********************************************************************/
+struct aip_beam_t
+{
+	std::string degrees;
+	std::string direction;
+	int 		gain;
+	int 		gain_list[4];
+	std::string active_list[4];
+	int 		mode; // 0 for TX/RX off, 1 for TX, 2 for RX
+};
+
+// Build a beam command from the arrays used throughout the executables
+aip_beam_t make_aip_beam(std::string degrees, std::string direction, int* gain_list, int gain, std::string* active_list, int mode);
+
+
+
+/***********************************************************************
+ * aip_controller
+ * Owns the transports of N mmWave arrays, each served by its own I/O
+ * thread. Commands for different arrays run concurrently, commands for
+ * the same array run in submission order. Every command returns a future
+ * which completes (or re-throws the serial error) when the array is done.
+ **********************************************************************/
+class aip_controller
+{
+public:
+	aip_controller(int ver_aip);
+	~aip_controller();
+
+	// Open the transport of an array (serial port, tcp://host:port or mock://, see aip_transport) and start its I/O thread
+	size_t add_array(const std::string& name_serial_port, const aip_transport_config_t& config = aip_transport_config_t());
+
+	size_t size() const;
+
+	const std::string& name(size_t array) const;
+
+	// Queue an arbitrary operation on the transport of one array
+	std::future<void> submit(size_t array, std::function<void(aip_transport*)> task);
+
+	// Full configuration of the array (send_to_aip)
+	std::future<void> configure(size_t array, const aip_beam_t& beam);
+
+	// Full configuration checking every response, repeated up to attempts times until the array acknowledges
+	// all commands (throws with the failed commands otherwise). Replaces the repeated configure() of the tools.
+	std::future<void> configure_verified(size_t array, const aip_beam_t& beam, int attempts = 2);
+
+	// Beam switch only (send_to_aip_fast)
+	std::future<void> steer(size_t array, const aip_beam_t& beam);
+
+	// Beam switch from pre-built register frames (see sweep_plan)
+	std::future<void> steer_frames(size_t array, const std::vector<std::string>& frames, int mode);
+
+	std::future<void> init(size_t array);
+
+	// Temperature registers of the four chips (read_aip_temperature), done receives the responses on the I/O thread
+	std::future<void> read_temperature(size_t array, std::function<void(const std::vector<std::string>&)> done);
+
+	std::future<void> disable(size_t array);
+
+	// Stop all I/O threads (after draining their queues) and close the transports
+	void close();
+
+private:
+	struct aip_port_t;
+
+	static void io_loop(aip_port_t* port);
+
+	int 									_ver_aip;
+	std::vector<std::unique_ptr<aip_port_t>> _ports;
+};
+
+
+// Wait for a set of array commands and re-throw the first error
+void wait_all(std::vector<std::future<void>>& pending);
+
+#endif /* INCLUDED_MMWAVE_AIP_CONTROLLER_H */
@@ -0,0 +1,268 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "aip_functions.h"
+#include "constants.h"
+#include <boost/format.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+
+
+/***********************************************************************
+ * Auxiliary functions for serial communications with mmWave array
+ **********************************************************************/
+ 
+// Create string of instructions containing configuration of array operations
+std::string* create_register_list(std::string degrees, std::string direction, int* gain_list, int gain, std::string* active_list, int mode)
+{
+	// Convert the active_list to hexadecimal equivalent for the AiP
+	std::string* active_list_hex ;
+	active_list_hex = active_list_to_hex(active_list);
+
+	// Convert the gain_list to hexadecimal equivalent for the AiP
+	std::string* gain_list_hex ;
+	gain_list_hex = gain_list_to_hex(gain_list);
+
+	// Convert the angles to hexadecimal equivalent for the AiP
+	std::string* angle_list_hex ;
+	angle_list_hex = angle_to_reg(degrees, direction);
+
+	// Create final register list
+	std::string* register_list = new std::string[4];
+	for (int i=0; i<4; i++){
+		register_list[i].append("000");
+		register_list[i].append(std::to_string(mode));
+		register_list[i].append(active_list_hex[i]);
+		register_list[i].append(std::to_string(gain));
+		register_list[i].append(gain_list_hex[i]);
+		// !!! THERE SEEMS TO BE A BUG IN THE EXAMPLES WE RECEIVED FROM AMOTECH. THEY SEEM TO HAVE INVERSED THE ORDER OF THE REGISTERS. HOWEVER, THIS DOES NOT SEEM TO MATTER IN THE END. 
+		register_list[i].append(angle_list_hex[3-i]); 
+	}    
+	delete[] active_list_hex;
+	delete[] gain_list_hex;
+	delete[] angle_list_hex;
+	//std::cout << boost::format(" REGISTER LIST: {%s, %s, %s, %s}") % register_list[0] % register_list[1] % register_list[2] % register_list[3] << std::endl;
+	return register_list; 
+}
+ 
+
+ 
+// Build the AT command writing one chip register
+std::string make_reg_command(const std::string& reg)
+{
+    std::string my_string = "AT+REG=";
+    my_string.append(reg);
+    my_string.append("\r\0");
+    return my_string;
+}
+
+
+
+// Write string on serial port and read response
+std::string write_read_serial(aip_transport* my_serial_port, std::string my_string, int ver_aip)
+{
+    if(ver_aip){
+    	std::cout << boost::format("    -- to serial port: %s") % my_string << std::endl;
+	}
+    std::string rx_string = my_serial_port->write_read(my_string);
+    if(ver_aip){
+    	std::cout << boost::format("    -- response from serial port: %s" ) % rx_string << std::endl;
+	}
+    return rx_string;
+}
+
+
+// Write strings on serial port and read the responses
+std::vector<std::string> write_read_serial_batch(aip_transport* my_serial_port, const std::vector<std::string>& my_strings, int ver_aip)
+{
+    if(ver_aip){
+    	for (size_t i=0; i<my_strings.size(); i++){
+    		std::cout << boost::format("    -- to serial port: %s") % my_strings[i] << std::endl;
+    	}
+	}
+    std::vector<std::string> rx_strings = my_serial_port->write_read_batch(my_strings);
+    if(ver_aip){
+    	for (size_t i=0; i<rx_strings.size(); i++){
+    		std::cout << boost::format("    -- response from serial port: %s" ) % rx_strings[i] << std::endl;
+    	}
+	}
+    return rx_strings;
+}
+
+
+
+/***********************************************************************
+ * Functions to control mmWave array
+ **********************************************************************/
+ 
+// Record a command whose response is not the expected one
+static void check_response(const std::string& my_string, std::string response, const std::string& expected, std::vector<std::string>* failures)
+{
+    if (response.find(expected) == std::string::npos){
+        std::string command = my_string.substr(0, my_string.find('\r'));
+        response = response.substr(0, response.find('\r'));
+        failures->push_back(str(boost::format("%s -> %s") % command % (response.empty() ? "no response" : response)));
+    }
+}
+
+
+// Commands enabling Tx or Rx (mode 1 or 2) or disabling both (mode 0)
+static void append_enable_commands(std::vector<std::string>& my_strings, int mode)
+{
+    if (mode == 1){
+		//std::cout << boost::format("Enabling Tx..") << std::endl;
+		my_strings.push_back("AT+TXEN=1\r\0");
+    }
+    else if (mode == 2){
+        //std::cout << boost::format("Enabling Rx..") << std::endl;
+		my_strings.push_back("AT+RXEN=1\r\0");
+    }   
+    else if (mode == 0){
+    	//std::cout << boost::format("Disabling Tx and Rx of AiP..") << std::endl;
+		my_strings.push_back("AT+TXEN=0\r\0");
+		my_strings.push_back("AT+RXEN=0\r\0");
+	}
+}
+
+
+// Full configuration sequence of send_to_aip, responses checked if failures is not NULL
+static void configure_sequence(aip_transport* my_serial_port, std::string degrees, std::string direction, int* gain_list, int gain, std::string* active_list, int mode, std::vector<std::string>* failures, int ver_aip)
+{
+    std::vector<std::string> my_strings;
+    std::string* register_list = create_register_list(degrees, direction, gain_list, gain, active_list, mode);
+      
+    // Initialize the mmWave array package
+    //std::cout << boost::format("Initialize mmWave array...") << std::endl;
+    my_strings.push_back("AT+DUT=0158\r\0");
+    my_strings.push_back("AT+AIPCONFIG=0202\r\0");
+    my_strings.push_back("AT+ADRNUM=001\r\0");
+    
+    // Initialize chip registers
+    for (int i=0; i<4; i++){
+    	my_strings.push_back(make_reg_command(REG1));
+    }
+    my_strings.push_back("AT+SEND?\r\0");
+    
+    // Write insctructions for each chip
+    for (int i=0; i<4; i++){
+        my_strings.push_back(make_reg_command(register_list[i]));
+    }
+    delete[] register_list;
+    my_strings.push_back("AT+SEND?\r\0");
+    
+    // The chip temperatures are read by read_aip_temperature (see aip_telemetry), not on every configuration
+    
+    // Enable Tx or Rx
+    append_enable_commands(my_strings, mode);
+    
+    std::vector<std::string> responses = write_read_serial_batch(my_serial_port, my_strings, ver_aip);
+    if (failures == NULL) return;
+    for (size_t i=0; i<my_strings.size(); i++){
+    	check_response(my_strings[i], responses[i], (my_strings[i] == "AT+SEND?\r\0") ? CHIP_OK : AMO_OK, failures);
+    }
+}
+
+
+// Send command to mmWave AiP
+void send_to_aip(aip_transport* my_serial_port, std::string degrees, std::string direction, int* gain_list, int gain, std::string* active_list, int mode, int ver_aip)
+{
+    configure_sequence(my_serial_port, degrees, direction, gain_list, gain, active_list, mode, NULL, ver_aip);
+}
+
+
+// Send command to mmWave AiP and check every response
+std::vector<std::string> send_to_aip_verified(aip_transport* my_serial_port, std::string degrees, std::string direction, int* gain_list, int gain, std::string* active_list, int mode, int ver_aip)
+{
+    std::vector<std::string> failures;
+    configure_sequence(my_serial_port, degrees, direction, gain_list, gain, active_list, mode, &failures, ver_aip);
+    return failures;
+}
+
+
+// Read temperature of each chip
+std::vector<std::string> read_aip_temperature(aip_transport* my_serial_port, int ver_aip)
+{
+    std::vector<std::string> my_strings(4, make_reg_command(REG_TEMP));
+    my_strings.push_back("AT+SEND?\r\0");
+    std::vector<std::string> responses = write_read_serial_batch(my_serial_port, my_strings, ver_aip);
+    responses.resize(4);
+    return responses;
+}
+
+
+// Temperature in a response to the temperature register: its last number
+double parse_temperature_response(const std::string& response)
+{
+    size_t end = response.find_last_of("0123456789");
+    if (end == std::string::npos) return std::nan("");
+    size_t begin = response.find_last_not_of("0123456789.", end);
+    begin = (begin == std::string::npos) ? 0 : begin + 1;
+    if (begin > 0 and response[begin-1] == '-') begin--;
+    return std::strtod(response.c_str() + begin, NULL);
+}
+
+
+// Send command to mmWave AiP
+void init_aip(aip_transport* my_serial_port, int ver_aip)
+{
+	std::vector<std::string> my_strings;
+	
+    // Initialize the mmWave array package
+    //std::cout << boost::format("Initialize mmWave array...") << std::endl;
+    my_strings.push_back("AT+DUT=0158\r\0");
+    my_strings.push_back("AT+AIPCONFIG=0202\r\0");
+    my_strings.push_back("AT+ADRNUM=001\r\0");
+    
+    // Initialize chip registers
+    for (int i=0; i<4; i++){
+    	my_strings.push_back(make_reg_command(REG1));
+    }
+    my_strings.push_back("AT+SEND?\r\0");
+    write_read_serial_batch(my_serial_port, my_strings, ver_aip);
+    // TODO: check if all responses = AMO_OK, CHIP_OK for AT+SEND?
+}
+
+
+
+// Send command to mmWave AiP
+void send_to_aip_fast(aip_transport* my_serial_port, std::string degrees, std::string direction, int* gain_list, int gain, std::string* active_list, int mode, int ver_aip)
+{
+    std::vector<std::string> frames(4);
+    std::string* register_list = create_register_list(degrees, direction, gain_list, gain, active_list, mode);
+    for (int i=0; i<4; i++){
+        frames[i] = make_reg_command(register_list[i]);
+    }
+    delete[] register_list;
+    
+    send_frames_fast(my_serial_port, frames, mode, ver_aip);
+}
+
+
+// Send pre-built register frames (see make_reg_command) to mmWave AiP
+void send_frames_fast(aip_transport* my_serial_port, const std::vector<std::string>& frames, int mode, int ver_aip)
+{
+    // Write insctructions for each chip
+    std::vector<std::string> my_strings(frames);
+    my_strings.push_back("AT+SEND?\r\0");
+    
+    // Enable Tx or Rx
+    append_enable_commands(my_strings, mode);
+    
+    write_read_serial_batch(my_serial_port, my_strings, ver_aip);
+    // TODO: check if all responses = AMO_OK, CHIP_OK for AT+SEND?
+}
+
+ 
+// Disable Tx/Rx of mmWave AiP
+void disable_aip(aip_transport* my_serial_port, int ver_aip)
+{
+    std::cout << boost::format("Disabling Tx and Rx of AiP..") << std::endl;
+    std::vector<std::string> my_strings;
+    append_enable_commands(my_strings, 0);
+    write_read_serial_batch(my_serial_port, my_strings, ver_aip);
+    // TODO: check if all responses = AMO_OK
+}
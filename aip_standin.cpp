@@ -0,0 +1,142 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "aip_standin.h"
+#include "aip_functions.h"
+#include "constants.h"
+#include <boost/format.hpp>
+#include <chrono>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+
+aip_standin::aip_standin(double reply_delay, bool tcp) :
+	_master_fd(-1), _slave_fd(-1), _listen_fd(-1), _tcp(tcp), _reply_delay(reply_delay), _stop(false), _num_commands(0), _num_temp_reads(0)
+{
+	if (tcp){
+		// loopback port chosen by the kernel, the client is accepted by the serving thread
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(addr);
+		addr.sin_family 	 = AF_INET;
+		addr.sin_port 		 = 0;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (_listen_fd < 0 or bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 or listen(_listen_fd, 1) != 0
+			or getsockname(_listen_fd, (struct sockaddr*)&addr, &addr_len) != 0){
+			throw std::runtime_error("AiP stand-in: cannot listen on a loopback port");
+		}
+		_port_name = str(boost::format("tcp://127.0.0.1:%u") % ntohs(addr.sin_port));
+		_thread = std::thread(&aip_standin::serve, this);
+		return;
+	}
+
+	_master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (_master_fd < 0 or grantpt(_master_fd) != 0 or unlockpt(_master_fd) != 0){
+		throw std::runtime_error("AiP stand-in: cannot create pseudo-terminal");
+	}
+	char name[128];
+	if (ptsname_r(_master_fd, name, sizeof(name)) != 0){
+		throw std::runtime_error("AiP stand-in: cannot get pseudo-terminal name");
+	}
+	_port_name = name;
+
+	// keep the slave side open and raw, so that replies are never echoed back
+	_slave_fd = open(name, O_RDWR | O_NOCTTY);
+	if (_slave_fd < 0){
+		throw std::runtime_error(str(boost::format("AiP stand-in: cannot open %s") % name));
+	}
+	struct termios tio;
+	tcgetattr(_slave_fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(_slave_fd, TCSANOW, &tio);
+
+	_thread = std::thread(&aip_standin::serve, this);
+}
+
+
+aip_standin::~aip_standin()
+{
+	stop();
+	if (_slave_fd >= 0) close(_slave_fd);
+	if (_master_fd >= 0) close(_master_fd);
+	if (_listen_fd >= 0) close(_listen_fd);
+}
+
+
+void aip_standin::stop()
+{
+	_stop = true;
+	if (_thread.joinable()){
+		_thread.join();
+	}
+}
+
+
+std::string aip_standin_reply(const std::string& command, size_t& num_temp_reads)
+{
+	std::string temp_command = make_reg_command(REG_TEMP);
+	temp_command.erase(temp_command.find('\r'));
+	std::string reply = (command == "AT+SEND?") ? CHIP_OK : AMO_OK;
+	if (command == temp_command){
+		// the four chips answer in turn, slowly warming up
+		reply = str(boost::format("AMO:%.2f") % (40.0 + 0.5*(num_temp_reads % 4) + 0.01*(num_temp_reads / 4)));
+		num_temp_reads++;
+	}
+	return reply + "\r\n";
+}
+
+
+void aip_standin::serve()
+{
+	std::string command;
+	char buff[256];
+	while (not _stop){
+		if (_tcp and _master_fd < 0){
+			struct pollfd pfd = {_listen_fd, POLLIN, 0};
+			if (poll(&pfd, 1, 50) <= 0) continue;
+			_master_fd = accept(_listen_fd, NULL, NULL);
+			int one = 1;
+			if (_master_fd >= 0) setsockopt(_master_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			command.clear();
+			continue;
+		}
+		struct pollfd pfd = {_master_fd, POLLIN, 0};
+		if (poll(&pfd, 1, 50) <= 0) continue;
+		ssize_t n = read(_master_fd, buff, sizeof(buff));
+		if (n <= 0 and _tcp){
+			// client gone: wait for the next one
+			close(_master_fd);
+			_master_fd = -1;
+			continue;
+		}
+		if (n <= 0) continue;
+		for (ssize_t i = 0; i < n; i++){
+			if (buff[i] == '\0') continue;
+			if (buff[i] != '\r'){
+				command.push_back(buff[i]);
+				continue;
+			}
+
+			// answer one complete command
+			if (_hook) _hook(command);
+			if (_reply_delay > 0){
+				std::this_thread::sleep_for(std::chrono::duration<double>(_reply_delay));
+			}
+			std::string reply = aip_standin_reply(command, _num_temp_reads);
+			ssize_t written = _tcp ? send(_master_fd, reply.data(), reply.size(), MSG_NOSIGNAL) : write(_master_fd, reply.data(), reply.size());
+			(void)written; // nothing to report to if the host side went away
+			_num_commands++;
+			command.clear();
+		}
+	}
+}
@@ -0,0 +1,64 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_AIP_STANDIN_H
+#define INCLUDED_MMWAVE_AIP_STANDIN_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+
+
+/***********************************************************************
+ * aip_standin
+ * Stand-in for a mmWave array on a pseudo-terminal, or behind a local TCP
+ * port like an array on a serial bridge. Opening port_name() with
+ * aip_transport gives the same AT command dialogue as the real AiP:
+ * every command terminated by '\r' is answered with "AMO:ok\r\n" (or the
+ * chip-ok message for AT+SEND?) after an optional reply delay. Reads of
+ * the temperature register are answered with a reading ("AMO:40.50").
+ * A command hook sees every command as it arrives, e.g. to model the
+ * effect of a beam switch on a stand-in Rx streamer.
+ **********************************************************************/
+class aip_standin
+{
+public:
+	// tcp: listen on a loopback port (one client at a time) instead of a pseudo-terminal
+	aip_standin(double reply_delay = 0.0, bool tcp = false);
+	~aip_standin();
+
+	// Path of the pseudo-terminal (or tcp://127.0.0.1:port) to open instead of /dev/ttyUSBx
+	const std::string& port_name() const { return _port_name; }
+
+	// Number of commands answered so far
+	size_t num_commands() const { return _num_commands; }
+
+	// Called on the stand-in thread with each command (without the '\r'), before the reply. Set before the first command.
+	void set_command_hook(std::function<void(const std::string& command)> hook) { _hook = hook; }
+
+	void stop();
+
+private:
+	void serve();
+
+	int 				_master_fd;	// pseudo-terminal master or connected client
+	int 				_slave_fd;
+	int 				_listen_fd;
+	bool 				_tcp;
+	std::string 		_port_name;
+	double 				_reply_delay;
+	std::atomic<bool> 	_stop;
+	std::atomic<size_t> _num_commands;
+	size_t 				_num_temp_reads;
+	std::function<void(const std::string&)> _hook;
+	std::thread 		_thread;
+};
+
+// Reply of the stand-in to one command (without the '\r'), num_temp_reads counts the temperature reads
+std::string aip_standin_reply(const std::string& command, size_t& num_temp_reads);
+
+#endif /* INCLUDED_MMWAVE_AIP_STANDIN_H */
@@ -0,0 +1,121 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "aip_telemetry.h"
+#include "aip_functions.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+
+
+// JSON number, null for a chip without reading
+static std::string json_number(double value)
+{
+	return std::isnan(value) ? std::string("null") : str(boost::format("%.2f") % value);
+}
+
+
+// JSON string of a serial response (without the line ending, quotes escaped)
+static std::string json_string(const std::string& text)
+{
+	std::string out = "\"";
+	for (size_t i = 0; i < text.size(); i++){
+		if (text[i] == '\r' or text[i] == '\n') continue;
+		if (text[i] == '"' or text[i] == '\\') out.push_back('\\');
+		out.push_back(text[i]);
+	}
+	return out + "\"";
+}
+
+
+aip_telemetry::aip_telemetry(aip_controller& arrays, double interval, sink_fn sink) :
+	_arrays(arrays), _interval(interval), _sink(sink), _flushed(0)
+{
+}
+
+
+void aip_telemetry::add_array(size_t array, const std::string& name)
+{
+	array_t tracked = {array, name, 0.0, false};
+	_tracked.push_back(tracked);
+}
+
+
+void aip_telemetry::poll(double time_now, std::vector<std::future<void>>& pending)
+{
+	for (size_t i = 0; i < _tracked.size(); i++){
+		array_t& tracked = _tracked[i];
+		if (tracked.read and time_now - tracked.last_time < _interval) continue;
+		tracked.read 	  = true;
+		tracked.last_time = time_now;
+
+		std::string name = tracked.name;
+		pending.push_back(_arrays.read_temperature(tracked.array, [this, name, time_now](const std::vector<std::string>& responses){
+			temperature_reading_t reading;
+			reading.array 	  = name;
+			reading.time 	  = time_now;
+			reading.responses = responses;
+			for (size_t k = 0; k < responses.size(); k++){
+				reading.chips.push_back(parse_temperature_response(responses[k]));
+			}
+			std::lock_guard<std::mutex> lock(_mutex);
+			_series.push_back(reading);
+		}));
+	}
+}
+
+
+void aip_telemetry::flush()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (; _flushed < _series.size(); _flushed++){
+		const temperature_reading_t& reading = _series[_flushed];
+		std::string chips, responses;
+		bool parsed = true;
+		for (size_t k = 0; k < reading.chips.size(); k++){
+			chips 	  += (k > 0 ? ", " : "") + json_number(reading.chips[k]);
+			responses += (k > 0 ? ", " : "") + json_string(reading.responses[k]);
+			parsed 	   = parsed and not std::isnan(reading.chips[k]);
+		}
+		// the raw responses are kept when a chip gave no reading, to decode them later
+		_sink(str(boost::format("{\"telemetry\": \"temperature\", \"array\": \"%s\", \"time\": %f, \"chips\": [%s]%s}")
+			% reading.array % reading.time % chips % (parsed ? std::string("") : ", \"responses\": [" + responses + "]")));
+	}
+}
+
+
+size_t aip_telemetry::num_readings() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _series.size();
+}
+
+
+void aip_telemetry::print_report() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::cout << boost::format("Array temperatures (%u readings, every %.0f s):") % _series.size() % _interval << std::endl;
+	for (size_t i = 0; i < _tracked.size(); i++){
+		const std::string& name = _tracked[i].name;
+		for (size_t chip = 0; chip < 4; chip++){
+			double first = NAN, last = NAN, low = NAN, high = NAN;
+			for (size_t k = 0; k < _series.size(); k++){
+				if (_series[k].array != name or chip >= _series[k].chips.size() or std::isnan(_series[k].chips[chip])) continue;
+				double value = _series[k].chips[chip];
+				if (std::isnan(first)) first = low = high = value;
+				last = value;
+				low  = std::min(low, value);
+				high = std::max(high, value);
+			}
+			if (std::isnan(first)){
+				std::cout << boost::format("  %s chip %u: no reading") % name % chip << std::endl;
+				continue;
+			}
+			std::cout << boost::format("  %s chip %u: %.2f -> %.2f (min %.2f, max %.2f)") % name % chip % first % last % low % high << std::endl;
+		}
+	}
+}
@@ -0,0 +1,79 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_AIP_TELEMETRY_H
+#define INCLUDED_MMWAVE_AIP_TELEMETRY_H
+
+#include "aip_controller.h"
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Temperature reading of one array: one value per chip (NaN if the
+ * response carried none) and the raw responses
+ **********************************************************************/
+struct temperature_reading_t
+{
+	std::string 				array;
+	double 						time;		// device time of the switch the reading preceded
+	std::vector<double> 		chips;
+	std::vector<std::string> 	responses;
+};
+
+
+
+/***********************************************************************
+ * aip_telemetry
+ * Reads the chip temperatures of the arrays at most once per interval,
+ * between two dwells: the sweep engine queues the readings before the
+ * beam switch and waits for both before the next capture window, so that
+ * no serial traffic overlaps a capture. The readings become a time series
+ * of JSON lines in the capture metadata.
+ **********************************************************************/
+class aip_telemetry
+{
+public:
+	typedef std::function<void(const std::string& line)> sink_fn;
+
+	// interval in seconds of device time, sink receives one metadata line per reading
+	aip_telemetry(aip_controller& arrays, double interval, sink_fn sink);
+
+	void add_array(size_t array, const std::string& name);
+
+	// Queue a reading of the arrays whose last reading is older than the interval
+	void poll(double time_now, std::vector<std::future<void>>& pending);
+
+	// Pass the completed readings to the sink (once the pending commands are done)
+	void flush();
+
+	size_t num_readings() const;
+
+	// First, last, min and max temperature of each chip
+	void print_report() const;
+
+private:
+	struct array_t
+	{
+		size_t 		array;
+		std::string name;
+		double 		last_time;
+		bool 		read;
+	};
+
+	aip_controller& 					_arrays;
+	double 								_interval;
+	sink_fn 							_sink;
+	std::vector<array_t> 				_tracked;
+	mutable std::mutex 					_mutex;
+	std::vector<temperature_reading_t> 	_series;
+	size_t 								_flushed;
+};
+
+#endif /* INCLUDED_MMWAVE_AIP_TELEMETRY_H */
@@ -0,0 +1,309 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "aip_transport.h"
+#include "aip_standin.h"
+#include <boost/format.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "/usr/local/include/libserial/SerialPort.h"
+using namespace LibSerial ;
+
+
+
+/***********************************************************************
+ * Responses
+ **********************************************************************/
+std::string aip_transport::read_response()
+{
+	std::string response;
+	char next_char;
+	while (read_byte(next_char, _config.timeout_ms)){
+		response.push_back(next_char);
+		if (next_char == '\r'){
+			// and the '\n' behind it
+			if (read_byte(next_char, _config.timeout_ms)) response.push_back(next_char);
+			break;
+		}
+	}
+	return response;
+}
+
+
+std::string aip_transport::write_read(const std::string& command)
+{
+	write(command);
+	return read_response();
+}
+
+
+std::vector<std::string> aip_transport::write_read_batch(const std::vector<std::string>& commands)
+{
+	std::vector<std::string> responses;
+	if (not _config.batch_writes){
+		for (size_t i = 0; i < commands.size(); i++){
+			responses.push_back(write_read(commands[i]));
+		}
+		return responses;
+	}
+
+	std::string batch;
+	for (size_t i = 0; i < commands.size(); i++){
+		batch.append(commands[i]);
+	}
+	write(batch);
+	for (size_t i = 0; i < commands.size(); i++){
+		responses.push_back(read_response());
+	}
+	return responses;
+}
+
+
+
+/***********************************************************************
+ * Local tty
+ **********************************************************************/
+class tty_transport : public aip_transport
+{
+public:
+	tty_transport(const std::string& address, const aip_transport_config_t& config) :
+		aip_transport(address, config), _port(address)
+	{
+		_port.SetBaudRate( baud_rate(config.baud) );
+		_port.SetCharacterSize( LibSerial::CharacterSize::CHAR_SIZE_8 );
+		_port.SetStopBits( LibSerial::StopBits::STOP_BITS_1 ) ;
+		_port.SetParity( LibSerial::Parity::PARITY_NONE );
+	}
+
+	void write(const std::string& data) { _port.Write(data); }
+
+	bool read_byte(char& byte, int timeout_ms)
+	{
+		try{
+			_port.ReadByte(byte, timeout_ms);
+			return true;
+		}
+		catch (const ReadTimeout&){
+			return false;
+		}
+	}
+
+	void close() { if (_port.IsOpen()) _port.Close(); }
+
+private:
+	static LibSerial::BaudRate baud_rate(int baud)
+	{
+		switch (baud){
+		case 9600: 		return LibSerial::BaudRate::BAUD_9600;
+		case 19200: 	return LibSerial::BaudRate::BAUD_19200;
+		case 38400: 	return LibSerial::BaudRate::BAUD_38400;
+		case 57600: 	return LibSerial::BaudRate::BAUD_57600;
+		case 115200: 	return LibSerial::BaudRate::BAUD_115200;
+		case 230400: 	return LibSerial::BaudRate::BAUD_230400;
+		case 460800: 	return LibSerial::BaudRate::BAUD_460800;
+		case 921600: 	return LibSerial::BaudRate::BAUD_921600;
+		default:
+			throw std::runtime_error(str(boost::format("Unsupported baud rate %d (9600 to 921600)") % baud));
+		}
+	}
+
+	SerialPort _port;
+};
+
+
+
+/***********************************************************************
+ * TCP serial bridge
+ **********************************************************************/
+class tcp_transport : public aip_transport
+{
+public:
+	tcp_transport(const std::string& address, const aip_transport_config_t& config) :
+		aip_transport(address, config), _fd(-1), _read_pos(0)
+	{
+		// tcp://host:port
+		std::string host_port = address.substr(6);
+		size_t colon = host_port.rfind(':');
+		if (colon == std::string::npos or colon == 0 or colon + 1 == host_port.size()){
+			throw std::runtime_error(str(boost::format("Bad serial bridge address %s (tcp://host:port)") % address));
+		}
+		std::string host = host_port.substr(0, colon);
+		std::string port = host_port.substr(colon + 1);
+		if (host.size() > 2 and host[0] == '[' and host[host.size() - 1] == ']') host = host.substr(1, host.size() - 2);
+
+		struct addrinfo hints, *found;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family   = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+		if (err != 0){
+			throw std::runtime_error(str(boost::format("Serial bridge %s: %s") % address % gai_strerror(err)));
+		}
+		// all addresses share the connect timeout: an unreachable bridge would otherwise hold the tool for the SYN retries
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config.connect_timeout_ms);
+		err = ETIMEDOUT;
+		for (struct addrinfo* ai = found; ai != NULL and _fd < 0; ai = ai->ai_next){
+			_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (_fd < 0){
+				err = errno;
+				continue;
+			}
+			err = connect_before(_fd, ai->ai_addr, ai->ai_addrlen, deadline);
+			if (err != 0){
+				::close(_fd);
+				_fd = -1;
+			}
+		}
+		freeaddrinfo(found);
+		if (_fd < 0){
+			throw std::runtime_error(str(boost::format("Cannot connect to serial bridge %s: %s") % address % std::strerror(err)));
+		}
+		// commands are a few bytes: send them right away
+		int one = 1;
+		setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+
+	~tcp_transport() { close(); }
+
+	void write(const std::string& data)
+	{
+		size_t sent = 0;
+		while (sent < data.size()){
+			ssize_t n = send(_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+			if (n < 0 and errno == EINTR) continue;
+			if (n <= 0){
+				throw std::runtime_error(str(boost::format("Serial bridge %s: %s") % address() % std::strerror(errno)));
+			}
+			sent += n;
+		}
+	}
+
+	bool read_byte(char& byte, int timeout_ms)
+	{
+		if (_read_pos == _read_buff.size()){
+			struct pollfd pfd = {_fd, POLLIN, 0};
+			if (poll(&pfd, 1, timeout_ms) <= 0) return false;
+			char buff[4096];
+			ssize_t n;
+			do {
+				n = recv(_fd, buff, sizeof(buff), 0);
+			} while (n < 0 and errno == EINTR);
+			// a bridge that went away is not a silent array: the beam switches would be lost unnoticed
+			if (n == 0){
+				throw std::runtime_error(str(boost::format("Serial bridge %s closed the connection") % address()));
+			}
+			if (n < 0){
+				throw std::runtime_error(str(boost::format("Serial bridge %s: %s") % address() % std::strerror(errno)));
+			}
+			_read_buff.assign(buff, n);
+			_read_pos = 0;
+		}
+		byte = _read_buff[_read_pos++];
+		return true;
+	}
+
+	void close()
+	{
+		if (_fd >= 0) ::close(_fd);
+		_fd = -1;
+	}
+
+private:
+	// Non-blocking connect, waiting for the handshake until the deadline; 0 or the error code
+	static int connect_before(int fd, const struct sockaddr* addr, socklen_t addr_len, std::chrono::steady_clock::time_point deadline)
+	{
+		int flags = fcntl(fd, F_GETFL, 0);
+		if (flags < 0 or fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) return errno;
+		if (connect(fd, addr, addr_len) != 0){
+			if (errno != EINPROGRESS) return errno;
+			while (true){
+				int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+				if (remaining_ms <= 0) return ETIMEDOUT;
+				struct pollfd pfd = {fd, POLLOUT, 0};
+				int n = poll(&pfd, 1, remaining_ms);
+				if (n < 0 and errno == EINTR) continue;
+				if (n < 0) return errno;
+				if (n > 0) break;
+			}
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) return errno;
+			if (err != 0) return err;
+		}
+		// reads poll with their own timeout, writes block
+		return (fcntl(fd, F_SETFL, flags) == 0) ? 0 : errno;
+	}
+
+	int 		_fd;
+	std::string _read_buff;
+	size_t 		_read_pos;
+};
+
+
+
+/***********************************************************************
+ * In-process mock
+ **********************************************************************/
+class mock_transport : public aip_transport
+{
+public:
+	mock_transport(const std::string& address, const aip_transport_config_t& config) :
+		aip_transport(address, config), _num_temp_reads(0)
+	{
+	}
+
+	// the replies are ready as soon as the commands are written
+	void write(const std::string& data)
+	{
+		for (size_t i = 0; i < data.size(); i++){
+			if (data[i] == '\0') continue;
+			if (data[i] != '\r'){
+				_command.push_back(data[i]);
+				continue;
+			}
+			std::string reply = aip_standin_reply(_command, _num_temp_reads);
+			_replies.insert(_replies.end(), reply.begin(), reply.end());
+			_command.clear();
+		}
+	}
+
+	bool read_byte(char& byte, int)
+	{
+		if (_replies.empty()) return false;
+		byte = _replies.front();
+		_replies.pop_front();
+		return true;
+	}
+
+	void close() {}
+
+private:
+	std::string 		_command;
+	std::deque<char> 	_replies;
+	size_t 				_num_temp_reads;
+};
+
+
+
+std::unique_ptr<aip_transport> aip_transport::open(const std::string& address, const aip_transport_config_t& config)
+{
+	if (address.compare(0, 6, "tcp://") == 0){
+		return std::unique_ptr<aip_transport>(new tcp_transport(address, config));
+	}
+	if (address.compare(0, 7, "mock://") == 0){
+		return std::unique_ptr<aip_transport>(new mock_transport(address, config));
+	}
+	return std::unique_ptr<aip_transport>(new tty_transport(address, config));
+}
@@ -0,0 +1,79 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_AIP_TRANSPORT_H
+#define INCLUDED_MMWAVE_AIP_TRANSPORT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Settings of the link to an array
+ **********************************************************************/
+struct aip_transport_config_t
+{
+	int 	baud 				= 115200;	// line rate of a local tty, 8N1 (a TCP bridge sets its own)
+	int 	timeout_ms 			= 20;		// a response ends when no byte arrives for this long
+	bool 	batch_writes 		= false;	// write the commands of a sequence at once, then read the responses
+	int 	connect_timeout_ms 	= 3000;		// TCP bridge: give up connecting after this long
+};
+
+
+
+/***********************************************************************
+ * aip_transport
+ * Byte link to the AT command interface of one array, opened from an
+ * address:
+ *
+ *   /dev/ttyUSB1         local tty (LibSerial)
+ *   tcp://host:port      raw TCP port of a ser2net-style serial bridge,
+ *                        for arrays wired to another host than the USRPs
+ *   mock://name          in-process array answering without latency,
+ *                        for benchmarks of the host side
+ *
+ * Everything above the write/read of bytes (responses, batches, the AiP
+ * command sequences of aip_functions) is shared by all transports.
+ * With batch_writes, a sequence of commands goes out in one write and
+ * the responses are read afterwards: one system call (or TCP segment)
+ * per beam switch instead of one round trip per command. The array must
+ * then buffer the commands it has not processed yet.
+ **********************************************************************/
+class aip_transport
+{
+public:
+	virtual ~aip_transport() {}
+
+	static std::unique_ptr<aip_transport> open(const std::string& address, const aip_transport_config_t& config = aip_transport_config_t());
+
+	virtual void write(const std::string& data) = 0;
+
+	// Read one byte, false if none arrived within timeout_ms
+	virtual bool read_byte(char& byte, int timeout_ms) = 0;
+
+	virtual void close() = 0;
+
+	const std::string& address() const { return _address; }
+	const aip_transport_config_t& config() const { return _config; }
+
+	// Response to one command: up to and including "\r\n", or what arrived before the timeout
+	std::string read_response();
+
+	std::string write_read(const std::string& command);
+
+	// One response per command, the commands written at once with batch_writes
+	std::vector<std::string> write_read_batch(const std::vector<std::string>& commands);
+
+protected:
+	aip_transport(const std::string& address, const aip_transport_config_t& config) : _address(address), _config(config) {}
+
+private:
+	std::string 			_address;
+	aip_transport_config_t 	_config;
+};
+
+#endif /* INCLUDED_MMWAVE_AIP_TRANSPORT_H */
@@ -0,0 +1,187 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "analysis.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+
+std::unique_ptr<analysis_stage> make_analysis_stage(const std::string& name)
+{
+	if (name == "power") 	return std::unique_ptr<analysis_stage>(new power_stage());
+	if (name == "spectrum") return std::unique_ptr<analysis_stage>(new spectrum_stage());
+	throw std::runtime_error(str(boost::format("Unknown analysis stage %s (power, spectrum)") % name));
+}
+
+
+static double to_db(double power)
+{
+	return 10*std::log10(power + 1e-20);
+}
+
+
+// Beams of a map in the order they were first seen
+template <typename beam_t>
+static std::vector<std::string> beams_in_order(const std::map<std::string, beam_t>& beams)
+{
+	std::vector<std::pair<double, std::string>> order;
+	for (typename std::map<std::string, beam_t>::const_iterator it = beams.begin(); it != beams.end(); ++it){
+		order.push_back(std::make_pair(it->second.first_time, it->first));
+	}
+	std::sort(order.begin(), order.end());
+	std::vector<std::string> names;
+	for (size_t i = 0; i < order.size(); i++){
+		names.push_back(order[i].second);
+	}
+	return names;
+}
+
+
+
+/***********************************************************************
+ * Power
+ **********************************************************************/
+void power_stage::process(const segment_info_t& info, const std::complex<float>* samps, uint64_t num_samps)
+{
+	double sum = 0, peak = 0;
+	uint64_t count = 0;
+	for (uint64_t i = 0; i < num_samps; i += info.channels){
+		double power = std::norm(samps[i]);
+		sum += power;
+		peak = std::max(peak, power);
+		count++;
+	}
+	if (count == 0) return;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	bool first = (_beams.count(info.beam) == 0);
+	beam_power_t& beam = _beams[info.beam];
+	beam.first_time = first ? info.time : std::min(beam.first_time, info.time);
+	beam.segments++;
+	beam.mean += sum / count;
+	beam.peak  = std::max(beam.peak, peak);
+}
+
+
+void power_stage::report(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<std::string> names = beams_in_order(_beams);
+	out << boost::format("Power of %u beams:") % names.size() << std::endl;
+	std::string best;
+	double best_mean = 0;
+	for (size_t i = 0; i < names.size(); i++){
+		const beam_power_t& beam = _beams[names[i]];
+		double mean = beam.mean / beam.segments;
+		out << boost::format("  %s: %.2f dBFS mean, %.2f dBFS peak (%u segments)") % names[i] % to_db(mean) % to_db(beam.peak) % beam.segments << std::endl;
+		if (best.empty() or mean > best_mean){
+			best 	  = names[i];
+			best_mean = mean;
+		}
+	}
+	if (not best.empty()){
+		out << boost::format("  strongest beam: %s (%.2f dBFS)") % best % to_db(best_mean) << std::endl;
+	}
+}
+
+
+
+/***********************************************************************
+ * Spectrum
+ **********************************************************************/
+spectrum_stage::spectrum_stage(size_t fft_size) :
+	_fft_size(fft_size), _window(fft_size), _twiddles(fft_size / 2)
+{
+	if (fft_size < 2 or (fft_size & (fft_size - 1)) != 0){
+		throw std::runtime_error(str(boost::format("FFT size %u is not a power of 2") % fft_size));
+	}
+	for (size_t i = 0; i < fft_size; i++){
+		_window[i] = 0.5f - 0.5f*std::cos(2*M_PI*i / fft_size);
+	}
+	for (size_t i = 0; i < fft_size / 2; i++){
+		_twiddles[i] = std::polar(1.0f, (float)(-2*M_PI*i / fft_size));
+	}
+}
+
+
+// In-place radix-2 FFT
+static void fft(std::vector<std::complex<float>>& x, const std::vector<std::complex<float>>& twiddles)
+{
+	size_t n = x.size();
+	for (size_t i = 1, j = 0; i < n; i++){
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) std::swap(x[i], x[j]);
+	}
+	for (size_t len = 2; len <= n; len <<= 1){
+		size_t step = n / len;
+		for (size_t i = 0; i < n; i += len){
+			for (size_t k = 0; k < len / 2; k++){
+				std::complex<float> t = x[i + k + len/2] * twiddles[k * step];
+				x[i + k + len/2] = x[i + k] - t;
+				x[i + k] 		+= t;
+			}
+		}
+	}
+}
+
+
+void spectrum_stage::process(const segment_info_t& info, const std::complex<float>* samps, uint64_t num_samps)
+{
+	uint64_t per_channel = num_samps / info.channels;
+	size_t ffts = per_channel / _fft_size;
+	if (ffts == 0) return;
+
+	std::vector<double> psd(_fft_size, 0.0);
+	std::vector<std::complex<float>> x(_fft_size);
+	for (size_t f = 0; f < ffts; f++){
+		const std::complex<float>* in = samps + f * _fft_size * info.channels;
+		for (size_t i = 0; i < _fft_size; i++){
+			x[i] = in[i * info.channels] * _window[i];
+		}
+		fft(x, _twiddles);
+		for (size_t i = 0; i < _fft_size; i++){
+			psd[i] += std::norm(x[i]);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	bool first = (_beams.count(info.beam) == 0);
+	beam_spectrum_t& beam = _beams[info.beam];
+	if (first){
+		beam.psd.assign(_fft_size, 0.0);
+		beam.rate 		= info.rate;
+		beam.first_time = info.time;
+	}
+	beam.first_time = std::min(beam.first_time, info.time);
+	for (size_t i = 0; i < _fft_size; i++){
+		beam.psd[i] += psd[i];
+	}
+	beam.ffts += ffts;
+}
+
+
+void spectrum_stage::report(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<std::string> names = beams_in_order(_beams);
+	out << boost::format("Spectrum of %u beams (%u-point FFT):") % names.size() % _fft_size << std::endl;
+	for (size_t i = 0; i < names.size(); i++){
+		const beam_spectrum_t& beam = _beams[names[i]];
+		size_t peak = std::max_element(beam.psd.begin(), beam.psd.end()) - beam.psd.begin();
+		double total = 0;
+		for (size_t k = 0; k < _fft_size; k++){
+			total += beam.psd[k];
+		}
+		// bins above fft_size/2 are the negative frequencies
+		double bin = (peak < _fft_size / 2) ? (double)peak : (double)peak - _fft_size;
+		out << boost::format("  %s: strongest tone at %.1f kHz, %.1f dB above the mean bin (%u FFTs)")
+			% names[i] % (bin * beam.rate / _fft_size / 1e3) % (to_db(beam.psd[peak]) - to_db(total / _fft_size)) % beam.ffts << std::endl;
+	}
+}
@@ -0,0 +1,116 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_ANALYSIS_H
+#define INCLUDED_MMWAVE_ANALYSIS_H
+
+#include <stdint.h>
+#include <complex>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Segment of a capture: the samples of one beam (or Tx/Rx beam pair)
+ **********************************************************************/
+struct segment_info_t
+{
+	std::string file;
+	size_t 		index;		// segment in the file
+	std::string beam;		// "LEFT - 78.00", or "Tx LEFT - 78.00 / Rx RIGHT - 0.00" for the joint tool
+	double 		time;		// device time of the beam switch
+	double 		rate;		// samples per second and channel
+	size_t 		channels;	// channels interleaved in the samples
+};
+
+
+
+/***********************************************************************
+ * analysis_stage
+ * One processing step applied to every segment of a capture. The replay
+ * engine calls process() from several worker threads at once, one
+ * segment per call, so a stage keeps per-segment work local and locks
+ * what it accumulates across segments. report() prints the results once
+ * all segments went through.
+ **********************************************************************/
+class analysis_stage
+{
+public:
+	virtual ~analysis_stage() {}
+
+	virtual std::string name() const = 0;
+
+	// samps holds num_samps samples, info.channels interleaved channels
+	virtual void process(const segment_info_t& info, const std::complex<float>* samps, uint64_t num_samps) = 0;
+
+	virtual void report(std::ostream& out) = 0;
+};
+
+// Stage by name: "power" (mean and peak power of each beam) or "spectrum" (averaged spectrum, strongest tone of each beam)
+std::unique_ptr<analysis_stage> make_analysis_stage(const std::string& name);
+
+
+
+/***********************************************************************
+ * Mean and peak power of the first channel, averaged per beam, and the
+ * beam with the highest power
+ **********************************************************************/
+class power_stage : public analysis_stage
+{
+public:
+	std::string name() const { return "power"; }
+	void process(const segment_info_t& info, const std::complex<float>* samps, uint64_t num_samps);
+	void report(std::ostream& out);
+
+private:
+	struct beam_power_t
+	{
+		size_t 	segments 	= 0;
+		double 	mean 		= 0;	// sum of the mean powers of the segments (linear)
+		double 	peak 		= 0;	// highest sample power (linear)
+		double 	first_time 	= 0;
+	};
+
+	std::mutex 							_mutex;
+	std::map<std::string, beam_power_t> _beams;
+};
+
+
+
+/***********************************************************************
+ * Spectrum of the first channel averaged over FFTs of fft_size samples
+ * (Hann window) and the frequency of its strongest bin, per beam
+ **********************************************************************/
+class spectrum_stage : public analysis_stage
+{
+public:
+	spectrum_stage(size_t fft_size = 1024);
+
+	std::string name() const { return "spectrum"; }
+	void process(const segment_info_t& info, const std::complex<float>* samps, uint64_t num_samps);
+	void report(std::ostream& out);
+
+private:
+	struct beam_spectrum_t
+	{
+		std::vector<double> psd;
+		size_t 				ffts = 0;
+		double 				rate = 0;
+		double 				first_time = 0;
+	};
+
+	size_t 									_fft_size;
+	std::vector<float> 						_window;
+	std::vector<std::complex<float>> 		_twiddles;
+	std::mutex 								_mutex;
+	std::map<std::string, beam_spectrum_t> 	_beams;
+};
+
+#endif /* INCLUDED_MMWAVE_ANALYSIS_H */
@@ -0,0 +1,130 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "bringup.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+
+
+
+bringup::bringup(bool parallel) :
+	_parallel(parallel), _total(0)
+{
+}
+
+
+size_t bringup::add(const std::string& name, std::function<void()> body, const std::vector<size_t>& after)
+{
+	for (size_t i = 0; i < after.size(); i++){
+		if (after[i] >= _steps.size()){
+			throw std::runtime_error(str(boost::format("Bring-up step %s comes after an unknown step") % name));
+		}
+	}
+	step_t step;
+	step.name 	= name;
+	step.body 	= body;
+	step.after 	= after;
+	step.start 	= 0;
+	step.end 	= 0;
+	step.done 	= false;
+	step.failed = false;
+	_steps.push_back(step);
+	return _steps.size() - 1;
+}
+
+
+void bringup::run_step(step_t& step)
+{
+	step.start = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+	try{
+		step.body();
+	}
+	catch (...){
+		step.end 	= std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+		step.failed = true;
+		throw;
+	}
+	step.end   = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+	step.done  = true;
+}
+
+
+void bringup::run()
+{
+	_start = std::chrono::steady_clock::now();
+	if (not _parallel){
+		for (size_t i = 0; i < _steps.size(); i++){
+			run_step(_steps[i]);
+		}
+		_total = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+		return;
+	}
+
+	// Steps only come after earlier steps, so the futures they wait for already exist
+	std::vector<std::shared_future<void>> done(_steps.size());
+	for (size_t i = 0; i < _steps.size(); i++){
+		std::vector<std::shared_future<void>> after;
+		for (size_t k = 0; k < _steps[i].after.size(); k++){
+			after.push_back(done[_steps[i].after[k]]);
+		}
+		step_t* step = &_steps[i];
+		done[i] = std::async(std::launch::async, [this, step, after](){
+			for (size_t k = 0; k < after.size(); k++){
+				after[k].get(); // a failed dependency fails this step without running it
+			}
+			run_step(*step);
+		}).share();
+	}
+
+	// Wait for every step before reporting, the first failure in step order is the cause of the others
+	for (size_t i = 0; i < done.size(); i++){
+		done[i].wait();
+	}
+	_total = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+	for (size_t i = 0; i < done.size(); i++){
+		done[i].get();
+	}
+}
+
+
+void bringup::log(const std::string& line)
+{
+	std::lock_guard<std::mutex> lock(_log_mutex);
+	std::cout << line << std::endl;
+}
+
+
+static std::string pad(const std::string& text, size_t width)
+{
+	return text + std::string(width - std::min(width, text.size()), ' ');
+}
+
+
+void bringup::print_report() const
+{
+	double busy = 0;
+	size_t width = 4;
+	for (size_t i = 0; i < _steps.size(); i++){
+		if (_steps[i].done) busy += _steps[i].end - _steps[i].start;
+		width = std::max(width, _steps[i].name.size());
+	}
+	std::cout << boost::format("Bring-up in %.3f s (%s, %.3f s of steps, overlap %.2fx):")
+		% _total % (_parallel ? "parallel" : "sequential") % busy % (busy / std::max(_total, 1e-9)) << std::endl;
+	std::cout << boost::format("  %s %9s %9s") % pad("step", width) % "start" % "time" << std::endl;
+	for (size_t i = 0; i < _steps.size(); i++){
+		if (_steps[i].failed){
+			std::cout << boost::format("  %s %8.3fs %9s") % pad(_steps[i].name, width) % _steps[i].start % "failed" << std::endl;
+			continue;
+		}
+		if (not _steps[i].done){
+			std::cout << boost::format("  %s %9s") % pad(_steps[i].name, width) % "not run" << std::endl;
+			continue;
+		}
+		std::cout << boost::format("  %s %8.3fs %8.3fs") % pad(_steps[i].name, width) % _steps[i].start % (_steps[i].end - _steps[i].start) << std::endl;
+	}
+}
@@ -0,0 +1,66 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_BRINGUP_H
+#define INCLUDED_MMWAVE_BRINGUP_H
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * bringup
+ * Setup of the devices as a graph of named steps. Each step runs on its
+ * own thread as soon as the steps it comes after are done, so that
+ * independent steps (tuning of different USRPs, array initialisation)
+ * overlap while order-dependent ones (time alignment after the LOs lock)
+ * stay sequenced. Records when each step started and how long it took.
+ **********************************************************************/
+class bringup
+{
+public:
+	// parallel = false runs the steps one after the other in the order they were added
+	bringup(bool parallel = true);
+
+	// Add a step running after the steps in after (ids returned by earlier add calls)
+	size_t add(const std::string& name, std::function<void()> body, const std::vector<size_t>& after = std::vector<size_t>());
+
+	// Run all steps and re-throw the error of the first failed step (dependent steps are not run)
+	void run();
+
+	// Print a line from a step without mixing it with the output of the concurrent steps
+	void log(const std::string& line);
+
+	// Start time and duration of each step, total time and overlap
+	void print_report() const;
+
+	double total() const { return _total; }
+
+private:
+	struct step_t
+	{
+		std::string 			name;
+		std::function<void()> 	body;
+		std::vector<size_t> 	after;
+		double 					start;	// seconds since run()
+		double 					end;
+		bool 					done;
+		bool 					failed;
+	};
+
+	void run_step(step_t& step);
+
+	bool 									_parallel;
+	std::vector<step_t> 					_steps;
+	std::mutex 								_log_mutex;
+	std::chrono::steady_clock::time_point 	_start;
+	double 									_total;
+};
+
+#endif /* INCLUDED_MMWAVE_BRINGUP_H */
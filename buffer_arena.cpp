@@ -0,0 +1,125 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "buffer_arena.h"
+#include "thread_config.h"
+#include <boost/format.hpp>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// mbind() without a dependency on libnuma
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+static const size_t HUGEPAGE_SIZE = 2*1024*1024;
+
+
+
+int interface_numa_node(const std::string& ifname)
+{
+	std::ifstream file(str(boost::format("/sys/class/net/%s/device/numa_node") % ifname).c_str());
+	int node = -1;
+	if (not (file >> node)) return -1;
+	return node;
+}
+
+
+int address_numa_node(const std::string& ip)
+{
+	struct in_addr target;
+	if (inet_pton(AF_INET, ip.c_str(), &target) != 1) return -1;
+
+	struct ifaddrs* list;
+	if (getifaddrs(&list) != 0) return -1;
+	int node = -1;
+	for (struct ifaddrs* ifa = list; ifa != NULL; ifa = ifa->ifa_next){
+		if (ifa->ifa_addr == NULL or ifa->ifa_netmask == NULL or ifa->ifa_addr->sa_family != AF_INET) continue;
+		uint32_t addr = ((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr;
+		uint32_t mask = ((struct sockaddr_in*)ifa->ifa_netmask)->sin_addr.s_addr;
+		if ((addr & mask) == (target.s_addr & mask)){
+			node = interface_numa_node(ifa->ifa_name);
+			break;
+		}
+	}
+	freeifaddrs(list);
+	return node;
+}
+
+
+
+buffer_arena::buffer_arena(size_t capacity, const arena_config_t& config) :
+	_base(NULL), _capacity(capacity), _used(0), _hugepages(false), _transparent(false), _numa_node(-1)
+{
+	_mapped = (capacity + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+
+	void* base = MAP_FAILED;
+	if (config.hugepages){
+		base = mmap(NULL, _mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		_hugepages = (base != MAP_FAILED);
+	}
+	if (base == MAP_FAILED){
+		// no reserved hugepages: regular pages, transparent hugepages if the kernel allows it
+		base = mmap(NULL, _mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED){
+			throw std::runtime_error(str(boost::format("Cannot map a buffer arena of %u bytes: %s") % _mapped % std::strerror(errno)));
+		}
+		if (config.hugepages){
+			_transparent = (madvise(base, _mapped, MADV_HUGEPAGE) == 0);
+		}
+	}
+	_base = (char*)base;
+
+	// bind before the first touch, so that the pages are allocated on the node
+	if (config.numa_node >= 0 and config.numa_node < 64){
+		unsigned long nodemask = 1UL << config.numa_node;
+		if (syscall(SYS_mbind, _base, _mapped, MPOL_BIND, &nodemask, sizeof(nodemask)*8, 0) == 0){
+			_numa_node = config.numa_node;
+		}
+	}
+
+	prefault_memory(_base, _mapped);
+}
+
+
+buffer_arena::~buffer_arena()
+{
+	munmap(_base, _mapped);
+}
+
+
+void* buffer_arena::allocate_bytes(size_t nbytes, size_t alignment)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	size_t offset = (_used + alignment - 1) / alignment * alignment;
+	if (offset + nbytes > _capacity){
+		throw std::runtime_error(str(boost::format("Buffer arena full: %u bytes requested, %u of %u bytes used") % nbytes % _used % _capacity));
+	}
+	_used = offset + nbytes;
+	return _base + offset;
+}
+
+
+size_t buffer_arena::used() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _used;
+}
+
+
+std::string buffer_arena::describe() const
+{
+	std::string node = (_numa_node >= 0) ? str(boost::format("NUMA node %d") % _numa_node) : "no NUMA binding";
+	std::string pages = _hugepages ? "2 MB hugepages" : (_transparent ? "regular pages (transparent hugepages requested)" : "regular pages");
+	return str(boost::format("%.1f MB on %s, %s") % (_mapped / 1e6) % pages % node);
+}
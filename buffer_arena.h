@@ -0,0 +1,79 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_BUFFER_ARENA_H
+#define INCLUDED_MMWAVE_BUFFER_ARENA_H
+
+#include <stddef.h>
+#include <mutex>
+#include <string>
+
+
+
+/***********************************************************************
+ * Arena configuration
+ **********************************************************************/
+struct arena_config_t
+{
+	bool 	hugepages = true;	// try 2 MB hugepages (MAP_HUGETLB) before regular pages
+	int 	numa_node = -1;		// bind the memory to this node (-1: no binding)
+};
+
+// NUMA node of a network interface (-1 if unknown or not a NUMA machine)
+int interface_numa_node(const std::string& ifname);
+
+// NUMA node of the interface whose subnet contains an IPv4 address, e.g. the "addr" of the USRP
+int address_numa_node(const std::string& ip);
+
+
+
+/***********************************************************************
+ * buffer_arena
+ * One up-front mapping from which all streaming, ring and writer buffers
+ * are carved. The mapping uses 2 MB hugepages when some are reserved
+ * (vm.nr_hugepages), otherwise regular pages with transparent hugepages
+ * requested, is bound to the NUMA node of the NIC and is prefaulted, so
+ * that the streaming loops neither take page faults nor touch remote
+ * memory. Buffers are never freed individually: they live as long as the
+ * arena.
+ **********************************************************************/
+class buffer_arena
+{
+public:
+	buffer_arena(size_t capacity, const arena_config_t& config);
+	~buffer_arena();
+
+	// Thread-safe bump allocation, throws when the arena is full
+	void* allocate_bytes(size_t nbytes, size_t alignment = 64);
+
+	template <typename T>
+	T* allocate(size_t count, size_t alignment = 64)
+	{
+		return static_cast<T*>(allocate_bytes(count*sizeof(T), alignment));
+	}
+
+	size_t capacity() const { return _capacity; }
+	size_t used() const;
+	bool hugepages() const { return _hugepages; }
+	int numa_node() const { return _numa_node; }
+
+	// e.g. "64 MB on 2 MB hugepages, NUMA node 1"
+	std::string describe() const;
+
+private:
+	buffer_arena(const buffer_arena&);
+	buffer_arena& operator=(const buffer_arena&);
+
+	char* 				_base;
+	size_t 				_capacity;
+	size_t 				_mapped;
+	size_t 				_used;
+	bool 				_hugepages;
+	bool 				_transparent;	// regular pages with transparent hugepages requested
+	int 				_numa_node;
+	mutable std::mutex 	_mutex;
+};
+
+#endif /* INCLUDED_MMWAVE_BUFFER_ARENA_H */
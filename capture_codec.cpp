@@ -0,0 +1,477 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "capture_codec.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef MMWAVE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+
+
+const size_t 		CAPTURE_FRAME_HEADER 	= 24;
+const std::string 	COMPRESSED_CAPTURE_EXT 	= ".mwz";
+
+static const char FRAME_MAGIC[4] = {'M', 'W', 'Z', 'B'};
+
+
+capture_codec_t capture_codec(const std::string& name)
+{
+	capture_codec_t codec;
+	if (name == "iq16") 			codec = CODEC_IQ16;
+	else if (name == "zstd") 		codec = CODEC_ZSTD;
+	else if (name == "iq16+zstd") 	codec = CODEC_IQ16_ZSTD;
+	else throw std::runtime_error(str(boost::format("Unknown compression %s (iq16, zstd, iq16+zstd)") % name));
+#ifndef MMWAVE_HAVE_ZSTD
+	if (codec == CODEC_ZSTD or codec == CODEC_IQ16_ZSTD){
+		throw std::runtime_error(str(boost::format("Compression %s needs zstd, not available in this build (MMWAVE_HAVE_ZSTD)") % name));
+	}
+#endif
+	return codec;
+}
+
+
+std::string capture_codec_name(capture_codec_t codec)
+{
+	switch (codec){
+	case CODEC_STORED: 		return "stored";
+	case CODEC_IQ16: 		return "iq16";
+	case CODEC_ZSTD: 		return "zstd";
+	case CODEC_IQ16_ZSTD: 	return "iq16+zstd";
+	}
+	return "unknown";
+}
+
+
+bool capture_frame_t::parse(const char* header)
+{
+	if (std::memcmp(header, FRAME_MAGIC, sizeof(FRAME_MAGIC)) != 0 or (uint8_t)header[4] > CODEC_IQ16_ZSTD) return false;
+	codec = (capture_codec_t)header[4];
+	std::memcpy(&raw_bytes, header + 8, 4);
+	std::memcpy(&stored_bytes, header + 12, 4);
+	std::memcpy(&raw_offset, header + 16, 8);
+	return true;
+}
+
+
+void capture_frame_t::write(char* header) const
+{
+	std::memcpy(header, FRAME_MAGIC, sizeof(FRAME_MAGIC));
+	header[4] = (char)codec;
+	header[5] = header[6] = header[7] = 0;
+	std::memcpy(header + 8, &raw_bytes, 4);
+	std::memcpy(header + 12, &stored_bytes, 4);
+	std::memcpy(header + 16, &raw_offset, 8);
+}
+
+
+
+/***********************************************************************
+ * iq16
+ * The payload is a sequence of runs:
+ *   0 | length (varint) | bytes 					copied as is
+ *   1 | floats (varint) | groups of 256 floats 	sc16 values
+ * A group is one byte (bit 7: deltas, bits 0-5: width) followed by the
+ * zigzag-coded values packed on width bits, LSB first. Deltas are taken
+ * with the float two places back (same I/Q rail), 0 at the run start.
+ **********************************************************************/
+static const size_t IQ16_MIN_RUN = 16;		// floats, shorter runs are not worth a header
+static const size_t IQ16_GROUP 	 = 256;
+
+// UHD converts sc16 to fc32 as k * (1/32767): iq16 codes a float when that expression gives it back bit for bit
+static const float SC16_TO_FC32 = 1.0f/32767.0f;
+
+// The sc16 value k of a float converted from sc16
+static inline bool sc16_value(const char* p, int32_t& k)
+{
+	float f;
+	std::memcpy(&f, p, sizeof(f));
+	float v = f * 32767.0f;
+	if (not (v > -32769.0f and v < 32768.0f)) return false;
+	k = (int32_t)lrintf(v);
+	if (k < -32768 or k > 32767) return false;
+	// the decoder must produce the same bits (-0.0 would come back as +0.0)
+	float back = k * SC16_TO_FC32;
+	return std::memcmp(&back, &f, sizeof(f)) == 0;
+}
+
+static inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static inline int32_t unzigzag(uint32_t z) { return (int32_t)(z >> 1) ^ -(int32_t)(z & 1); }
+static inline uint32_t bit_width(uint32_t v) { return v ? 32 - __builtin_clz(v) : 0; }
+
+static size_t iq16_bound(size_t raw_bytes)
+{
+	// a run header per 64 bytes at most, and packed floats never take more than their 4 bytes
+	return raw_bytes + raw_bytes/4 + 64;
+}
+
+static char* put_varint(char* out, uint64_t v)
+{
+	while (v >= 0x80){
+		*out++ = (char)(v | 0x80);
+		v >>= 7;
+	}
+	*out++ = (char)v;
+	return out;
+}
+
+static const char* get_varint(const char* in, const char* end, uint64_t& v)
+{
+	v = 0;
+	for (int shift = 0; in < end and shift < 64; shift += 7){
+		uint8_t byte = *in++;
+		v |= (uint64_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) return in;
+	}
+	throw std::runtime_error("Corrupt iq16 block (run length)");
+}
+
+static char* put_literal(char* out, const char* raw, size_t bytes)
+{
+	if (bytes == 0) return out;
+	*out++ = 0;
+	out = put_varint(out, bytes);
+	std::memcpy(out, raw, bytes);
+	return out + bytes;
+}
+
+static char* pack_run(const char* raw, size_t floats, char* out)
+{
+	int32_t prev[2] = {0, 0};
+	uint32_t values[IQ16_GROUP], deltas[IQ16_GROUP];
+	for (size_t g = 0; g < floats; g += IQ16_GROUP){
+		size_t m = std::min(IQ16_GROUP, floats - g);
+		uint32_t any_value = 0, any_delta = 0;
+		for (size_t i = 0; i < m; i++){
+			int32_t k = 0;
+			sc16_value(raw + 4*(g + i), k);
+			int32_t& before = prev[(g + i) & 1];
+			values[i] = zigzag(k);
+			deltas[i] = zigzag(k - before);
+			before = k;
+			any_value |= values[i];
+			any_delta |= deltas[i];
+		}
+		bool delta = bit_width(any_delta) < bit_width(any_value);
+		uint32_t width = delta ? bit_width(any_delta) : bit_width(any_value);
+		const uint32_t* packed = delta ? deltas : values;
+		*out++ = (char)((delta ? 0x80 : 0) | width);
+
+		uint64_t acc = 0;
+		uint32_t bits = 0;
+		for (size_t i = 0; i < m; i++){
+			acc |= (uint64_t)packed[i] << bits;
+			bits += width;
+			while (bits >= 8){
+				*out++ = (char)acc;
+				acc >>= 8;
+				bits -= 8;
+			}
+		}
+		if (bits > 0) *out++ = (char)acc;
+	}
+	return out;
+}
+
+static size_t iq16_encode(const char* raw, size_t raw_bytes, char* out)
+{
+	char* start = out;
+	size_t pos = 0, literal = 0;
+	int32_t k;
+	while (pos + 4*IQ16_MIN_RUN <= raw_bytes){
+		size_t floats = 0;
+		while (floats < IQ16_MIN_RUN and sc16_value(raw + pos + 4*floats, k)) floats++;
+		if (floats < IQ16_MIN_RUN){
+			// the samples may start at any byte after a header
+			pos++;
+			continue;
+		}
+		while (pos + 4*(floats + 1) <= raw_bytes and sc16_value(raw + pos + 4*floats, k)) floats++;
+
+		out = put_literal(out, raw + literal, pos - literal);
+		*out++ = 1;
+		out = put_varint(out, floats);
+		out = pack_run(raw + pos, floats, out);
+		pos 	+= 4*floats;
+		literal  = pos;
+	}
+	out = put_literal(out, raw + literal, raw_bytes - literal);
+	return out - start;
+}
+
+static void iq16_decode(const char* in, size_t in_bytes, char* raw, size_t raw_bytes)
+{
+	const char* end = in + in_bytes;
+	char* out = raw;
+	char* out_end = raw + raw_bytes;
+	while (in < end){
+		char kind = *in++;
+		uint64_t count;
+		in = get_varint(in, end, count);
+		if (kind == 0){
+			if (count > (uint64_t)(end - in) or count > (uint64_t)(out_end - out)) throw std::runtime_error("Corrupt iq16 block (literal)");
+			std::memcpy(out, in, count);
+			in 	+= count;
+			out += count;
+			continue;
+		}
+		if (kind != 1 or count > (uint64_t)(out_end - out) / 4) throw std::runtime_error("Corrupt iq16 block (run)");
+
+		int32_t prev[2] = {0, 0};
+		for (size_t g = 0; g < count; g += IQ16_GROUP){
+			size_t m = std::min<uint64_t>(IQ16_GROUP, count - g);
+			if (in == end) throw std::runtime_error("Corrupt iq16 block (group)");
+			uint8_t header = *in++;
+			uint32_t width = header & 0x3f;
+			bool delta = (header & 0x80) != 0;
+			if (width > 32 or (m*width + 7)/8 > (uint64_t)(end - in)) throw std::runtime_error("Corrupt iq16 block (group)");
+
+			uint64_t acc = 0;
+			uint32_t bits = 0;
+			uint64_t mask = (width < 32) ? ((uint64_t)1 << width) - 1 : 0xffffffffull;
+			for (size_t i = 0; i < m; i++){
+				while (bits < width){
+					acc |= (uint64_t)(uint8_t)*in++ << bits;
+					bits += 8;
+				}
+				int32_t k = unzigzag((uint32_t)(acc & mask));
+				acc >>= width;
+				bits -= width;
+				int32_t& before = prev[(g + i) & 1];
+				if (delta) k += before;
+				before = k;
+				float f = k * SC16_TO_FC32;
+				std::memcpy(out, &f, sizeof(f));
+				out += sizeof(f);
+			}
+		}
+	}
+	if (out != out_end) throw std::runtime_error("Corrupt iq16 block (size)");
+}
+
+
+
+/***********************************************************************
+ * Blocks
+ **********************************************************************/
+block_compressor::block_compressor(capture_codec_t codec, int level) :
+	_codec(codec), _level(level), _zstd(NULL)
+{
+#ifdef MMWAVE_HAVE_ZSTD
+	if (codec == CODEC_ZSTD or codec == CODEC_IQ16_ZSTD){
+		_zstd = ZSTD_createCCtx();
+		if (_zstd == NULL) throw std::runtime_error("Cannot create a zstd context");
+	}
+#endif
+}
+
+
+block_compressor::~block_compressor()
+{
+#ifdef MMWAVE_HAVE_ZSTD
+	if (_zstd != NULL) ZSTD_freeCCtx((ZSTD_CCtx*)_zstd);
+#endif
+}
+
+
+size_t block_compressor::compress(const char* raw, size_t raw_bytes, std::vector<char>& frame)
+{
+	size_t bound = iq16_bound(raw_bytes);
+#ifdef MMWAVE_HAVE_ZSTD
+	bound = std::max(bound, ZSTD_compressBound(iq16_bound(raw_bytes)));
+#endif
+	// frames only grow: the buffers of the writer are reused block after block
+	if (frame.size() < CAPTURE_FRAME_HEADER + bound) frame.resize(CAPTURE_FRAME_HEADER + bound);
+	char* payload = &frame[CAPTURE_FRAME_HEADER];
+
+	capture_frame_t header;
+	header.codec 		= _codec;
+	header.raw_bytes 	= raw_bytes;
+	header.raw_offset 	= 0;
+	size_t stored = raw_bytes;
+	if (_codec == CODEC_IQ16){
+		stored = iq16_encode(raw, raw_bytes, payload);
+	}
+#ifdef MMWAVE_HAVE_ZSTD
+	else if (_codec == CODEC_ZSTD){
+		size_t n = ZSTD_compressCCtx((ZSTD_CCtx*)_zstd, payload, bound, raw, raw_bytes, _level);
+		if (not ZSTD_isError(n)) stored = n;
+	}
+	else if (_codec == CODEC_IQ16_ZSTD){
+		if (_scratch.size() < iq16_bound(raw_bytes)) _scratch.resize(iq16_bound(raw_bytes));
+		size_t packed = iq16_encode(raw, raw_bytes, &_scratch.front());
+		size_t n = ZSTD_compressCCtx((ZSTD_CCtx*)_zstd, payload, bound, &_scratch.front(), packed, _level);
+		if (not ZSTD_isError(n)) stored = n;
+	}
+#endif
+	if (stored >= raw_bytes){
+		header.codec = CODEC_STORED;
+		stored = raw_bytes;
+		std::memcpy(payload, raw, raw_bytes);
+	}
+	header.stored_bytes = stored;
+	header.write(&frame.front());
+	return CAPTURE_FRAME_HEADER + stored;
+}
+
+
+void decompress_frame(const capture_frame_t& frame, const char* payload, char* raw)
+{
+	switch (frame.codec){
+	case CODEC_STORED:
+		if (frame.stored_bytes != frame.raw_bytes) throw std::runtime_error("Corrupt stored block");
+		std::memcpy(raw, payload, frame.raw_bytes);
+		return;
+	case CODEC_IQ16:
+		iq16_decode(payload, frame.stored_bytes, raw, frame.raw_bytes);
+		return;
+#ifdef MMWAVE_HAVE_ZSTD
+	case CODEC_ZSTD:{
+		size_t n = ZSTD_decompress(raw, frame.raw_bytes, payload, frame.stored_bytes);
+		if (ZSTD_isError(n) or n != frame.raw_bytes) throw std::runtime_error("Corrupt zstd block");
+		return;
+	}
+	case CODEC_IQ16_ZSTD:{
+		unsigned long long packed = ZSTD_getFrameContentSize(payload, frame.stored_bytes);
+		if (packed == ZSTD_CONTENTSIZE_UNKNOWN or packed == ZSTD_CONTENTSIZE_ERROR or packed > iq16_bound(frame.raw_bytes)){
+			throw std::runtime_error("Corrupt iq16+zstd block");
+		}
+		std::vector<char> scratch(packed);
+		size_t n = ZSTD_decompress(&scratch.front(), packed, payload, frame.stored_bytes);
+		if (ZSTD_isError(n) or n != packed) throw std::runtime_error("Corrupt iq16+zstd block");
+		iq16_decode(&scratch.front(), packed, raw, frame.raw_bytes);
+		return;
+	}
+#endif
+	default:
+		throw std::runtime_error(str(boost::format("Cannot decompress %s blocks in this build (MMWAVE_HAVE_ZSTD)") % capture_codec_name(frame.codec)));
+	}
+}
+
+
+void compression_stats_t::add(const compression_stats_t& other)
+{
+	blocks 		 += other.blocks;
+	raw_bytes 	 += other.raw_bytes;
+	stored_bytes += other.stored_bytes;
+	cpu 		 += other.cpu;
+}
+
+
+void print_compression_report(const std::string& codec, const compression_stats_t& stats, std::ostream& out)
+{
+	out << boost::format("Compression (%s): %u blocks, %.1f MB into %.1f MB (ratio %.2f), %.0f MB/s per core (%.2f CPU s)")
+		% codec % stats.blocks % (stats.raw_bytes / 1e6) % (stats.stored_bytes / 1e6) % stats.ratio() % stats.mb_per_core() % stats.cpu << std::endl;
+}
+
+
+
+/***********************************************************************
+ * Reading compressed captures
+ **********************************************************************/
+static void read_at(int fd, const std::string& path, uint64_t offset, char* data, size_t bytes)
+{
+	for (size_t done = 0; done < bytes; ){
+		ssize_t n = pread(fd, data + done, bytes - done, offset + done);
+		if (n < 0 and errno == EINTR) continue;
+		if (n <= 0){
+			throw std::runtime_error(str(boost::format("Cannot read %s at %u: %s") % path % (offset + done) % (n == 0 ? "end of file" : std::strerror(errno))));
+		}
+		done += n;
+	}
+}
+
+
+compressed_capture::compressed_capture(const std::string& path) :
+	_path(path), _fd(-1), _size(0), _frames_end(0), _raw_size(0)
+{
+	_fd = open(path.c_str(), O_RDONLY);
+	if (_fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot open compressed capture %s: %s") % path % std::strerror(errno)));
+	}
+	struct stat st;
+	fstat(_fd, &st);
+	_size = st.st_size;
+
+	try{
+		uint64_t offset = 0;
+		while (offset + CAPTURE_FRAME_HEADER <= _size){
+			char header[CAPTURE_FRAME_HEADER];
+			read_at(_fd, _path, offset, header, sizeof(header));
+			block_t block;
+			if (not block.parse(header) or block.raw_offset != _raw_size){
+				throw std::runtime_error(str(boost::format("%s: no frame of the capture at %u") % path % offset));
+			}
+			block.file_offset = offset + CAPTURE_FRAME_HEADER;
+			// the last frame of a capture cut short
+			if (block.file_offset + block.stored_bytes > _size) break;
+			_blocks.push_back(block);
+			_raw_size += block.raw_bytes;
+			offset = block.file_offset + block.stored_bytes;
+		}
+		_frames_end = offset;
+	}
+	catch (...){
+		close(_fd);
+		throw;
+	}
+}
+
+
+compressed_capture::~compressed_capture()
+{
+	close(_fd);
+}
+
+
+void compressed_capture::read_block(size_t block, char* raw) const
+{
+	const block_t& b = _blocks[block];
+	std::vector<char> payload(b.stored_bytes);
+	if (b.stored_bytes > 0) read_at(_fd, _path, b.file_offset, &payload.front(), b.stored_bytes);
+	decompress_frame(b, payload.data(), raw);
+}
+
+
+void compressed_capture::read(uint64_t offset, uint64_t bytes, char* raw) const
+{
+	if (offset + bytes > _raw_size){
+		throw std::runtime_error(str(boost::format("%s: bytes %u to %u beyond the capture (%u bytes)") % _path % offset % (offset + bytes) % _raw_size));
+	}
+	// first block holding offset
+	size_t block = 0, lo = 0, hi = _blocks.size();
+	while (lo < hi){
+		size_t mid = (lo + hi) / 2;
+		if (_blocks[mid].raw_offset + _blocks[mid].raw_bytes <= offset) lo = mid + 1;
+		else hi = mid;
+	}
+	block = lo;
+
+	std::vector<char> scratch;
+	for (; bytes > 0; block++){
+		const block_t& b = _blocks[block];
+		uint64_t skip = offset - b.raw_offset;
+		uint64_t take = std::min<uint64_t>(b.raw_bytes - skip, bytes);
+		if (skip == 0 and take == b.raw_bytes){
+			read_block(block, raw);
+		}
+		else{
+			scratch.resize(b.raw_bytes);
+			read_block(block, &scratch.front());
+			std::memcpy(raw, &scratch[skip], take);
+		}
+		raw 	+= take;
+		offset 	+= take;
+		bytes 	-= take;
+	}
+}
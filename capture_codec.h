@@ -0,0 +1,165 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_CAPTURE_CODEC_H
+#define INCLUDED_MMWAVE_CAPTURE_CODEC_H
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Block compression of capture files
+ * A compressed capture (<name>.dat.mwz) holds the bytes of the usual
+ * capture layout cut in blocks, each stored as one frame that
+ * decompresses on its own:
+ *
+ *   "MWZB" | codec (1 byte) | 3 zero bytes | raw bytes (u32)
+ *   | stored bytes (u32) | raw offset (u64) | stored bytes of payload
+ *
+ * (little endian), the raw offset being the position of the block in
+ * the uncompressed file. A reader finds any byte of the capture by
+ * hopping from frame header to frame header, and a capture cut short
+ * loses at most its last frame.
+ *
+ * Codecs:
+ *   iq16 	 The samples are sc16 on the wire, converted to fc32 by UHD:
+ *   		 every float is k * (1/32767) with an integer k. Runs of such floats
+ *   		 are coded as k, or as the difference with the previous sample
+ *   		 of the same I/Q rail, bit-packed by groups of 256 at the
+ *   		 width of the largest value; anything else (headers, samples
+ *   		 that are not sc16) is kept as is. Lossless, fast, and small
+ *   		 for the near-noise parts of the segments.
+ *   zstd 	 zstd on the block (builds with MMWAVE_HAVE_ZSTD only)
+ *   iq16+zstd iq16, then zstd on its output
+ * A block that does not shrink is stored as is (codec "stored").
+ **********************************************************************/
+enum capture_codec_t
+{
+	CODEC_STORED 	= 0,
+	CODEC_IQ16 		= 1,
+	CODEC_ZSTD 		= 2,
+	CODEC_IQ16_ZSTD = 3,
+};
+
+// Codec by name (iq16, zstd, iq16+zstd), throws if unknown or not built in
+capture_codec_t capture_codec(const std::string& name);
+
+std::string capture_codec_name(capture_codec_t codec);
+
+// Bytes of a frame header, and extension appended to compressed captures
+extern const size_t 		CAPTURE_FRAME_HEADER;
+extern const std::string 	COMPRESSED_CAPTURE_EXT;
+
+struct capture_frame_t
+{
+	capture_codec_t codec;
+	uint32_t 		raw_bytes;
+	uint32_t 		stored_bytes;
+	uint64_t 		raw_offset;
+
+	// Parse a frame header, false if it is not one
+	bool parse(const char* header);
+	void write(char* header) const;
+};
+
+
+
+/***********************************************************************
+ * block_compressor
+ * Compresses blocks into frames, one per compressor thread (it keeps
+ * the zstd context between blocks).
+ **********************************************************************/
+class block_compressor
+{
+public:
+	block_compressor(capture_codec_t codec, int level = 3);
+	~block_compressor();
+
+	// Frame of a block into frame (resized), with a zero raw offset; returns the frame size
+	size_t compress(const char* raw, size_t raw_bytes, std::vector<char>& frame);
+
+private:
+	capture_codec_t 	_codec;
+	int 				_level;
+	void* 				_zstd;		// ZSTD_CCtx
+	std::vector<char> 	_scratch;
+};
+
+// Payload of a frame back into raw (frame.raw_bytes bytes)
+void decompress_frame(const capture_frame_t& frame, const char* payload, char* raw);
+
+
+
+/***********************************************************************
+ * Compression statistics of a writer
+ **********************************************************************/
+struct compression_stats_t
+{
+	uint64_t 	blocks 		 = 0;
+	uint64_t 	raw_bytes 	 = 0;
+	uint64_t 	stored_bytes = 0;	// frame headers included
+	double 		cpu 		 = 0;	// CPU seconds of the compressor threads
+
+	double ratio() const 		{ return stored_bytes ? (double)raw_bytes / stored_bytes : 0; }
+	double mb_per_core() const 	{ return (cpu > 0) ? raw_bytes / cpu / 1e6 : 0; }
+	void add(const compression_stats_t& other);
+};
+
+// Blocks, MB in and out, ratio, MB/s per core
+void print_compression_report(const std::string& codec, const compression_stats_t& stats, std::ostream& out = std::cout);
+
+
+
+/***********************************************************************
+ * compressed_capture
+ * Random access to a compressed capture: the frame headers are read
+ * once, then any range of the uncompressed capture is decoded from the
+ * frames that hold it. Safe to read from several threads.
+ **********************************************************************/
+class compressed_capture
+{
+public:
+	compressed_capture(const std::string& path);
+	~compressed_capture();
+
+	const std::string& path() const { return _path; }
+
+	// Size of the uncompressed capture, and of the compressed file
+	uint64_t raw_size() const { return _raw_size; }
+	uint64_t size() const { return _size; }
+
+	// Bytes after the last whole frame (a capture that was cut short)
+	uint64_t trailing_bytes() const { return _size - _frames_end; }
+
+	size_t num_blocks() const { return _blocks.size(); }
+	uint64_t block_offset(size_t block) const { return _blocks[block].raw_offset; }
+	uint32_t block_bytes(size_t block) const { return _blocks[block].raw_bytes; }
+	capture_codec_t block_codec(size_t block) const { return _blocks[block].codec; }
+
+	// Uncompressed bytes of a block (block_bytes(block) of them)
+	void read_block(size_t block, char* raw) const;
+
+	// Any range of the uncompressed capture
+	void read(uint64_t offset, uint64_t bytes, char* raw) const;
+
+private:
+	struct block_t : capture_frame_t
+	{
+		uint64_t file_offset;	// of the payload
+	};
+
+	std::string 			_path;
+	int 					_fd;
+	uint64_t 				_size;
+	uint64_t 				_frames_end;
+	uint64_t 				_raw_size;
+	std::vector<block_t> 	_blocks;
+};
+
+#endif /* INCLUDED_MMWAVE_CAPTURE_CODEC_H */
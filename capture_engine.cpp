@@ -0,0 +1,356 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "capture_engine.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+
+
+capture_layout_t parse_capture_layout(const std::string& name)
+{
+	if (name == "per-channel") return LAYOUT_PER_CHANNEL;
+	if (name == "interleaved") return LAYOUT_INTERLEAVED;
+	throw std::runtime_error(str(boost::format("Unknown output layout %s (expected per-channel or interleaved)") % name));
+}
+
+
+
+/***********************************************************************
+ * State of one stream (only touched by its recv thread during a segment)
+ **********************************************************************/
+struct capture_engine::stream_state_t
+{
+	capture_stream_t 								source;
+	size_t 											num_channels;
+	size_t 											spb;
+	bool 											one_packet;
+	size_t 											max_consecutive_timeouts;
+	std::vector<std::vector<std::complex<float>>> 	own_buffs;
+	std::vector<std::complex<float>*> 				buffs;
+	std::vector<std::complex<float>> 				interleaved;
+	std::vector<std::complex<float>> 				zeros;
+	std::vector<capture_writer*> 					writers;	// one per channel, or one for all channels
+	std::thread 									thread;
+
+	// current segment
+	uint64_t 			job;
+	bool 				active;
+	long long 			start;
+	long long 			dropped_end;	// end of the samples dropped outside the segments
+	uint64_t 			nsamps;
+	uint64_t 			written;
+	size_t 				segment;
+	std::string 		beam;
+	rx_segment_stats_t 	stats;
+	rx_segment_stats_t 	totals;
+};
+
+
+
+capture_engine::capture_engine(const std::vector<capture_stream_t>& streams, const capture_config_t& capture, capture_layout_t layout,
+							   double rate, size_t batch_samps, buffer_arena* arena, size_t max_consecutive_timeouts) :
+	_layout(layout), _rate(rate), _job(0), _job_start(0), _job_samps(0), _job_done(0), _stop(false), _closed(false)
+{
+	for (size_t i = 0; i < streams.size(); i++){
+		std::unique_ptr<stream_state_t> state(new stream_state_t);
+		state->source 					= streams[i];
+		state->num_channels 			= streams[i].stream->get_num_channels();
+		state->spb 						= batch_samps > 0 ? batch_samps : streams[i].stream->get_max_num_samps();
+		state->one_packet 				= (batch_samps == 0);
+		state->max_consecutive_timeouts = max_consecutive_timeouts;
+		state->job 						= 0;
+		state->active 					= false;
+		state->dropped_end 				= LLONG_MIN;
+		state->segment 					= 0;
+
+		// recv buffers, one per channel
+		state->own_buffs.resize(arena != NULL ? 0 : state->num_channels);
+		for (size_t ch = 0; ch < state->num_channels; ch++){
+			if (arena != NULL){
+				state->buffs.push_back(arena->allocate<std::complex<float>>(state->spb));
+			}
+			else{
+				state->own_buffs[ch].resize(state->spb);
+				state->buffs.push_back(&state->own_buffs[ch].front());
+			}
+		}
+		if (layout == LAYOUT_INTERLEAVED and state->num_channels > 1){
+			state->interleaved.resize(state->spb * state->num_channels);
+		}
+		state->zeros.resize(state->spb * state->num_channels);
+
+		// outputs
+		size_t num_outputs = (layout == LAYOUT_PER_CHANNEL) ? state->num_channels : 1;
+		for (size_t k = 0; k < num_outputs; k++){
+			capture_config_t config = capture;
+			config.prefix = (layout == LAYOUT_PER_CHANNEL) ? str(boost::format("%s_%s_ch%u") % capture.prefix % streams[i].name % k)
+														   : str(boost::format("%s_%s") % capture.prefix % streams[i].name);
+			_writers.push_back(std::unique_ptr<capture_writer>(new capture_writer(config)));
+			state->writers.push_back(_writers.back().get());
+		}
+		_streams.push_back(std::move(state));
+	}
+
+	for (size_t i = 0; i < _streams.size(); i++){
+		stream_state_t* state = _streams[i].get();
+		state->thread = std::thread([this, state](){ recv_loop(state); });
+	}
+}
+
+
+capture_engine::~capture_engine()
+{
+	try {
+		close();
+	}
+	catch (const std::exception& e){
+		std::cerr << boost::format("Capture engine: %s") % e.what() << std::endl;
+	}
+}
+
+
+pthread_t capture_engine::recv_thread(size_t stream)
+{
+	return _streams[stream]->thread.native_handle();
+}
+
+
+std::vector<rx_segment_stats_t> capture_engine::capture_segment(const std::string& header, const std::string& beam, double start_time, uint64_t nsamps)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (_error) std::rethrow_exception(_error);
+	_job_start 	= std::llround(start_time * _rate);
+	_job_samps 	= nsamps;
+	_job_header = header;
+	_job_beam 	= beam;
+	_job_done 	= 0;
+	_job++;
+	_cond.notify_all();
+	_cond.wait(lock, [this](){ return _job_done == _streams.size() or _error; });
+	if (_error) std::rethrow_exception(_error);
+
+	std::vector<rx_segment_stats_t> stats;
+	rx_segment_stats_t all;
+	for (size_t i = 0; i < _streams.size(); i++){
+		stats.push_back(_streams[i]->stats);
+		all.add(_streams[i]->stats);
+	}
+	std::cout << boost::format("  -- Received %u samples on %u streams from time %f") % nsamps % _streams.size() % start_time << std::endl;
+	if (not all.ok()){
+		std::cout << boost::format("  -- Segment degraded: %u overflows, %u lost samples (zero-filled), %u bad packets")
+			% all.overflows % all.lost_samps % all.bad_packets << std::endl;
+	}
+	if (all.skipped_samps > 0){
+		std::cout << boost::format("  -- Window started before the segment was posted: %u samples skipped (zero-filled)") % all.skipped_samps << std::endl;
+	}
+	return stats;
+}
+
+
+void capture_engine::close()
+{
+	if (_closed) return;
+	_closed = true;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_cond.notify_all();
+	for (size_t i = 0; i < _streams.size(); i++){
+		if (_streams[i]->thread.joinable()){
+			_streams[i]->thread.join();
+		}
+	}
+	for (size_t i = 0; i < _writers.size(); i++){
+		_writers[i]->close();
+	}
+	if (_error) std::rethrow_exception(_error);
+}
+
+
+void capture_engine::print_report() const
+{
+	for (size_t i = 0; i < _streams.size(); i++){
+		const stream_state_t& state = *_streams[i];
+		std::cout << boost::format("Stream %s (%u channels): %u segments, %u samples per channel, %u lost (zero-filled), %u overflows, %u timeouts, %u bad packets, %u recv calls")
+			% state.source.name % state.num_channels % state.segment % state.totals.received_samps % state.totals.lost_samps
+			% state.totals.overflows % state.totals.timeouts % state.totals.bad_packets % state.totals.recv_calls << std::endl;
+	}
+	for (size_t i = 0; i < _writers.size(); i++){
+		_writers[i]->print_compression_report();
+	}
+}
+
+
+
+/***********************************************************************
+ * Recv threads
+ **********************************************************************/
+void capture_engine::recv_loop(stream_state_t* state)
+{
+	try {
+		uhd::rx_metadata_t md;
+		double timeout = state->one_packet ? 0.1 : 0.1 + state->spb/_rate;
+		size_t consecutive_timeouts = 0;
+		bool has_next_tick = false;
+		long long next_tick = 0;
+
+		while (true){
+			if (not poll_segment(state)) return;
+
+			// the streams are received continuously, samples outside a segment are dropped
+			size_t num_rx_samps = state->source.stream->recv(state->buffs, state->spb, md, timeout, state->one_packet);
+
+			// a segment posted during the recv call may start within these samples
+			if (not poll_segment(state)) return;
+			if (state->active) state->stats.recv_calls++;
+
+			switch (md.error_code){
+			case uhd::rx_metadata_t::ERROR_CODE_NONE:
+				break;
+
+			case uhd::rx_metadata_t::ERROR_CODE_TIMEOUT:
+				// before streaming starts and between segments, timeouts are expected
+				if (state->active){
+					state->stats.timeouts++;
+					if (++consecutive_timeouts >= state->max_consecutive_timeouts){
+						throw std::runtime_error(str(boost::format("Receiver %s stalled: %u consecutive timeouts") % state->source.name % consecutive_timeouts));
+					}
+				}
+				continue;
+
+			case uhd::rx_metadata_t::ERROR_CODE_OVERFLOW:
+				if (state->active) state->stats.overflows++;
+				continue;
+
+			case uhd::rx_metadata_t::ERROR_CODE_ALIGNMENT:
+			case uhd::rx_metadata_t::ERROR_CODE_BAD_PACKET:
+				if (state->active) state->stats.bad_packets++;
+				continue;
+
+			default:
+				throw std::runtime_error(str(boost::format("Receiver %s error %s") % state->source.name % md.strerror()));
+			}
+			consecutive_timeouts = 0;
+
+			long long tick = (md.has_time_spec or not has_next_tick) ? md.time_spec.to_ticks(_rate) : next_tick;
+			if (state->active) handle_samples(state, tick, num_rx_samps);
+			else state->dropped_end = tick + num_rx_samps;
+			next_tick 		= tick + num_rx_samps;
+			has_next_tick 	= true;
+		}
+	}
+	catch (...){
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (not _error) _error = std::current_exception();
+		_cond.notify_all();
+	}
+}
+
+
+// Pick up a new segment if the stream is idle; false once the engine stops
+bool capture_engine::poll_segment(stream_state_t* state)
+{
+	std::string header;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_stop) return false;
+		if (state->active or _job == state->job) return true;
+		state->job 		= _job;
+		state->start 	= _job_start;
+		state->nsamps 	= _job_samps;
+		state->beam 	= _job_beam;
+		header 			= _job_header;
+		state->active 	= true;
+	}
+	state->written 	= 0;
+	state->stats 	= rx_segment_stats_t();
+	state->stats.requested_samps = state->nsamps;
+	for (size_t k = 0; k < state->writers.size(); k++){
+		state->writers[k]->begin_segment();
+		state->writers[k]->write_text(header);
+		state->writers[k]->write_text("\nUSRP data\n");
+	}
+	if (state->nsamps == 0) finish_segment(state);
+	return true;
+}
+
+
+void capture_engine::handle_samples(stream_state_t* state, long long tick, size_t num_rx_samps)
+{
+	long long end = state->start + state->nsamps;
+	long long pos = state->start + state->written;	// device time of the next sample to write
+	if (tick + (long long)num_rx_samps <= pos) return;
+
+	// missing samples inside the window are zero-filled, so that all outputs stay sample-aligned
+	while (tick > pos and pos < end){
+		size_t count = std::min<long long>(std::min<long long>(tick, end) - pos, state->spb);
+		for (size_t k = 0; k < state->writers.size(); k++){
+			state->writers[k]->write_samples(&state->zeros.front(), count * (state->writers.size() == 1 ? state->num_channels : 1));
+		}
+		// the part of the gap that was received while no segment was posted is not lost by the device
+		size_t skipped = (state->dropped_end > pos) ? std::min<long long>(state->dropped_end - pos, count) : 0;
+		state->stats.skipped_samps 	+= skipped;
+		state->stats.lost_samps 	+= count - skipped;
+		state->written 				+= count;
+		pos 						+= count;
+	}
+
+	if (pos < end and tick + (long long)num_rx_samps > pos){
+		size_t offset = pos - tick;
+		size_t count = std::min<long long>(num_rx_samps - offset, end - pos);
+		if (_layout == LAYOUT_PER_CHANNEL){
+			for (size_t ch = 0; ch < state->num_channels; ch++){
+				state->writers[ch]->write_samples(state->buffs[ch] + offset, count);
+			}
+		}
+		else if (state->num_channels == 1){
+			state->writers[0]->write_samples(state->buffs[0] + offset, count);
+		}
+		else{
+			for (size_t i = 0; i < count; i++){
+				for (size_t ch = 0; ch < state->num_channels; ch++){
+					state->interleaved[i*state->num_channels + ch] = state->buffs[ch][offset + i];
+				}
+			}
+			state->writers[0]->write_samples(&state->interleaved.front(), count * state->num_channels);
+		}
+		state->stats.received_samps += count;
+		state->written 				+= count;
+	}
+
+	if (state->written == state->nsamps){
+		finish_segment(state);
+	}
+}
+
+
+void capture_engine::finish_segment(stream_state_t* state)
+{
+	for (size_t k = 0; k < state->writers.size(); k++){
+		capture_writer* out = state->writers[k];
+		out->write_text("\n");
+		out->end_segment();
+		int channel = (_layout == LAYOUT_PER_CHANNEL) ? (int)k : -1;
+		out->write_metadata(str(boost::format(
+			"{\"segment\": %u, \"stream\": \"%s\", \"channel\": %d, \"file\": \"%s\", \"beam\": \"%s\", \"start_time\": %f, \"requested\": %u, \"received\": %u, "
+			"\"lost\": %u, \"skipped\": %u, \"overflows\": %u, \"timeouts\": %u, \"bad_packets\": %u, \"recv_calls\": %u, \"status\": \"%s\"}")
+			% state->segment % state->source.name % channel % out->current_file() % state->beam % (state->start / _rate)
+			% state->stats.requested_samps % state->stats.received_samps % state->stats.lost_samps % state->stats.skipped_samps % state->stats.overflows
+			% state->stats.timeouts % state->stats.bad_packets % state->stats.recv_calls % state->stats.status()));
+	}
+	state->totals.add(state->stats);
+	state->segment++;
+	state->active = false;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_job_done++;
+	_cond.notify_all();
+}
@@ -0,0 +1,108 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_CAPTURE_ENGINE_H
+#define INCLUDED_MMWAVE_CAPTURE_ENGINE_H
+
+#include <uhd/stream.hpp>
+#include <pthread.h>
+#include <stdint.h>
+#include <complex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer_arena.h"
+#include "capture_writer.h"
+#include "rx_capture.h"
+
+
+
+/***********************************************************************
+ * Streams and output layout of the capture engine
+ **********************************************************************/
+struct capture_stream_t
+{
+	std::string 			name;		// used in the file names, e.g. "rx0"
+	uhd::rx_streamer::sptr 	stream;
+};
+
+enum capture_layout_t
+{
+	LAYOUT_PER_CHANNEL,		// one file per channel: <prefix>_<stream>_ch<k>
+	LAYOUT_INTERLEAVED		// one file per stream, samples of its channels interleaved: <prefix>_<stream>
+};
+
+capture_layout_t parse_capture_layout(const std::string& name);
+
+
+
+/***********************************************************************
+ * capture_engine
+ * Receives several Rx streamers (channels of one or several USRPs) at
+ * once, with one recv thread per streamer. The streams are received
+ * continuously; a segment is a window of the device time: every stream
+ * writes exactly nsamps samples starting at the same time_spec, so that
+ * the segments of all channels are sample-aligned whatever the recv
+ * timing of each thread. Samples outside the windows (e.g. during beam
+ * switching) are dropped; a window should start after the segment is
+ * posted (e.g. once the switch is over), its samples received before
+ * are zero-filled and counted as skipped. Each output goes through its own capture
+ * writer, with the usual segment layout and metadata file. Errors are
+ * handled as in rx_capture: counted per segment, only late commands,
+ * broken chains and stalled streams are fatal.
+ **********************************************************************/
+class capture_engine
+{
+public:
+	capture_engine(const std::vector<capture_stream_t>& streams, const capture_config_t& capture, capture_layout_t layout,
+				   double rate, size_t batch_samps = 0, buffer_arena* arena = NULL, size_t max_consecutive_timeouts = 10);
+	~capture_engine();
+
+	// Capture nsamps samples of every stream from device time start_time (blocks until all streams are done)
+	std::vector<rx_segment_stats_t> capture_segment(const std::string& header, const std::string& beam, double start_time, uint64_t nsamps);
+
+	// Stop the recv threads and flush all outputs
+	void close();
+
+	size_t num_streams() const { return _streams.size(); }
+	pthread_t recv_thread(size_t stream);
+	size_t num_writers() const { return _writers.size(); }
+	capture_writer& writer(size_t index) { return *_writers[index]; }
+
+	void print_report() const;
+
+private:
+	struct stream_state_t;
+
+	void recv_loop(stream_state_t* state);
+	bool poll_segment(stream_state_t* state);
+	void handle_samples(stream_state_t* state, long long tick, size_t num_rx_samps);
+	void finish_segment(stream_state_t* state);
+
+	capture_layout_t 								_layout;
+	double 											_rate;
+	std::vector<std::unique_ptr<capture_writer>> 	_writers;
+	std::vector<std::unique_ptr<stream_state_t>> 	_streams;
+
+	// current segment, shared with the recv threads
+	std::mutex 				_mutex;
+	std::condition_variable _cond;
+	uint64_t 				_job;			// incremented for every segment
+	long long 				_job_start;		// start of the window, in samples
+	uint64_t 				_job_samps;
+	std::string 			_job_header;
+	std::string 			_job_beam;
+	size_t 					_job_done;		// streams done with the current segment
+	std::exception_ptr 		_error;
+	bool 					_stop;
+	bool 					_closed;
+};
+
+#endif /* INCLUDED_MMWAVE_CAPTURE_ENGINE_H */
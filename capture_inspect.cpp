@@ -0,0 +1,403 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "capture_inspect.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+
+/***********************************************************************
+ * Selection and listing
+ **********************************************************************/
+std::vector<size_t> select_segments(const capture_file& capture, const std::string& segments, const std::string& beam)
+{
+	std::vector<bool> selected(capture.num_segments(), segments.empty());
+	std::vector<std::string> ranges;
+	boost::split(ranges, segments, boost::is_any_of(","), boost::token_compress_on);
+	for (size_t i = 0; i < ranges.size(); i++){
+		if (ranges[i].empty()) continue;
+		unsigned long first, last;
+		char extra;
+		int fields = std::sscanf(ranges[i].c_str(), "%lu-%lu%c", &first, &last, &extra);
+		if (fields == 1) last = first;
+		if ((fields != 1 and fields != 2) or first > last or last >= capture.num_segments()){
+			throw std::runtime_error(str(boost::format("Bad segment selection %s (%s has %u segments)") % ranges[i] % capture.path() % capture.num_segments()));
+		}
+		std::fill(selected.begin() + first, selected.begin() + last + 1, true);
+	}
+
+	std::vector<size_t> chosen;
+	for (size_t i = 0; i < selected.size(); i++){
+		if (selected[i] and capture.info(i).beam.find(beam) != std::string::npos) chosen.push_back(i);
+	}
+	return chosen;
+}
+
+
+void list_segments(const capture_file& capture, const std::vector<size_t>& segments, std::ostream& out)
+{
+	out << boost::format("%8s %12s %12s %14s  %s") % "segment" % "time" % "samples" % "offset" % "beam" << std::endl;
+	for (size_t i = 0; i < segments.size(); i++){
+		size_t s = segments[i];
+		out << boost::format("%8u %12.6f %12u %14u  %s") % s % capture.info(s).time % capture.num_samps(s) % capture.data_offset(s) % capture.info(s).beam << std::endl;
+	}
+}
+
+
+
+/***********************************************************************
+ * Workers
+ **********************************************************************/
+// Runs work(0) ... work(count - 1) on the worker threads, rethrows the first error
+static void run_workers(size_t count, size_t threads, const std::function<void(size_t)>& work)
+{
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max<size_t>(1, std::min(threads, count));
+
+	std::atomic<size_t> next(0);
+	std::atomic<bool> failed(false);
+	std::mutex error_mutex;
+	std::exception_ptr error;
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; t++){
+		workers.push_back(std::thread([&](){
+			try{
+				for (size_t i = next++; i < count and not failed; i = next++){
+					work(i);
+				}
+			}
+			catch (...){
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (not error) error = std::current_exception();
+				failed = true;
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++){
+		workers[t].join();
+	}
+	if (error) std::rethrow_exception(error);
+}
+
+
+// Chunks of the samples of the segments, a whole number of samples each
+struct chunk_t
+{
+	size_t 		segment;	// position in the list of segments
+	uint64_t 	offset;		// bytes from the first sample of the segment
+	uint64_t 	bytes;
+};
+
+static std::vector<chunk_t> split_segments(const capture_file& capture, const std::vector<size_t>& segments, uint64_t chunk_bytes)
+{
+	const uint64_t samp_bytes = sizeof(std::complex<float>);
+	chunk_bytes = std::max(chunk_bytes / samp_bytes, (uint64_t)1) * samp_bytes;
+	std::vector<chunk_t> chunks;
+	for (size_t i = 0; i < segments.size(); i++){
+		uint64_t bytes = capture.num_samps(segments[i]) * samp_bytes;
+		for (uint64_t offset = 0; offset < bytes; offset += chunk_bytes){
+			chunk_t chunk = {i, offset, std::min(chunk_bytes, bytes - offset)};
+			chunks.push_back(chunk);
+		}
+	}
+	return chunks;
+}
+
+
+
+/***********************************************************************
+ * Statistics
+ **********************************************************************/
+void segment_stats_t::add(const segment_stats_t& other)
+{
+	samps 	+= other.samps;
+	power 	+= other.power;
+	peak 	 = std::max(peak, other.peak);
+	sum 	+= other.sum;
+	clipped += other.clipped;
+	invalid += other.invalid;
+}
+
+
+std::vector<segment_stats_t> segment_statistics(const capture_file& capture, const std::vector<size_t>& segments, const inspect_config_t& config)
+{
+	std::vector<chunk_t> chunks = split_segments(capture, segments, config.chunk_bytes);
+	std::vector<segment_stats_t> chunk_stats(chunks.size());
+	run_workers(chunks.size(), config.threads, [&](size_t c){
+		const chunk_t& chunk = chunks[c];
+		const char* data = (const char*)capture.samples(segments[chunk.segment]) + chunk.offset;
+		segment_stats_t& stats = chunk_stats[c];
+
+		// copied a block at a time: the samples rarely start on a float boundary in the file
+		std::complex<float> block[4096];
+		for (uint64_t done = 0; done < chunk.bytes; ){
+			size_t n = std::min<uint64_t>(sizeof(block), chunk.bytes - done) / sizeof(block[0]);
+			std::memcpy(block, data + done, n * sizeof(block[0]));
+			for (size_t i = 0; i < n; i++){
+				float re = block[i].real(), im = block[i].imag();
+				if (not std::isfinite(re) or not std::isfinite(im)){
+					stats.invalid++;
+					continue;
+				}
+				double power = (double)re*re + (double)im*im;
+				stats.power += power;
+				stats.peak 	 = std::max(stats.peak, power);
+				stats.sum 	+= std::complex<double>(re, im);
+				if (std::fabs(re) >= 1.0f or std::fabs(im) >= 1.0f) stats.clipped++;
+			}
+			stats.samps += n;
+			done += n * sizeof(block[0]);
+		}
+		capture.release(capture.data_offset(segments[chunk.segment]) + chunk.offset, chunk.bytes);
+	});
+
+	std::vector<segment_stats_t> stats(segments.size());
+	for (size_t c = 0; c < chunks.size(); c++){
+		stats[chunks[c].segment].add(chunk_stats[c]);
+	}
+	return stats;
+}
+
+
+static double to_db(double power)
+{
+	return 10*std::log10(power + 1e-20);
+}
+
+
+void print_segment_statistics(const capture_file& capture, const std::vector<size_t>& segments, const std::vector<segment_stats_t>& stats, std::ostream& out)
+{
+	out << boost::format("%8s %12s %10s %10s %10s %10s %10s  %s") % "segment" % "samples" % "mean dBFS" % "peak dBFS" % "DC dBFS" % "clipped" % "invalid" % "beam" << std::endl;
+	for (size_t i = 0; i < segments.size(); i++){
+		const segment_stats_t& s = stats[i];
+		uint64_t valid = s.samps - s.invalid;
+		double mean = valid ? s.power / valid : 0;
+		double dc 	= valid ? std::norm(s.sum / (double)valid) : 0;
+		out << boost::format("%8u %12u %10.2f %10.2f %10.2f %10u %10u  %s")
+			% segments[i] % s.samps % to_db(mean) % to_db(s.peak) % to_db(dc) % s.clipped % s.invalid % capture.info(segments[i]).beam << std::endl;
+	}
+}
+
+
+
+/***********************************************************************
+ * Copies
+ **********************************************************************/
+// Bytes to put at an offset of an output file, from the capture or from a text
+struct copy_t
+{
+	const char* data;
+	uint64_t 	bytes;
+	int 		fd;
+	uint64_t 	offset;
+	int64_t 	capture_offset;	// offset of data in the capture (released once copied), -1 for texts
+};
+
+static int create_output(const std::string& path)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot create %s: %s") % path % std::strerror(errno)));
+	}
+	return fd;
+}
+
+static void run_copies(const capture_file& capture, const std::vector<copy_t>& copies, const inspect_config_t& config)
+{
+	// the capture parts split in chunks, so that one long segment is copied by all workers
+	std::vector<copy_t> chunks;
+	for (size_t i = 0; i < copies.size(); i++){
+		uint64_t chunk_bytes = (copies[i].capture_offset < 0) ? copies[i].bytes : std::max<uint64_t>(config.chunk_bytes, 1);
+		for (uint64_t done = 0; done < copies[i].bytes; done += chunk_bytes){
+			copy_t chunk 	= copies[i];
+			chunk.data 	   += done;
+			chunk.bytes 	= std::min(chunk_bytes, copies[i].bytes - done);
+			chunk.offset   += done;
+			if (chunk.capture_offset >= 0) chunk.capture_offset += done;
+			chunks.push_back(chunk);
+		}
+	}
+	run_workers(chunks.size(), config.threads, [&](size_t c){
+		const copy_t& chunk = chunks[c];
+		for (uint64_t done = 0; done < chunk.bytes; ){
+			ssize_t n = pwrite(chunk.fd, chunk.data + done, chunk.bytes - done, chunk.offset + done);
+			if (n < 0 and errno == EINTR) continue;
+			if (n <= 0){
+				throw std::runtime_error(str(boost::format("Cannot write %u bytes: %s") % chunk.bytes % std::strerror(errno)));
+			}
+			done += n;
+		}
+		if (chunk.capture_offset >= 0) capture.release(chunk.capture_offset, chunk.bytes);
+	});
+}
+
+static void close_outputs(const std::vector<int>& fds, const std::vector<std::string>& paths)
+{
+	std::string failed;
+	for (size_t i = 0; i < fds.size(); i++){
+		if (close(fds[i]) != 0 and failed.empty()) failed = paths[i];
+	}
+	if (not failed.empty()){
+		throw std::runtime_error(str(boost::format("Cannot write %s: %s") % failed % std::strerror(errno)));
+	}
+}
+
+static void copy_or_close(const capture_file& capture, const std::vector<copy_t>& copies, const std::vector<int>& fds, const std::vector<std::string>& paths, const inspect_config_t& config)
+{
+	try{
+		run_copies(capture, copies, config);
+	}
+	catch (...){
+		for (size_t i = 0; i < fds.size(); i++){
+			close(fds[i]);
+		}
+		throw;
+	}
+	close_outputs(fds, paths);
+}
+
+
+// Name of a capture without directory and extension
+static std::string capture_name(const std::string& path)
+{
+	std::string name = path.substr(path.find_last_of('/') + 1);
+	size_t dot = name.rfind('.');
+	return (dot == std::string::npos or dot == 0) ? name : name.substr(0, dot);
+}
+
+
+uint64_t extract_segments(const capture_file& capture, const std::vector<size_t>& segments, const std::string& out_dir, bool raw, const inspect_config_t& config, std::vector<std::string>* out_files)
+{
+	// the texts stay in place while the workers copy them
+	std::vector<std::string> texts(segments.size());
+	std::vector<std::string> paths;
+	std::vector<int> fds;
+	std::vector<copy_t> copies;
+	uint64_t total = 0;
+	try{
+		for (size_t i = 0; i < segments.size(); i++){
+			size_t s = segments[i];
+			paths.push_back(str(boost::format("%s/%s_seg%05u.dat") % out_dir % capture_name(capture.path()) % s));
+			fds.push_back(create_output(paths.back()));
+
+			uint64_t samp_bytes = capture.num_samps(s) * sizeof(std::complex<float>);
+			uint64_t offset = 0;
+			if (not raw){
+				texts[i] = capture.header(s);
+				copy_t text = {texts[i].data(), texts[i].size(), fds.back(), 0, -1};
+				copies.push_back(text);
+				offset = texts[i].size();
+			}
+			copy_t samples = {(const char*)capture.samples(s), samp_bytes, fds.back(), offset, (int64_t)capture.data_offset(s)};
+			copies.push_back(samples);
+			offset += samp_bytes;
+			if (not raw){
+				static const char end_text[] = "\n";
+				copy_t end = {end_text, 1, fds.back(), offset, -1};
+				copies.push_back(end);
+				offset++;
+			}
+			total += offset;
+		}
+	}
+	catch (...){
+		for (size_t i = 0; i < fds.size(); i++){
+			close(fds[i]);
+		}
+		throw;
+	}
+
+	copy_or_close(capture, copies, fds, paths, config);
+	if (out_files != NULL) *out_files = paths;
+	return total;
+}
+
+
+uint64_t convert_capture(const capture_file& capture, const std::vector<size_t>& segments, const std::string& out_path, size_t align, const inspect_config_t& config)
+{
+	static const std::string usrp_marker = "USRP data\n";
+	if (out_path == capture.path()){
+		throw std::runtime_error(str(boost::format("Cannot convert %s onto itself") % out_path));
+	}
+	align = std::max<size_t>(align, 1);
+
+	std::vector<std::string> texts(segments.size());
+	std::vector<copy_t> copies;
+	std::vector<capture_file::index_entry_t> entries;
+	std::vector<int> fds(1, create_output(out_path));
+	std::vector<std::string> paths(1, out_path);
+	uint64_t offset = 0;
+	for (size_t i = 0; i < segments.size(); i++){
+		size_t s = segments[i];
+		// the header up to the marker, blank lines so that the samples start on an align boundary
+		std::string header = capture.header(s);
+		header.resize(header.size() - usrp_marker.size());
+		uint64_t unpadded = offset + header.size() + usrp_marker.size();
+		header.append((align - unpadded % align) % align, '\n');
+		texts[i] = header + usrp_marker;
+
+		copy_t text = {texts[i].data(), texts[i].size(), fds[0], offset, -1};
+		copies.push_back(text);
+		uint64_t samp_bytes = capture.num_samps(s) * sizeof(std::complex<float>);
+		capture_file::index_entry_t entry = {offset, offset + texts[i].size(), samp_bytes};
+		entries.push_back(entry);
+		offset += texts[i].size();
+		copy_t samples = {(const char*)capture.samples(s), samp_bytes, fds[0], offset, (int64_t)capture.data_offset(s)};
+		copies.push_back(samples);
+		offset += samp_bytes;
+		static const char end_text[] = "\n";
+		copy_t end = {end_text, 1, fds[0], offset, -1};
+		copies.push_back(end);
+		offset++;
+	}
+	copy_or_close(capture, copies, fds, paths, config);
+	capture_file::save_index(out_path, offset, entries);
+	return offset;
+}
+
+
+uint64_t decompress_capture(const compressed_capture& capture, const std::string& out_path, const inspect_config_t& config)
+{
+	if (out_path == capture.path()){
+		throw std::runtime_error(str(boost::format("Cannot decompress %s onto itself") % out_path));
+	}
+	std::vector<int> fds(1, create_output(out_path));
+	std::vector<std::string> paths(1, out_path);
+	try{
+		run_workers(capture.num_blocks(), config.threads, [&](size_t b){
+			std::vector<char> raw(capture.block_bytes(b));
+			capture.read_block(b, raw.data());
+			for (uint64_t done = 0; done < raw.size(); ){
+				ssize_t n = pwrite(fds[0], raw.data() + done, raw.size() - done, capture.block_offset(b) + done);
+				if (n < 0 and errno == EINTR) continue;
+				if (n <= 0){
+					throw std::runtime_error(str(boost::format("Cannot write %s: %s") % out_path % std::strerror(errno)));
+				}
+				done += n;
+			}
+		});
+	}
+	catch (...){
+		close(fds[0]);
+		throw;
+	}
+	close_outputs(fds, paths);
+	return capture.raw_size();
+}
@@ -0,0 +1,79 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_CAPTURE_INSPECT_H
+#define INCLUDED_MMWAVE_CAPTURE_INSPECT_H
+
+#include "replay.h"
+#include "capture_codec.h"
+#include <stdint.h>
+#include <complex>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Inspection of capture files
+ * Works from the segment index of capture_file, so that a segment is
+ * found without parsing the file. The samples are processed in chunks
+ * spread over worker threads (a single long segment is split as well),
+ * each chunk dropped from memory once done: the memory taken does not
+ * grow with the size of the capture.
+ **********************************************************************/
+struct inspect_config_t
+{
+	size_t 		threads 	= 0;			// worker threads (0: one per core)
+	uint64_t 	chunk_bytes = 16 << 20;		// samples handled by a worker at once
+};
+
+// Segments by number ("0,3,10-20", empty: all) whose beam contains the beam string (empty: any)
+std::vector<size_t> select_segments(const capture_file& capture, const std::string& segments, const std::string& beam);
+
+// One line per segment: number, switch time, beam, samples, offset of the samples in the file
+void list_segments(const capture_file& capture, const std::vector<size_t>& segments, std::ostream& out = std::cout);
+
+
+
+/***********************************************************************
+ * Statistics of the samples of a segment (all channels)
+ **********************************************************************/
+struct segment_stats_t
+{
+	uint64_t 				samps 	 = 0;
+	double 					power 	 = 0;	// sum of the sample powers (linear)
+	double 					peak 	 = 0;	// highest sample power (linear)
+	std::complex<double> 	sum;			// DC offset once divided by samps
+	uint64_t 				clipped  = 0;	// samples with I or Q at full scale
+	uint64_t 				invalid  = 0;	// NaN or infinite samples (not counted in the sums)
+
+	void add(const segment_stats_t& other);
+};
+
+std::vector<segment_stats_t> segment_statistics(const capture_file& capture, const std::vector<size_t>& segments, const inspect_config_t& config);
+
+void print_segment_statistics(const capture_file& capture, const std::vector<size_t>& segments, const std::vector<segment_stats_t>& stats, std::ostream& out = std::cout);
+
+
+
+/***********************************************************************
+ * Copies
+ * extract_segments writes every segment to <out_dir>/<name>_seg<N>.dat,
+ * itself a capture with a single segment (or the bare fc32 samples when
+ * raw). convert_capture writes the selected segments to one capture in
+ * the same layout, with the samples of every segment starting on an
+ * align boundary (blank lines are added before the USRP data marker),
+ * and saves its index: tools then read the samples in place and open
+ * the file without scanning it. Both return the bytes written.
+ **********************************************************************/
+uint64_t extract_segments(const capture_file& capture, const std::vector<size_t>& segments, const std::string& out_dir, bool raw, const inspect_config_t& config, std::vector<std::string>* out_files = NULL);
+
+uint64_t convert_capture(const capture_file& capture, const std::vector<size_t>& segments, const std::string& out_path, size_t align, const inspect_config_t& config);
+
+// Uncompressed copy of a compressed capture (.dat.mwz), its blocks decoded in parallel; returns the bytes written
+uint64_t decompress_capture(const compressed_capture& capture, const std::string& out_path, const inspect_config_t& config);
+
+#endif /* INCLUDED_MMWAVE_CAPTURE_INSPECT_H */
@@ -0,0 +1,512 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "capture_writer.h"
+#include "buffer_arena.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+static double thread_cpu_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+
+// _frame_bytes of a block the compressor failed on
+static const size_t COMPRESS_FAILED = (size_t)-1;
+
+
+capture_writer::capture_writer(const capture_config_t& config) :
+	_config(config), _closed(false), _meta_bytes(0), _compress(config.compression != "none"), _codec(CODEC_STORED), _stop_compressors(false),
+	_block(NULL), _block_slot(0), _block_fill(0), _file_index(0), _file_bytes(0), _file_segments(0),
+	_fd(-1), _fd_index(0), _fd_raw_bytes(0), _fd_bytes(0), _notify_fd(-1)
+{
+	if (_config.block_size == 0 or _config.num_blocks == 0){
+		throw std::runtime_error("Capture writer: block size and number of blocks must be positive");
+	}
+	if (_compress){
+		_codec = capture_codec(_config.compression);
+		if (_config.compress_threads == 0){
+			throw std::runtime_error("Capture writer: compression needs at least one compressor thread");
+		}
+	}
+
+	// Create the output directory if needed
+	if (mkdir(_config.out_dir.c_str(), 0755) != 0 and errno != EEXIST){
+		throw std::runtime_error(str(boost::format("Cannot create output directory %s: %s") % _config.out_dir % std::strerror(errno)));
+	}
+
+	// Open the first file here, so that a bad path stops the run before any hardware is touched
+	std::string meta_name = str(boost::format("%s/%s.meta.jsonl") % _config.out_dir % _config.prefix);
+	if (_config.resume == NULL){
+		open_file(0);
+		_meta.open(meta_name.c_str());
+	}
+	else{
+		const capture_position_t& position = *_config.resume;
+		resume_file(position);
+		_file_index 	= position.file_index;
+		_file_bytes 	= position.raw_bytes;
+		_file_segments 	= position.file_segments;
+
+		// the metadata of the segments after the position goes with them
+		struct stat st;
+		_meta_bytes = (stat(meta_name.c_str(), &st) == 0) ? std::min((uint64_t)st.st_size, position.meta_bytes) : 0;
+		if (_meta_bytes < position.meta_bytes){
+			std::cerr << boost::format("Capture writer: %s is shorter than at the checkpoint, appending to it") % meta_name << std::endl;
+		}
+		else if (truncate(meta_name.c_str(), _meta_bytes) != 0){
+			throw std::runtime_error(str(boost::format("Cannot truncate metadata file %s: %s") % meta_name % std::strerror(errno)));
+		}
+		_meta.open(meta_name.c_str(), std::ios::app);
+	}
+	if (not _meta.is_open()){
+		throw std::runtime_error(str(boost::format("Cannot open metadata file %s") % meta_name));
+	}
+
+	if (not _config.notify_socket.empty()){
+		_notify_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (_notify_fd < 0){
+			throw std::runtime_error(str(boost::format("Cannot create notify socket: %s") % std::strerror(errno)));
+		}
+	}
+
+	if (_config.arena != NULL){
+		for (size_t i = 0; i < _config.num_blocks; i++){
+			_blocks.push_back(_config.arena->allocate<char>(_config.block_size, 4096));
+		}
+	}
+	else{
+		_storage.resize(_config.num_blocks);
+		for (size_t i = 0; i < _storage.size(); i++){
+			_storage[i].resize(_config.block_size);
+			_blocks.push_back(&_storage[i].front());
+		}
+	}
+	for (size_t i = 0; i < _blocks.size(); i++){
+		_free_blocks.push_back(i);
+	}
+	if (_compress){
+		_frames.resize(_blocks.size());
+		_frame_bytes.assign(_blocks.size(), 0);
+	}
+
+	_thread = std::thread(&capture_writer::writer_loop, this);
+	for (size_t i = 0; _compress and i < _config.compress_threads; i++){
+		_compressors.push_back(std::thread(&capture_writer::compress_loop, this));
+	}
+}
+
+
+capture_writer::~capture_writer()
+{
+	try {
+		close();
+	}
+	catch (const std::exception& e){
+		std::cerr << boost::format("Capture writer: %s") % e.what() << std::endl;
+	}
+	if (_notify_fd >= 0){
+		::close(_notify_fd);
+	}
+}
+
+
+std::string capture_writer::file_name(size_t index) const
+{
+	std::string ext = _compress ? COMPRESSED_CAPTURE_EXT : "";
+	if (_config.rotate_bytes == 0 and _config.rotate_segments == 0){
+		return str(boost::format("%s/%s.dat%s") % _config.out_dir % _config.prefix % ext);
+	}
+	return str(boost::format("%s/%s_%05u.dat%s") % _config.out_dir % _config.prefix % index % ext);
+}
+
+
+std::string capture_writer::current_file() const
+{
+	return file_name(_file_index);
+}
+
+
+
+/***********************************************************************
+ * Capture loop side
+ **********************************************************************/
+void capture_writer::begin_segment()
+{
+	check_error();
+	bool rotate = (_file_segments > 0) and
+		((_config.rotate_segments > 0 and _file_segments >= _config.rotate_segments) or
+		 (_config.rotate_bytes > 0 and _file_bytes >= _config.rotate_bytes));
+	if (rotate){
+		if (_block_fill > 0) submit_block();
+		item_t item = {item_t::ROTATE, 0, 0};
+		push(item);
+		_file_index++;
+		_file_bytes 	= 0;
+		_file_segments 	= 0;
+	}
+	_file_segments++;
+}
+
+
+void capture_writer::end_segment()
+{
+	check_error();
+}
+
+
+void capture_writer::write_text(const std::string& text)
+{
+	write(text.data(), text.size());
+}
+
+
+void capture_writer::write_samples(const std::complex<float>* buff, size_t num_samps)
+{
+	write(buff, num_samps*sizeof(std::complex<float>));
+}
+
+
+void capture_writer::write(const void* data, size_t nbytes)
+{
+	const char* src = (const char*)data;
+	_file_bytes += nbytes;
+	while (nbytes > 0){
+		if (_block == NULL){
+			// wait for a free block (back-pressure when the disk is slower than the capture)
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this](){ return not _free_blocks.empty() or _error; });
+			if (_error) std::rethrow_exception(_error);
+			_block_slot = _free_blocks.back();
+			_block 		= _blocks[_block_slot];
+			_free_blocks.pop_back();
+		}
+		size_t chunk = std::min(nbytes, _config.block_size - _block_fill);
+		std::memcpy(_block + _block_fill, src, chunk);
+		_block_fill += chunk;
+		src 		+= chunk;
+		nbytes 		-= chunk;
+		if (_block_fill == _config.block_size){
+			submit_block();
+		}
+	}
+}
+
+
+void capture_writer::write_metadata(const std::string& line)
+{
+	_meta << line << std::endl;
+	_meta_bytes += line.size() + 1;
+}
+
+
+void capture_writer::checkpoint(checkpoint_fn done)
+{
+	check_error();
+	checkpoint_t checkpoint;
+	checkpoint.position.file_index 	  = _file_index;
+	checkpoint.position.file_segments = _file_segments;
+	checkpoint.position.raw_bytes 	  = _file_bytes;
+	checkpoint.position.meta_bytes 	  = _meta_bytes;
+	checkpoint.done 				  = done;
+
+	// the partial block goes out now (one smaller block, or frame, per checkpoint)
+	if (_block_fill > 0) submit_block();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_checkpoints.push_back(checkpoint);
+	}
+	item_t item = {item_t::CHECKPOINT, 0, 0};
+	push(item);
+}
+
+
+void capture_writer::close()
+{
+	if (_closed) return;
+	_closed = true;
+	_meta.close();
+	if (_block_fill > 0) submit_block();
+	item_t item = {item_t::CLOSE, 0, 0};
+	push(item);
+	_thread.join();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop_compressors = true;
+	}
+	_cond.notify_all();
+	for (size_t i = 0; i < _compressors.size(); i++){
+		_compressors[i].join();
+	}
+	check_error();
+}
+
+
+void capture_writer::submit_block()
+{
+	item_t item = {item_t::DATA, _block_slot, _block_fill};
+	push(item);
+	_block 		= NULL;
+	_block_fill = 0;
+}
+
+
+void capture_writer::push(const item_t& item)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queue.push_back(item);
+		if (_compress and item.kind == item_t::DATA) _compress_queue.push_back(item);
+	}
+	_cond.notify_all();
+}
+
+
+void capture_writer::check_error()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_error) std::rethrow_exception(_error);
+}
+
+
+
+/***********************************************************************
+ * Writer thread side
+ **********************************************************************/
+void capture_writer::writer_loop()
+{
+	bool failed = false;
+	while (true){
+		item_t item;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this](){ return not _queue.empty(); });
+			item = _queue.front();
+			_queue.pop_front();
+		}
+
+		// the compressed block, once a compressor is done with it (also when failed: the block must be free before reuse)
+		size_t frame_bytes = 0;
+		if (_compress and item.kind == item_t::DATA){
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [&](){ return _frame_bytes[item.slot] != 0; });
+			frame_bytes = _frame_bytes[item.slot];
+		}
+
+		checkpoint_t checkpoint;
+		if (item.kind == item_t::CHECKPOINT){
+			std::lock_guard<std::mutex> lock(_mutex);
+			checkpoint = _checkpoints.front();
+			_checkpoints.pop_front();
+		}
+
+		try {
+			if (not failed){
+				if (item.kind == item_t::DATA and not _compress){
+					write_all(_blocks[item.slot], item.nbytes);
+				}
+				else if (item.kind == item_t::DATA){
+					if (frame_bytes == COMPRESS_FAILED) throw std::runtime_error("Block compression failed");
+					// frames only know their place in the file once written
+					capture_frame_t frame;
+					frame.parse(&_frames[item.slot].front());
+					frame.raw_offset = _fd_raw_bytes;
+					frame.write(&_frames[item.slot].front());
+					write_all(&_frames[item.slot].front(), frame_bytes);
+					_fd_raw_bytes += item.nbytes;
+				}
+				else if (item.kind == item_t::ROTATE){
+					finish_file();
+					open_file(_fd_index + 1);
+				}
+				else if (item.kind == item_t::CHECKPOINT){
+					if (fdatasync(_fd) != 0){
+						throw std::runtime_error(str(boost::format("Sync of %s failed: %s") % file_name(_fd_index) % std::strerror(errno)));
+					}
+					checkpoint.position.stored_bytes = _fd_bytes;
+					checkpoint.done(checkpoint.position);
+				}
+				else if (item.kind == item_t::CLOSE){
+					finish_file();
+				}
+			}
+		}
+		catch (...){
+			// keep draining the queue so that the capture loop never blocks, the error is raised there
+			failed = true;
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (not _error) _error = std::current_exception();
+		}
+
+		if (item.kind == item_t::DATA){
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_compress) _frame_bytes[item.slot] = 0;
+			_free_blocks.push_back(item.slot);
+		}
+		_cond.notify_all();
+		if (item.kind == item_t::CLOSE) return;
+	}
+}
+
+
+void capture_writer::write_all(const char* data, size_t nbytes)
+{
+	size_t off = 0;
+	while (off < nbytes){
+		ssize_t n = ::write(_fd, data + off, nbytes - off);
+		if (n < 0){
+			if (errno == EINTR) continue;
+			throw std::runtime_error(str(boost::format("Write to %s failed: %s") % file_name(_fd_index) % std::strerror(errno)));
+		}
+		off += n;
+	}
+	_fd_bytes += nbytes;
+}
+
+
+void capture_writer::open_file(size_t index)
+{
+	std::string part = file_name(index) + ".part";
+	_fd = ::open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (_fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot open output file %s: %s") % part % std::strerror(errno)));
+	}
+	_fd_index 	  = index;
+	_fd_raw_bytes = 0;
+	_fd_bytes 	  = 0;
+}
+
+
+void capture_writer::resume_file(const capture_position_t& position)
+{
+	// the file was finished (renamed) if the capture stopped at a rotation or went through close()
+	std::string final_name = file_name(position.file_index);
+	std::string part = final_name + ".part";
+	if (access(part.c_str(), F_OK) != 0 and std::rename(final_name.c_str(), part.c_str()) != 0){
+		throw std::runtime_error(str(boost::format("Cannot resume capture file %s: %s") % final_name % std::strerror(errno)));
+	}
+	_fd = ::open(part.c_str(), O_WRONLY);
+	if (_fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot open output file %s: %s") % part % std::strerror(errno)));
+	}
+
+	// whatever follows the position is captured again
+	struct stat st;
+	if (fstat(_fd, &st) != 0 or (uint64_t)st.st_size < position.stored_bytes){
+		throw std::runtime_error(str(boost::format("Cannot resume %s: shorter than at the checkpoint (%u bytes)") % part % position.stored_bytes));
+	}
+	if (ftruncate(_fd, position.stored_bytes) != 0 or lseek(_fd, 0, SEEK_END) < 0){
+		throw std::runtime_error(str(boost::format("Cannot truncate %s: %s") % part % std::strerror(errno)));
+	}
+	_fd_index 	  = position.file_index;
+	_fd_raw_bytes = position.raw_bytes;
+	_fd_bytes 	  = position.stored_bytes;
+}
+
+
+void capture_writer::finish_file()
+{
+	if (_fd < 0) return;
+	::close(_fd);
+	_fd = -1;
+
+	// the rename makes the complete file appear atomically (IN_MOVED_TO for inotify watchers)
+	std::string final_name = file_name(_fd_index);
+	std::string part = final_name + ".part";
+	if (std::rename(part.c_str(), final_name.c_str()) != 0){
+		throw std::runtime_error(str(boost::format("Cannot rename %s: %s") % part % std::strerror(errno)));
+	}
+	notify(final_name);
+}
+
+
+void capture_writer::notify(const std::string& path)
+{
+	if (_notify_fd < 0) return;
+	struct sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, _config.notify_socket.c_str(), sizeof(addr.sun_path) - 1);
+	std::string message = path + "\n";
+	// a missing listener must not stop the capture
+	if (sendto(_notify_fd, message.data(), message.size(), 0, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+		std::cerr << boost::format("Capture writer: cannot notify %s (%s)") % _config.notify_socket % std::strerror(errno) << std::endl;
+	}
+}
+
+
+
+/***********************************************************************
+ * Compressor threads
+ **********************************************************************/
+void capture_writer::compress_loop()
+{
+	std::unique_ptr<block_compressor> compressor;
+	while (true){
+		item_t item;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this](){ return not _compress_queue.empty() or _stop_compressors; });
+			if (_compress_queue.empty()) return;
+			item = _compress_queue.front();
+			_compress_queue.pop_front();
+		}
+
+		size_t frame_bytes = COMPRESS_FAILED;
+		double cpu_start = thread_cpu_seconds();
+		try {
+			if (not compressor) compressor.reset(new block_compressor(_codec, _config.compression_level));
+			frame_bytes = compressor->compress(_blocks[item.slot], item.nbytes, _frames[item.slot]);
+		}
+		catch (...){
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (not _error) _error = std::current_exception();
+		}
+		double cpu = thread_cpu_seconds() - cpu_start;
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_frame_bytes[item.slot] = frame_bytes;
+			if (frame_bytes != COMPRESS_FAILED){
+				_compression.blocks++;
+				_compression.raw_bytes 	  += item.nbytes;
+				_compression.stored_bytes += frame_bytes;
+				_compression.cpu 		  += cpu;
+			}
+		}
+		_cond.notify_all();
+	}
+}
+
+
+compression_stats_t capture_writer::compression_stats()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _compression;
+}
+
+
+void capture_writer::print_compression_report(std::ostream& out)
+{
+	if (_compress) ::print_compression_report(_config.compression, compression_stats(), out);
+}
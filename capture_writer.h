@@ -0,0 +1,196 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_CAPTURE_WRITER_H
+#define INCLUDED_MMWAVE_CAPTURE_WRITER_H
+
+#include "capture_codec.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class buffer_arena;
+
+
+/***********************************************************************
+ * Position of a capture at a segment boundary
+ * Taken by capture_writer::checkpoint once everything before it is on
+ * disk, and given back in the configuration of a new writer to continue
+ * the files from there (see sweep_journal.h).
+ **********************************************************************/
+struct capture_position_t
+{
+	uint64_t 	file_index 	  = 0;	// current file
+	uint64_t 	file_segments = 0;	// segments in the current file
+	uint64_t 	raw_bytes 	  = 0;	// uncompressed bytes of the current file
+	uint64_t 	stored_bytes  = 0;	// bytes of the current file on disk (raw_bytes without compression)
+	uint64_t 	meta_bytes 	  = 0;	// bytes of the metadata file
+};
+
+
+
+/***********************************************************************
+ * Capture output configuration
+ **********************************************************************/
+struct capture_config_t
+{
+	std::string out_dir 		= ".";			// directory of the capture files
+	std::string prefix 			= "outfile";	// file name prefix
+	uint64_t 	rotate_bytes 	= 0;			// start a new file at the next segment once this size is reached (0: never)
+	uint64_t 	rotate_segments = 0;			// start a new file every N segments (0: never)
+	std::string notify_socket 	= "";			// Unix datagram socket announcing finished files (empty: none)
+	size_t 		block_size 		= 1 << 20;		// bytes handed to the writer thread at once
+	size_t 		num_blocks 		= 64;			// blocks in flight between the capture loop and the writer thread
+	buffer_arena* arena 		= NULL;			// take the blocks from this arena (default: heap)
+	std::string compression 	= "none";		// block compression of the files: none, iq16, zstd or iq16+zstd (see capture_codec.h)
+	int 		compression_level = 3;			// zstd level
+	size_t 		compress_threads = 2;			// compressor threads
+	const capture_position_t* resume = NULL;	// continue the files of an interrupted capture from this position (default: start over)
+};
+
+
+
+/***********************************************************************
+ * capture_writer
+ * Writes the capture files of a sweep from a dedicated writer thread.
+ * The capture loop copies text and samples into fixed-size blocks which
+ * the writer thread puts on disk. Files are only rotated at segment
+ * boundaries, so that every file keeps the usual layout
+ * ("AiP data" header, "USRP data" marker, samples) and can be processed
+ * on its own. A file is written as <name>.dat.part and renamed to
+ * <name>.dat once complete; its path is then sent to the notify socket.
+ * Without rotation the single file is <prefix>.dat, with rotation the
+ * files are <prefix>_00000.dat, <prefix>_00001.dat, ...
+ * The status of every segment is logged, one JSON object per line, to
+ * <prefix>.meta.jsonl next to the capture files.
+ * With compression, every block is compressed on its own by a pool of
+ * compressor threads between the capture loop and the writer thread,
+ * which writes the frames in order to <name>.dat.mwz (see
+ * capture_codec.h). The metadata then refers to the .mwz files.
+ * A checkpoint syncs the data written so far and reports the position
+ * of the capture; a writer configured to resume from such a position
+ * reopens the file it was in, drops whatever follows the position in the
+ * file and in the metadata, and goes on appending.
+ **********************************************************************/
+class capture_writer
+{
+public:
+	typedef std::function<void(const capture_position_t& position)> checkpoint_fn;
+
+	capture_writer(const capture_config_t& config);
+	~capture_writer();
+
+	// Mark the start of a segment (the only place where a file may be rotated)
+	void begin_segment();
+
+	void end_segment();
+
+	void write_text(const std::string& text);
+
+	void write_samples(const std::complex<float>* buff, size_t num_samps);
+
+	void write(const void* data, size_t nbytes);
+
+	// Append one line to the metadata file (written directly, segments are rare compared to samples)
+	void write_metadata(const std::string& line);
+
+	// Between two segments: once everything written so far is synced to disk, the writer thread calls done with the position
+	void checkpoint(checkpoint_fn done);
+
+	// Flush, finish the last file and stop the writer thread
+	void close();
+
+	// Number of files started so far and path of the current one (without .part)
+	size_t num_files() const { return _file_index + 1; }
+	std::string current_file() const;
+
+	// Handle of the writer thread (for pinning and scheduling)
+	pthread_t writer_thread() { return _thread.native_handle(); }
+
+	// Blocks compressed so far, and their ratio and speed
+	compression_stats_t compression_stats();
+	void print_compression_report(std::ostream& out = std::cout);
+
+private:
+	struct item_t
+	{
+		enum kind_t { DATA, ROTATE, CHECKPOINT, CLOSE } kind;
+		size_t 	slot;
+		size_t 	nbytes;
+	};
+
+	struct checkpoint_t
+	{
+		capture_position_t 	position;
+		checkpoint_fn 		done;
+	};
+
+	std::string file_name(size_t index) const;
+	void submit_block();
+	void push(const item_t& item);
+	void check_error();
+
+	// writer thread side
+	void writer_loop();
+	void write_all(const char* data, size_t nbytes);
+	void open_file(size_t index);
+	void resume_file(const capture_position_t& position);
+	void finish_file();
+	void notify(const std::string& path);
+
+	// compressor threads
+	void compress_loop();
+
+	capture_config_t 				_config;
+	std::vector<std::vector<char>> 	_storage;
+	std::vector<char*> 				_blocks;
+	std::vector<size_t> 			_free_blocks;
+	std::deque<item_t> 				_queue;
+	std::mutex 						_mutex;
+	std::condition_variable 		_cond;
+	std::exception_ptr 				_error;
+	std::thread 					_thread;
+	bool 							_closed;
+	std::ofstream 					_meta;
+	uint64_t 						_meta_bytes;
+	std::deque<checkpoint_t> 		_checkpoints;
+
+	// compression (frames[slot] holds the compressed block of blocks[slot])
+	bool 							_compress;
+	capture_codec_t 				_codec;
+	std::vector<std::vector<char>> 	_frames;
+	std::vector<size_t> 			_frame_bytes;	// 0 until compressed
+	std::deque<item_t> 				_compress_queue;
+	std::vector<std::thread> 		_compressors;
+	bool 							_stop_compressors;
+	compression_stats_t 			_compression;
+
+	// capture loop side
+	char* 		_block;
+	size_t 		_block_slot;
+	size_t 		_block_fill;
+	size_t 		_file_index;
+	uint64_t 	_file_bytes;
+	uint64_t 	_file_segments;
+
+	// writer thread side
+	int 		_fd;
+	size_t 		_fd_index;
+	uint64_t 	_fd_raw_bytes;	// uncompressed bytes written to the current file
+	uint64_t 	_fd_bytes;		// bytes of the current file on disk
+	int 		_notify_fd;
+};
+
+#endif /* INCLUDED_MMWAVE_CAPTURE_WRITER_H */
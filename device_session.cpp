@@ -0,0 +1,108 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "device_session.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+
+
+std::string normalize_device_args(const std::string& args)
+{
+	std::vector<std::string> pairs, kept;
+	boost::split(pairs, args, boost::is_any_of(","));
+	for (size_t i = 0; i < pairs.size(); i++){
+		std::string pair = boost::algorithm::erase_all_copy(pairs[i], " ");
+		if (not pair.empty()) kept.push_back(pair);
+	}
+	std::sort(kept.begin(), kept.end());
+	return boost::algorithm::join(kept, ",");
+}
+
+
+device_sessions::device_sessions(bool shared) :
+	_shared(shared), _before(read_process_usage())
+{
+}
+
+
+uhd::usrp::multi_usrp::sptr device_sessions::open(const std::string& role, const std::string& args, const std::string& direction)
+{
+	if (direction != "rx" and direction != "tx"){
+		throw std::runtime_error(str(boost::format("Unknown chain %s of device role %s") % direction % role));
+	}
+	bool rx = (direction == "rx");
+	std::string key = normalize_device_args(args);
+
+	// The lock is held only to find or reserve the session: different devices open concurrently,
+	// and a role of a device being opened waits for that open
+	std::shared_future<uhd::usrp::multi_usrp::sptr> usrp;
+	std::promise<uhd::usrp::multi_usrp::sptr> opened;
+	size_t index = 0;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_shared){
+			for (size_t i = 0; i < _sessions.size(); i++){
+				session_t& session = _sessions[i];
+				if (session.key != key or (rx ? session.rx_used : session.tx_used)) continue;
+				session.roles.push_back(role);
+				(rx ? session.rx_used : session.tx_used) = true;
+				usrp = session.usrp;
+				break;
+			}
+		}
+		if (not usrp.valid()){
+			session_t session;
+			session.key 		= key;
+			session.roles.push_back(role);
+			session.rx_used 	= rx;
+			session.tx_used 	= not rx;
+			session.usrp 		= opened.get_future().share();
+			session.open_secs 	= 0;
+			index = _sessions.size();
+			_sessions.push_back(session);
+		}
+	}
+	if (usrp.valid()) return usrp.get();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	try {
+		opened.set_value(uhd::usrp::multi_usrp::make(args));
+	}
+	catch (...){
+		opened.set_exception(std::current_exception());
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	_sessions[index].open_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return _sessions[index].usrp.get();
+}
+
+
+size_t device_sessions::size() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _sessions.size();
+}
+
+
+void device_sessions::print_report() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	process_usage_t now = read_process_usage();
+	double open_secs = 0;
+	for (size_t i = 0; i < _sessions.size(); i++){
+		open_secs += _sessions[i].open_secs;
+	}
+	std::cout << boost::format("Device sessions (%s): %u, opened in %.3f s, %+.1f MB resident memory, %+d threads")
+		% (_shared ? "shared" : "one per role") % _sessions.size() % open_secs
+		% (((double)now.rss_bytes - (double)_before.rss_bytes) / 1e6) % ((long)now.threads - (long)_before.threads) << std::endl;
+	for (size_t i = 0; i < _sessions.size(); i++){
+		std::cout << boost::format("  %s: %s (%.3f s)") % _sessions[i].key % boost::algorithm::join(_sessions[i].roles, ", ") % _sessions[i].open_secs << std::endl;
+	}
+}
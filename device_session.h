@@ -0,0 +1,62 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_DEVICE_SESSION_H
+#define INCLUDED_MMWAVE_DEVICE_SESSION_H
+
+#include <uhd/usrp/multi_usrp.hpp>
+#include "thread_config.h"
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * device_sessions
+ * Opens each physical USRP once and hands the same multi_usrp to every
+ * role on it. The Rx and Tx chains of a multi_usrp have their own subdev
+ * spec, channels, rates and streamers, so one session carries e.g. the BB
+ * Rx role (rx subdev A:0) and the LO Tx role (tx subdev B:0) of an X310:
+ * one set of transport threads and buffers instead of one per role.
+ * A second role on the same chain of a device gets its own session.
+ **********************************************************************/
+class device_sessions
+{
+public:
+	// shared = false opens a session per role (the behaviour of the original tools)
+	device_sessions(bool shared = true);
+
+	// Device of a role using the "rx" or "tx" chain of the device at args. Thread-safe: different devices
+	// are opened concurrently, a role of a device that is being opened waits for it.
+	uhd::usrp::multi_usrp::sptr open(const std::string& role, const std::string& args, const std::string& direction);
+
+	size_t size() const;
+
+	// Sessions with their roles and open times, memory and threads added since construction
+	void print_report() const;
+
+private:
+	struct session_t
+	{
+		std::string 					key;		// normalised device args
+		std::vector<std::string> 		roles;
+		bool 							rx_used;
+		bool 							tx_used;
+		std::shared_future<uhd::usrp::multi_usrp::sptr> usrp;	// ready once the device is open
+		double 							open_secs;
+	};
+
+	bool 					_shared;
+	std::vector<session_t> 	_sessions;
+	process_usage_t 		_before;
+	mutable std::mutex 		_mutex;
+};
+
+// Device args as sorted "key=value" pairs without blanks, equal for the same device
+std::string normalize_device_args(const std::string& args);
+
+#endif /* INCLUDED_MMWAVE_DEVICE_SESSION_H */
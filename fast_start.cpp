@@ -0,0 +1,159 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "fast_start.h"
+#include <uhd/exception.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+static const std::chrono::milliseconds SENSOR_POLL(10);
+static const std::chrono::milliseconds PPS_POLL(5);		// latency of the edge detection
+
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+double wait_for_lo_locked(uhd::usrp::multi_usrp::sptr usrp, const std::string& direction, const std::vector<size_t>& channels, double timeout)
+{
+	bool tx = (direction == "tx");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < channels.size(); i++){
+		std::vector<std::string> sensor_names = tx ? usrp->get_tx_sensor_names(channels[i]) : usrp->get_rx_sensor_names(channels[i]);
+		if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked") == sensor_names.end()) continue;
+		while (not (tx ? usrp->get_tx_sensor("lo_locked", channels[i]) : usrp->get_rx_sensor("lo_locked", channels[i])).to_bool()){
+			if (seconds_since(start) > timeout){
+				throw std::runtime_error(str(boost::format("%s LO of channel %u not locked after %.1f s") % direction % channels[i] % timeout));
+			}
+			std::this_thread::sleep_for(SENSOR_POLL);
+		}
+	}
+	return seconds_since(start);
+}
+
+
+double wait_for_ref_locked(uhd::usrp::multi_usrp::sptr usrp, double timeout)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::string> sensor_names = usrp->get_mboard_sensor_names(0);
+	if (std::find(sensor_names.begin(), sensor_names.end(), "ref_locked") == sensor_names.end()) return 0.0;
+	while (not usrp->get_mboard_sensor("ref_locked", 0).to_bool()){
+		if (seconds_since(start) > timeout){
+			throw std::runtime_error(str(boost::format("Reference not locked after %.1f s") % timeout));
+		}
+		std::this_thread::sleep_for(SENSOR_POLL);
+	}
+	return seconds_since(start);
+}
+
+
+void check_locked(uhd::usrp::multi_usrp::sptr usrp, const std::string& direction, const std::vector<size_t>& channels, bool check_ref, const std::string& label)
+{
+	bool tx = (direction == "tx");
+	std::vector<std::string> sensor_names;
+	for (size_t i = 0; i < channels.size(); i++){
+		sensor_names = tx ? usrp->get_tx_sensor_names(channels[i]) : usrp->get_rx_sensor_names(channels[i]);
+		if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked") != sensor_names.end()){
+			uhd::sensor_value_t lo_locked = tx ? usrp->get_tx_sensor("lo_locked", channels[i]) : usrp->get_rx_sensor("lo_locked", channels[i]);
+			std::cout << boost::format("Checking %s: %s ...") % label % lo_locked.to_pp_string() << std::endl;
+			UHD_ASSERT_THROW(lo_locked.to_bool());
+		}
+	}
+	sensor_names = usrp->get_mboard_sensor_names(0);
+	if (check_ref and std::find(sensor_names.begin(), sensor_names.end(), "ref_locked") != sensor_names.end()){
+		uhd::sensor_value_t ref_locked = usrp->get_mboard_sensor("ref_locked", 0);
+		std::cout << boost::format("Checking %s: %s ...") % label % ref_locked.to_pp_string() << std::endl;
+		UHD_ASSERT_THROW(ref_locked.to_bool());
+	}
+}
+
+
+// Wait until the last PPS time of a device differs from last (a new edge has been latched)
+static bool wait_for_pps_edge(uhd::usrp::multi_usrp::sptr usrp, const uhd::time_spec_t& last, std::chrono::steady_clock::time_point deadline)
+{
+	while (usrp->get_time_last_pps() == last){
+		if (std::chrono::steady_clock::now() > deadline) return false;
+		std::this_thread::sleep_for(PPS_POLL);
+	}
+	return true;
+}
+
+
+// Latch the time returned by next_pps_time on the PPS edge after the next one (see sync_time_on_pps)
+static bool latch_time_on_pps(const std::vector<uhd::usrp::multi_usrp::sptr>& usrps, std::function<double()> next_pps_time, double timeout)
+{
+	if (usrps.empty()) return true;
+	std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+
+	// An edge just passed: the next one is almost a second away, time enough to arm every device
+	if (not wait_for_pps_edge(usrps[0], usrps[0]->get_time_last_pps(), std::chrono::steady_clock::now() + period)){
+		return false;
+	}
+	double time = next_pps_time();
+	std::vector<uhd::time_spec_t> armed(usrps.size());
+	for (size_t i = 0; i < usrps.size(); i++){
+		armed[i] = usrps[i]->get_time_last_pps();
+		usrps[i]->set_time_next_pps(uhd::time_spec_t(time));
+	}
+
+	// Return on the latching edge rather than after a fixed second
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + period;
+	for (size_t i = 0; i < usrps.size(); i++){
+		if (not wait_for_pps_edge(usrps[i], armed[i], deadline)) return false;
+	}
+	return true;
+}
+
+
+bool sync_time_on_pps(const std::vector<uhd::usrp::multi_usrp::sptr>& usrps, double timeout)
+{
+	return latch_time_on_pps(usrps, [](){ return 0.0; }, timeout);
+}
+
+
+bool sync_host_time_on_pps(const std::vector<uhd::usrp::multi_usrp::sptr>& usrps, double time_base, double timeout)
+{
+	// the edge just seen is the host second rounded to nearest, the next one the second after
+	return latch_time_on_pps(usrps, [time_base](){ return std::floor(host_time() + 0.5) + 1.0 - time_base; }, timeout);
+}
+
+
+double host_time()
+{
+	return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+
+/***********************************************************************
+ * startup_timer
+ **********************************************************************/
+startup_timer::startup_timer() :
+	_start(std::chrono::steady_clock::now())
+{
+}
+
+
+double startup_timer::elapsed() const
+{
+	return seconds_since(_start);
+}
+
+
+double startup_timer::report_first_sample(double device_now, double stream_start) const
+{
+	double setup = elapsed();
+	double wait  = std::max(0.0, stream_start - device_now);
+	std::cout << boost::format("Time to first sample: %.3f s (setup %.3f s, stream starts %.3f s later)") % (setup + wait) % setup % wait << std::endl;
+	return setup + wait;
+}
@@ -0,0 +1,68 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_FAST_START_H
+#define INCLUDED_MMWAVE_FAST_START_H
+
+#include <uhd/usrp/multi_usrp.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Fast start
+ * The setup of the tools waits on the hardware with fixed sleeps (1 s of
+ * "setup time", 1 s for the PPS pulse). These helpers poll the readiness
+ * of the device instead and return as soon as it is there.
+ **********************************************************************/
+
+// Poll the lo_locked sensor of Tx ("tx") or Rx ("rx") channels until all of them are locked.
+// Returns the seconds waited, throws after timeout. Channels without the sensor are ready.
+double wait_for_lo_locked(uhd::usrp::multi_usrp::sptr usrp, const std::string& direction, const std::vector<size_t>& channels, double timeout = 2.0);
+
+// Poll the ref_locked sensor of motherboard 0 (if any) until the external reference is locked
+double wait_for_ref_locked(uhd::usrp::multi_usrp::sptr usrp, double timeout = 2.0);
+
+// Check (once) that the LOs of the channels and, if check_ref, the reference of motherboard 0 are locked,
+// printing the sensors as "Checking <label>: ..." (throws if one is not locked)
+void check_locked(uhd::usrp::multi_usrp::sptr usrp, const std::string& direction, const std::vector<size_t>& channels, bool check_ref, const std::string& label);
+
+// Set the time of all devices to 0 on the same PPS edge: wait for an edge on get_time_last_pps(),
+// latch 0 on the next one and return as soon as every device has seen it. Returns false, with the
+// times left unchanged, when no edge comes within timeout (no PPS connected).
+bool sync_time_on_pps(const std::vector<uhd::usrp::multi_usrp::sptr>& usrps, double timeout = 1.5);
+
+// Same, with the time of the devices set to the host time (Unix seconds) minus time_base. Devices on
+// different hosts then agree on the device time, provided the hosts share the PPS and their clocks are
+// right to within half a second (NTP, GPS): agents exchange time_base, then align their own devices.
+bool sync_host_time_on_pps(const std::vector<uhd::usrp::multi_usrp::sptr>& usrps, double time_base, double timeout = 1.5);
+
+// Host time in Unix seconds
+double host_time();
+
+
+
+/***********************************************************************
+ * startup_timer
+ * Wall-clock time from program start, to report the time to first sample
+ **********************************************************************/
+class startup_timer
+{
+public:
+	startup_timer();
+
+	double elapsed() const;
+
+	// Print and return the time from program start to the first sample of a stream starting at
+	// device time stream_start, device_now being the device time read now
+	double report_first_sample(double device_now, double stream_start) const;
+
+private:
+	std::chrono::steady_clock::time_point _start;
+};
+
+#endif /* INCLUDED_MMWAVE_FAST_START_H */
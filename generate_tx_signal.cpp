@@ -4,21 +4,17 @@
 //
 
 #include <uhd/exception.hpp>
-#include <uhd/usrp/multi_usrp.hpp>
 #include <uhd/utils/safe_main.hpp>
-#include <uhd/utils/static.hpp>
-#include <uhd/utils/thread.hpp>
 #include <stdint.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
-#include <boost/math/special_functions/round.hpp>
 #include <boost/program_options.hpp>
 #include <chrono>
-#include <csignal>
 #include <iostream>
 #include <string>
-#include <thread>
-#include <fstream>
+#include <vector>
+
+#include "waveform.h"
 
 namespace po = boost::program_options;
 
@@ -27,12 +23,34 @@ namespace po = boost::program_options;
  **********************************************************************/
 int UHD_SAFE_MAIN(int argc, char* argv[])
 {
-    
+    // variables to be set by po
+    std::string output, type, tone_list;
+    uint64_t 	seed;
+    size_t 		num_symbols, sps, length, root;
+    double 		rate, f0, f1;
+    float 		amplitude;
+    unsigned 	threads;
+    bool 		matlab;
+
     // setup the program options
     po::options_description desc("Allowed options");
     // clang-format off
     desc.add_options()
 		("help", "help message")
+		("output", po::value<std::string>(&output)->default_value("tx_signal.wfm"), "waveform file to write")
+		("type", po::value<std::string>(&type)->default_value("legacy-qpsk"), "waveform: legacy-qpsk, qpsk, bpsk, zadoff-chu, chirp, multitone or constant")
+		("seed", po::value<uint64_t>(&seed)->default_value(1), "seed of the random symbols")
+		("symbols", po::value<size_t>(&num_symbols)->default_value(1000), "number of symbols of a burst")
+		("sps", po::value<size_t>(&sps)->default_value(1), "samples per symbol of a burst")
+		("length", po::value<size_t>(&length)->default_value(10000), "number of samples of the waveform (a burst is zero-padded)")
+		("root", po::value<size_t>(&root)->default_value(7), "root of the Zadoff-Chu sequence (coprime with the length)")
+		("rate", po::value<double>(&rate)->default_value(1000000), "sample rate of the chirp and multi-tone (also stored in the file)")
+		("f0", po::value<double>(&f0)->default_value(-100e3), "start frequency of the chirp in Hz")
+		("f1", po::value<double>(&f1)->default_value(100e3), "stop frequency of the chirp in Hz")
+		("tones", po::value<std::string>(&tone_list)->default_value("100e3"), "frequencies of the multi-tone in Hz, e.g. \"-200e3,50e3,300e3\"")
+		("amplitude", po::value<float>(&amplitude)->default_value(1.0f), "amplitude of the I and Q components")
+		("threads", po::value<unsigned>(&threads)->default_value(0), "generator threads (0: all cores)")
+		("matlab", po::bool_switch(&matlab), "also print the samples as MATLAB assignments (tx_packet(n) = ...)")
     ;
     // clang-format on
     po::variables_map vm;
@@ -41,28 +59,64 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 
     // print the help message
     if (vm.count("help")) {
-        std::cout << boost::format("Generate the transmitted signal: ") % desc << std::endl;
+        std::cout << boost::format("Generate the transmitted signal as a waveform file %s") % desc << std::endl;
         return ~0;
     }
-    
-    
+
+
     // Generate baseband data to transmit
-    std::vector<std::complex<float>> data_bb(10000);
-    srand (1);
-    for (size_t i = 0; i < 1000; i++){
-        data_bb[i] = (2*(rand() % 2) -1) + (2*(rand() % 2) -1)*1j ;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::complex<float>> data_bb;
+    std::string description;
+    size_t print_samps = length;
+    if (type == "legacy-qpsk"){
+    	data_bb = legacy_qpsk_burst(seed, num_symbols, length);
+    	description = str(boost::format("legacy-qpsk seed=%u symbols=%u length=%u") % seed % num_symbols % length);
+    	print_samps = std::min(num_symbols, length);
+    }
+    else if (type == "qpsk" or type == "bpsk"){
+    	data_bb = psk_burst(type == "qpsk" ? 2 : 1, seed, num_symbols, sps, length, amplitude, threads);
+    	description = str(boost::format("%s seed=%u symbols=%u sps=%u length=%u amplitude=%g") % type % seed % num_symbols % sps % length % amplitude);
+    	print_samps = num_symbols * sps;
+    }
+    else if (type == "zadoff-chu"){
+    	data_bb = zadoff_chu(root, length, amplitude, threads);
+    	description = str(boost::format("zadoff-chu root=%u length=%u amplitude=%g") % root % length % amplitude);
     }
-    for (size_t i = 1000; i < data_bb.size(); i++){
-        data_bb[i] = 0.0;
+    else if (type == "chirp"){
+    	data_bb = linear_chirp(f0, f1, rate, length, amplitude, threads);
+    	description = str(boost::format("chirp f0=%g f1=%g rate=%g length=%u amplitude=%g") % f0 % f1 % rate % length % amplitude);
     }
-    
+    else if (type == "multitone"){
+    	std::vector<std::string> tone_strings;
+    	std::vector<double> tones;
+    	boost::split(tone_strings, tone_list, boost::is_any_of(","));
+    	for (size_t i = 0; i < tone_strings.size(); i++){
+    		if (not tone_strings[i].empty()) tones.push_back(std::stod(tone_strings[i]));
+    	}
+    	data_bb = multitone(tones, rate, length, amplitude, threads);
+    	description = str(boost::format("multitone tones=%s rate=%g length=%u amplitude=%g") % tone_list % rate % length % amplitude);
+    }
+    else if (type == "constant"){
+    	data_bb = constant_waveform(length, amplitude);
+    	description = str(boost::format("constant length=%u amplitude=%g") % length % amplitude);
+    }
+    else{
+    	throw std::runtime_error(str(boost::format("Unknown waveform type %s") % type));
+    }
+    double generate_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    write_waveform(output, data_bb, rate, description);
+    std::cout << boost::format("Wrote %s: %s (%u samples, generated in %.3f s, %.1f Msps)")
+    	% output % description % data_bb.size() % generate_s % (data_bb.size() / std::max(generate_s, 1e-9) / 1e6) << std::endl;
+
     // Print out baseband data packet
-    for (size_t i = 0; i < 1000; i++){
-        std::cout << boost::format("tx_packet(%f) = %f + (%f)*1i ;") % (i+1) % std::real(data_bb[i]) % std::imag(data_bb[i]) << std::endl;
+    if (matlab){
+	    for (size_t i = 0; i < print_samps; i++){
+	        std::cout << boost::format("tx_packet(%f) = %f + (%f)*1i ;") % (i+1) % std::real(data_bb[i]) % std::imag(data_bb[i]) << std::endl;
+	    }
     }
-    
-   
-    
+
     // finished
     std::cout << std::endl << "Done!" << std::endl << std::endl;
     return EXIT_SUCCESS;
@@ -0,0 +1,264 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "job_socket.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+
+// longest request accepted, and time given to a client to send it
+static const size_t MAX_REQUEST_BYTES = 64*1024;
+static const int 	REQUEST_TIMEOUT_MS = 5000;
+
+
+
+/***********************************************************************
+ * Requests
+ **********************************************************************/
+std::string job_request_t::get(const std::string& key, const std::string& def) const
+{
+	std::map<std::string, std::string>::const_iterator it = args.find(key);
+	return (it == args.end()) ? def : it->second;
+}
+
+
+double job_request_t::get_double(const std::string& key, double def) const
+{
+	std::string value = get(key, "");
+	if (value.empty()) return def;
+	char* end;
+	double number = std::strtod(value.c_str(), &end);
+	if (*end != '\0'){
+		throw std::runtime_error(str(boost::format("Bad value of %s: %s (number expected)") % key % value));
+	}
+	return number;
+}
+
+
+uint64_t job_request_t::get_uint(const std::string& key, uint64_t def) const
+{
+	std::string value = get(key, "");
+	if (value.empty()) return def;
+	char* end;
+	unsigned long long number = std::strtoull(value.c_str(), &end, 10);
+	if (*end != '\0' or value[0] == '-'){
+		throw std::runtime_error(str(boost::format("Bad value of %s: %s (integer expected)") % key % value));
+	}
+	return number;
+}
+
+
+bool job_request_t::get_bool(const std::string& key, bool def) const
+{
+	std::string value = get(key, "");
+	if (value.empty()) return def;
+	if (value == "1" or value == "true") return true;
+	if (value == "0" or value == "false") return false;
+	throw std::runtime_error(str(boost::format("Bad value of %s: %s (true or false expected)") % key % value));
+}
+
+
+void job_request_t::check_keys(const std::vector<std::string>& known) const
+{
+	for (std::map<std::string, std::string>::const_iterator it = args.begin(); it != args.end(); ++it){
+		if (std::find(known.begin(), known.end(), it->first) == known.end()){
+			throw std::runtime_error(str(boost::format("Unknown argument %s of %s (%s)") % it->first % command % boost::algorithm::join(known, ", ")));
+		}
+	}
+}
+
+
+job_request_t parse_job_request(const std::string& line)
+{
+	std::vector<std::string> tokens;
+	std::string trimmed = boost::algorithm::trim_copy(line);
+	if (not trimmed.empty()){
+		boost::algorithm::split(tokens, trimmed, boost::algorithm::is_space(), boost::algorithm::token_compress_on);
+	}
+	if (tokens.empty()){
+		throw std::runtime_error("Empty request");
+	}
+
+	job_request_t request;
+	request.command = tokens[0];
+	for (size_t i = 1; i < tokens.size(); i++){
+		size_t eq = tokens[i].find('=');
+		if (eq == std::string::npos or eq == 0){
+			throw std::runtime_error(str(boost::format("Bad argument %s (key=value expected)") % tokens[i]));
+		}
+		request.args[tokens[i].substr(0, eq)] = tokens[i].substr(eq + 1);
+	}
+	return request;
+}
+
+
+
+/***********************************************************************
+ * Socket helpers
+ **********************************************************************/
+static struct sockaddr_un socket_address(const std::string& path)
+{
+	struct sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.empty() or path.size() >= sizeof(addr.sun_path)){
+		throw std::runtime_error(str(boost::format("Bad socket path %s (1 to %u characters)") % path % (sizeof(addr.sun_path) - 1)));
+	}
+	std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	return addr;
+}
+
+
+// Whole line to a connected socket, false once the peer is gone
+static bool send_line(int fd, const std::string& line)
+{
+	std::string message = line;
+	std::replace(message.begin(), message.end(), '\n', ' ');
+	message += "\n";
+	size_t off = 0;
+	while (off < message.size()){
+		ssize_t n = send(fd, message.data() + off, message.size() - off, MSG_NOSIGNAL);
+		if (n < 0){
+			if (errno == EINTR) continue;
+			return false;
+		}
+		off += n;
+	}
+	return true;
+}
+
+
+
+/***********************************************************************
+ * job_server
+ **********************************************************************/
+job_server::job_server(const std::string& path) :
+	_path(path), _listen_fd(-1)
+{
+	struct sockaddr_un addr = socket_address(path);
+
+	// a socket file nobody listens on any more is replaced
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe >= 0){
+		bool in_use = connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+		close(probe);
+		if (in_use){
+			throw std::runtime_error(str(boost::format("Another daemon is listening on %s") % path));
+		}
+	}
+	unlink(path.c_str());
+
+	_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (_listen_fd < 0 or bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 or listen(_listen_fd, 8) != 0){
+		std::string error = std::strerror(errno);
+		if (_listen_fd >= 0) close(_listen_fd);
+		throw std::runtime_error(str(boost::format("Cannot listen on %s: %s") % path % error));
+	}
+}
+
+
+job_server::~job_server()
+{
+	if (_listen_fd >= 0){
+		close(_listen_fd);
+		unlink(_path.c_str());
+	}
+}
+
+
+void job_server::serve(handler_fn handler, std::function<bool()> stop_requested)
+{
+	while (not stop_requested()){
+		struct pollfd pfd = {_listen_fd, POLLIN, 0};
+		if (poll(&pfd, 1, 100) <= 0) continue;
+		int fd = accept(_listen_fd, NULL, NULL);
+		if (fd < 0) continue;
+		handle_client(fd, handler);
+		close(fd);
+	}
+}
+
+
+void job_server::handle_client(int fd, handler_fn handler)
+{
+	// one request line, from a client that does not take forever to send it
+	std::string line;
+	while (line.find('\n') == std::string::npos and line.size() < MAX_REQUEST_BYTES){
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) <= 0){
+			send_line(fd, "error no request received");
+			return;
+		}
+		char buff[4096];
+		ssize_t n = recv(fd, buff, sizeof(buff), 0);
+		if (n < 0 and errno == EINTR) continue;
+		if (n <= 0) break;
+		line.append(buff, n);
+	}
+	line = line.substr(0, line.find('\n'));
+	if (line.empty()) return;	// e.g. a daemon starting up checks whether the socket is in use
+
+	bool connected = true;
+	reply_fn reply = [&](const std::string& text){
+		if (connected) connected = send_line(fd, text);
+	};
+	try {
+		std::string summary = handler(parse_job_request(line), reply);
+		reply(summary.empty() ? "ok" : "ok " + summary);
+	}
+	catch (const std::exception& e){
+		std::cerr << boost::format("Job failed (%s): %s") % line % e.what() << std::endl;
+		reply(std::string("error ") + e.what());
+	}
+}
+
+
+
+/***********************************************************************
+ * Client
+ **********************************************************************/
+bool run_job(const std::string& path, const std::string& request, std::function<void(const std::string& line)> on_line)
+{
+	struct sockaddr_un addr = socket_address(path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 or connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+		std::string error = std::strerror(errno);
+		if (fd >= 0) close(fd);
+		throw std::runtime_error(str(boost::format("Cannot connect to the daemon on %s: %s") % path % error));
+	}
+	if (not send_line(fd, request)){
+		close(fd);
+		throw std::runtime_error(str(boost::format("Cannot send the request to %s") % path));
+	}
+
+	// reply lines until the daemon closes the connection
+	std::string pending, last;
+	char buff[4096];
+	while (true){
+		ssize_t n = recv(fd, buff, sizeof(buff), 0);
+		if (n < 0 and errno == EINTR) continue;
+		if (n <= 0) break;
+		pending.append(buff, n);
+		size_t eol;
+		while ((eol = pending.find('\n')) != std::string::npos){
+			last = pending.substr(0, eol);
+			pending.erase(0, eol + 1);
+			on_line(last);
+		}
+	}
+	close(fd);
+	return last.compare(0, 3, "ok ") == 0 or last == "ok";
+}
@@ -0,0 +1,84 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_JOB_SOCKET_H
+#define INCLUDED_MMWAVE_JOB_SOCKET_H
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Jobs over a local Unix socket
+ * A client connects to the stream socket of the daemon, sends one
+ * request line and reads reply lines until the connection closes:
+ *
+ *   sweep plan-rx=rx.csv nsamps=200000 outdir=/data/run12 prefix=p3
+ *   pair 0 0 Tx LEFT - 78.00 / Rx LEFT - 78.00 ok
+ *   ...
+ *   ok 1156 pairs, 1156 segments, 1 file(s) in 812.4 s
+ *
+ * A request is a command followed by key=value arguments (no blanks in
+ * the values). The last reply line starts with "ok" or "error". Clients
+ * are served one at a time, the jobs share the hardware of the daemon.
+ **********************************************************************/
+struct job_request_t
+{
+	std::string 						command;
+	std::map<std::string, std::string> 	args;
+
+	// Value of an argument or the default; the numbers throw if the value does not parse
+	std::string get(const std::string& key, const std::string& def) const;
+	double get_double(const std::string& key, double def) const;
+	uint64_t get_uint(const std::string& key, uint64_t def) const;
+	bool get_bool(const std::string& key, bool def) const;
+
+	// Throws on an argument that is not in known (a typo would silently take the default)
+	void check_keys(const std::vector<std::string>& known) const;
+};
+
+// Parse "command key=value ...", throws if malformed
+job_request_t parse_job_request(const std::string& line);
+
+
+
+/***********************************************************************
+ * job_server
+ * Listening side of the socket (the daemon). The handler runs on the
+ * calling thread for each request and sends progress lines through
+ * reply; the server then closes the exchange with "ok <summary>", or
+ * "error <message>" if the request or the handler threw. A client that
+ * goes away does not stop the job, its replies are dropped.
+ **********************************************************************/
+class job_server
+{
+public:
+	typedef std::function<void(const std::string& line)> reply_fn;
+	typedef std::function<std::string(const job_request_t& request, reply_fn reply)> handler_fn;
+
+	// Bind the socket (a socket file left by a previous daemon is replaced)
+	job_server(const std::string& path);
+	~job_server();
+
+	const std::string& path() const { return _path; }
+
+	// Serve clients one at a time until stop_requested returns true (checked every 100 ms while idle)
+	void serve(handler_fn handler, std::function<bool()> stop_requested);
+
+private:
+	void handle_client(int fd, handler_fn handler);
+
+	std::string _path;
+	int 		_listen_fd;
+};
+
+// Client side: send one request to the daemon at path, pass every reply line to on_line; true if the last one is "ok ..."
+bool run_job(const std::string& path, const std::string& request, std::function<void(const std::string& line)> on_line);
+
+#endif /* INCLUDED_MMWAVE_JOB_SOCKET_H */
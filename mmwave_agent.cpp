@@ -0,0 +1,647 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include <uhd/exception.hpp>
+#include <uhd/usrp/multi_usrp.hpp>
+#include <uhd/utils/safe_main.hpp>
+#include <uhd/utils/thread.hpp>
+#include <stdint.h>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aip_functions.h"
+#include "capture_writer.h"
+#include "rx_capture.h"
+#include "tx_monitor.h"
+#include "buffer_arena.h"
+#include "waveform.h"
+#include "waveform_source.h"
+#include "aip_controller.h"
+#include "sweep_plan.h"
+#include "sweep_schedule.h"
+#include "fast_start.h"
+#include "bringup.h"
+#include "device_session.h"
+#include "stream_standin.h"
+#include "agent_link.h"
+namespace po = boost::program_options;
+
+
+std::atomic<bool> stop_signal_called(false);
+void sig_int_handler(int) { stop_signal_called = true; }
+
+// room for the buffers of the Tx workers
+const size_t ARENA_HEADROOM = 4*1024*1024;
+
+// time given to the Rx agent to connect, and to the peer to answer a control message
+const double CONNECT_TIMEOUT = 60.0;
+const double REPLY_TIMEOUT = 10.0;
+
+// largest difference between the device times of the agents once aligned (a PPS edge missed, host clocks off)
+const double MAX_TIME_MISMATCH = 0.5;
+
+// time given to the confirmation of a Tx switch after the end of the Rx window
+const double CONFIRM_TIMEOUT = 0.5;
+
+
+/***********************************************************************
+ * tx_worker function
+ * Sends the BB waveform and the LO of the USRP-Tx until the agent stops
+ **********************************************************************/
+void tx_worker(waveform_source::sptr data_bb,
+    waveform_source::sptr data_lo,
+    uhd::tx_streamer::sptr stream_tx, buffer_arena* arena, double start_time, bool loop)
+{
+    size_t spb = stream_tx->get_max_num_samps();
+    std::complex<float>* buff_bb = arena->allocate<std::complex<float>>(spb);
+    std::complex<float>* buff_lo = arena->allocate<std::complex<float>>(spb);
+    std::vector<std::complex<float>*> buffs(2);
+    buffs[0] = buff_bb;
+    buffs[1] = buff_lo;
+
+    uhd::tx_metadata_t md;
+    md.start_of_burst = true;
+    md.end_of_burst   = false;
+    md.has_time_spec  = true;
+    md.time_spec = uhd::time_spec_t(start_time);
+
+    waveform_player player_bb(data_bb, loop);
+    waveform_player player_lo(data_lo);
+    while (not stop_signal_called) {
+        player_bb.fill(buff_bb, spb);
+        player_lo.fill(buff_lo, spb);
+        stream_tx->send(buffs, spb, md);
+        md.start_of_burst = false;
+        md.has_time_spec  = false;
+    }
+
+    // send a mini EOB packet
+    md.end_of_burst = true;
+    stream_tx->send("", 0, md);
+}
+
+
+/***********************************************************************
+ * rx_lo_worker function
+ * Sends the LO of the USRP-Rx until the agent stops
+ **********************************************************************/
+void rx_lo_worker(waveform_source::sptr data_lo,
+    uhd::tx_streamer::sptr stream_rx_lo, buffer_arena* arena, double start_time)
+{
+    size_t spb = stream_rx_lo->get_max_num_samps();
+    std::complex<float>* buff_lo = arena->allocate<std::complex<float>>(spb);
+    std::vector<std::complex<float>*> buffs(1);
+    buffs[0] = buff_lo;
+
+    uhd::tx_metadata_t md;
+    md.start_of_burst = true;
+    md.end_of_burst   = false;
+    md.has_time_spec  = true;
+    md.time_spec = uhd::time_spec_t(start_time);
+
+    waveform_player player_lo(data_lo);
+    while (not stop_signal_called) {
+        player_lo.fill(buff_lo, spb);
+        stream_rx_lo->send(buffs, spb, md);
+        md.start_of_burst = false;
+        md.has_time_spec  = false;
+    }
+
+    // send a mini EOB packet
+    md.end_of_burst = true;
+    stream_rx_lo->send("", 0, md);
+}
+
+
+/***********************************************************************
+ * The side of the sweep run by this agent
+ **********************************************************************/
+struct agent_side_t
+{
+    aip_controller* 					arrays;
+    size_t 								array;
+    std::function<double()> 			device_time;
+    std::function<void(double)> 		align_time;		// device time = host time - time base
+    std::function<void(double)> 		start_workers;	// Tx streamers of the agent, from a device time on
+};
+
+
+// Throws if the peer aborted, or sent something else than one of the expected messages
+static void check_message(const std::vector<std::string>& words, const std::vector<std::string>& expected)
+{
+    if (not words.empty() and words[0] == "abort") {
+        std::string reason;
+        for (size_t i = 1; i < words.size(); i++) reason += (i > 1 ? " " : "") + words[i];
+        throw std::runtime_error("Peer agent aborted: " + reason);
+    }
+    if (words.empty() or std::find(expected.begin(), expected.end(), words[0]) == expected.end()) {
+        std::string line;
+        for (size_t i = 0; i < words.size(); i++) line += (i > 0 ? " " : "") + words[i];
+        throw std::runtime_error(str(boost::format("Unexpected message from the peer agent: %s") % line));
+    }
+}
+
+
+// Next message of the peer, which must be command with nargs arguments
+static std::vector<std::string> expect_message(agent_link& link, const std::string& command, size_t nargs, double timeout)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    std::string line;
+    while (not link.receive(line, 0.1)) {
+        if (stop_signal_called) throw std::runtime_error("Interrupted");
+        if (std::chrono::steady_clock::now() >= deadline) {
+            throw std::runtime_error(str(boost::format("No %s message from the peer agent within %.0f s") % command % timeout));
+        }
+    }
+    std::vector<std::string> words = split_message(line);
+    check_message(words, {command});
+    if (words.size() != nargs + 1) {
+        throw std::runtime_error(str(boost::format("Bad %s message from the peer agent: %s") % command % line));
+    }
+    return words;
+}
+
+
+// Sleep until a device time, handling the messages of the peer in the meantime
+static void wait_for_time(const agent_side_t& side, double time, agent_link& link, std::function<void(const std::vector<std::string>&)> on_message)
+{
+    while (true) {
+        if (stop_signal_called) throw std::runtime_error("Interrupted");
+        double left = time - side.device_time();
+        if (left <= 0) return;
+        std::string line;
+        if (link.receive(line, std::min(left, 0.1))) on_message(split_message(line));
+    }
+}
+
+
+static double parse_number(const std::string& word)
+{
+    char* end;
+    double number = std::strtod(word.c_str(), &end);
+    if (word.empty() or *end != '\0') {
+        throw std::runtime_error(str(boost::format("Bad number in a message of the peer agent: %s") % word));
+    }
+    return number;
+}
+
+
+static std::string beam_name(const sweep_step_t& step)
+{
+    return str(boost::format("%s - %s") % step.direction % step.angle);
+}
+
+
+/***********************************************************************
+ * Tx agent
+ * Listens for the Rx agent, checks that both run the same plans, aligns
+ * its device time on the time base of the Rx agent, then switches the Tx
+ * array at the switch time of the first slot of every Tx step and
+ * confirms each switch ("switched <step> <device time>").
+ **********************************************************************/
+static void run_tx_agent(agent_side_t& side, int port, const sweep_plan_t& plan_tx, const sweep_plan_t& plan_rx)
+{
+    std::cout << boost::format("Tx agent: waiting for the Rx agent on port %d...") % port << std::endl;
+    agent_link::sptr link = agent_link::listen(port, [](){ return (bool)stop_signal_called; });
+    if (not link) throw std::runtime_error("Interrupted");
+    std::cout << boost::format("Rx agent connected from %s") % link->peer() << std::endl;
+
+    try {
+        // hello <hash Tx plan> <hash Rx plan> <Rx rate> <guard> <time base>
+        std::vector<std::string> hello = expect_message(*link, "hello", 5, REPLY_TIMEOUT);
+        if (std::strtoull(hello[1].c_str(), NULL, 16) != sweep_plan_hash(plan_tx) or std::strtoull(hello[2].c_str(), NULL, 16) != sweep_plan_hash(plan_rx)) {
+            throw std::runtime_error(str(boost::format("The agents run different plans (Tx %016x x Rx %016x here, %s x %s on the Rx agent)")
+                % sweep_plan_hash(plan_tx) % sweep_plan_hash(plan_rx) % hello[1] % hello[2]));
+        }
+        double rate 		= parse_number(hello[3]);
+        double guard 		= parse_number(hello[4]);
+        double time_base 	= parse_number(hello[5]);
+
+        side.align_time(time_base);
+        side.start_workers(std::floor(side.device_time()) + 1.0);
+        link->send(str(boost::format("ready %.6f") % side.device_time()));
+
+        std::vector<std::string> start = expect_message(*link, "start", 1, REPLY_TIMEOUT);
+        std::vector<schedule_slot_t> schedule = make_sweep_schedule(plan_tx, plan_rx, rate, parse_number(start[1]), guard);
+        std::cout << boost::format("Sweep %s x %s: %u Tx beams from device time %.3f to %.3f (time base %.0f)")
+            % plan_tx.name % plan_rx.name % plan_tx.steps.size() % schedule.front().switch_time % sweep_schedule_end(schedule, rate) % time_base << std::endl;
+
+        // progress of the Rx agent, as its captures come
+        size_t captured = 0, degraded = 0, switches = 0, late = 0;
+        bool ended = false;
+        std::function<void(const std::vector<std::string>&)> on_message = [&](const std::vector<std::string>& words){
+            check_message(words, {"captured", "end"});
+            if (words[0] == "end") {
+                ended = true;
+                return;
+            }
+            captured++;
+            if (words.size() < 4 or words[3] != "ok") degraded++;
+        };
+
+        for (size_t n = 0; n < schedule.size(); n++) {
+            const schedule_slot_t& slot = schedule[n];
+            if (not slot.tx_switch) continue;
+            wait_for_time(side, slot.switch_time, *link, on_message);
+            if (ended) throw std::runtime_error("The Rx agent ended the sweep early");
+
+            const sweep_step_t& step = plan_tx.steps[slot.tx];
+            side.arrays->steer_frames(side.array, step.frames, plan_tx.mode).get();
+            double done = side.device_time();
+            link->send(str(boost::format("switched %u %.6f") % slot.tx % done));
+            switches++;
+            if (done > slot.start) late++;
+            std::cout << boost::format("Tx AiP set to %s ° at time %f (slot %f, window %f)%s, %u of %u pairs captured")
+                % beam_name(step) % done % slot.switch_time % slot.start % (done > slot.start ? " LATE" : "") % captured % schedule.size() << std::endl;
+        }
+
+        // the Rx agent ends the sweep after its last window
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(sweep_schedule_end(schedule, rate) - side.device_time() + REPLY_TIMEOUT));
+        while (not ended) {
+            if (stop_signal_called) throw std::runtime_error("Interrupted");
+            if (std::chrono::steady_clock::now() >= deadline) throw std::runtime_error("No end message from the Rx agent");
+            std::string line;
+            if (link->receive(line, 0.1)) on_message(split_message(line));
+        }
+        link->send(str(boost::format("bye %u %u") % switches % late));
+        std::cout << boost::format("Tx report: %u switches (%u late), %u pairs captured by the Rx agent (%u not ok)") % switches % late % captured % degraded << std::endl;
+    }
+    catch (const std::exception& e) {
+        try { link->send(std::string("abort ") + e.what()); } catch (...) {}
+        throw;
+    }
+}
+
+
+/***********************************************************************
+ * Rx agent
+ * Connects to the Tx agent and leads the sweep: sends the time base and
+ * the start time, switches the Rx array at every slot and captures the
+ * window of the slot. A pair whose Tx switch is not confirmed before
+ * the window starts, or whose Rx switch ended after it, is marked late.
+ **********************************************************************/
+static void run_rx_agent(agent_side_t& side, const std::string& peer, const sweep_plan_t& plan_tx, const sweep_plan_t& plan_rx,
+                         uhd::rx_streamer::sptr rx_stream, double rate, capture_config_t capture, size_t recv_batch, double guard, double lead,
+                         const tx_async_monitor* rx_lo_monitor)
+{
+    std::cout << boost::format("Rx agent: connecting to the Tx agent %s...") % peer << std::endl;
+    agent_link::sptr link = agent_link::connect(peer, CONNECT_TIMEOUT);
+    double time_base = std::floor(host_time());
+
+    try {
+        link->send(str(boost::format("hello %016x %016x %.6f %.6f %.0f") % sweep_plan_hash(plan_tx) % sweep_plan_hash(plan_rx) % rate % guard % time_base));
+        side.align_time(time_base);
+        side.start_workers(std::floor(side.device_time()) + 1.0);
+
+        std::vector<std::string> ready = expect_message(*link, "ready", 1, REPLY_TIMEOUT);
+        double mismatch = parse_number(ready[1]) - side.device_time();
+        std::cout << boost::format("Device times aligned on time base %.0f: Tx agent %+.3f ms from here (including the link latency)") % time_base % (1e3*mismatch) << std::endl;
+        if (std::fabs(mismatch) > MAX_TIME_MISMATCH) {
+            throw std::runtime_error(str(boost::format("Device times of the agents differ by %.3f s: are both hosts on the same PPS and clock?") % mismatch));
+        }
+
+        double t0 = std::ceil(side.device_time()) + lead;
+        std::vector<schedule_slot_t> schedule = make_sweep_schedule(plan_tx, plan_rx, rate, t0, guard);
+        link->send(str(boost::format("start %.6f") % t0));
+
+        capture_writer outfile(capture);
+        std::cout << boost::format("Sweep %s x %s: %u pairs from device time %.3f to %.3f into %s")
+            % plan_tx.name % plan_rx.name % schedule.size() % t0 % sweep_schedule_end(schedule, rate) % outfile.current_file() << std::endl;
+        outfile.write_metadata(str(boost::format("{\"schedule\": \"start\", \"peer\": \"%s\", \"time_base\": %.0f, \"start\": %f, \"guard\": %f, \"pairs\": %u}")
+            % link->peer() % time_base % t0 % guard % schedule.size()));
+
+        // the Tx agent cannot wait for a re-capture: none
+        rx_capture receiver(rx_stream, outfile, rate, guard + 1.0, 0, recv_batch);
+        if (rx_lo_monitor != NULL) receiver.add_tx_monitor(rx_lo_monitor);
+
+        std::map<size_t, double> tx_switched;
+        std::function<void(const std::vector<std::string>&)> on_message = [&](const std::vector<std::string>& words){
+            check_message(words, {"switched"});
+            if (words.size() != 3) throw std::runtime_error("Bad switched message from the Tx agent");
+            tx_switched[std::strtoul(words[1].c_str(), NULL, 10)] = parse_number(words[2]);
+        };
+
+        uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+        stream_cmd.stream_now = false;
+        stream_cmd.time_spec = uhd::time_spec_t(schedule.front().switch_time);
+        rx_stream->issue_stream_cmd(stream_cmd);
+
+        size_t late_tx = 0, late_rx = 0, degraded = 0;
+        try {
+            for (size_t n = 0; n < schedule.size(); n++) {
+                const schedule_slot_t& slot = schedule[n];
+                const sweep_step_t& step_tx = plan_tx.steps[slot.tx];
+                const sweep_step_t& step_rx = plan_rx.steps[slot.rx];
+                wait_for_time(side, slot.switch_time, *link, on_message);
+
+                side.arrays->steer_frames(side.array, step_rx.frames, plan_rx.mode).get();
+                double rx_done = side.device_time();
+                std::cout << boost::format("Rx AiP set to %s ° at time %f (slot %f, window %f)%s")
+                    % beam_name(step_rx) % rx_done % slot.switch_time % slot.start % (rx_done > slot.start ? " LATE" : "") << std::endl;
+
+                std::string beam = str(boost::format("Tx %s / Rx %s") % beam_name(step_tx) % beam_name(step_rx));
+                rx_segment_stats_t stats = receiver.capture_segment(str(boost::format("\nAiP Tx data\n%s - %s degrees at time %f\nAiP Rx data\n%s - %s degrees at time %f\n")
+                                                                        % step_tx.direction % step_tx.angle % slot.switch_time % step_rx.direction % step_rx.angle % slot.switch_time),
+                                                                    beam, slot.switch_time, slot.samps, slot.start);
+
+                // confirmations that came during the window, then a short wait for a missing one
+                std::string line;
+                while (link->receive(line, 0)) on_message(split_message(line));
+                std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(CONFIRM_TIMEOUT));
+                while (tx_switched.count(slot.tx) == 0 and std::chrono::steady_clock::now() < deadline) {
+                    if (link->receive(line, 0.05)) on_message(split_message(line));
+                }
+
+                bool tx_ok = tx_switched.count(slot.tx) > 0 and tx_switched[slot.tx] <= slot.start;
+                bool rx_ok = rx_done <= slot.start;
+                std::string status = not tx_ok ? "late-tx" : not rx_ok ? "late-rx" : stats.status();
+                if (not tx_ok) late_tx++;
+                else if (not rx_ok) late_rx++;
+                else if (not stats.ok()) degraded++;
+                outfile.write_metadata(str(boost::format("{\"schedule\": \"slot\", \"segment\": %u, \"tx\": %u, \"rx\": %u, \"switch_time\": %f, \"window_start\": %f, "
+                                                         "\"tx_switched\": %s, \"rx_switched\": %f, \"status\": \"%s\"}")
+                    % (receiver.num_segments() - 1) % slot.tx % slot.rx % slot.switch_time % slot.start
+                    % (tx_switched.count(slot.tx) > 0 ? str(boost::format("%f") % tx_switched[slot.tx]) : "null") % rx_done % status));
+                if (status != "ok") std::cout << boost::format("  -- Pair %u %u: %s") % slot.tx % slot.rx % status << std::endl;
+                link->send(str(boost::format("captured %u %u %s") % slot.tx % slot.rx % status));
+            }
+        }
+        catch (...) {
+            rx_stream->issue_stream_cmd(uhd::stream_cmd_t(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS));
+            throw;
+        }
+        rx_stream->issue_stream_cmd(uhd::stream_cmd_t(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS));
+
+        link->send("end");
+        std::vector<std::string> bye = expect_message(*link, "bye", 2, REPLY_TIMEOUT);
+        outfile.close();
+        receiver.print_report();
+        outfile.print_compression_report();
+        std::cout << boost::format("Sweep report: %u pairs, %u late Tx switches, %u late Rx switches, %u degraded; Tx agent: %s switches (%s late)")
+            % schedule.size() % late_tx % late_rx % degraded % bye[1] % bye[2] << std::endl;
+    }
+    catch (const std::exception& e) {
+        try { link->send(std::string("abort ") + e.what()); } catch (...) {}
+        throw;
+    }
+}
+
+
+
+/***********************************************************************
+ * Main function
+ **********************************************************************/
+int UHD_SAFE_MAIN(int argc, char* argv[])
+{
+    // variables to be set by po
+    std::string role, peer, args, name_serial_port, ref, file, plan_file_tx, plan_file_rx;
+    aip_transport_config_t serial_config;
+    capture_config_t capture;
+    double rate, freq_bb, freq_lo, gain_bb, gain_lo, guard, lead, rotate_mb;
+    uint64_t nbr_samps_per_degree;
+    size_t recv_batch;
+    int port, ver_aip;
+    bool loop, standin, shared_session;
+
+    // variables with initializations
+    int gain_list[4] = {0,0,0,0};
+    std::string active_list[4] = {"1111", "1111", "1111", "1111"};
+    std::string subdev_tx = "A:0 B:0";
+    std::string subdev_rx_bb = "A:0";
+    std::string subdev_rx_lo = "B:0";
+    std::string ant = "TX/RX";
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+        ("help", "help message")
+        ("role", po::value<std::string>(&role)->default_value(""), "side of the sweep run by this agent: tx (USRP-Tx and Tx array) or rx (USRP-Rx and Rx array)")
+        ("port", po::value<int>(&port)->default_value(5750), "TCP port on which the Tx agent waits for the Rx agent")
+        ("peer", po::value<std::string>(&peer)->default_value(""), "host:port of the Tx agent (Rx agent)")
+        ("args", po::value<std::string>(&args)->default_value(""), "USRP of this agent (default: addr=192.168.192.50 for Tx, addr=192.168.192.40 for Rx)")
+        ("standin", po::bool_switch(&standin), "no USRP: stand-in streamers timed by the host clock (the array defaults to mock://)")
+        ("serialport", po::value<std::string>(&name_serial_port)->default_value("/dev/ttyUSB0"), "Serial port of the mmWave array of this agent (/dev/ttyUSBx, tcp://host:port or mock://)")
+        ("baud", po::value<int>(&serial_config.baud)->default_value(115200), "baud rate of the serial port of the array")
+        ("serial-timeout-ms", po::value<int>(&serial_config.timeout_ms)->default_value(20), "timeout in ms after which the response of an array is complete (no byte for that long; raise it for a slow tcp:// bridge)")
+        ("ref", po::value<std::string>(&ref)->default_value("external"), "clock and time reference (internal, external, gpsdo), shared by both hosts")
+        ("rate", po::value<double>(&rate)->default_value(1000000), "sample rate of the USRP of this agent (the schedule follows the Rx rate)")
+        ("freq-bb", po::value<double>(&freq_bb)->default_value(4000000000), "Center frequency of the baseband signal in Hz")
+        ("freq-lo", po::value<double>(&freq_lo)->default_value(6000000000), "Center frequency of the LO signal in Hz")
+        ("gain-bb", po::value<double>(&gain_bb)->default_value(30), "Gain of the baseband signal in dB")
+        ("gain-lo", po::value<double>(&gain_lo)->default_value(31.5), "Gain of the LO chain")
+        ("file", po::value<std::string>(&file)->default_value(""), "waveform file of the Tx BB chain, see generate_tx_signal (default: QPSK burst of srand(1))")
+        ("loop", po::value<bool>(&loop)->default_value(true), "play the waveform in a loop (false: once, then zeros)")
+        ("nsamps-per-degree", po::value<uint64_t>(&nbr_samps_per_degree)->default_value(500000), "Number of samples per Tx/Rx beam direction (for Rx plan steps without a dwell)")
+        ("plan-tx", po::value<std::string>(&plan_file_tx)->default_value(""), "sweep plan file (CSV) of the Tx array, the same on both agents (default: LEFT then RIGHT sweep)")
+        ("plan-rx", po::value<std::string>(&plan_file_rx)->default_value(""), "sweep plan file (CSV) of the Rx array, the same on both agents (default: LEFT then RIGHT sweep)")
+        ("guard", po::value<double>(&guard)->default_value(0.1), "seconds between the beam switches and the Rx window of each pair, to cover both switches (Rx agent)")
+        ("lead", po::value<double>(&lead)->default_value(2.0), "seconds between the start message and the first switch (Rx agent)")
+        ("ver-aip", po::value<int>(&ver_aip)->default_value(0), "verbose mmWave array on or off")
+        ("outdir", po::value<std::string>(&capture.out_dir)->default_value("."), "directory of the capture files (Rx agent)")
+        ("prefix", po::value<std::string>(&capture.prefix)->default_value("outfile"), "name prefix of the capture files (Rx agent)")
+        ("rotate-mb", po::value<double>(&rotate_mb)->default_value(0), "start a new capture file at the next Tx/Rx beam pair once this size (MB) is reached (0: single file)")
+        ("compress", po::value<std::string>(&capture.compression)->default_value("none"), "compress the capture files block by block (.dat.mwz): none, iq16, zstd or iq16+zstd")
+        ("recv-batch", po::value<size_t>(&recv_batch)->default_value(0), "samples per recv call, covering many packets (0: one packet per call)")
+        ("shared-session", po::value<bool>(&shared_session)->default_value(true), "open the USRP-Rx once for the BB-RX and LO-TX roles")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help") or (role != "tx" and role != "rx")) {
+        std::cout << boost::format("Agent of a sweep split between a Tx host and an Rx host, on a shared PPS time base. %s") % desc << std::endl;
+        std::cout << "    Tx host: mmwave_agent --role tx --port 5750 --plan-tx tx.csv --plan-rx rx.csv" << std::endl
+                  << "    Rx host: mmwave_agent --role rx --peer txhost:5750 --plan-tx tx.csv --plan-rx rx.csv --outdir /data/run12" << std::endl;
+        return ~0;
+    }
+    if (role == "rx" and peer.empty()) {
+        throw std::runtime_error("The Rx agent needs the address of the Tx agent (--peer host:port)");
+    }
+    bool is_tx = (role == "tx");
+    if (args.empty()) args = is_tx ? "addr=192.168.192.50" : "addr=192.168.192.40";
+    if (standin and vm["serialport"].defaulted()) name_serial_port = is_tx ? "mock://tx" : "mock://rx";
+    std::signal(SIGINT, &sig_int_handler);
+    std::signal(SIGTERM, &sig_int_handler);
+
+    // Both agents load the plans: the Rx agent sends their hashes, the Tx agent checks them
+    sweep_plan_t plan_tx = plan_file_tx.empty() ? default_sweep_plan(1, nbr_samps_per_degree) : load_sweep_plan(plan_file_tx, 1, nbr_samps_per_degree);
+    sweep_plan_t plan_rx = plan_file_rx.empty() ? default_sweep_plan(2, nbr_samps_per_degree) : load_sweep_plan(plan_file_rx, 2, nbr_samps_per_degree);
+    capture.rotate_bytes = (uint64_t)(rotate_mb * 1e6);
+    align_capture_blocks(capture, recv_batch);
+
+    arena_config_t arena_config;
+    buffer_arena arena(ARENA_HEADROOM, arena_config);
+    agent_side_t side;
+    int mode = is_tx ? 1 : 2;
+
+    // The array of this agent, with its serial I/O thread
+    aip_controller arrays(ver_aip);
+    side.arrays = &arrays;
+    std::cout << boost::format("Opening the mmWave %s array on %s...") % (is_tx ? "Tx" : "Rx") % name_serial_port << std::endl;
+    side.array = arrays.add_array(name_serial_port, serial_config);
+
+
+    // ==============================================================
+    // Bring up the array and the USRP of this side
+    // ==============================================================
+    uhd::usrp::multi_usrp::sptr usrp_tx, usrp_rx_bb, usrp_rx_lo;
+    device_sessions sessions(shared_session);
+    bringup bring;
+    bring.add("AiP init", [&](){
+        arrays.configure_verified(side.array, make_aip_beam("DEG_0", "LEFT", gain_list, 0, active_list, mode)).get();
+    });
+    if (not standin and is_tx) {
+        bring.add("USRP-Tx", [&](){
+            bring.log(str(boost::format("Creating the USRP-Tx device with: %s...") % args));
+            usrp_tx = sessions.open("Tx", args, "tx");
+            usrp_tx->set_tx_subdev_spec(subdev_tx);
+            usrp_tx->set_clock_source(ref);
+            usrp_tx->set_time_source(ref);
+            usrp_tx->set_tx_rate(rate);
+            usrp_tx->set_tx_freq(uhd::tune_request_t(freq_bb), 0);
+            usrp_tx->set_tx_freq(uhd::tune_request_t(freq_lo), 1);
+            usrp_tx->set_tx_gain(gain_bb, 0);
+            usrp_tx->set_tx_gain(gain_lo, 1);
+            usrp_tx->set_tx_antenna(ant, 0);
+            usrp_tx->set_tx_antenna(ant, 1);
+            wait_for_lo_locked(usrp_tx, "tx", {0, 1});
+            check_locked(usrp_tx, "tx", {0}, ref == "external", "TX");
+        });
+    }
+    if (not standin and not is_tx) {
+        bring.add("USRP-Rx", [&](){
+            bring.log(str(boost::format("Creating the USRP-Rx-BB and USRP-Rx-LO devices with: %s...") % args));
+            usrp_rx_bb = sessions.open("Rx-BB", args, "rx");
+            usrp_rx_lo = sessions.open("Rx-LO", args, "tx");
+            usrp_rx_bb->set_rx_subdev_spec(subdev_rx_bb);
+            usrp_rx_bb->set_clock_source(ref);
+            usrp_rx_bb->set_time_source(ref);
+            usrp_rx_bb->set_rx_rate(rate);
+            usrp_rx_bb->set_rx_freq(uhd::tune_request_t(freq_bb), 0);
+            usrp_rx_bb->set_rx_gain(gain_bb, 0);
+            usrp_rx_bb->set_rx_antenna(ant, 0);
+            usrp_rx_lo->set_tx_subdev_spec(subdev_rx_lo);
+            usrp_rx_lo->set_tx_rate(rate);
+            usrp_rx_lo->set_tx_freq(uhd::tune_request_t(freq_lo), 0);
+            usrp_rx_lo->set_tx_gain(gain_lo, 0);
+            usrp_rx_lo->set_tx_antenna(ant, 0);
+            wait_for_lo_locked(usrp_rx_bb, "rx", {0});
+            wait_for_lo_locked(usrp_rx_lo, "tx", {0});
+            check_locked(usrp_rx_bb, "rx", {0}, ref == "external", "RX");
+            check_locked(usrp_rx_lo, "tx", {0}, ref == "external", "TX");
+        });
+    }
+    try {
+        bring.run();
+    }
+    catch (...) {
+        bring.print_report();
+        throw;
+    }
+    bring.print_report();
+
+
+    // ==================================================================
+    // Streamers, device time and its alignment on the time base
+    // ==================================================================
+    uhd::tx_streamer::sptr stream_tx;
+    uhd::rx_streamer::sptr rx_stream;
+    if (standin) {
+        // the stand-ins of both agents take their time from the host clock, like USRPs on the same PPS
+        if (is_tx) {
+            standin_tx_streamer* tx = new standin_tx_streamer(2, rate);
+            stream_tx.reset(tx);
+            side.device_time = [tx](){ return tx->time_now(); };
+            side.align_time  = [tx](double time_base){ tx->set_time_now(host_time() - time_base); };
+        }
+        else {
+            standin_rx_streamer* rx = new standin_rx_streamer(1, rate);
+            standin_tx_streamer* lo = new standin_tx_streamer(1, rate);
+            rx_stream.reset(rx);
+            stream_tx.reset(lo);
+            side.device_time = [rx](){ return rx->time_now(); };
+            side.align_time  = [rx, lo](double time_base){
+                double now = host_time() - time_base;
+                rx->set_time_now(now);
+                lo->set_time_now(now);
+            };
+        }
+    }
+    else {
+        uhd::usrp::multi_usrp::sptr usrp = is_tx ? usrp_tx : usrp_rx_bb;
+        uhd::stream_args_t stream_args("fc32", "sc16");
+        stream_args.channels = is_tx ? std::vector<size_t>{0, 1} : std::vector<size_t>{0};
+        if (is_tx) stream_tx = usrp_tx->get_tx_stream(stream_args);
+        else {
+            stream_tx = usrp_rx_lo->get_tx_stream(stream_args);
+            rx_stream = usrp_rx_bb->get_rx_stream(stream_args);
+        }
+        side.device_time = [usrp](){ return usrp->get_time_now().get_real_secs(); };
+        side.align_time  = [usrp](double time_base){
+            if (not sync_host_time_on_pps({usrp}, time_base)) {
+                // without a PPS the host clocks are the only common time, to a few ms with NTP
+                std::cerr << "Warning: no PPS edge, device time set from the host clock" << std::endl;
+                usrp->set_time_now(uhd::time_spec_t(host_time() - time_base));
+            }
+        };
+    }
+
+    // The Tx streamer of the agent (BB and LO on the Tx side, LO on the Rx side) starts once the time is aligned
+    waveform_source::sptr data_bb = file.empty() ? waveform_source::from_samples(legacy_qpsk_burst(1), "legacy-qpsk seed=1 symbols=1000 length=10000")
+                                                 : waveform_source::map_file(file);
+    waveform_source::sptr data_lo = waveform_source::from_samples(constant_waveform(10000), "constant length=10000 amplitude=1");
+    std::thread worker;
+    side.start_workers = [&](double start_time){
+        worker = is_tx ? std::thread(&tx_worker, data_bb, data_lo, stream_tx, &arena, start_time, loop)
+                       : std::thread(&rx_lo_worker, data_lo, stream_tx, &arena, start_time);
+    };
+    tx_async_monitor tx_monitor(is_tx ? "tx" : "rx_lo", stream_tx);
+
+
+    // ======================================
+    // Run the side of the sweep
+    // ======================================
+    std::string error;
+    try {
+        if (is_tx) run_tx_agent(side, port, plan_tx, plan_rx);
+        else run_rx_agent(side, peer, plan_tx, plan_rx, rx_stream, rate, capture, recv_batch, guard, lead, &tx_monitor);
+    }
+    catch (const std::exception& e) {
+        error = e.what();
+    }
+
+
+    // ======================
+    // Closing up everything
+    // ======================
+    stop_signal_called = true;
+    if (worker.joinable()) worker.join();
+    tx_monitor.print_report();
+    arrays.disable(side.array).get();
+    arrays.close();
+    if (not error.empty()) {
+        throw std::runtime_error(error);
+    }
+
+    std::cout << std::endl << "Done!" << std::endl << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -24,8 +24,6 @@
 
 #include "constants.h"
 #include "aip_functions.h"
-#include "/usr/local/include/libserial/SerialPort.h"
-using namespace LibSerial ;
 
 namespace po = boost::program_options;
 
@@ -42,6 +40,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // variables to be set by po
     std::string 	name_serial_port;
     int 			ver_aip;
+    aip_transport_config_t serial_config;
 
     int 		nbr_directions = 3;
     
@@ -62,8 +61,10 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // clang-format off
     desc.add_options()
 		("help", "help message")
-		("serialport", po::value<std::string>(&name_serial_port)->default_value("/dev/ttyUSB0"), "Serial port of the mmWave array")
+		("serialport", po::value<std::string>(&name_serial_port)->default_value("/dev/ttyUSB0"), "Serial port of the mmWave array (/dev/ttyUSBx, tcp://host:port of a serial bridge or mock://)")
 		("ver-aip", po::value<int>(&ver_aip)->default_value(0), "verbose mmWave arrays on or off")
+		("baud", po::value<int>(&serial_config.baud)->default_value(115200), "baud rate of the serial port (8N1)")
+		("serial-timeout-ms", po::value<int>(&serial_config.timeout_ms)->default_value(20), "timeout in ms after which the response of an array is complete (no byte for that long; raise it for a slow tcp:// bridge)")
         
     ;
     // clang-format on
@@ -84,23 +85,16 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // ======================================
     // Create and open the serial port for communication with the mmWave array.
     std::cout << boost::format("Create and open the serial port for mmWave array on %s...") % name_serial_port << std::endl;
-    SerialPort my_serial_port( name_serial_port );
-    std::string my_string;  
-    // Set serial port parameters 
-    std::cout << boost::format("Set serial port parameters ...") << std::endl;
-    my_serial_port.SetBaudRate( LibSerial::BaudRate::BAUD_115200 );
-    my_serial_port.SetCharacterSize( LibSerial::CharacterSize::CHAR_SIZE_8 );
-    my_serial_port.SetStopBits( LibSerial::StopBits::STOP_BITS_1 ) ;
-    my_serial_port.SetParity( LibSerial::Parity::PARITY_NONE );
+    std::unique_ptr<aip_transport> my_serial_port = aip_transport::open(name_serial_port, serial_config);
     
 
 	int mode_init = 2;
 	std::cout << boost::format("Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
-    send_to_aip(&my_serial_port, "DEG_0", "UP", gain_list, gain, active_list, mode_init, ver_aip);
+    send_to_aip(my_serial_port.get(), "DEG_0", "UP", gain_list, gain, active_list, mode_init, ver_aip);
     std::cout << boost::format("Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
-    send_to_aip(&my_serial_port, "DEG_0", "UP", gain_list, gain, active_list, mode_init, ver_aip);
+    send_to_aip(my_serial_port.get(), "DEG_0", "UP", gain_list, gain, active_list, mode_init, ver_aip);
     std::cout << boost::format("Setting AiP to %s - %s °") % "LEFT" % "0"  << std::endl;
-    send_to_aip(&my_serial_port, "DEG_0", "LEFT", gain_list, gain, active_list, mode_init, ver_aip);
+    send_to_aip(my_serial_port.get(), "DEG_0", "LEFT", gain_list, gain, active_list, mode_init, ver_aip);
 	
     
   
@@ -109,7 +103,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 	// ==============================================================
 	
 	
-	init_aip(&my_serial_port, ver_aip);
+	init_aip(my_serial_port.get(), ver_aip);
 	
 	std::string degrees;
 	std::string angle; 
@@ -123,7 +117,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     	degrees = possible_degrees[cpt_directions];
     	angle = possible_angles[cpt_directions];	
     	std::cout << boost::format("Setting AiP to %s - %s °") % direction % angle  << std::endl;
-    	send_to_aip_fast(&my_serial_port, degrees, direction, gain_list, gain, active_list, mode, ver_aip);
+    	send_to_aip_fast(my_serial_port.get(), degrees, direction, gain_list, gain, active_list, mode, ver_aip);
     	
 		usleep(100000);
 	}
@@ -131,11 +125,11 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 	
     
     // Disable AiP
-    disable_aip(&my_serial_port, ver_aip);
+    disable_aip(my_serial_port.get(), ver_aip);
     
     // Close serial port
     std::cout << std::endl << "Close serial port ..." << std::endl << std::endl;
-    my_serial_port.Close();
+    my_serial_port->close();
     
 
     // finished
@@ -0,0 +1,476 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include <uhd/utils/safe_main.hpp>
+#include <stdint.h>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "aip_functions.h"
+#include "aip_controller.h"
+#include "aip_standin.h"
+#include "aip_transport.h"
+#include "stream_functions.h"
+#include "capture_writer.h"
+#include "capture_codec.h"
+#include "buffer_arena.h"
+#include "transport_tuning.h"
+#include "stream_standin.h"
+#include "waveform.h"
+#include "waveform_source.h"
+#include "sweep_plan.h"
+#include "settling.h"
+namespace po = boost::program_options;
+
+
+
+/***********************************************************************
+ * Benchmark results
+ **********************************************************************/
+struct bench_result_t
+{
+	std::string name;
+	uint64_t 	iterations;
+	double 		total_s;
+	double 		items;      // items processed over all iterations (samples, bytes, commands)
+	std::string item_unit;
+	double 		dtlb_misses = -1; // data TLB misses over all iterations (-1: counter not available)
+};
+
+// Data TLB miss counter of the calling thread (perf_event_open, may be denied by perf_event_paranoid)
+class dtlb_counter
+{
+public:
+	dtlb_counter()
+	{
+		struct perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size 			= sizeof(attr);
+		attr.type 			= PERF_TYPE_HW_CACHE;
+		attr.config 		= PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled 		= 1;
+		attr.exclude_kernel = 1;
+		_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	~dtlb_counter() { if (_fd >= 0) close(_fd); }
+	void start() { if (_fd >= 0){ ioctl(_fd, PERF_EVENT_IOC_RESET, 0); ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0); } }
+	double stop()
+	{
+		if (_fd < 0) return -1;
+		ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+		uint64_t count;
+		return (read(_fd, &count, sizeof(count)) == sizeof(count)) ? (double)count : -1;
+	}
+private:
+	int _fd;
+};
+
+// Time a function over a number of iterations
+bench_result_t run_bench(const std::string& name, uint64_t iterations, double items_per_iteration, const std::string& item_unit, std::function<void()> body)
+{
+	body(); // warm-up
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < iterations; i++){
+		body();
+	}
+	bench_result_t result;
+	result.name 		= name;
+	result.iterations 	= iterations;
+	result.total_s 		= std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.items 		= items_per_iteration * iterations;
+	result.item_unit 	= item_unit;
+	return result;
+}
+
+// Print results as CSV or as one JSON object per line
+void print_results(std::ostream& out, const std::vector<bench_result_t>& results, const std::string& format)
+{
+	if (format == "csv"){
+		out << "benchmark,iterations,total_s,ns_per_iteration,rate,rate_unit,dtlb_misses" << std::endl;
+	}
+	for (size_t i = 0; i < results.size(); i++){
+		const bench_result_t& r = results[i];
+		double ns_per_iteration = 1e9 * r.total_s / r.iterations;
+		double rate = r.items / r.total_s;
+		if (format == "csv"){
+			out << boost::format("%s,%u,%.6f,%.1f,%.6e,%s/s,%.0f") % r.name % r.iterations % r.total_s % ns_per_iteration % rate % r.item_unit % r.dtlb_misses << std::endl;
+		}
+		else{
+			out << boost::format("{\"benchmark\": \"%s\", \"iterations\": %u, \"total_s\": %.6f, \"ns_per_iteration\": %.1f, \"rate\": %.6e, \"rate_unit\": \"%s/s\", \"dtlb_misses\": %.0f}")
+				% r.name % r.iterations % r.total_s % ns_per_iteration % rate % r.item_unit % r.dtlb_misses << std::endl;
+		}
+	}
+}
+
+
+
+/***********************************************************************
+ * Main function
+ **********************************************************************/
+int UHD_SAFE_MAIN(int argc, char* argv[])
+{
+    // variables to be set by po
+    std::string 	format, output, scratch_dir;
+    uint64_t 		iterations, serial_iterations;
+    size_t 			spb;
+    double 			reply_delay;
+    size_t 			ring_mb;
+    int 			numa_node;
+    double 			self_test_rate, self_test_secs;
+    size_t 			waveform_samps;
+    settling_config_t settling;
+    double 			settling_rate, settling_delay, settling_jitter, settling_ramp, settling_step_db;
+
+    int 			gain 				= 0;
+    int 			gain_list[4] 		= {0,0,0,0};
+    std::string 	active_list[4] 		= {"1111", "1111", "1111", "1111"};
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+		("help", "help message")
+		("iterations", po::value<uint64_t>(&iterations)->default_value(100000), "iterations of the CPU-bound benchmarks")
+		("serial-iterations", po::value<uint64_t>(&serial_iterations)->default_value(200), "iterations of the serial round trip benchmark")
+		("spb", po::value<size_t>(&spb)->default_value(2000), "samples per buffer for the Tx fill and Rx write benchmarks")
+		("reply-delay", po::value<double>(&reply_delay)->default_value(0.0), "reply delay of the AiP stand-in in seconds")
+		("format", po::value<std::string>(&format)->default_value("csv"), "output format (csv or json)")
+		("output", po::value<std::string>(&output)->default_value(""), "file to write the results to (default: standard output)")
+		("ring-mb", po::value<size_t>(&ring_mb)->default_value(512), "size of the capture ring of the arena benchmarks in MB")
+		("numa-node", po::value<int>(&numa_node)->default_value(-1), "NUMA node of the arena benchmarks (set a remote node to measure cross-node traffic)")
+		("scratch-dir", po::value<std::string>(&scratch_dir)->default_value("/tmp"), "directory of the file written by the Rx write benchmark")
+		("self-test-rate", po::value<double>(&self_test_rate)->default_value(200e6), "rate of the streaming self-test against the stand-in streamers")
+		("self-test-secs", po::value<double>(&self_test_secs)->default_value(1.0), "samples of the streaming self-test, in seconds at the self-test rate")
+		("waveform-samps", po::value<size_t>(&waveform_samps)->default_value(1 << 22), "length of the waveforms of the generator benchmarks")
+		("settling-switches", po::value<size_t>(&settling.switches)->default_value(50), "beam switches of the settling benchmark against the stand-ins")
+		("settling-rate", po::value<double>(&settling_rate)->default_value(10e6), "Rx rate of the settling benchmark")
+		("settling-delay", po::value<double>(&settling_delay)->default_value(0.0005), "modelled delay in seconds from AT+SEND? to the gain step of the stand-in array")
+		("settling-jitter", po::value<double>(&settling_jitter)->default_value(0.0003), "modelled random extra delay of the gain step, up to this many seconds")
+		("settling-ramp", po::value<double>(&settling_ramp)->default_value(0.0001), "modelled duration of the gain step in seconds")
+		("settling-step", po::value<double>(&settling_step_db)->default_value(20), "modelled gain difference between the two beams in dB")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help")) {
+        std::cout << boost::format("Benchmarks of the mmWave AiP library and streaming paths %s") % desc << std::endl;
+        return ~0;
+    }
+    if (format != "csv" and format != "json"){
+    	throw std::runtime_error(str(boost::format("Unknown output format %s") % format));
+    }
+
+    std::vector<bench_result_t> results;
+    bool bench_failed = false;
+
+    // Register encoding: all 68 beams of the LEFT/RIGHT/UP/DOWN sweeps
+    results.push_back(run_bench("register_encoding", iterations / 68 + 1, 68, "beams", [&](){
+    	for (int d = 0; d < 4; d++){
+    		for (int k = 0; k < 17; k++){
+    			std::string* register_list = create_register_list(AIP_DEGREES[k], AIP_DIRECTIONS[d], gain_list, gain, active_list, 2);
+    			delete[] register_list;
+			}
+		}
+	}));
+
+	// Frame building: the four AT+REG commands of one beam switch
+	std::string* register_list = create_register_list("DEG_45", "LEFT", gain_list, gain, active_list, 2);
+	size_t frame_bytes = 0;
+	results.push_back(run_bench("frame_building", iterations, 4, "frames", [&](){
+		for (int i = 0; i < 4; i++){
+			frame_bytes += make_reg_command(register_list[i]).size();
+		}
+	}));
+	delete[] register_list;
+
+	// Command round trip and beam switch (send_frames_fast) over each transport: the pseudo-terminal and
+	// TCP bridge stand-ins and the in-process mock, one command per round trip or batched
+	{
+		std::vector<std::string> frames(4);
+		register_list = create_register_list("DEG_45", "LEFT", gain_list, gain, active_list, 2);
+		for (int i = 0; i < 4; i++){
+			frames[i] = make_reg_command(register_list[i]);
+		}
+		delete[] register_list;
+		std::string command = make_reg_command(REG1);
+		const char* kinds[3] = {"serial", "tcp", "mock"};
+		for (int kind = 0; kind < 3; kind++){
+			std::unique_ptr<aip_standin> standin;
+			std::string address = "mock://bench";
+			if (kind < 2){
+				standin.reset(new aip_standin(reply_delay, kind == 1));
+				address = standin->port_name();
+			}
+			uint64_t round_trips = (kind < 2) ? serial_iterations : iterations;
+			for (int batch = 0; batch < 2; batch++){
+				aip_transport_config_t config;
+				config.batch_writes = (batch == 1);
+				std::unique_ptr<aip_transport> port = aip_transport::open(address, config);
+				if (batch == 0){
+					results.push_back(run_bench(str(boost::format("%s_round_trip") % kinds[kind]), round_trips, 1, "commands", [&](){
+						write_read_serial(port.get(), command, 0);
+					}));
+				}
+				results.push_back(run_bench(str(boost::format("%s_beam_switch%s") % kinds[kind] % (batch ? "_batched" : "")), round_trips / 6 + 1, 1, "switches", [&](){
+					send_frames_fast(port.get(), frames, 2, 0);
+				}));
+				port->close();
+			}
+		}
+	}
+
+	// Tx buffer fill from the 10000-sample burst used by the Tx tools
+	std::vector<std::complex<float>> data_bb(10000);
+	for (size_t i = 0; i < 1000; i++){
+		data_bb[i] = std::complex<float>(2*(i % 2) - 1.0f, 2*((i / 2) % 2) - 1.0f);
+	}
+	std::vector<std::complex<float>> buff(spb);
+	size_t index_bb = 0;
+	results.push_back(run_bench("tx_buffer_fill", iterations, spb, "samples", [&](){
+		fill_tx_buffer(&buff.front(), spb, data_bb, index_bb);
+	}));
+
+	// Rx write path: one recv buffer per call into the capture writer (includes the final flush)
+	{
+		capture_config_t capture;
+		capture.out_dir = scratch_dir;
+		capture.prefix 	= "mmwave_bench";
+		capture_writer outfile(capture);
+		bench_result_t result = run_bench("rx_write", iterations / 100 + 1, spb, "samples", [&](){
+			outfile.write_samples(&buff.front(), spb);
+		});
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		outfile.close();
+		result.total_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		results.push_back(result);
+		std::remove(outfile.current_file().c_str());
+		std::remove(str(boost::format("%s/mmwave_bench.meta.jsonl") % scratch_dir).c_str());
+	}
+
+	// Rx write path with block compression, on sc16 samples as UHD hands them over:
+	// a burst over the first 10% of the buffers, low-level noise elsewhere (2 MB of samples,
+	// more than a block, so that zstd does not find the same samples again)
+	{
+		std::vector<std::complex<float>> rx_buff(std::max<size_t>(10*spb, 1 << 18) / spb * spb);
+		std::mt19937 rng(1);
+		std::normal_distribution<float> noise(0, 8);
+		for (size_t i = 0; i < rx_buff.size(); i++){
+			float re = std::round(noise(rng)), im = std::round(noise(rng));
+			if (i < rx_buff.size() / 10){
+				re += std::round(8000*std::cos(0.01*i));
+				im += std::round(8000*std::sin(0.01*i));
+			}
+			rx_buff[i] = std::complex<float>(re, im) * (1.0f/32767.0f);	// scale of the sc16 -> fc32 converter of UHD
+		}
+		const std::string codecs[] = {"iq16", "zstd", "iq16+zstd"};
+		for (size_t c = 0; c < 3; c++){
+			capture_config_t capture;
+			capture.out_dir 	= scratch_dir;
+			capture.prefix 		= "mmwave_bench";
+			capture.compression = codecs[c];
+			std::unique_ptr<capture_writer> outfile;
+			try {
+				outfile.reset(new capture_writer(capture));
+			}
+			catch (const std::exception& e){
+				std::cerr << boost::format("rx_write_%s: skipped (%s)") % codecs[c] % e.what() << std::endl;
+				continue;
+			}
+
+			// the codecs must be lossless: one block through the compressor and back, bit for bit
+			block_compressor compressor(capture_codec(codecs[c]));
+			std::vector<char> frame;
+			size_t frame_bytes = compressor.compress((const char*)&rx_buff.front(), rx_buff.size()*sizeof(std::complex<float>), frame);
+			capture_frame_t header;
+			header.parse(&frame.front());
+			std::vector<std::complex<float>> decoded(rx_buff.size());
+			decompress_frame(header, &frame[CAPTURE_FRAME_HEADER], (char*)&decoded.front());
+			if (std::memcmp(&decoded.front(), &rx_buff.front(), rx_buff.size()*sizeof(std::complex<float>)) != 0){
+				throw std::runtime_error(str(boost::format("rx_write_%s: decoded samples differ from the input") % codecs[c]));
+			}
+			std::cerr << boost::format("rx_write_%s: decode check ok (%s frame, %.2fx)")
+				% codecs[c] % capture_codec_name(header.codec) % ((double)rx_buff.size()*sizeof(std::complex<float>) / frame_bytes) << std::endl;
+
+			size_t rx_index = 0;
+			bench_result_t result = run_bench("rx_write_" + codecs[c], iterations / 100 + 1, spb, "samples", [&](){
+				outfile->write_samples(&rx_buff[rx_index], spb);
+				rx_index = (rx_index + spb) % rx_buff.size();
+			});
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			outfile->close();
+			result.total_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			results.push_back(result);
+			std::cerr << "rx_write_" << codecs[c] << ": ";
+			outfile->print_compression_report(std::cerr);
+			std::remove(outfile->current_file().c_str());
+			std::remove(str(boost::format("%s/mmwave_bench.meta.jsonl") % scratch_dir).c_str());
+		}
+	}
+
+	// Capture ring on hugepages and on regular pages: one recv buffer per iteration copied into a ring
+	// much larger than the TLB reach, as the capture path does at high rates
+	for (int huge = 1; huge >= 0; huge--){
+		arena_config_t arena_config;
+		arena_config.hugepages = (huge == 1);
+		arena_config.numa_node = numa_node;
+		buffer_arena arena(ring_mb*1024*1024, arena_config);
+		size_t ring_samps = ring_mb*1024*1024 / sizeof(std::complex<float>);
+		std::complex<float>* ring = arena.allocate<std::complex<float>>(ring_samps - spb, 4096);
+		size_t ring_index = 0;
+		uint64_t ring_iterations = 4*ring_samps/spb;
+		dtlb_counter counter;
+		counter.start();
+		bench_result_t result = run_bench(huge ? "ring_write_hugepages" : "ring_write_regular_pages", ring_iterations, spb, "samples", [&](){
+			std::memcpy(ring + ring_index, &buff.front(), spb*sizeof(std::complex<float>));
+			ring_index += spb;
+			if (ring_index + spb > ring_samps - spb) ring_index = 0;
+		});
+		result.dtlb_misses = counter.stop();
+		std::cerr << boost::format("%s: %s") % result.name % arena.describe() << std::endl;
+		results.push_back(result);
+	}
+
+	// Streaming self-test against unpaced stand-in streamers: the host side alone (convert, recv/send loop),
+	// to compare with the rate asked of the USRP
+	{
+		transport_params_t transport = transport_params_for_rate(self_test_rate);
+		uhd::rx_streamer::sptr rx_stream(new standin_rx_streamer(1, self_test_rate, transport.spp, false));
+		uhd::tx_streamer::sptr tx_stream(new standin_tx_streamer(1, self_test_rate, transport.spp, false));
+		self_test_result_t tests[2] = {rx_self_test(rx_stream, self_test_rate, self_test_secs),
+									   tx_self_test(tx_stream, self_test_rate, self_test_secs)};
+		for (size_t i = 0; i < 2; i++){
+			bench_result_t result;
+			result.name 		= tests[i].name + "_self_test_standin";
+			result.iterations 	= 1;
+			result.total_s 		= tests[i].seconds;
+			result.items 		= tests[i].samps;
+			result.item_unit 	= "samples";
+			results.push_back(result);
+			std::cerr << boost::format("%s: %.1f Msps host-side, %u drops") % result.name % tests[i].msps() % tests[i].drops() << std::endl;
+		}
+	}
+
+	// Beam switch settling against the stand-ins: the stand-in array steps the gain of the stand-in Rx
+	// at the AT+SEND? of a beam, after the modelled delay, and the analysis has to find these steps back
+	{
+		std::string path = str(boost::format("%s/mmwave_bench.plan") % scratch_dir);
+		{
+			std::ofstream plan_file(path.c_str());
+			plan_file << "LEFT,DEG_0,,,1111 1111 1111 1111," << std::endl;
+			plan_file << "LEFT,DEG_0,,,0000 0000 0000 0000," << std::endl;
+		}
+		sweep_plan_t plan = load_sweep_plan(path, 2, 1);
+		std::remove(path.c_str());
+
+		standin_rx_streamer* rx = new standin_rx_streamer(1, settling_rate);
+		uhd::rx_streamer::sptr rx_stream(rx);
+		aip_standin standin(reply_delay);
+		std::mt19937 rng(1);
+		std::uniform_real_distribution<double> jitter(0, settling_jitter);
+		double gains_db[2] = {0, -settling_step_db};
+		int beam = -1; // beam of the register frames since the last AT+SEND?
+		standin.set_command_hook([&](const std::string& command){
+			for (int b = 0; b < 2; b++){
+				for (size_t i = 0; i < 4; i++){
+					const std::string& frame = plan.steps[b].frames[i];
+					if (frame != plan.steps[1 - b].frames[i] and command + "\r" == frame) beam = b;
+				}
+			}
+			if (command == "AT+SEND?" and beam >= 0){
+				rx->schedule_gain(rx->time_now() + settling_delay + jitter(rng), gains_db[beam], settling_ramp);
+				beam = -1;
+			}
+		});
+
+		aip_controller arrays(0);
+		size_t array = arrays.add_array(standin.port_name());
+		uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+		stream_cmd.stream_now = true;
+		rx->issue_stream_cmd(stream_cmd);
+		settling_result_t settled = run_settling_test(rx_stream, settling_rate, arrays, array, plan.steps[0], plan.steps[1], plan.mode,
+													  [rx](){ return rx->time_now(); }, settling);
+		stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
+		rx->issue_stream_cmd(stream_cmd);
+		arrays.close();
+
+		bench_result_t result;
+		result.name 		= "beam_settling_standin";
+		result.iterations 	= 0;
+		result.total_s 		= 0;
+		for (size_t k = 0; k < settled.events.size(); k++){
+			if (not settled.events[k].detected()) continue;
+			result.iterations++;
+			result.total_s += settled.events[k].total();
+		}
+		result.items 		= result.iterations;
+		result.item_unit 	= "switches";
+		if (result.iterations > 0){
+			results.push_back(result);
+		}
+		else{
+			// No mean switch time without events: leave the row out and fail the run after the other results
+			std::cerr << boost::format("%s: no events (none of the %u switches detected)") % result.name % settled.events.size() << std::endl;
+			bench_failed = true;
+		}
+		std::cerr << boost::format("%s: modelled RF settling %.3f to %.3f ms after AT+SEND?, %.3f ms ramp")
+			% result.name % (1e3 * settling_delay) % (1e3 * (settling_delay + settling_jitter)) % (1e3 * settling_ramp) << std::endl;
+		print_settling_report(settled, std::cerr);
+	}
+
+	// Waveform generators on all cores, for a long sequence
+	results.push_back(run_bench("waveform_qpsk", 3, waveform_samps, "samples", [&](){
+		psk_burst(2, 1, waveform_samps, 1, waveform_samps);
+	}));
+	results.push_back(run_bench("waveform_zadoff_chu", 3, waveform_samps, "samples", [&](){
+		zadoff_chu(1, waveform_samps);
+	}));
+	results.push_back(run_bench("waveform_chirp", 3, waveform_samps, "samples", [&](){
+		linear_chirp(-10e6, 10e6, 100e6, waveform_samps);
+	}));
+
+	// Tx buffer fill from a mapped waveform file, played from the page cache with read-ahead
+	{
+		std::string path = str(boost::format("%s/mmwave_bench.wfm") % scratch_dir);
+		write_waveform(path, psk_burst(2, 1, waveform_samps, 1, waveform_samps), 0, "mmwave_bench");
+		waveform_player player(waveform_source::map_file(path));
+		results.push_back(run_bench("tx_fill_mapped", 4*waveform_samps/spb, spb, "samples", [&](){
+			player.fill(&buff.front(), spb);
+		}));
+		std::remove(path.c_str());
+	}
+
+	// Output results
+	if (output.empty()){
+		print_results(std::cout, results, format);
+	}
+	else{
+		std::ofstream outfile(output.c_str());
+		print_results(outfile, results, format);
+	}
+
+    return bench_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
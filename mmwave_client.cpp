@@ -0,0 +1,74 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "job_socket.h"
+namespace po = boost::program_options;
+
+
+
+int main(int argc, char* argv[])
+{
+    // variables to be set by po
+    std::string socket_path;
+    std::vector<std::string> request_words;
+    bool quiet;
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+        ("help", "help message")
+        ("socket", po::value<std::string>(&socket_path)->default_value("/tmp/mmwave_daemon.sock"), "Unix socket of mmwave_daemon")
+        ("quiet", po::bool_switch(&quiet), "print the last reply line only")
+        ("request", po::value<std::vector<std::string>>(&request_words), "command (sweep, status or shutdown) and its key=value arguments")
+    ;
+    // clang-format on
+    po::positional_options_description positional;
+    positional.add("request", -1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help") or request_words.empty()) {
+        std::cout << boost::format("Client of mmwave_daemon %s") % desc << std::endl;
+        std::cout << "    mmwave_client status" << std::endl
+                  << "    mmwave_client sweep plan-tx=tx.csv plan-rx=rx.csv nsamps=200000 outdir=/data/run12 prefix=p3" << std::endl
+                  << "    mmwave_client sweep outdir=/data/run12 prefix=p3 resume=true" << std::endl
+                  << "    mmwave_client shutdown" << std::endl
+                  << "sweep arguments: plan-tx, plan-rx (default: LEFT then RIGHT sweeps), nsamps, outdir, prefix, rotate-mb, rotate-segments," << std::endl
+                  << "                 notify-socket, compress, compress-threads, compress-level, recapture-bad, resume" << std::endl;
+        return ~0;
+    }
+
+    std::string request;
+    for (size_t i = 0; i < request_words.size(); i++) {
+        request += (i > 0 ? " " : "") + request_words[i];
+    }
+
+    // the daemon streams progress lines, the last one is "ok ..." or "error ..."
+    std::string last;
+    bool ok;
+    try {
+        ok = run_job(socket_path, request, [&](const std::string& line){
+            if (not quiet) std::cout << line << std::endl;
+            last = line;
+        });
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return ~0;
+    }
+    if (quiet) std::cout << last << std::endl;
+    if (last.empty()) std::cerr << "Error: no reply from the daemon" << std::endl;
+    return ok ? EXIT_SUCCESS : ~0;
+}
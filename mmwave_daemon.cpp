@@ -0,0 +1,521 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include <uhd/exception.hpp>
+#include <uhd/usrp/multi_usrp.hpp>
+#include <uhd/utils/safe_main.hpp>
+#include <uhd/utils/thread.hpp>
+#include <stdint.h>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aip_functions.h"
+#include "capture_writer.h"
+#include "rx_capture.h"
+#include "tx_monitor.h"
+#include "thread_config.h"
+#include "buffer_arena.h"
+#include "waveform.h"
+#include "waveform_source.h"
+#include "aip_controller.h"
+#include "sweep_plan.h"
+#include "sweep_engine.h"
+#include "sweep_journal.h"
+#include "fast_start.h"
+#include "bringup.h"
+#include "device_session.h"
+#include "stream_standin.h"
+#include "job_socket.h"
+namespace po = boost::program_options;
+
+
+std::atomic<bool> stop_signal_called(false);
+void sig_int_handler(int) { stop_signal_called = true; }
+
+// room for the buffers of the Tx workers
+const size_t ARENA_HEADROOM = 4*1024*1024;
+
+// device time between a job request and the first sample of its Rx stream
+const double STREAM_LEAD = 0.2;
+
+
+/***********************************************************************
+ * tx_worker function
+ * Sends the BB waveform and the LO of the USRP-Tx from the start of the
+ * daemon until it stops
+ **********************************************************************/
+void tx_worker(waveform_source::sptr data_bb,
+    waveform_source::sptr data_lo,
+    uhd::tx_streamer::sptr stream_tx, buffer_arena* arena, double start_time, bool loop)
+{
+    size_t spb = stream_tx->get_max_num_samps();
+    std::complex<float>* buff_bb = arena->allocate<std::complex<float>>(spb);
+    std::complex<float>* buff_lo = arena->allocate<std::complex<float>>(spb);
+    std::vector<std::complex<float>*> buffs(2);
+    buffs[0] = buff_bb;
+    buffs[1] = buff_lo;
+
+    uhd::tx_metadata_t md;
+    md.start_of_burst = true;
+    md.end_of_burst   = false;
+    md.has_time_spec  = true;
+    md.time_spec = uhd::time_spec_t(start_time);
+
+    waveform_player player_bb(data_bb, loop);
+    waveform_player player_lo(data_lo);
+    while (not stop_signal_called) {
+        player_bb.fill(buff_bb, spb);
+        player_lo.fill(buff_lo, spb);
+        stream_tx->send(buffs, spb, md);
+        md.start_of_burst = false;
+        md.has_time_spec  = false;
+    }
+
+    // send a mini EOB packet
+    md.end_of_burst = true;
+    stream_tx->send("", 0, md);
+}
+
+
+/***********************************************************************
+ * rx_lo_worker function
+ * Sends the LO of the USRP-Rx from the start of the daemon until it stops
+ **********************************************************************/
+void rx_lo_worker(waveform_source::sptr data_lo,
+    uhd::tx_streamer::sptr stream_rx_lo, buffer_arena* arena, double start_time)
+{
+    size_t spb = stream_rx_lo->get_max_num_samps();
+    std::complex<float>* buff_lo = arena->allocate<std::complex<float>>(spb);
+    std::vector<std::complex<float>*> buffs(1);
+    buffs[0] = buff_lo;
+
+    uhd::tx_metadata_t md;
+    md.start_of_burst = true;
+    md.end_of_burst   = false;
+    md.has_time_spec  = true;
+    md.time_spec = uhd::time_spec_t(start_time);
+
+    waveform_player player_lo(data_lo);
+    while (not stop_signal_called) {
+        player_lo.fill(buff_lo, spb);
+        stream_rx_lo->send(buffs, spb, md);
+        md.start_of_burst = false;
+        md.has_time_spec  = false;
+    }
+
+    // send a mini EOB packet
+    md.end_of_burst = true;
+    stream_rx_lo->send("", 0, md);
+}
+
+
+/***********************************************************************
+ * Devices held by the daemon between jobs
+ **********************************************************************/
+struct daemon_devices_t
+{
+    aip_controller* 						arrays;
+    size_t 									array_tx;
+    size_t 									array_rx;
+    uhd::rx_streamer::sptr 					rx_stream;
+    double 									rate_rx;
+    sweep_engine::clock_fn 					device_time;
+    std::vector<const tx_async_monitor*> 	tx_monitors;
+    uint64_t 								default_dwell;
+    size_t 									recv_batch;
+    thread_config_t 						threads;
+};
+
+
+// Stop the Rx stream at the end of a job and drop the samples still in flight
+static void stop_rx_stream(uhd::rx_streamer::sptr rx_stream)
+{
+    rx_stream->issue_stream_cmd(uhd::stream_cmd_t(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS));
+    std::vector<std::complex<float>> buff(rx_stream->get_max_num_samps());
+    uhd::rx_metadata_t md;
+    for (size_t i = 0; i < 10000; i++) {
+        rx_stream->recv(&buff.front(), buff.size(), md, 0.1);
+        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) break;
+    }
+}
+
+
+/***********************************************************************
+ * Sweep job
+ * A joint sweep of mmwave_joint_txrx on the open devices: the arrays are
+ * initialised and the Tx workers are running, the Rx stream is started
+ * for the job and stopped after it. Every Tx/Rx beam pair is journaled,
+ * so that a failed job can be sent again with resume=true.
+ **********************************************************************/
+static std::string run_sweep_job(daemon_devices_t& devices, const job_request_t& request, job_server::reply_fn reply)
+{
+    request.check_keys({"plan-tx", "plan-rx", "nsamps", "outdir", "prefix", "rotate-mb", "rotate-segments", "notify-socket",
+                        "compress", "compress-threads", "compress-level", "recapture-bad", "resume"});
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Plans and capture settings, all validated before anything is written
+    uint64_t dwell = request.get_uint("nsamps", devices.default_dwell);
+    std::string plan_file_tx = request.get("plan-tx", "");
+    std::string plan_file_rx = request.get("plan-rx", "");
+    sweep_plan_t plan_tx = plan_file_tx.empty() ? default_sweep_plan(1, dwell) : load_sweep_plan(plan_file_tx, 1, dwell);
+    sweep_plan_t plan_rx = plan_file_rx.empty() ? default_sweep_plan(2, dwell) : load_sweep_plan(plan_file_rx, 2, dwell);
+
+    capture_config_t capture;
+    capture.out_dir 			= request.get("outdir", ".");
+    capture.prefix 				= request.get("prefix", "outfile");
+    capture.rotate_bytes 		= (uint64_t)(request.get_double("rotate-mb", 0) * 1e6);
+    capture.rotate_segments 	= request.get_uint("rotate-segments", 0);
+    capture.notify_socket 		= request.get("notify-socket", "");
+    capture.compression 		= request.get("compress", "none");
+    capture.compress_threads 	= request.get_uint("compress-threads", 2);
+    capture.compression_level 	= (int)request.get_uint("compress-level", 3);
+    size_t max_recaptures 		= request.get_uint("recapture-bad", 0);
+    bool resume 				= request.get_bool("resume", false);
+    align_capture_blocks(capture, devices.recv_batch);
+
+    sweep_journal journal(capture, plan_tx, plan_rx, resume);
+    const journal_entry_t* resume_at = journal.last();
+    if (resume) {
+        capture.resume = (resume_at != NULL) ? &resume_at->position : NULL;
+        reply(str(boost::format("resume %u of %u pairs already captured") % journal.num_done() % journal.num_pairs()));
+    }
+    capture_writer outfile(capture);
+    apply_thread_role(devices.threads, ROLE_WRITER, outfile.writer_thread());
+    std::cout << boost::format("Job: %s x %s into %s") % plan_tx.name % plan_rx.name % outfile.current_file() << std::endl;
+
+    rx_capture receiver(devices.rx_stream, outfile, devices.rate_rx, STREAM_LEAD + 0.1, max_recaptures, devices.recv_batch);
+    for (size_t i = 0; i < devices.tx_monitors.size(); i++) {
+        receiver.add_tx_monitor(devices.tx_monitors[i]);
+    }
+    if (resume_at != NULL) receiver.set_next_segment(resume_at->segments);
+
+    // The sweep time of a resumed job goes on from its last pair (see mmwave_joint_txrx)
+    double time_offset = journal.time_offset(devices.device_time());
+    sweep_engine::clock_fn sweep_time = [&devices, time_offset](){ return devices.device_time() + time_offset; };
+    if (resume_at != NULL) {
+        outfile.write_metadata(str(boost::format("{\"journal\": \"resume\", \"pairs_done\": %u, \"segment\": %u, \"time\": %f, \"time_offset\": %f}")
+            % journal.num_done() % resume_at->segments % sweep_time() % time_offset));
+    }
+
+    uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+    stream_cmd.stream_now = false;
+    stream_cmd.time_spec = uhd::time_spec_t(devices.device_time() + STREAM_LEAD);
+    devices.rx_stream->issue_stream_cmd(stream_cmd);
+
+    size_t pairs = 0;
+    try {
+        sweep_engine engine(*devices.arrays, sweep_time);
+        engine.set_done([&journal](size_t tx, size_t rx){ return journal.done(tx, rx); });
+        engine.run_joint(devices.array_tx, plan_tx, devices.array_rx, plan_rx, [&](size_t tx, const sweep_step_t& step_tx, size_t rx, const sweep_step_t& step_rx, double time_now){
+            if (stop_signal_called) {
+                throw std::runtime_error("Daemon stopping, job interrupted (send it again with resume=true)");
+            }
+            std::string beam = str(boost::format("Tx %s - %s / Rx %s - %s") % step_tx.direction % step_tx.angle % step_rx.direction % step_rx.angle);
+            rx_segment_stats_t stats = receiver.capture_segment(str(boost::format("\nAiP Tx data\n%s - %s degrees at time %f\nAiP Rx data\n%s - %s degrees at time %f\n")
+                                                                    % step_tx.direction % step_tx.angle % time_now % step_rx.direction % step_rx.angle % time_now),
+                                                                beam, time_now, step_rx.dwell_samps);
+
+            journal_entry_t entry;
+            entry.tx 		= tx;
+            entry.rx 		= rx;
+            entry.segments 	= receiver.num_segments();
+            entry.time 		= sweep_time();
+            entry.wall 		= sweep_journal::wall_time();
+            outfile.checkpoint([&journal, entry](const capture_position_t& position) mutable {
+                entry.position = position;
+                journal.append(entry);
+            });
+            reply(str(boost::format("pair %u %u %s %s") % tx % rx % beam % stats.status()));
+            pairs++;
+        });
+    }
+    catch (...) {
+        stop_rx_stream(devices.rx_stream);
+        throw;
+    }
+    stop_rx_stream(devices.rx_stream);
+
+    outfile.close();
+    receiver.print_report();
+    outfile.print_compression_report();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return str(boost::format("%u pairs, %u segments, %u file(s) in %.1f s") % pairs % receiver.num_segments() % outfile.num_files() % secs);
+}
+
+
+
+/***********************************************************************
+ * Main function
+ **********************************************************************/
+int UHD_SAFE_MAIN(int argc, char* argv[])
+{
+    std::chrono::steady_clock::time_point daemon_start = std::chrono::steady_clock::now();
+
+    // variables to be set by po
+    std::string socket_path, args_tx, args_rx, name_serial_port_tx, name_serial_port_rx, ref, file;
+    std::string thread_cpus, thread_realtime;
+    aip_transport_config_t serial_config;
+    arena_config_t arena_config;
+    double rate_tx, rate_rx, freq_bb, freq_lo, gain_tx_bb, gain_rx_bb, gain_lo, tx_start;
+    int ver_aip;
+    bool loop, fast_start, parallel_bringup, shared_session, standin, lock_memory;
+    daemon_devices_t devices;
+
+    // variables with initializations
+    int gain_list[4] = {0,0,0,0};
+    std::string active_list[4] = {"1111", "1111", "1111", "1111"};
+    std::string subdev_tx = "A:0 B:0";
+    std::string subdev_rx_bb = "A:0";
+    std::string subdev_rx_lo = "B:0";
+    std::string ant = "TX/RX";
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+        ("help", "help message")
+        ("socket", po::value<std::string>(&socket_path)->default_value("/tmp/mmwave_daemon.sock"), "Unix socket on which the jobs are accepted (see mmwave_client)")
+        ("args-tx", po::value<std::string>(&args_tx)->default_value("addr=192.168.192.50"), "USRP IP address for Tx")
+        ("args-rx", po::value<std::string>(&args_rx)->default_value("addr=192.168.192.40"), "USRP IP address for Rx")
+        ("standin", po::bool_switch(&standin), "no USRPs: stand-in Tx and Rx streamers at the rates (the arrays default to mock://)")
+        ("file", po::value<std::string>(&file)->default_value(""), "waveform file of the Tx BB chain, see generate_tx_signal (default: QPSK burst of srand(1))")
+        ("loop", po::value<bool>(&loop)->default_value(true), "play the waveform in a loop (false: once, then zeros)")
+        ("tx-start", po::value<double>(&tx_start)->default_value(1.0), "device time in seconds at which sample 0 of the waveform and the LO are sent")
+        ("serialport-tx", po::value<std::string>(&name_serial_port_tx)->default_value("/dev/ttyUSB0"), "Serial port of the Tx mmWave array (/dev/ttyUSBx, tcp://host:port or mock://)")
+        ("serialport-rx", po::value<std::string>(&name_serial_port_rx)->default_value("/dev/ttyUSB1"), "Serial port of the Rx mmWave array (/dev/ttyUSBx, tcp://host:port or mock://)")
+        ("baud", po::value<int>(&serial_config.baud)->default_value(115200), "baud rate of the serial ports of the arrays")
+        ("serial-timeout-ms", po::value<int>(&serial_config.timeout_ms)->default_value(20), "timeout in ms after which the response of an array is complete (no byte for that long; raise it for a slow tcp:// bridge)")
+        ("ref", po::value<std::string>(&ref)->default_value("external"), "clock reference (internal, external, gpsdo)")
+        ("rate-tx", po::value<double>(&rate_tx)->default_value(1000000), "sample rate of Tx")
+        ("rate-rx", po::value<double>(&rate_rx)->default_value(1000000), "sample rate of Rx")
+        ("freq-bb", po::value<double>(&freq_bb)->default_value(4000000000), "Center frequency of Tx and Rx baseband signal in Hz")
+        ("freq-lo", po::value<double>(&freq_lo)->default_value(6000000000), "Center frequency of Tx and Rx LO signal in Hz")
+        ("gain-tx-bb", po::value<double>(&gain_tx_bb)->default_value(30), "Gain of Tx baseband signal in dB")
+        ("gain-rx-bb", po::value<double>(&gain_rx_bb)->default_value(30), "Gain of Rx baseband signal in dB")
+        ("gain-lo", po::value<double>(&gain_lo)->default_value(31.5), "Gain of the LO chain (for Tx and Rx)")
+        ("nsamps-per-degree", po::value<uint64_t>(&devices.default_dwell)->default_value(500000), "samples per beam pair of the jobs that do not set nsamps")
+        ("recv-batch", po::value<size_t>(&devices.recv_batch)->default_value(0), "samples per recv call, covering many packets (0: one packet per call)")
+        ("ver-aip", po::value<int>(&ver_aip)->default_value(0), "verbose mmWave arrays on or off")
+        ("cpus", po::value<std::string>(&thread_cpus)->default_value(""), "CPU cores per thread role, e.g. \"tx=2,lo=3,rx=4,writer=5,serial=1\"")
+        ("realtime", po::value<std::string>(&thread_realtime)->default_value(""), "thread roles run with SCHED_FIFO, e.g. \"tx,lo,rx\"")
+        ("mlock", po::bool_switch(&lock_memory), "lock all memory of the process in RAM")
+        ("hugepages", po::value<bool>(&arena_config.hugepages)->default_value(true), "allocate the Tx buffers on 2 MB hugepages (falls back to regular pages)")
+        ("shared-session", po::value<bool>(&shared_session)->default_value(true), "open the USRP-Rx once for the BB-RX and LO-TX roles")
+        ("parallel-bringup", po::value<bool>(&parallel_bringup)->default_value(true), "bring up the arrays and the USRPs concurrently")
+        ("fast-start", po::bool_switch(&fast_start), "poll the LO lock and the PPS edge instead of fixed sleeps, initialize the arrays once with verified responses")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help")) {
+        std::cout << boost::format("mmWave measurement daemon: keeps the USRPs and arrays open and runs the sweep jobs of mmwave_client. %s") % desc << std::endl;
+        return ~0;
+    }
+    if (standin) {
+        if (vm["serialport-tx"].defaulted()) name_serial_port_tx = "mock://tx";
+        if (vm["serialport-rx"].defaulted()) name_serial_port_rx = "mock://rx";
+    }
+
+    // Claim the socket first: a second daemon must not touch the devices of the first one
+    job_server server(socket_path);
+    std::signal(SIGINT, &sig_int_handler);
+    std::signal(SIGTERM, &sig_int_handler);
+
+    devices.threads = parse_thread_config(thread_cpus, thread_realtime, lock_memory);
+    lock_process_memory(devices.threads);
+    buffer_arena arena(ARENA_HEADROOM, arena_config);
+
+    // Arrays, each with its serial I/O thread
+    aip_controller arrays(ver_aip);
+    devices.arrays = &arrays;
+    std::cout << boost::format("Opening the mmWave arrays on %s and %s...") % name_serial_port_tx % name_serial_port_rx << std::endl;
+    devices.array_tx = arrays.add_array(name_serial_port_tx, serial_config);
+    devices.array_rx = arrays.add_array(name_serial_port_rx, serial_config);
+    arrays.submit(devices.array_tx, [&](aip_transport*){ apply_thread_role(devices.threads, ROLE_SERIAL); }).get();
+    arrays.submit(devices.array_rx, [&](aip_transport*){ apply_thread_role(devices.threads, ROLE_SERIAL); }).get();
+
+
+    // ==============================================================
+    // Bring up the arrays and the USRPs once, as mmwave_joint_txrx
+    // ==============================================================
+    uhd::usrp::multi_usrp::sptr usrp_tx, usrp_rx_bb, usrp_rx_lo;
+    device_sessions sessions(shared_session);
+    bringup bring(parallel_bringup);
+    bring.add("AiP Tx init", [&](){
+        std::vector<std::future<void>> commands;
+        commands.push_back(fast_start ? arrays.configure_verified(devices.array_tx, make_aip_beam("DEG_0", "LEFT", gain_list, 0, active_list, 1))
+                                      : arrays.configure(devices.array_tx, make_aip_beam("DEG_0", "LEFT", gain_list, 0, active_list, 1)));
+        if (not fast_start) commands.push_back(arrays.init(devices.array_tx)); // the verified configuration runs the init sequence
+        wait_all(commands);
+    });
+    bring.add("AiP Rx init", [&](){
+        std::vector<std::future<void>> commands;
+        commands.push_back(fast_start ? arrays.configure_verified(devices.array_rx, make_aip_beam("DEG_0", "LEFT", gain_list, 0, active_list, 2))
+                                      : arrays.configure(devices.array_rx, make_aip_beam("DEG_0", "LEFT", gain_list, 0, active_list, 2)));
+        if (not fast_start) commands.push_back(arrays.init(devices.array_rx)); // the verified configuration runs the init sequence
+        wait_all(commands);
+    });
+    if (not standin) {
+        size_t step_tx = bring.add("USRP-Tx", [&](){
+            bring.log(str(boost::format("Creating the USRP-Tx device with: %s...") % args_tx));
+            usrp_tx = sessions.open("Tx", args_tx, "tx");
+            usrp_tx->set_tx_subdev_spec(subdev_tx);
+            if (vm.count("ref")) usrp_tx->set_clock_source(ref);
+            usrp_tx->set_tx_rate(rate_tx);
+            usrp_tx->set_tx_freq(uhd::tune_request_t(freq_bb), 0);
+            usrp_tx->set_tx_freq(uhd::tune_request_t(freq_lo), 1);
+            usrp_tx->set_tx_gain(gain_tx_bb, 0);
+            usrp_tx->set_tx_gain(gain_lo, 1);
+            usrp_tx->set_tx_antenna(ant, 0);
+            usrp_tx->set_tx_antenna(ant, 1);
+            if (fast_start) wait_for_lo_locked(usrp_tx, "tx", {0, 1});
+            else std::this_thread::sleep_for(std::chrono::seconds(1));
+        });
+        size_t step_rx = bring.add("USRP-Rx", [&](){
+            bring.log(str(boost::format("Creating the USRP-Rx-BB and USRP-Rx-LO devices with: %s...") % args_rx));
+            usrp_rx_bb = sessions.open("Rx-BB", args_rx, "rx");
+            usrp_rx_lo = sessions.open("Rx-LO", args_rx, "tx");
+            usrp_rx_bb->set_rx_subdev_spec(subdev_rx_bb);
+            if (vm.count("ref")) usrp_rx_bb->set_clock_source(ref);
+            usrp_rx_bb->set_rx_rate(rate_rx);
+            usrp_rx_bb->set_rx_freq(uhd::tune_request_t(freq_bb), 0);
+            usrp_rx_bb->set_rx_gain(gain_rx_bb, 0);
+            usrp_rx_bb->set_rx_antenna(ant, 0);
+            usrp_rx_lo->set_tx_subdev_spec(subdev_rx_lo);
+            usrp_rx_lo->set_tx_rate(rate_rx);
+            usrp_rx_lo->set_tx_freq(uhd::tune_request_t(freq_lo), 0);
+            usrp_rx_lo->set_tx_gain(gain_lo, 0);
+            usrp_rx_lo->set_tx_antenna(ant, 0);
+            if (fast_start) {
+                wait_for_lo_locked(usrp_rx_bb, "rx", {0});
+                wait_for_lo_locked(usrp_rx_lo, "tx", {0});
+            }
+            else std::this_thread::sleep_for(std::chrono::seconds(1));
+        });
+        size_t step_time = bring.add("time alignment", [&](){
+            usrp_tx->set_time_source(ref);
+            usrp_rx_bb->set_time_source(ref);
+            if (not fast_start or not sync_time_on_pps({usrp_tx, usrp_rx_bb})) {
+                usrp_tx->set_time_unknown_pps(uhd::time_spec_t(0.0));
+                usrp_rx_bb->set_time_unknown_pps(uhd::time_spec_t(0.0));
+                std::this_thread::sleep_for(std::chrono::seconds(1)); // wait for pps sync pulse
+            }
+        }, {step_tx, step_rx});
+        bring.add("lock check", [&](){
+            check_locked(usrp_tx, "tx", {0}, ref == "external", "TX");
+            check_locked(usrp_rx_bb, "rx", {0}, ref == "external", "RX");
+            check_locked(usrp_rx_lo, "tx", {0}, ref == "external", "TX");
+        }, {step_time});
+    }
+    try {
+        bring.run();
+    }
+    catch (...) {
+        bring.print_report();
+        throw;
+    }
+    bring.print_report();
+
+
+    // ==================================================================
+    // Streamers, and the Tx workers running for the life of the daemon
+    // ==================================================================
+    uhd::tx_streamer::sptr stream_tx, stream_rx_lo;
+    if (standin) {
+        standin_rx_streamer* rx = new standin_rx_streamer(1, rate_rx);
+        devices.rx_stream.reset(rx);
+        devices.rate_rx 	= rate_rx;
+        devices.device_time = [rx](){ return rx->time_now(); };
+        stream_tx.reset(new standin_tx_streamer(2, rate_tx));
+        stream_rx_lo.reset(new standin_tx_streamer(1, rate_rx));
+    }
+    else {
+        uhd::stream_args_t stream_args("fc32", "sc16");
+        stream_args.channels = {0, 1};
+        stream_tx = usrp_tx->get_tx_stream(stream_args);
+        stream_args.channels = {0};
+        stream_rx_lo = usrp_rx_lo->get_tx_stream(stream_args);
+        devices.rx_stream 	= usrp_rx_bb->get_rx_stream(stream_args);
+        devices.rate_rx 	= usrp_rx_bb->get_rx_rate();
+        devices.device_time = [usrp_rx_bb](){ return usrp_rx_bb->get_time_now().get_real_secs(); };
+    }
+
+    waveform_source::sptr data_bb = file.empty() ? waveform_source::from_samples(legacy_qpsk_burst(1), "legacy-qpsk seed=1 symbols=1000 length=10000")
+                                                 : waveform_source::map_file(file);
+    waveform_source::sptr data_lo = waveform_source::from_samples(constant_waveform(10000), "constant length=10000 amplitude=1");
+    std::thread tx_thread(&tx_worker, data_bb, data_lo, stream_tx, &arena, tx_start, loop);
+    apply_thread_role(devices.threads, ROLE_TX, tx_thread.native_handle());
+    std::thread rx_lo_thread(&rx_lo_worker, data_lo, stream_rx_lo, &arena, tx_start);
+    apply_thread_role(devices.threads, ROLE_LO, rx_lo_thread.native_handle());
+    tx_async_monitor tx_monitor("tx", stream_tx);
+    tx_async_monitor rx_lo_monitor("rx_lo", stream_rx_lo);
+    devices.tx_monitors.push_back(&tx_monitor);
+    devices.tx_monitors.push_back(&rx_lo_monitor);
+
+    // the jobs run on the main thread, which is the recv loop
+    apply_thread_role(devices.threads, ROLE_RX);
+    print_thread_report();
+    double bringup_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - daemon_start).count();
+
+
+    // ===========================================
+    // Serve the jobs until shutdown or a signal
+    // ===========================================
+    size_t jobs = 0, failed_jobs = 0;
+    std::cout << boost::format("Ready after %.1f s, waiting for jobs on %s") % bringup_secs % server.path() << std::endl;
+    server.serve([&](const job_request_t& request, job_server::reply_fn reply) -> std::string {
+        if (request.command == "status") {
+            double up = std::chrono::duration<double>(std::chrono::steady_clock::now() - daemon_start).count();
+            tx_event_counts_t tx = tx_monitor.counts(), lo = rx_lo_monitor.counts();
+            return str(boost::format("up %.0f s (bring-up %.1f s), %u jobs (%u failed), device time %.3f s, Tx underflows %u, LO underflows %u")
+                % up % bringup_secs % jobs % failed_jobs % devices.device_time() % tx.underflows % lo.underflows);
+        }
+        if (request.command == "shutdown") {
+            stop_signal_called = true;
+            return "shutting down";
+        }
+        if (request.command != "sweep") {
+            throw std::runtime_error(str(boost::format("Unknown command %s (sweep, status or shutdown)") % request.command));
+        }
+        jobs++;
+        try {
+            return run_sweep_job(devices, request, reply);
+        }
+        catch (...) {
+            failed_jobs++;
+            throw;
+        }
+    }, [](){ return (bool)stop_signal_called; });
+
+
+    // ======================
+    // Closing up everything
+    // ======================
+    std::cout << std::endl << boost::format("Stopping after %u jobs (%u failed)...") % jobs % failed_jobs << std::endl;
+    stop_signal_called = true;
+    tx_thread.join();
+    rx_lo_thread.join();
+    tx_monitor.print_report();
+    rx_lo_monitor.print_report();
+
+    std::vector<std::future<void>> pending;
+    pending.push_back(arrays.disable(devices.array_tx));
+    pending.push_back(arrays.disable(devices.array_rx));
+    wait_all(pending);
+    arrays.close();
+
+    std::cout << std::endl << "Done!" << std::endl << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include <uhd/utils/safe_main.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "replay.h"
+#include "capture_codec.h"
+#include "capture_inspect.h"
+namespace po = boost::program_options;
+
+
+
+int UHD_SAFE_MAIN(int argc, char* argv[])
+{
+    // variables to be set by po
+    std::string command, file, segments, beam, out_dir, out_path;
+    double rate;
+    size_t channels, align, chunk_mb;
+    bool save_index, raw;
+    inspect_config_t config;
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+        ("help", "help message")
+        ("command", po::value<std::string>(&command), "list, extract, stats, convert or decompress")
+        ("file", po::value<std::string>(&file), "capture file (mmwave_rx, mmwave_joint_txrx or the original outfile.dat)")
+        ("segments", po::value<std::string>(&segments)->default_value(""), "segments to work on, e.g. 0,3,10-20 (default: all)")
+        ("beam", po::value<std::string>(&beam)->default_value(""), "only the segments whose beam contains this text, e.g. \"Rx RIGHT - 4.00\"")
+        ("threads", po::value<size_t>(&config.threads)->default_value(0), "worker threads for stats, extract, convert and decompress (0: one per core)")
+        ("chunk-mb", po::value<size_t>(&chunk_mb)->default_value(16), "MB of samples handled by a worker at once")
+        ("out-dir", po::value<std::string>(&out_dir)->default_value("."), "extract: directory of the segment files")
+        ("raw", po::value<bool>(&raw)->default_value(false), "extract: bare fc32 samples, without the AiP header")
+        ("out", po::value<std::string>(&out_path)->default_value(""), "convert: output capture (indexed, aligned samples); decompress: output capture (default: the name without .mwz)")
+        ("align", po::value<size_t>(&align)->default_value(4096), "convert: byte boundary of the samples of every segment")
+        ("save-index", po::value<bool>(&save_index)->default_value(true), "save the segment index next to the capture (<file>.idx) once built")
+        ("rate", po::value<double>(&rate)->default_value(1e6), "sample rate of the capture (not stored in the file)")
+        ("channels", po::value<size_t>(&channels)->default_value(1), "channels interleaved in the capture")
+    ;
+    // clang-format on
+    po::positional_options_description positional;
+    positional.add("command", 1).add("file", 1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help") or command.empty() or file.empty()) {
+        std::cout << boost::format("mmWave capture inspection %s") % desc << std::endl;
+        std::cout << "    mmwave_inspect list outfile.dat" << std::endl
+                  << "    mmwave_inspect extract outfile.dat --beam \"Rx RIGHT - 4.00\" --out-dir segments" << std::endl
+                  << "    mmwave_inspect stats outfile.dat --segments 0-9" << std::endl
+                  << "    mmwave_inspect convert outfile.dat --out indexed.dat" << std::endl
+                  << "    mmwave_inspect decompress outfile.dat.mwz" << std::endl;
+        return ~0;
+    }
+    if (command != "list" and command != "extract" and command != "stats" and command != "convert" and command != "decompress") {
+        std::cerr << boost::format("Unknown command %s (list, extract, stats, convert or decompress)") % command << std::endl;
+        return ~0;
+    }
+    if (command == "convert" and out_path.empty()) {
+        std::cerr << "convert needs --out" << std::endl;
+        return ~0;
+    }
+    config.chunk_bytes = (uint64_t)chunk_mb << 20;
+
+    // the other commands work on uncompressed captures: a .dat.mwz is decompressed first
+    if (command == "decompress") {
+        if (out_path.empty()) {
+            size_t ext = COMPRESSED_CAPTURE_EXT.size();
+            bool compressed_name = file.size() > ext and file.compare(file.size() - ext, ext, COMPRESSED_CAPTURE_EXT) == 0;
+            out_path = compressed_name ? file.substr(0, file.size() - ext) : file + ".dat";
+        }
+        compressed_capture compressed(file);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t bytes = decompress_capture(compressed, out_path, config);
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << boost::format("%s: %u blocks, %.1f MB into %.1f MB (ratio %.2f) in %.3f s (%.0f MB/s)")
+            % file % compressed.num_blocks() % (compressed.size() / 1e6) % (bytes / 1e6) % (compressed.size() ? (double)bytes / compressed.size() : 0)
+            % secs % (secs > 0 ? bytes / secs / 1e6 : 0) << std::endl;
+        if (compressed.trailing_bytes() > 0) {
+            std::cout << boost::format("Warning: %u bytes after the last whole block (capture cut short) were left out") % compressed.trailing_bytes() << std::endl;
+        }
+        std::cout << "  -- " << out_path << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    capture_file capture(file, rate, channels);
+    std::cout << boost::format("%s: %u segments, %u samples, %s in %.1f ms")
+        % file % capture.num_segments() % capture.total_samps() % (capture.index_loaded() ? "index loaded" : "indexed") % (capture.index_secs() * 1e3) << std::endl;
+    if (save_index and not capture.index_loaded()) {
+        try {
+            capture.save_index();
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Warning: " << e.what() << std::endl;
+        }
+    }
+
+    std::vector<size_t> selected = select_segments(capture, segments, beam);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t bytes = 0;
+    if (command == "list") {
+        list_segments(capture, selected);
+        return EXIT_SUCCESS;
+    }
+    else if (command == "stats") {
+        std::vector<segment_stats_t> stats = segment_statistics(capture, selected, config);
+        print_segment_statistics(capture, selected, stats);
+        for (size_t i = 0; i < selected.size(); i++) {
+            bytes += capture.num_samps(selected[i]) * sizeof(std::complex<float>);
+        }
+    }
+    else if (command == "extract") {
+        std::vector<std::string> files;
+        bytes = extract_segments(capture, selected, out_dir, raw, config, &files);
+        for (size_t i = 0; i < files.size(); i++) {
+            std::cout << "  -- " << files[i] << std::endl;
+        }
+    }
+    else {
+        bytes = convert_capture(capture, selected, out_path, align, config);
+        std::cout << boost::format("  -- %s and %s") % out_path % capture_file::index_path(out_path) << std::endl;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << boost::format("%u segments, %.1f MB in %.3f s (%.0f MB/s)") % selected.size() % (bytes / 1e6) % secs % (secs > 0 ? bytes / secs / 1e6 : 0) << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -18,59 +18,65 @@
 #include <iostream>
 #include <string>
 #include <thread>
-#include <fstream>
 
 #include "constants.h"
 #include "aip_functions.h"
-#include "/usr/local/include/libserial/SerialPort.h"
-using namespace LibSerial ;
+#include "stream_functions.h"
+#include "capture_writer.h"
+#include "rx_capture.h"
+#include "tx_monitor.h"
+#include "thread_config.h"
+#include "buffer_arena.h"
+#include "transport_tuning.h"
+#include "waveform.h"
+#include "waveform_source.h"
+#include "aip_controller.h"
+#include "sweep_plan.h"
+#include "sweep_engine.h"
+#include "sweep_journal.h"
+#include "fast_start.h"
+#include "bringup.h"
+#include "device_session.h"
 namespace po = boost::program_options;
 
 
 bool stop_signal_called = false;
 
+// room for the streaming buffers in the arena, next to the capture blocks
+const size_t ARENA_HEADROOM = 4*1024*1024;
+
 
 /***********************************************************************
  * tx_worker function
  * A function to be used as a boost::thread_group thread for transmitting
  **********************************************************************/
-void tx_worker(std::vector<std::complex<float>> data_bb,
-    std::vector<std::complex<float>> data_lo,
-    uhd::tx_streamer::sptr stream_tx)
+void tx_worker(waveform_source::sptr data_bb,
+    waveform_source::sptr data_lo,
+    uhd::tx_streamer::sptr stream_tx, buffer_arena* arena, double start_time, bool loop)
 {
-	// allocate a buffer which we re-use for each channel
+	// take a buffer from the arena which we re-use for each channel
     size_t spb = stream_tx->get_max_num_samps(); 
-    std::vector<std::complex<float>> buff_bb(spb);
-    std::vector<std::complex<float>> buff_lo(spb);
+    std::complex<float>* buff_bb = arena->allocate<std::complex<float>>(spb);
+    std::complex<float>* buff_lo = arena->allocate<std::complex<float>>(spb);
     std::vector<std::complex<float>*> buffs(2);
-    buffs[0] = &buff_bb.front(); 
-	buffs[1] = &buff_lo.front(); 
+    buffs[0] = buff_bb; 
+	buffs[1] = buff_lo; 
 
 	// setup the metadata flags
     uhd::tx_metadata_t md;
     md.start_of_burst = true;
     md.end_of_burst   = false;
     md.has_time_spec  = true;
-    md.time_spec = uhd::time_spec_t(1.0); // give us 1.0 seconds to fill the tx buffers
+    md.time_spec = uhd::time_spec_t(start_time); // sample 0 of the waveform goes out at start_time, leaving time to fill the tx buffers
     
-    size_t index_bb = 0;
-	size_t index_lo = 0;
+    waveform_player player_bb(data_bb, loop);
+	waveform_player player_lo(data_lo);
     // send data until the signal handler gets called
     while (not stop_signal_called) {
     
         // fill the buffer with the data file
-        for (size_t n = 0; n < spb; n++) {
-		    buff_bb[n] = data_bb[index_bb];
-		    buff_lo[n] = data_lo[index_lo];
-		    index_bb++;
-		    index_lo++;
-		    if (index_bb == data_bb.size()){
-		    	index_bb = 0;
-			}
-		    if (index_lo == data_lo.size()){
-		    	index_lo = 0;
-			}
-		}
+        player_bb.fill(buff_bb, spb);
+        player_lo.fill(buff_lo, spb);
 
         // send the entire contents of the buffer
         stream_tx->send(buffs, spb, md);
@@ -89,35 +95,29 @@ void tx_worker(std::vector<std::complex<float>> data_bb,
  * rx_lo_worker function
  * A function to be used as a boost::thread_group thread for transmitting
  **********************************************************************/
-void rx_lo_worker(std::vector<std::complex<float>> data_lo,
-    uhd::tx_streamer::sptr stream_rx_lo)
+void rx_lo_worker(waveform_source::sptr data_lo,
+    uhd::tx_streamer::sptr stream_rx_lo, buffer_arena* arena, double start_time)
 {
 
-	// allocate a buffer which we re-use for each channel
+	// take a buffer from the arena which we re-use for each channel
     size_t spb = stream_rx_lo->get_max_num_samps(); 
-    std::vector<std::complex<float>> buff_lo(spb);
+    std::complex<float>* buff_lo = arena->allocate<std::complex<float>>(spb);
     std::vector<std::complex<float>*> buffs(1);
-	buffs[0] = &buff_lo.front(); 
+	buffs[0] = buff_lo; 
 	
 	// setup the metadata flags
     uhd::tx_metadata_t md;
     md.start_of_burst = true;
     md.end_of_burst   = false;
     md.has_time_spec  = true;
-    md.time_spec = uhd::time_spec_t(1.0); // give us 0.1 seconds to fill the tx buffers
+    md.time_spec = uhd::time_spec_t(start_time); // the LO starts with the Tx, leaving time to fill the tx buffers
     
-	size_t index_lo = 0;
+	waveform_player player_lo(data_lo);
     // send data until the signal handler gets called
     while (not stop_signal_called) {
     
         // fill the buffer with the data file
-        for (size_t n = 0; n < spb; n++) {
-		    buff_lo[n] = data_lo[index_lo];
-		    index_lo++;
-		    if (index_lo == data_lo.size()){
-		    	index_lo = 0;
-			}
-		}
+        player_lo.fill(buff_lo, spb);
 
         // send the entire contents of the buffer
         stream_rx_lo->send(buffs, spb, md);
@@ -140,13 +140,31 @@ void rx_lo_worker(std::vector<std::complex<float>> data_lo,
  **********************************************************************/
 int UHD_SAFE_MAIN(int argc, char* argv[])
 {
+    startup_timer startup;
     
     // variable definitions
-    std::string 	args_tx, args_rx, name_serial_port_tx, name_serial_port_rx, ref; 
+    std::string 	args_tx, args_rx, name_serial_port_tx, name_serial_port_rx, ref, file; 
+    aip_transport_config_t serial_config;
     int 			mode_tx, mode_rx, ver_aip; 
     double 			rate_tx, rate_rx, freq_bb, freq_lo, gain_tx_bb, gain_rx_bb, gain_lo; 
-    std::ofstream 	outfile;
+    capture_config_t capture;
+    double 			rotate_mb;
+    size_t 			max_recaptures;
+    size_t 			recv_batch;
+    std::string 	thread_cpus, thread_realtime;
+    bool 			lock_memory;
+    arena_config_t 	arena_config;
+    bool 			high_rate;
+    double 			tx_start;
+    bool 			loop;
+    double 			self_test;
+    bool 			fast_start;
+    bool 			resume;
+    bool 			parallel_bringup;
+    bool 			shared_session;
+    double 			temp_interval;
     uint64_t 		nbr_samps_per_degree;
+    std::string 	plan_file_tx, plan_file_rx;
     
     // variables with initializations
     int 			gain_tx				= 0; 									// attenuation of entire Tx mmWave array
@@ -160,12 +178,6 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     std::string		subdev_rx_lo		= "B:0";
     std::string 	ant_bb 				= "TX/RX";
     std::string 	ant_lo 				= "TX/RX";
-    std::string 	all_directions[4] 	= {"LEFT", "RIGHT", "UP", "DOWN"};
-	std::string 	all_degrees[17] 	= {"DEG_0","DEG_11_25","DEG_22_25","DEG_33_75","DEG_45","DEG_56_25","DEG_67_5","DEG_78_75","DEG_90",
-											  "DEG_101_2","DEG_112_5","DEG_123_7","DEG_135","DEG_146_2","DEG_157_5","DEG_168_7","DEG_180"};	
-    std::string 	all_angles[17] 		= {"0.00", "4.00", "8.00", "11.50", "15.50", "19.50", "23.50", "28.00", "32.50",
-    										 "37.00", "41.50", "46.50", "52.00", "57.50", "64.50", "72.00", "78.00"};			
-	float 			seconds_in_future 	= 2.0;
 	int 			nbr_degrees 		= 17; // nbr of beams in one direction from broadside, between 1 and 17
 	int 			nbr_directions 		= 2;  // nbr of directions, between 1 and 4 (2 to sweep from left to right)
     
@@ -177,8 +189,14 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 		("help", "help message")
 		("args-tx", po::value<std::string>(&args_tx)->default_value("addr=192.168.192.50"), "USRP IP address for Tx") 
 		("args-rx", po::value<std::string>(&args_rx)->default_value("addr=192.168.192.40"), "USRP IP address for Rx") 
-		("serialport-tx", po::value<std::string>(&name_serial_port_tx)->default_value("/dev/ttyUSB0"), "Serial port of the Tx mmWave array")
-		("serialport-rx", po::value<std::string>(&name_serial_port_rx)->default_value("/dev/ttyUSB1"), "Serial port of the Rx mmWave array")
+		("file", po::value<std::string>(&file)->default_value(""), "waveform file of the Tx BB chain, see generate_tx_signal (default: QPSK burst of srand(1))")
+		("loop", po::value<bool>(&loop)->default_value(true), "play the waveform in a loop (false: once, then zeros)")
+		("tx-start", po::value<double>(&tx_start)->default_value(1.0), "device time in seconds at which sample 0 of the waveform and the LO are sent")
+		("serialport-tx", po::value<std::string>(&name_serial_port_tx)->default_value("/dev/ttyUSB0"), "Serial port of the Tx mmWave array (/dev/ttyUSBx, tcp://host:port of a serial bridge or mock:// for an in-process array)")
+		("serialport-rx", po::value<std::string>(&name_serial_port_rx)->default_value("/dev/ttyUSB1"), "Serial port of the Rx mmWave array (/dev/ttyUSBx, tcp://host:port of a serial bridge or mock:// for an in-process array)")
+		("baud", po::value<int>(&serial_config.baud)->default_value(115200), "baud rate of the serial ports of the arrays (8N1, set on the bridge for tcp://)")
+		("batch-writes", po::bool_switch(&serial_config.batch_writes), "write the commands of a beam switch at once, then read the responses (the array must buffer them)")
+		("serial-timeout-ms", po::value<int>(&serial_config.timeout_ms)->default_value(20), "timeout in ms after which the response of an array is complete (no byte for that long; raise it for a slow tcp:// bridge)")
 		("ref", po::value<std::string>(&ref)->default_value("external"), "clock reference (internal, external, gpsdo)")
 		("rate-tx", po::value<double>(&rate_tx)->default_value(1000000), "sample rate of Tx")
 		("rate-rx", po::value<double>(&rate_rx)->default_value(1000000), "sample rate of Rx")
@@ -187,8 +205,32 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 		("gain-tx-bb", po::value<double>(&gain_tx_bb)->default_value(30), "Gain of Tx baseband signal in dB")
 		("gain-rx-bb", po::value<double>(&gain_rx_bb)->default_value(30), "Gain of Rx baseband signal in dB")
 		("gain-lo", po::value<double>(&gain_lo)->default_value(31.5), "Gain of the LO chain (for Tx and Rx)")
-		("nsamps-per-degree", po::value<uint64_t>(&nbr_samps_per_degree)->default_value(500000), "Number of samples per Tx/Rx beam direction")
+		("nsamps-per-degree", po::value<uint64_t>(&nbr_samps_per_degree)->default_value(500000), "Number of samples per Tx/Rx beam direction (for Rx plan steps without a dwell)")
+		("plan-tx", po::value<std::string>(&plan_file_tx)->default_value(""), "sweep plan file (CSV) of the Tx array (default: LEFT then RIGHT sweep)")
+		("plan-rx", po::value<std::string>(&plan_file_rx)->default_value(""), "sweep plan file (CSV) of the Rx array, swept for every Tx beam (default: LEFT then RIGHT sweep)")
 		("ver-aip", po::value<int>(&ver_aip)->default_value(0), "verbose mmWave arrays on or off")
+		("outdir", po::value<std::string>(&capture.out_dir)->default_value("."), "directory of the capture files")
+		("prefix", po::value<std::string>(&capture.prefix)->default_value("outfile"), "name prefix of the capture files")
+		("rotate-mb", po::value<double>(&rotate_mb)->default_value(0), "start a new capture file at the next Tx/Rx beam pair once this size (MB) is reached (0: single file)")
+		("rotate-segments", po::value<uint64_t>(&capture.rotate_segments)->default_value(0), "start a new capture file every N Tx/Rx beam pairs (0: single file)")
+		("notify-socket", po::value<std::string>(&capture.notify_socket)->default_value(""), "Unix datagram socket to announce finished capture files")
+		("compress", po::value<std::string>(&capture.compression)->default_value("none"), "compress the capture files block by block (.dat.mwz): none, iq16 (lossless for the sc16 samples), zstd or iq16+zstd")
+		("compress-threads", po::value<size_t>(&capture.compress_threads)->default_value(2), "compressor threads")
+		("compress-level", po::value<int>(&capture.compression_level)->default_value(3), "zstd compression level")
+		("resume", po::bool_switch(&resume), "continue an interrupted sweep from its journal (<outdir>/<prefix>.journal): the captured Tx/Rx beam pairs are skipped, the capture files and metadata are continued")
+		("recapture-bad", po::value<size_t>(&max_recaptures)->default_value(0), "number of times a Tx/Rx beam pair with overflows or lost samples is captured again")
+		("recv-batch", po::value<size_t>(&recv_batch)->default_value(0), "samples per recv call, covering many packets (0: one packet per call)")
+		("cpus", po::value<std::string>(&thread_cpus)->default_value(""), "CPU cores per thread role, e.g. \"tx=2,lo=3,rx=4,writer=5,serial=1\"")
+		("realtime", po::value<std::string>(&thread_realtime)->default_value(""), "thread roles run with SCHED_FIFO, e.g. \"tx,lo,rx\"")
+		("mlock", po::bool_switch(&lock_memory), "lock all memory of the process in RAM")
+		("hugepages", po::value<bool>(&arena_config.hugepages)->default_value(true), "allocate the streaming and capture buffers on 2 MB hugepages (falls back to regular pages)")
+		("numa-node", po::value<int>(&arena_config.numa_node)->default_value(-1), "NUMA node of the buffers (default: node of the NIC that reaches the Rx USRP)")
+		("high-rate", po::bool_switch(&high_rate), "size frames, socket buffers and samples per packet for the rates and check the host limits")
+		("self-test", po::value<double>(&self_test)->default_value(0), "seconds of Tx, Rx and LO streaming self-test before the sweep (0: none, 1 s with --high-rate)")
+		("temp-interval", po::value<double>(&temp_interval)->default_value(10), "seconds between readings of the array temperatures, taken between dwells (0: none)")
+		("shared-session", po::value<bool>(&shared_session)->default_value(true), "open the USRP-Rx once for the BB-RX and LO-TX roles (false: one device session per role)")
+		("parallel-bringup", po::value<bool>(&parallel_bringup)->default_value(true), "bring up the arrays and the USRPs concurrently (false: one step after the other)")
+		("fast-start", po::bool_switch(&fast_start), "poll the LO lock and the PPS edge instead of fixed sleeps, initialize the arrays once with verified responses")
     ;
     // clang-format on
     po::variables_map vm;
@@ -201,199 +243,232 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
         return ~0;
     }
     
+    // Read and validate the sweep plans before touching the hardware (the Tx dwell is set by the Rx sweep)
+    sweep_plan_t plan_tx = plan_file_tx.empty() ? default_sweep_plan(1, nbr_samps_per_degree, nbr_directions, nbr_degrees) 
+    											: load_sweep_plan(plan_file_tx, 1, nbr_samps_per_degree);
+    sweep_plan_t plan_rx = plan_file_rx.empty() ? default_sweep_plan(2, nbr_samps_per_degree, nbr_directions, nbr_degrees) 
+    											: load_sweep_plan(plan_file_rx, 2, nbr_samps_per_degree);
+    
+    // Threading configuration (memory is locked before the buffers are allocated)
+    thread_config_t threads = parse_thread_config(thread_cpus, thread_realtime, lock_memory);
+    lock_process_memory(threads);
+    
+    // All streaming and capture buffers come from one hugepage-backed arena, local to the NIC of the Rx USRP
+    if (arena_config.numa_node < 0){
+    	uhd::device_addr_t dev_addr(args_rx);
+    	arena_config.numa_node = dev_addr.has_key("addr") ? address_numa_node(dev_addr["addr"]) : -1;
+    }
+    align_capture_blocks(capture, recv_batch);
+    buffer_arena arena(capture.block_size*capture.num_blocks + recv_batch*sizeof(std::complex<float>) + ARENA_HEADROOM, arena_config);
+    std::cout << boost::format("Buffer arena: %s") % arena.describe() << std::endl;
+    
+    // Checkpoint journal of the captured Tx/Rx beam pairs, from which --resume continues the capture files
+    capture.rotate_bytes = (uint64_t)(rotate_mb * 1e6);
+    sweep_journal journal(capture, plan_tx, plan_rx, resume);
+    const journal_entry_t* resume_at = journal.last();
+    if (resume){
+    	std::cout << boost::format("Resuming sweep from %s: %u of %u Tx/Rx beam pairs already captured") % journal.path() % journal.num_done() % journal.num_pairs() << std::endl;
+    	capture.resume = (resume_at != NULL) ? &resume_at->position : NULL;
+    }
+    
     // Open the output file
-    outfile.open("//home/francois/uhd-3.15.0.0/host/build/mmwave_code/outfile.dat", std::ofstream::binary);
-    if (outfile.is_open()){
-		printf("Output file opened correctly. \n"); }
-    else{
-		printf("OUTPUT FILE NOT OPENED !!! \n"); }
+    capture.arena = &arena;
+    capture_writer outfile(capture);
+    apply_thread_role(threads, ROLE_WRITER, outfile.writer_thread());
+    std::cout << boost::format("Output file %s opened correctly.") % outfile.current_file() << std::endl;
     
     
-    // ======================================================
-    // Open and initialize serial port of the mmWave array Tx
-    // ======================================================
-    // Create and open the serial port for communication with the mmWave array Tx.
+    // ================================================================
+    // Open and initialize serial ports of the mmWave arrays Tx and Rx
+    // ================================================================
+    // Each array gets its own serial I/O thread, so that both arrays are programmed concurrently
+    aip_controller arrays(ver_aip);
     std::cout << boost::format("Create and open the serial port for mmWave array Tx on %s...") % name_serial_port_tx << std::endl;
-    SerialPort my_serial_port_tx( name_serial_port_tx );
-    // Set serial port parameters 
-    std::cout << boost::format("  -- Set serial port parameters ...") << std::endl;
-    my_serial_port_tx.SetBaudRate( LibSerial::BaudRate::BAUD_115200 );
-    my_serial_port_tx.SetCharacterSize( LibSerial::CharacterSize::CHAR_SIZE_8 );
-    my_serial_port_tx.SetStopBits( LibSerial::StopBits::STOP_BITS_1 ) ;
-    my_serial_port_tx.SetParity( LibSerial::Parity::PARITY_NONE );
-    // Initialize mmWave array Tx
-    mode_tx = 1; // Tx mode
-	std::cout << boost::format("  -- Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
-    send_to_aip(&my_serial_port_tx, "DEG_0", "UP", gain_list_tx, gain_tx, active_list_tx, mode_tx, ver_aip);
-    std::cout << boost::format("  -- Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
-    send_to_aip(&my_serial_port_tx, "DEG_0", "UP", gain_list_tx, gain_tx, active_list_tx, mode_tx, ver_aip);
-    std::cout << boost::format("  -- Setting AiP to %s - %s °") % "LEFT" % "0"  << std::endl;
-    send_to_aip(&my_serial_port_tx, "DEG_0", "LEFT", gain_list_tx, gain_tx, active_list_tx, mode_tx, ver_aip);
-    
-    
-    // ======================================================
-    // Open and initialize serial port of the mmWave array Rx
-    // ======================================================
-    // Create and open the serial port for communication with the mmWave array Tx.
+    size_t array_tx = arrays.add_array(name_serial_port_tx, serial_config);
     std::cout << boost::format("Create and open the serial port for mmWave array Rx on %s...") % name_serial_port_rx << std::endl;
-    SerialPort my_serial_port_rx( name_serial_port_rx );
-    // Set serial port parameters 
-    std::cout << boost::format("  -- Set serial port parameters ...") << std::endl;
-    my_serial_port_rx.SetBaudRate( LibSerial::BaudRate::BAUD_115200 );
-    my_serial_port_rx.SetCharacterSize( LibSerial::CharacterSize::CHAR_SIZE_8 );
-    my_serial_port_rx.SetStopBits( LibSerial::StopBits::STOP_BITS_1 ) ;
-    my_serial_port_rx.SetParity( LibSerial::Parity::PARITY_NONE );
-    // Initialize mmWave array Tx
-    mode_rx = 2; // Tx mode
-	std::cout << boost::format("  -- Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
-    send_to_aip(&my_serial_port_rx, "DEG_0", "UP", gain_list_rx, gain_rx, active_list_rx, mode_rx, ver_aip);
-    std::cout << boost::format("  -- Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
-    send_to_aip(&my_serial_port_rx, "DEG_0", "UP", gain_list_rx, gain_rx, active_list_rx, mode_rx, ver_aip);
-    std::cout << boost::format("  -- Setting AiP to %s - %s °") % "LEFT" % "0"  << std::endl;
-    send_to_aip(&my_serial_port_rx, "DEG_0", "LEFT", gain_list_rx, gain_rx, active_list_rx, mode_rx, ver_aip);
-    
-    
-    // =============================================
-    // Create and initialize USRP Tx and Rx devices
-    // =============================================
-    // Create USRP devices
-    std::cout << boost::format("Creating the USRP-Tx device with: %s...") % args_tx << std::endl;
-    uhd::usrp::multi_usrp::sptr usrp_tx = uhd::usrp::multi_usrp::make(args_tx);
-    std::cout << boost::format("Creating the USRP-Rx-BB device with: %s...") % args_rx << std::endl;
-    uhd::usrp::multi_usrp::sptr usrp_rx_bb = uhd::usrp::multi_usrp::make(args_rx);
-    std::cout << boost::format("Creating the USRP-Rx-LO device with: %s...") % args_rx << std::endl;
-    uhd::usrp::multi_usrp::sptr usrp_rx_lo = uhd::usrp::multi_usrp::make(args_rx);
-    
-    // always select the subdevice first, the channel mapping affects the other settings
-    std::cout << boost::format("Setting subdevice USRP-Tx device to: %s...") % subdev_tx << std::endl;
-    std::cout << boost::format("Setting subdevice USRP-Rx-BB device to: %s...") % subdev_rx_bb << std::endl;
-    std::cout << boost::format("Setting subdevice USRP-Rx-LO device to: %s...") % subdev_rx_lo << std::endl;
-    usrp_tx->set_tx_subdev_spec(subdev_tx); 
-    usrp_rx_bb->set_rx_subdev_spec(subdev_rx_bb); 
-    usrp_rx_lo->set_tx_subdev_spec(subdev_rx_lo);
-    std::cout << boost::format("Using USRP-Tx Device: %s") % usrp_tx->get_pp_string() << std::endl;
-    std::cout << boost::format("Using USRP-Rx-BB Device: %s") % usrp_rx_bb->get_pp_string() << std::endl;
-    std::cout << boost::format("Using USRP-Rx-LO Device: %s") % usrp_rx_lo->get_pp_string() << std::endl;
-    
-    // Lock mboard clocks
-    if (vm.count("ref")) {
-    	usrp_tx->set_clock_source(ref);
-    	usrp_rx_bb->set_clock_source(ref);
-    	usrp_rx_lo->set_clock_source(ref);
+    size_t array_rx = arrays.add_array(name_serial_port_rx, serial_config);
+    arrays.submit(array_tx, [&](aip_transport*){ apply_thread_role(threads, ROLE_SERIAL); }).get();
+    arrays.submit(array_rx, [&](aip_transport*){ apply_thread_role(threads, ROLE_SERIAL); }).get();
+    
+    // High-rate mode: transport of each device sized for its rate, checked against the host limits
+    transport_params_t transport_tx = transport_params_for_rate(rate_tx, 2);
+    transport_params_t transport_rx = transport_params_for_rate(rate_rx, 1);
+    if (high_rate){
+    	args_tx = tune_device_args(args_tx, transport_tx);
+    	args_rx = tune_device_args(args_rx, transport_rx);
+    	check_transport_limits(transport_tx);
+    	check_transport_limits(transport_rx);
+    	if (vm["self-test"].defaulted()) self_test = 1.0;
     }
     
-    // set the sample rate
-    std::cout << boost::format("Setting USRP-Tx Rate: %f Msps...") % (rate_tx / 1e6) << std::endl;
-    usrp_tx->set_tx_rate(rate_tx);
-    std::cout << boost::format("Actual USRP-Tx Rate: %f Msps...") % (usrp_tx->get_tx_rate() / 1e6) << std::endl;
-    std::cout << boost::format("Setting USRP-Rx-BB Rx Rate and USRP-Rx-LO Tx Rate: %f Msps...") % (rate_rx / 1e6) << std::endl;
-    usrp_rx_bb->set_rx_rate(rate_rx);
-    usrp_rx_lo->set_tx_rate(rate_rx);
-    std::cout << boost::format("Actual USRP-Rx-BB Rx Rate and USRP-Rx-LO Tx Rate: %f Msps and %f Msps...") % (usrp_rx_bb->get_rx_rate() / 1e6) % (usrp_rx_lo->get_tx_rate() / 1e6)<< std::endl;
-	
-	// set the center frequency of the baseband and LO chains
-    std::cout << boost::format("Setting USRP-Tx BB and USRP-Rx BB Freq: %f MHz...") % (freq_bb / 1e6) << std::endl;
-    uhd::tune_request_t tune_request_bb(freq_bb);
-    usrp_tx->set_tx_freq(tune_request_bb, 0);
-    usrp_rx_bb->set_rx_freq(tune_request_bb, 0);
-    std::cout << boost::format("Actual USRP-Tx BB and USRP-Rx BB Freq: %f MHz and %f MHz...") % (usrp_tx->get_tx_freq(0) / 1e6) % (usrp_rx_bb->get_rx_freq(0) / 1e6) << std::endl;
-	std::cout << boost::format("Setting USRP-Tx LO and USRP-Rx LO Freq: %f MHz...") % (freq_lo / 1e6) << std::endl;
-    uhd::tune_request_t tune_request_lo(freq_lo);
-    usrp_tx->set_tx_freq(tune_request_lo, 1);
-    usrp_rx_lo->set_tx_freq(tune_request_lo, 0);
-    std::cout << boost::format("Actual USRP-Tx LO and USRP-Rx LO Freq: %f MHz and %f Msps...") % (usrp_tx->get_tx_freq(1) / 1e6) % (usrp_rx_lo->get_tx_freq(0)) << std::endl;
-    
-	// set the gains of the baseband and LO chains
-    std::cout << boost::format("Setting USRP-Tx BB Gain: %f dB...") % gain_tx_bb << std::endl;
-    usrp_tx->set_tx_gain(gain_tx_bb, 0);
-    std::cout << boost::format("Actual USRP-Tx BB Gain: %f dB...") % usrp_tx->get_tx_gain(0) << std::endl;
-    std::cout << boost::format("Setting USRP-Rx BB Gain: %f dB...") % gain_rx_bb << std::endl;
-    usrp_rx_bb->set_rx_gain(gain_rx_bb, 0);
-    std::cout << boost::format("Actual USRP-Rx BB Gain: %f dB...") % usrp_rx_bb->get_rx_gain(0) << std::endl;
-    std::cout << boost::format("Setting USRP-Tx LO Gain: %f dB...") % gain_lo << std::endl;
-    usrp_tx->set_tx_gain(gain_lo, 1);
-    std::cout << boost::format("Actual USRP-Tx LO Gain: %f dB...") % usrp_tx->get_tx_gain(1) << std::endl;
-    std::cout << boost::format("Setting USRP-Rx LO Gain: %f dB...") % gain_lo << std::endl;
-    usrp_rx_lo->set_tx_gain(gain_lo, 0);
-    std::cout << boost::format("Actual USRP-Rx LO Gain: %f dB...") % usrp_rx_lo->get_tx_gain(0) << std::endl;
-    
-    // set the Tx and Rx antenna ports
-    std::cout << boost::format("Setting USRP Tx and Rx antenna ports...") << std::endl;
-    usrp_tx->set_tx_antenna(ant_bb, 0);
-    usrp_tx->set_tx_antenna(ant_lo, 1);
-    usrp_rx_bb->set_rx_antenna(ant_bb, 0);
-    usrp_rx_lo->set_tx_antenna(ant_lo, 0);
-    
-    // allow for some setup time
-    std::this_thread::sleep_for(std::chrono::seconds(1)); 
     
-    // Setting timestamp and time source
-    std::cout << boost::format("Setting USRP Tx and Rx timestamps to 0...") << std::endl;
-    usrp_tx->set_time_source(ref);
-    usrp_tx->set_time_unknown_pps(uhd::time_spec_t(0.0));
-    usrp_rx_bb->set_time_source(ref);
-    usrp_rx_bb->set_time_unknown_pps(uhd::time_spec_t(0.0));
-    std::this_thread::sleep_for(std::chrono::seconds(1)); // wait for pps sync pulse
-    usrp_tx->set_time_now(0.0);
-    usrp_rx_bb->set_time_now(0.0);
-    
-    // Check Ref and LO Lock detect for USRP Tx
-    std::vector<std::string> sensor_names;
-    sensor_names = usrp_tx->get_tx_sensor_names(0);
-    if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked")
-        != sensor_names.end()) {
-        uhd::sensor_value_t lo_locked = usrp_tx->get_tx_sensor("lo_locked", 0);
-        std::cout << boost::format("Checking TX: %s ...") % lo_locked.to_pp_string() << std::endl;
-        UHD_ASSERT_THROW(lo_locked.to_bool());
-    }
-    size_t mboard_sensor_idx = 0;
-    sensor_names = usrp_tx->get_mboard_sensor_names(mboard_sensor_idx);
-    if ((ref == "external")
-        and (std::find(sensor_names.begin(), sensor_names.end(), "ref_locked")
-                != sensor_names.end())) {
-        uhd::sensor_value_t ref_locked =
-            usrp_tx->get_mboard_sensor("ref_locked", mboard_sensor_idx);
-        std::cout << boost::format("Checking TX: %s ...") % ref_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(ref_locked.to_bool());
-    }
-
-    // Check Ref and LO Lock detect for USRP Rx
-    sensor_names = usrp_rx_bb->get_rx_sensor_names(0);
-    if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked")
-        != sensor_names.end()) {
-        uhd::sensor_value_t lo_locked = usrp_rx_bb->get_rx_sensor("lo_locked", 0);
-        std::cout << boost::format("Checking RX: %s ...") % lo_locked.to_pp_string() << std::endl;
-        UHD_ASSERT_THROW(lo_locked.to_bool());
-    }
-    sensor_names = usrp_rx_lo->get_tx_sensor_names(0);
-    if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked")
-        != sensor_names.end()) {
-        uhd::sensor_value_t lo_locked = usrp_rx_lo->get_tx_sensor("lo_locked", 0);
-        std::cout << boost::format("Checking TX: %s ...") % lo_locked.to_pp_string() << std::endl;
-        UHD_ASSERT_THROW(lo_locked.to_bool());
+    // ==============================================================
+    // Bring up the mmWave arrays and the USRP Tx and Rx devices
+    // ==============================================================
+    // The arrays, the USRP-Tx and the USRP-Rx are set up concurrently, each as a chain of steps.
+    // The BB and LO chains of the USRP-Rx (same device) are tuned one after the other, the self-test
+    // measures one device at a time and the time alignment waits for both devices to be locked.
+    uhd::usrp::multi_usrp::sptr usrp_tx, usrp_rx_bb, usrp_rx_lo;
+    device_sessions sessions(shared_session);
+    std::vector<std::future<void>> pending;
+    bringup bring(parallel_bringup);
+    mode_tx = 1; // Tx mode
+    mode_rx = 2; // Rx mode
+    
+    // Initialize mmWave arrays Tx and Rx
+    bring.add("AiP Tx init", [&](){
+    	std::vector<std::future<void>> commands;
+    	if (fast_start){
+    		// one configuration, repeated only if the array does not acknowledge it
+    		bring.log(str(boost::format("  -- Setting AiP Tx to %s - %s ° (verified)") % "LEFT" % "0"));
+    		commands.push_back(arrays.configure_verified(array_tx, make_aip_beam("DEG_0", "LEFT", gain_list_tx, gain_tx, active_list_tx, mode_tx)));
+    	}
+    	else{
+    		bring.log(str(boost::format("  -- Setting AiP Tx to %s - %s °, %s - %s °, %s - %s °") % "UP" % "0" % "UP" % "0" % "LEFT" % "0"));
+	    	commands.push_back(arrays.configure(array_tx, make_aip_beam("DEG_0", "UP", gain_list_tx, gain_tx, active_list_tx, mode_tx)));
+	    	commands.push_back(arrays.configure(array_tx, make_aip_beam("DEG_0", "UP", gain_list_tx, gain_tx, active_list_tx, mode_tx)));
+	    	commands.push_back(arrays.configure(array_tx, make_aip_beam("DEG_0", "LEFT", gain_list_tx, gain_tx, active_list_tx, mode_tx)));
+    	}
+    	wait_all(commands);
+    });
+    bring.add("AiP Rx init", [&](){
+    	std::vector<std::future<void>> commands;
+    	if (fast_start){
+    		bring.log(str(boost::format("  -- Setting AiP Rx to %s - %s ° (verified)") % "LEFT" % "0"));
+    		commands.push_back(arrays.configure_verified(array_rx, make_aip_beam("DEG_0", "LEFT", gain_list_rx, gain_rx, active_list_rx, mode_rx)));
+    	}
+    	else{
+    		bring.log(str(boost::format("  -- Setting AiP Rx to %s - %s °, %s - %s °, %s - %s °") % "UP" % "0" % "UP" % "0" % "LEFT" % "0"));
+	    	commands.push_back(arrays.configure(array_rx, make_aip_beam("DEG_0", "UP", gain_list_rx, gain_rx, active_list_rx, mode_rx)));
+	    	commands.push_back(arrays.configure(array_rx, make_aip_beam("DEG_0", "UP", gain_list_rx, gain_rx, active_list_rx, mode_rx)));
+	    	commands.push_back(arrays.configure(array_rx, make_aip_beam("DEG_0", "LEFT", gain_list_rx, gain_rx, active_list_rx, mode_rx)));
+    	}
+    	wait_all(commands);
+    });
+    
+    // USRP-Tx: device, then subdevice (always first, the channel mapping affects the other settings), clock, rate, BB and LO chains
+    size_t step_make_tx = bring.add("USRP-Tx make", [&](){
+    	bring.log(str(boost::format("Creating the USRP-Tx device with: %s...") % args_tx));
+    	usrp_tx = sessions.open("Tx", args_tx, "tx");
+    });
+    size_t step_tune_tx = bring.add("USRP-Tx tune", [&](){
+    	usrp_tx->set_tx_subdev_spec(subdev_tx);
+    	bring.log(str(boost::format("Using USRP-Tx Device (subdevice %s): %s") % subdev_tx % usrp_tx->get_pp_string()));
+    	if (vm.count("ref")) usrp_tx->set_clock_source(ref);
+    	usrp_tx->set_tx_rate(rate_tx);
+    	usrp_tx->set_tx_freq(uhd::tune_request_t(freq_bb), 0);
+    	usrp_tx->set_tx_freq(uhd::tune_request_t(freq_lo), 1);
+    	usrp_tx->set_tx_gain(gain_tx_bb, 0);
+    	usrp_tx->set_tx_gain(gain_lo, 1);
+    	usrp_tx->set_tx_antenna(ant_bb, 0);
+    	usrp_tx->set_tx_antenna(ant_lo, 1);
+    	bring.log(str(boost::format("Actual USRP-Tx Rate: %f Msps, BB Freq: %f MHz, BB Gain: %f dB, LO Freq: %f MHz, LO Gain: %f dB") 
+    		% (usrp_tx->get_tx_rate() / 1e6) % (usrp_tx->get_tx_freq(0) / 1e6) % usrp_tx->get_tx_gain(0) % (usrp_tx->get_tx_freq(1) / 1e6) % usrp_tx->get_tx_gain(1)));
+    }, {step_make_tx});
+    
+    // USRP-Rx: BB (Rx) and LO (Tx) chains
+    size_t step_make_rx = bring.add("USRP-Rx make", [&](){
+    	bring.log(str(boost::format("Creating the USRP-Rx-BB and USRP-Rx-LO devices with: %s...") % args_rx));
+    	usrp_rx_bb = sessions.open("Rx-BB", args_rx, "rx");
+    	usrp_rx_lo = sessions.open("Rx-LO", args_rx, "tx");
+    });
+    size_t step_tune_rx_bb = bring.add("USRP-Rx-BB tune", [&](){
+    	usrp_rx_bb->set_rx_subdev_spec(subdev_rx_bb);
+    	bring.log(str(boost::format("Using USRP-Rx-BB Device (subdevice %s): %s") % subdev_rx_bb % usrp_rx_bb->get_pp_string()));
+    	if (vm.count("ref")) usrp_rx_bb->set_clock_source(ref);
+    	usrp_rx_bb->set_rx_rate(rate_rx);
+    	usrp_rx_bb->set_rx_freq(uhd::tune_request_t(freq_bb), 0);
+    	usrp_rx_bb->set_rx_gain(gain_rx_bb, 0);
+    	usrp_rx_bb->set_rx_antenna(ant_bb, 0);
+    	bring.log(str(boost::format("Actual USRP-Rx-BB Rate: %f Msps, Freq: %f MHz, Gain: %f dB") 
+    		% (usrp_rx_bb->get_rx_rate() / 1e6) % (usrp_rx_bb->get_rx_freq(0) / 1e6) % usrp_rx_bb->get_rx_gain(0)));
+    }, {step_make_rx});
+    size_t step_tune_rx_lo = bring.add("USRP-Rx-LO tune", [&](){
+    	usrp_rx_lo->set_tx_subdev_spec(subdev_rx_lo);
+    	bring.log(str(boost::format("Using USRP-Rx-LO Device (subdevice %s): %s") % subdev_rx_lo % usrp_rx_lo->get_pp_string()));
+    	if (vm.count("ref")) usrp_rx_lo->set_clock_source(ref);
+    	usrp_rx_lo->set_tx_rate(rate_rx);
+    	usrp_rx_lo->set_tx_freq(uhd::tune_request_t(freq_lo), 0);
+    	usrp_rx_lo->set_tx_gain(gain_lo, 0);
+    	usrp_rx_lo->set_tx_antenna(ant_lo, 0);
+    	bring.log(str(boost::format("Actual USRP-Rx-LO Rate: %f Msps, Freq: %f MHz, Gain: %f dB") 
+    		% (usrp_rx_lo->get_tx_rate() / 1e6) % (usrp_rx_lo->get_tx_freq(0) / 1e6) % usrp_rx_lo->get_tx_gain(0)));
+    }, {step_tune_rx_bb});
+    
+    // Streaming self-test at the sweep rates, on temporary streamers, one device at a time so that they do not share the link
+    std::vector<size_t> tuned = {step_tune_tx, step_tune_rx_lo};
+    if (self_test > 0){
+    	tuned = {bring.add("self-test", [&](){
+	    	uhd::stream_args_t stream_args_test("fc32", "sc16");
+	    	stream_args_test.channels = {0, 1};
+	    	if (high_rate) tune_stream_args(stream_args_test, transport_tx);
+	    	print_self_test(tx_self_test(usrp_tx->get_tx_stream(stream_args_test), usrp_tx->get_tx_rate(), self_test));
+	    	stream_args_test.channels = {0};
+	    	if (high_rate) tune_stream_args(stream_args_test, transport_rx);
+	    	print_self_test(rx_self_test(usrp_rx_bb->get_rx_stream(stream_args_test), usrp_rx_bb->get_rx_rate(), self_test));
+	    	print_self_test(tx_self_test(usrp_rx_lo->get_tx_stream(stream_args_test), usrp_rx_lo->get_tx_rate(), self_test));
+    	}, tuned)};
     }
-    mboard_sensor_idx = 0;
-    sensor_names = usrp_rx_bb->get_mboard_sensor_names(mboard_sensor_idx);
-    if ((ref == "external")
-        and (std::find(sensor_names.begin(), sensor_names.end(), "ref_locked")
-                != sensor_names.end())) {
-        uhd::sensor_value_t ref_locked =
-            usrp_rx_bb->get_mboard_sensor("ref_locked", mboard_sensor_idx);
-        std::cout << boost::format("Checking RX: %s ...") % ref_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(ref_locked.to_bool());
+    
+    // Wait for the LOs (and reference) to lock: polled with --fast-start, a fixed setup time otherwise
+    size_t step_lock_tx = bring.add("USRP-Tx lock", [&](){
+    	if (not fast_start){
+    		std::this_thread::sleep_for(std::chrono::seconds(1)); 
+    		return;
+    	}
+    	wait_for_lo_locked(usrp_tx, "tx", {0, 1});
+    	if (ref == "external") wait_for_ref_locked(usrp_tx);
+    }, tuned);
+    size_t step_lock_rx = bring.add("USRP-Rx lock", [&](){
+    	if (not fast_start){
+    		std::this_thread::sleep_for(std::chrono::seconds(1)); 
+    		return;
+    	}
+    	wait_for_lo_locked(usrp_rx_bb, "rx", {0});
+    	wait_for_lo_locked(usrp_rx_lo, "tx", {0});
+    	if (ref == "external"){
+    		wait_for_ref_locked(usrp_rx_bb);
+    		wait_for_ref_locked(usrp_rx_lo);
+    	}
+    }, tuned);
+    
+    // Setting timestamp and time source
+    size_t step_time = bring.add("time alignment", [&](){
+    	bring.log("Setting USRP Tx and Rx timestamps to 0...");
+	    usrp_tx->set_time_source(ref);
+	    usrp_rx_bb->set_time_source(ref);
+	    if (fast_start){
+	    	// both devices latch 0 on the same PPS edge, detected by polling
+	    	if (not sync_time_on_pps({usrp_tx, usrp_rx_bb})){
+	    		bring.log(str(boost::format("No PPS edge on the %s source, setting the times now") % ref));
+	    		usrp_tx->set_time_now(0.0);
+	    		usrp_rx_bb->set_time_now(0.0);
+	    	}
+	    }
+	    else{
+		    usrp_tx->set_time_unknown_pps(uhd::time_spec_t(0.0));
+		    usrp_rx_bb->set_time_unknown_pps(uhd::time_spec_t(0.0));
+		    std::this_thread::sleep_for(std::chrono::seconds(1)); // wait for pps sync pulse
+		    usrp_tx->set_time_now(0.0);
+		    usrp_rx_bb->set_time_now(0.0);
+	    }
+    }, {step_lock_tx, step_lock_rx});
+    
+    // Check Ref and LO Lock detect for USRP Tx and Rx
+    bring.add("lock check", [&](){
+    	check_locked(usrp_tx, "tx", {0}, ref == "external", "TX");
+    	check_locked(usrp_rx_bb, "rx", {0}, ref == "external", "RX");
+    	check_locked(usrp_rx_lo, "tx", {0}, ref == "external", "TX");
+    }, {step_time});
+    
+    try{
+    	bring.run();
     }
-    sensor_names = usrp_rx_lo->get_mboard_sensor_names(mboard_sensor_idx);
-    if ((ref == "external")
-        and (std::find(sensor_names.begin(), sensor_names.end(), "ref_locked")
-                != sensor_names.end())) {
-        uhd::sensor_value_t ref_locked =
-            usrp_rx_lo->get_mboard_sensor("ref_locked", mboard_sensor_idx);
-        std::cout << boost::format("Checking TX: %s ...") % ref_locked.to_pp_string()
-                  << std::endl;
-        UHD_ASSERT_THROW(ref_locked.to_bool());
+    catch (...){
+    	bring.print_report(); // shows which step failed and which were not run
+    	throw;
     }
+    bring.print_report();
     
     
     
@@ -401,32 +476,31 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // Create signals to transmit and UHD Tx streamers
     // ================================================
     
-    // Generate baseband data to transmit
-    std::vector<std::complex<float>> data_bb(10000);
-    srand (1);
-    for (size_t i = 0; i < 1000; i++){
-        data_bb[i] = (2*(rand() % 2) -1) + (2*(rand() % 2) -1)*1j ;
+    // Baseband data to transmit: waveform file, or the QPSK burst of srand(1)
+    waveform_source::sptr data_bb;
+    if (file.empty()){
+    	data_bb = waveform_source::from_samples(legacy_qpsk_burst(1), "legacy-qpsk seed=1 symbols=1000 length=10000");
     }
-    for (size_t i = 1000; i < data_bb.size(); i++){
-        data_bb[i] = 0.0;
+    else{
+    	data_bb = waveform_source::map_file(file);
+    	std::cout << boost::format("Tx BB waveform %s: %s (%u samples, mapped)") % file % data_bb->description() % data_bb->size() << std::endl;
     }
     
-    // Generate LO signals to transmit
-    std::vector<std::complex<float>> data_lo(10000);
-    for (size_t i = 0; i < data_lo.size(); i++){
-        data_lo[i] = 1.0;
-    }
+    // LO signals to transmit (one source shared by both LO workers)
+    waveform_source::sptr data_lo = waveform_source::from_samples(constant_waveform(10000), "constant length=10000 amplitude=1");
     
     // create a transmit streamer for USRP-Tx
     std::vector<size_t> channel_nums_tx = {0, 1};
     uhd::stream_args_t stream_args_tx("fc32", "sc16");
     stream_args_tx.channels = channel_nums_tx;
+    if (high_rate) tune_stream_args(stream_args_tx, transport_tx);
     uhd::tx_streamer::sptr stream_tx = usrp_tx->get_tx_stream(stream_args_tx);
     
     // create a transmit streamer for USRP-Rx-LO
     std::vector<size_t> channel_nums_rx_lo = {0};
     uhd::stream_args_t stream_args_rx_lo("fc32", "sc16");
     stream_args_rx_lo.channels = channel_nums_rx_lo;
+    if (high_rate) tune_stream_args(stream_args_rx_lo, transport_rx);
     uhd::tx_streamer::sptr stream_rx_lo = usrp_rx_lo->get_tx_stream(stream_args_rx_lo);
     
     
@@ -435,10 +509,14 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // =========================================================
     std::cout << boost::format("Starting USRP-Tx thread...") << std::endl;
     boost::thread_group tx_thread;
-    tx_thread.create_thread(boost::bind(&tx_worker, data_bb, data_lo, stream_tx));
+    boost::thread* tx_worker_thread = tx_thread.create_thread(boost::bind(&tx_worker, data_bb, data_lo, stream_tx, &arena, tx_start, loop));
+    apply_thread_role(threads, ROLE_TX, tx_worker_thread->native_handle());
     std::cout << boost::format("Starting USRP-Rx-LO thread...") << std::endl;
     boost::thread_group rx_lo_thread;
-    rx_lo_thread.create_thread(boost::bind(&rx_lo_worker, data_lo, stream_rx_lo));
+    boost::thread* rx_lo_worker_thread = rx_lo_thread.create_thread(boost::bind(&rx_lo_worker, data_lo, stream_rx_lo, &arena, tx_start));
+    apply_thread_role(threads, ROLE_LO, rx_lo_worker_thread->native_handle());
+    tx_async_monitor tx_monitor("tx", stream_tx);
+    tx_async_monitor rx_lo_monitor("rx_lo", stream_rx_lo);
     
     
     // ====================
@@ -448,19 +526,22 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     std::vector<size_t> channel_nums_rx_bb = {0};
     uhd::stream_args_t stream_args_rx_bb("fc32", "sc16");
     stream_args_rx_bb.channels = channel_nums_rx_bb;
+    if (high_rate) tune_stream_args(stream_args_rx_bb, transport_rx);
     uhd::rx_streamer::sptr rx_stream = usrp_rx_bb->get_rx_stream(stream_args_rx_bb);
+    sessions.print_report();
     
-    //meta-data will be filled in by recv()
-    uhd::rx_metadata_t md;
-    
-    // allocate a buffer which we re-use for each channel
-	size_t spb = rx_stream->get_max_num_samps(); 
-    std::vector<std::complex<float>> 	buff_bb(spb);
-    std::vector<std::complex<float>*> 	buffs(1);
-    buffs[0] = &buff_bb.front(); 
-    
+    // Rx streaming starts one second after the first Tx and LO samples (2 s with the default --tx-start)
+    double seconds_in_future = tx_start + 1.0;
     //the first call to recv() will block this many seconds before receiving
     double timeout = seconds_in_future + 0.1; //timeout 
+    rx_capture receiver(rx_stream, outfile, usrp_rx_bb->get_rx_rate(), timeout, max_recaptures, recv_batch, &arena);
+    receiver.add_tx_monitor(&tx_monitor);
+    receiver.add_tx_monitor(&rx_lo_monitor);
+    if (resume_at != NULL) receiver.set_next_segment(resume_at->segments);
+    
+    // the recv loop runs on the main thread
+    apply_thread_role(threads, ROLE_RX);
+    print_thread_report();
     
     //setup streaming
 	std::cout << boost::format("Begin streaming , %f seconds in the future...")  % seconds_in_future << std::endl;
@@ -468,102 +549,68 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 	stream_cmd.stream_now = false;
 	stream_cmd.time_spec = uhd::time_spec_t(seconds_in_future);
 	rx_stream->issue_stream_cmd(stream_cmd);
+	startup.report_first_sample(usrp_rx_bb->get_time_now().get_real_secs(), seconds_in_future);
 	
     
     // ========================================================
 	// Start looping over all AiP directions at Tx and Rx side
 	// ========================================================
 	
-    //float 			time_next_direction = 1.0; 	// initial time of first transmission
-    std::string 	direction_tx, direction_rx;
-    std::string 	degrees_tx, degrees_rx;
-	std::string 	angle_tx, angle_rx; 
+	// the verified configuration of the fast start already ran the init sequence
+	if (not fast_start){
+		pending.push_back(arrays.init(array_tx));
+		pending.push_back(arrays.init(array_rx));
+		wait_all(pending);
+	}
 	
-	mode_tx = 1;
-	mode_rx = 2;
+	// The device time starts over with every run: a resumed sweep keeps counting from the last captured pair
+	double time_offset = journal.time_offset(usrp_rx_bb->get_time_now().get_real_secs());
+	sweep_engine::clock_fn sweep_time = [usrp_rx_bb, time_offset](){ return usrp_rx_bb->get_time_now().get_real_secs() + time_offset; };
+	if (resume_at != NULL){
+		outfile.write_metadata(str(boost::format("{\"journal\": \"resume\", \"pairs_done\": %u, \"segment\": %u, \"time\": %f, \"time_offset\": %f}")
+			% journal.num_done() % resume_at->segments % sweep_time() % time_offset));
+	}
 	
-	init_aip(&my_serial_port_tx, ver_aip);
-	init_aip(&my_serial_port_rx, ver_aip);
+	// Loop over all Tx beams and, for each of them, over all Rx beams
+	sweep_engine engine(arrays, sweep_time);
+	engine.set_done([&journal](size_t tx, size_t rx){ return journal.done(tx, rx); });
 	
-	// Loop over all Tx angles
-    for (int cpt_direction_tx = 0; cpt_direction_tx < nbr_directions; cpt_direction_tx++){
-    	for (int cpt_degrees_tx = 0; cpt_degrees_tx < nbr_degrees; cpt_degrees_tx++){
-    		direction_tx = all_directions[cpt_direction_tx];
-			if (cpt_direction_tx == 0){
-				degrees_tx 	= all_degrees[nbr_degrees-1-cpt_degrees_tx];
-				angle_tx 	= all_angles[nbr_degrees-1-cpt_degrees_tx];
-			}
-			else if (cpt_direction_tx == 1){
-				degrees_tx 	= all_degrees[cpt_degrees_tx];
-				angle_tx 	= all_angles[cpt_degrees_tx];
-			}
-			// Setting Tx AiP
-			std::cout << boost::format("Setting Tx AiP to %s - %s ° at time %f") % direction_tx % angle_tx % usrp_tx->get_time_now().get_real_secs() << std::endl;
-			send_to_aip_fast(&my_serial_port_tx, degrees_tx, direction_tx, gain_list_tx, gain_tx, active_list_tx, mode_tx, ver_aip);
-    		
-    		// Loop over all Rx angles
-    		for (int cpt_direction_rx = 0; cpt_direction_rx < nbr_directions; cpt_direction_rx++){
-    			for (int cpt_degrees_rx = 0; cpt_degrees_rx < nbr_degrees; cpt_degrees_rx++){
-    				direction_rx = all_directions[cpt_direction_rx];
-    				if (cpt_direction_rx == 0){
-    					degrees_rx 	= all_degrees[nbr_degrees-1-cpt_degrees_rx];
-    					angle_rx 	= all_angles[nbr_degrees-1-cpt_degrees_rx];
-    				}
-    				else if (cpt_direction_rx == 1){
-    					degrees_rx 	= all_degrees[cpt_degrees_rx];
-    					angle_rx 	= all_angles[cpt_degrees_rx];
-    				}
-    				// Setting Rx AiP
-    				float time_now = usrp_rx_bb->get_time_now().get_real_secs() ;    	
-					std::cout << boost::format("Setting Rx AiP to %s - %s ° at time %f") % direction_rx % angle_rx % time_now << std::endl;
-					send_to_aip_fast(&my_serial_port_rx, degrees_rx, direction_rx, gain_list_rx, gain_rx, active_list_rx, mode_rx, ver_aip);
-    				
-    				// Write Rx and Tx AiP data to file
-    				if (outfile.is_open()) {
-						outfile << std::endl << "AiP Tx data" << std::endl ;
-						outfile << boost::format("%s - %s degrees at time %f") % direction_tx % angle_tx % time_now;
-						outfile << std::endl << "AiP Rx data" << std::endl ;
-						outfile << boost::format("%s - %s degrees at time %f") % direction_rx % angle_rx % time_now;
-						outfile << std::endl;
-					}
-					
-					// Receive "nbr_samps_per_degree" samples
-					if (outfile.is_open()) {
-						outfile << std::endl << "USRP data" << std::endl ;
-					}
-					size_t num_acc_samps = 0; //number of accumulated samples
-					while(num_acc_samps < nbr_samps_per_degree){
-						//receive a single packet
-						size_t num_rx_samps = rx_stream->recv(&buffs.front(), buffs.size(), md, timeout, true);
-
-						//use a small timeout for subsequent packets
-						timeout = 0.1;
-						
-						//handle the error code
-						if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) break;
-						if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
-							throw std::runtime_error(str(boost::format(
-								"Receiver error %s"
-							) % md.strerror()));
-						}
-						
-						if (outfile.is_open()) {
-							outfile.write((const char*)&buffs.front(), num_rx_samps*sizeof(std::complex<float>));
-						}
-						
-						num_acc_samps += num_rx_samps;
-					}
-					std::cout << boost::format("  -- Received %f samples") % num_acc_samps << std::endl;
-					
-					if (outfile.is_open()) {
-						outfile << std::endl;
-					}
-					
-    			}
-			}    	
-			
-    	}    
-    }
+	// Temperature time series of both arrays in the capture metadata
+	aip_telemetry telemetry(arrays, temp_interval, [&](const std::string& line){ outfile.write_metadata(line); });
+	if (temp_interval > 0){
+		telemetry.add_array(array_tx, "tx");
+		telemetry.add_array(array_rx, "rx");
+		engine.set_telemetry(&telemetry);
+	}
+	
+	engine.run_joint(array_tx, plan_tx, array_rx, plan_rx, [&](size_t tx, const sweep_step_t& step_tx, size_t rx, const sweep_step_t& step_rx, double time_now){
+		// Receive "step_rx.dwell_samps" samples, with the Rx and Tx AiP data as header
+		receiver.capture_segment(str(boost::format("\nAiP Tx data\n%s - %s degrees at time %f\nAiP Rx data\n%s - %s degrees at time %f\n") 
+									 % step_tx.direction % step_tx.angle % time_now % step_rx.direction % step_rx.angle % time_now),
+								 str(boost::format("Tx %s - %s / Rx %s - %s") % step_tx.direction % step_tx.angle % step_rx.direction % step_rx.angle),
+								 time_now, step_rx.dwell_samps);
+		
+		// The pair goes to the journal once its segments are on disk (from the writer thread)
+		journal_entry_t entry;
+		entry.tx 		= tx;
+		entry.rx 		= rx;
+		entry.segments 	= receiver.num_segments();
+		entry.time 		= sweep_time();
+		entry.wall 		= sweep_journal::wall_time();
+		outfile.checkpoint([&journal, entry](const capture_position_t& position) mutable {
+			entry.position = position;
+			journal.append(entry);
+		});
+	});
+	
+	// Flush the capture files
+	outfile.close();
+	receiver.print_report();
+	outfile.print_compression_report();
+	tx_monitor.print_report();
+	rx_lo_monitor.print_report();
+	if (temp_interval > 0) telemetry.print_report();
+	std::cout << boost::format("Wrote %u capture file(s) to %s") % outfile.num_files() % capture.out_dir << std::endl;
     
     
     
@@ -575,16 +622,18 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     
     // Disable AiP Tx and Rx
     std::cout << std::endl << "Disabling mmWave Tx and Rx ..." << std::endl;
-    disable_aip(&my_serial_port_tx, ver_aip);
-    disable_aip(&my_serial_port_rx, ver_aip);
+    pending.push_back(arrays.disable(array_tx));
+    pending.push_back(arrays.disable(array_rx));
+    wait_all(pending);
     
     // Close serial port
     std::cout << "Close serial ports for mmWave Tx and Rx ..." << std::endl;
-    my_serial_port_tx.Close();
-    my_serial_port_rx.Close();
+    arrays.close();
     
     // Stopping all transmitter threads
     stop_signal_called = true;
+    tx_thread.join_all();
+    rx_lo_thread.join_all();
     
     // finished
     std::cout << std::endl << "Done!" << std::endl << std::endl;
@@ -0,0 +1,86 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include <uhd/utils/safe_main.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "analysis.h"
+#include "replay.h"
+namespace po = boost::program_options;
+
+
+
+int UHD_SAFE_MAIN(int argc, char* argv[])
+{
+    // variables to be set by po
+    std::vector<std::string> files;
+    std::string stages_list;
+    double rate;
+    size_t channels;
+    replay_config_t replay_config;
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+    desc.add_options()
+        ("help", "help message")
+        ("file", po::value<std::vector<std::string>>(&files), "capture file(s) written by mmwave_rx, mmwave_joint_txrx or the original tools")
+        ("rate", po::value<double>(&rate)->default_value(1e6), "sample rate of the captures (not stored in the files)")
+        ("channels", po::value<size_t>(&channels)->default_value(1), "channels interleaved in the captures")
+        ("stages", po::value<std::string>(&stages_list)->default_value("power,spectrum"), "analysis stages to run on every segment, comma separated (power, spectrum)")
+        ("threads", po::value<size_t>(&replay_config.threads)->default_value(0), "worker threads (0: one per core)")
+        ("paced", po::value<bool>(&replay_config.paced)->default_value(false), "release the segments at the sample rate, as the capture did")
+        ("repeat", po::value<size_t>(&replay_config.repeat)->default_value(1), "passes over the captures (throughput measurements)")
+    ;
+    // clang-format on
+    po::positional_options_description positional;
+    positional.add("file", -1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help") or files.empty()) {
+        std::cout << boost::format("mmWave capture replay %s") % desc << std::endl;
+        std::cout << "Feeds the segments of recorded captures, with their beams, through the analysis stages." << std::endl
+                  << "    mmwave_replay --rate 1e6 --stages power,spectrum outfile.dat" << std::endl;
+        return ~0;
+    }
+
+    std::vector<std::string> stage_names;
+    boost::split(stage_names, stages_list, boost::is_any_of(","), boost::token_compress_on);
+    std::vector<std::unique_ptr<analysis_stage>> stages;
+    std::vector<analysis_stage*> stage_ptrs;
+    for (size_t i = 0; i < stage_names.size(); i++){
+        if (stage_names[i].empty()) continue;
+        stages.push_back(make_analysis_stage(stage_names[i]));
+        stage_ptrs.push_back(stages.back().get());
+    }
+
+    std::vector<std::unique_ptr<capture_file>> captures;
+    std::vector<capture_file*> capture_ptrs;
+    for (size_t i = 0; i < files.size(); i++){
+        captures.push_back(std::unique_ptr<capture_file>(new capture_file(files[i], rate, channels)));
+        capture_ptrs.push_back(captures.back().get());
+        std::cout << boost::format("%s: %u segments, %u samples (indexed in %.1f ms)")
+            % files[i] % captures.back()->num_segments() % captures.back()->total_samps() % (captures.back()->index_secs() * 1e3) << std::endl;
+    }
+
+    replay_stats_t stats = replay_captures(capture_ptrs, stage_ptrs, replay_config);
+    std::cout << std::endl;
+    for (size_t i = 0; i < stages.size(); i++){
+        stages[i]->report(std::cout);
+        std::cout << std::endl;
+    }
+    print_replay_report(stats);
+
+    return EXIT_SUCCESS;
+}
@@ -20,30 +20,45 @@
 #include <string>
 #include <thread>
 
-#include <fstream>
-
 #include "constants.h"
 #include "aip_functions.h"
-#include "/usr/local/include/libserial/SerialPort.h"
-using namespace LibSerial ;
+#include "stream_functions.h"
+#include "capture_writer.h"
+#include "rx_capture.h"
+#include "capture_engine.h"
+#include "tx_monitor.h"
+#include "thread_config.h"
+#include "buffer_arena.h"
+#include "aip_controller.h"
+#include "transport_tuning.h"
+#include "waveform.h"
+#include "waveform_source.h"
+#include "sweep_plan.h"
+#include "sweep_engine.h"
+#include "settling.h"
+#include "fast_start.h"
+#include "device_session.h"
 
 namespace po = boost::program_options;
 
 bool stop_signal_called = false;
 
+// room for the streaming buffers in the arena, next to the capture blocks
+const size_t ARENA_HEADROOM = 4*1024*1024;
+
 /***********************************************************************
  * lo_transmit_worker function
  * A function to be used as a boost::thread_group thread for transmitting
  **********************************************************************/
-void lo_transmit_worker(std::vector<std::complex<float>> data_lo,
-    uhd::tx_streamer::sptr tx_stream)
+void lo_transmit_worker(waveform_source::sptr data_lo,
+    uhd::tx_streamer::sptr tx_stream, buffer_arena* arena)
 {
 
-	// allocate a buffer which we re-use for each channel
+	// take a buffer from the arena which we re-use for each channel
     size_t spb = tx_stream->get_max_num_samps(); 
-    std::vector<std::complex<float>> buff_lo(spb);
+    std::complex<float>* buff_lo = arena->allocate<std::complex<float>>(spb);
     std::vector<std::complex<float>*> buffs(1);
-	buffs[0] = &buff_lo.front(); 
+	buffs[0] = buff_lo; 
 	
 	// setup the metadata flags
     uhd::tx_metadata_t md;
@@ -52,18 +67,12 @@ void lo_transmit_worker(std::vector<std::complex<float>> data_lo,
     md.has_time_spec  = true;
     md.time_spec = uhd::time_spec_t(0.1); // give us 0.1 seconds to fill the tx buffers
     
-	size_t index_lo = 0;
+	waveform_player player_lo(data_lo);
     // send data until the signal handler gets called
     while (not stop_signal_called) {
     
         // fill the buffer with the data file
-        for (size_t n = 0; n < spb; n++) {
-		    buff_lo[n] = data_lo[index_lo];
-		    index_lo++;
-		    if (index_lo == data_lo.size()){
-		    	index_lo = 0;
-			}
-		}
+        player_lo.fill(buff_lo, spb);
 
         // send the entire contents of the buffer
         tx_stream->send(buffs, spb, md);
@@ -85,27 +94,36 @@ void lo_transmit_worker(std::vector<std::complex<float>> data_lo,
  **********************************************************************/
 int UHD_SAFE_MAIN(int argc, char* argv[])
 {
+    startup_timer startup;
+    
     // variables to be set by po
     std::string args, file, ant_bb, ant_lo, subdev_bb, subdev_lo, ref, pps, channel_list, name_serial_port;
+    aip_transport_config_t serial_config;
     uint64_t total_num_samps;
     double rate_bb, rate_lo, freq_bb, gain_bb, freq_lo, gain_lo;
     
     
-    std::ofstream outfile;
-    uint64_t 	nbr_samps_per_direction = 500000;
-    int 		nbr_directions = 3;
+    capture_config_t capture;
+    double 		rotate_mb;
+    size_t 		max_recaptures;
+    size_t 		recv_batch;
+    std::string rx_channel_list, layout_name;
+    double 		switch_guard;
+    bool 		stream_per_channel;
+    std::string thread_cpus, thread_realtime;
+    bool 		lock_memory;
+    arena_config_t arena_config;
+    bool 		high_rate;
+    double 		self_test;
+    bool 		fast_start;
+    bool 		shared_session;
+    double 		temp_interval;
+    settling_config_t settling;
+    uint64_t 	nbr_samps_per_direction;
+    std::vector<std::string> plan_files;
     float 		seconds_in_future = 1;
     int 		ver_aip = 0;
     
-    // The following vector contains the phase shift between antennas (in degrees)
-    std::string possible_degrees[17] = {"DEG_0","DEG_11_25","DEG_22_25","DEG_33_75","DEG_45","DEG_56_25","DEG_67_5","DEG_78_75","DEG_90","DEG_101_2","DEG_112_5","DEG_123_7","DEG_135","DEG_146_2","DEG_157_5","DEG_168_7","DEG_180"};	
-    // The beam directions corresponding to the previous phase shifts are given below (in degrees)
-    std::string possible_angles[17] = {"0.00", "4.00", "8.00", "11.50", "15.50", "19.50", "23.50", "28.00", "32.50", "37.00", "41.50", "46.50", "52.00", "57.50", "64.50", "72.00", "78.00"};			
-    std::string possible_directions[4] = {"LEFT", "RIGHT", "UP", "DOWN"};
-    int gain = 0; 
-    int gain_list[4] = {0,0,0,0};
-    std::string active_list[4] = {"1111", "1111", "1111", "1111"};
-    
 
     // setup the program options
     po::options_description desc("Allowed options");
@@ -125,7 +143,38 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 		("subdev-lo", po::value<std::string>(&subdev_lo)->default_value("B:0"), "LO subdevice specification")
 		("ref", po::value<std::string>(&ref)->default_value("external"), "clock reference (internal, external, gpsdo)")
 		("pps", po::value<std::string>(&pps)->default_value("external"), "PPS source (internal, external, gpsdo)")
-		("serialport", po::value<std::string>(&name_serial_port)->default_value("/dev/ttyUSB1"), "Serial port of the mmWave array")
+		("serialport", po::value<std::string>(&name_serial_port)->default_value("/dev/ttyUSB1"), "Serial port of the mmWave array (/dev/ttyUSBx, tcp://host:port of a serial bridge or mock:// for an in-process array)")
+		("baud", po::value<int>(&serial_config.baud)->default_value(115200), "baud rate of the serial ports of the arrays (8N1, set on the bridge for tcp://)")
+		("batch-writes", po::bool_switch(&serial_config.batch_writes), "write the commands of a beam switch at once, then read the responses (the array must buffer them)")
+		("serial-timeout-ms", po::value<int>(&serial_config.timeout_ms)->default_value(20), "timeout in ms after which the response of an array is complete (no byte for that long; raise it for a slow tcp:// bridge)")
+		("plan", po::value<std::vector<std::string>>(&plan_files)->composing(), "sweep plan file (CSV), may be repeated to run several plans back-to-back (default: LEFT then RIGHT sweep)")
+		("nsamps-per-beam", po::value<uint64_t>(&nbr_samps_per_direction)->default_value(500000), "number of samples per beam for plan steps without a dwell")
+		("outdir", po::value<std::string>(&capture.out_dir)->default_value("."), "directory of the capture files")
+		("prefix", po::value<std::string>(&capture.prefix)->default_value("outfile"), "name prefix of the capture files")
+		("rotate-mb", po::value<double>(&rotate_mb)->default_value(0), "start a new capture file at the next beam once this size (MB) is reached (0: single file)")
+		("rotate-segments", po::value<uint64_t>(&capture.rotate_segments)->default_value(0), "start a new capture file every N beams (0: single file)")
+		("notify-socket", po::value<std::string>(&capture.notify_socket)->default_value(""), "Unix datagram socket to announce finished capture files")
+		("compress", po::value<std::string>(&capture.compression)->default_value("none"), "compress the capture files block by block (.dat.mwz): none, iq16 (lossless for the sc16 samples), zstd or iq16+zstd")
+		("compress-threads", po::value<size_t>(&capture.compress_threads)->default_value(2), "compressor threads")
+		("compress-level", po::value<int>(&capture.compression_level)->default_value(3), "zstd compression level")
+		("recapture-bad", po::value<size_t>(&max_recaptures)->default_value(0), "number of times a beam with overflows or lost samples is captured again")
+		("recv-batch", po::value<size_t>(&recv_batch)->default_value(0), "samples per recv call, covering many packets (0: one packet per call)")
+		("rx-channels", po::value<std::string>(&rx_channel_list)->default_value("0"), "Rx channels of the BB device, e.g. \"0,1\" with --subdev-bb \"A:0 B:0\" or a multi-device --args")
+		("stream-per-channel", po::bool_switch(&stream_per_channel), "one streamer and recv thread per Rx channel (default: one streamer for all channels)")
+		("layout", po::value<std::string>(&layout_name)->default_value("per-channel"), "output of several channels: per-channel files or interleaved samples")
+		("switch-guard", po::value<double>(&switch_guard)->default_value(0.001), "seconds between the end of a beam switch and the segment of the multi-channel capture")
+		("cpus", po::value<std::string>(&thread_cpus)->default_value(""), "CPU cores per thread role, e.g. \"lo=2,rx=3,writer=4,serial=1\"")
+		("realtime", po::value<std::string>(&thread_realtime)->default_value(""), "thread roles run with SCHED_FIFO, e.g. \"lo,rx\"")
+		("mlock", po::bool_switch(&lock_memory), "lock all memory of the process in RAM")
+		("hugepages", po::value<bool>(&arena_config.hugepages)->default_value(true), "allocate the streaming and capture buffers on 2 MB hugepages (falls back to regular pages)")
+		("numa-node", po::value<int>(&arena_config.numa_node)->default_value(-1), "NUMA node of the buffers (default: node of the NIC that reaches the USRP)")
+		("high-rate", po::bool_switch(&high_rate), "size frames, socket buffers and samples per packet for the rate and check the host limits")
+		("self-test", po::value<double>(&self_test)->default_value(0), "seconds of Rx and LO streaming self-test before the sweep (0: none, 1 s with --high-rate)")
+		("temp-interval", po::value<double>(&temp_interval)->default_value(10), "seconds between readings of the array temperatures, taken between dwells (0: none)")
+		("shared-session", po::value<bool>(&shared_session)->default_value(true), "open the USRP once for the BB-RX and LO-TX roles (false: one device session per role)")
+		("fast-start", po::bool_switch(&fast_start), "poll the LO lock and the PPS edge instead of fixed sleeps, verify the responses of the array configuration")
+		("settling-test", po::value<size_t>(&settling.switches)->default_value(0), "instead of the sweep, switch N times between the first two beams of the plan (e.g. the beam on the transmitter and all antennas off) and report the settling time from the Rx power")
+		("settling-dwell", po::value<double>(&settling.dwell)->default_value(0.02), "seconds between two switches of the settling test")
         
     ;
     // clang-format on
@@ -139,12 +188,58 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
         return ~0;
     }
     
-    // Open the output file
-    outfile.open("//home/francois/uhd-3.15.0.0/host/build/mmwave_code/outfile.dat", std::ofstream::binary);
-    if (outfile.is_open()){
-	printf("Output file opened correctly. \n"); }
-    else{
-	printf("OUTPUT FILE NOT OPENED !!! \n"); }
+    // Read and validate the sweep plans before touching the hardware
+    int mode = 2; // 0 for TX/RX off, 1 for TX, 2 for RX
+    std::vector<sweep_plan_t> plans;
+    for (size_t i = 0; i < plan_files.size(); i++){
+    	plans.push_back(load_sweep_plan(plan_files[i], mode, nbr_samps_per_direction));
+    }
+    if (plans.empty()){
+    	plans.push_back(default_sweep_plan(mode, nbr_samps_per_direction));
+    }
+    
+    // Rx channels: more than one goes through the multi-channel capture engine
+    std::vector<size_t> rx_channels;
+    std::vector<std::string> rx_channel_strings;
+    boost::split(rx_channel_strings, rx_channel_list, boost::is_any_of(","));
+    for (size_t i = 0; i < rx_channel_strings.size(); i++){
+    	if (not rx_channel_strings[i].empty()) rx_channels.push_back(std::stoi(rx_channel_strings[i]));
+    }
+    if (rx_channels.empty()){
+    	throw std::runtime_error("No Rx channel given");
+    }
+    bool multi_channel = (rx_channels.size() > 1 or stream_per_channel);
+    if (settling.switches > 0 and (multi_channel or plans[0].steps.size() < 2)){
+    	throw std::runtime_error("The settling test needs one Rx channel and a plan with two beams");
+    }
+    capture_layout_t layout = parse_capture_layout(layout_name);
+    size_t num_outputs = 1;
+    if (multi_channel){
+    	num_outputs = (layout == LAYOUT_PER_CHANNEL or stream_per_channel) ? rx_channels.size() : 1;
+    }
+    
+    // Threading configuration (memory is locked before the buffers are allocated)
+    thread_config_t threads = parse_thread_config(thread_cpus, thread_realtime, lock_memory);
+    lock_process_memory(threads);
+    
+    // All streaming and capture buffers come from one hugepage-backed arena, local to the NIC of the USRP
+    if (arena_config.numa_node < 0){
+    	uhd::device_addr_t dev_addr(args);
+    	arena_config.numa_node = dev_addr.has_key("addr") ? address_numa_node(dev_addr["addr"]) : -1;
+    }
+    align_capture_blocks(capture, recv_batch);
+    buffer_arena arena(num_outputs*capture.block_size*capture.num_blocks + rx_channels.size()*recv_batch*sizeof(std::complex<float>) + ARENA_HEADROOM, arena_config);
+    std::cout << boost::format("Buffer arena: %s") % arena.describe() << std::endl;
+    
+    // Open the output file (the capture engine opens its own files once the streamers exist)
+    capture.rotate_bytes = (uint64_t)(rotate_mb * 1e6);
+    capture.arena = &arena;
+    std::unique_ptr<capture_writer> outfile;
+    if (not multi_channel){
+    	outfile.reset(new capture_writer(capture));
+    	apply_thread_role(threads, ROLE_WRITER, outfile->writer_thread());
+    	std::cout << boost::format("Output file %s opened correctly.") % outfile->current_file() << std::endl;
+    }
     
     
     // ======================================
@@ -152,22 +247,32 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // ======================================
     // Create and open the serial port for communication with the mmWave array.
     std::cout << boost::format("Create and open the serial port for mmWave array on %s...") % name_serial_port << std::endl;
-    SerialPort my_serial_port( name_serial_port );
-    std::string my_string;  
-    // Set serial port parameters 
-    std::cout << boost::format("Set serial port parameters ...") << std::endl;
-    my_serial_port.SetBaudRate( LibSerial::BaudRate::BAUD_115200 );
-    my_serial_port.SetCharacterSize( LibSerial::CharacterSize::CHAR_SIZE_8 );
-    my_serial_port.SetStopBits( LibSerial::StopBits::STOP_BITS_1 ) ;
-    my_serial_port.SetParity( LibSerial::Parity::PARITY_NONE );
-	
-    
+    aip_controller arrays(ver_aip);
+    size_t array = arrays.add_array(name_serial_port, serial_config);
+    arrays.submit(array, [&](aip_transport*){ apply_thread_role(threads, ROLE_SERIAL); }).get();
+    
+    // Full configuration of the array on the first beam, the sweep then only switches beams
+    sweep_step_t first_step = plans[0].steps[0];
+    std::cout << boost::format("Setting AiP to %s - %s °") % first_step.direction % first_step.angle << std::endl;
+    aip_beam_t first_beam = make_aip_beam(first_step.degrees, first_step.direction, first_step.gain_list, first_step.gain, first_step.active_list, mode);
+    if (fast_start) arrays.configure_verified(array, first_beam).get();
+    else 			arrays.configure(array, first_beam).get();
+    
+    
+    // High-rate mode: transport sized for the rate, checked against the host limits
+    transport_params_t transport = transport_params_for_rate(std::max(rate_bb, rate_lo), rx_channels.size());
+    if (high_rate){
+    	args = tune_device_args(args, transport);
+    	check_transport_limits(transport);
+    	if (vm["self-test"].defaulted()) self_test = 1.0;
+    }
     
-    // create usrp RX device (with BB-RX and LO-TX)
+    // create usrp RX device (with BB-RX and LO-TX), one session for both roles unless --shared-session=false
+    device_sessions sessions(shared_session);
     std::cout << boost::format("Creating the USRP-RX-BB device with: %s...") % args << std::endl;
-    uhd::usrp::multi_usrp::sptr usrp_rx_bb = uhd::usrp::multi_usrp::make(args);
+    uhd::usrp::multi_usrp::sptr usrp_rx_bb = sessions.open("RX-BB", args, "rx");
     std::cout << boost::format("Creating the USRP-RX-LO device with: %s...") % args << std::endl;
-    uhd::usrp::multi_usrp::sptr usrp_rx_lo = uhd::usrp::multi_usrp::make(args);
+    uhd::usrp::multi_usrp::sptr usrp_rx_lo = sessions.open("RX-LO", args, "tx");
     
     // always select the subdevice first, the channel mapping affects the other settings
     std::cout << boost::format("Setting subdevice USRP-RX-BB device to: %s...") % subdev_bb << std::endl;
@@ -191,15 +296,18 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     usrp_rx_lo->set_tx_rate(rate_lo);
     std::cout << boost::format("Actual SRP-RX-LO Tx Rate: %f Msps...") % (usrp_rx_lo->get_tx_rate() / 1e6) << std::endl;
     
-    // set the center frequency, rf gain and antenna for the BB RF chain
-    std::cout << boost::format("Setting USRP-RX BB Freq: %f MHz...") % (freq_bb / 1e6) << std::endl;
-    uhd::tune_request_t tune_request_bb(freq_bb);
-    usrp_rx_bb->set_rx_freq(tune_request_bb, 0);
-    std::cout << boost::format("Actual USRP-RX BB Freq: %f MHz...") % (usrp_rx_bb->get_rx_freq(0) / 1e6) << std::endl;
-    std::cout << boost::format("Setting USRP-RX BB Gain: %f dB...") % gain_bb << std::endl;
-    usrp_rx_bb->set_rx_gain(gain_bb, 0);
-    std::cout << boost::format("Actual USRP-RX BB Gain: %f dB...") % usrp_rx_bb->get_rx_gain(0) << std::endl;
-    usrp_rx_bb->set_rx_antenna(ant_bb, 0);
+    // set the center frequency, rf gain and antenna for the BB RF chain (every Rx channel)
+    for (size_t i = 0; i < rx_channels.size(); i++){
+    	size_t ch = rx_channels[i];
+	    std::cout << boost::format("Setting USRP-RX BB Freq: %f MHz (channel %u)...") % (freq_bb / 1e6) % ch << std::endl;
+	    uhd::tune_request_t tune_request_bb(freq_bb);
+	    usrp_rx_bb->set_rx_freq(tune_request_bb, ch);
+	    std::cout << boost::format("Actual USRP-RX BB Freq: %f MHz...") % (usrp_rx_bb->get_rx_freq(ch) / 1e6) << std::endl;
+	    std::cout << boost::format("Setting USRP-RX BB Gain: %f dB...") % gain_bb << std::endl;
+	    usrp_rx_bb->set_rx_gain(gain_bb, ch);
+	    std::cout << boost::format("Actual USRP-RX BB Gain: %f dB...") % usrp_rx_bb->get_rx_gain(ch) << std::endl;
+	    usrp_rx_bb->set_rx_antenna(ant_bb, ch);
+    }
     
     // set the center frequency, rf gain and antenna for the LO RF chain
     std::cout << boost::format("Setting USRP-RX LO Freq: %f MHz...") % (freq_lo / 1e6) << std::endl;
@@ -211,24 +319,47 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     std::cout << boost::format("Actual USRP-RX LO Gain: %f dB...") % usrp_rx_lo->get_tx_gain(0) << std::endl;
     usrp_rx_lo->set_tx_antenna(ant_lo, 0);
     
-    // allow for some setup time
-    std::this_thread::sleep_for(std::chrono::seconds(1)); 
+    // Streaming self-test at the sweep rates, on temporary streamers
+    if (self_test > 0){
+    	uhd::stream_args_t stream_args_test("fc32", "sc16");
+    	stream_args_test.channels = rx_channels;
+    	if (high_rate) tune_stream_args(stream_args_test, transport);
+    	print_self_test(rx_self_test(usrp_rx_bb->get_rx_stream(stream_args_test), usrp_rx_bb->get_rx_rate(), self_test));
+    	stream_args_test.channels = {0};
+    	print_self_test(tx_self_test(usrp_rx_lo->get_tx_stream(stream_args_test), usrp_rx_lo->get_tx_rate(), self_test));
+    }
     
     // Setting timestamp and time source (only for USRP-RX-BB, USRP-RX-LO follows automatically)
     std::cout << boost::format("Setting USRP-RX timestamp to 0...") << std::endl;
     usrp_rx_bb->set_time_source(pps);
-    usrp_rx_bb->set_time_unknown_pps(uhd::time_spec_t(0.0));
-    std::this_thread::sleep_for(std::chrono::seconds(1)); // wait for pps sync pulse
-    usrp_rx_bb->set_time_now(0.0);
+    if (fast_start){
+    	// wait for the LOs and the PPS edge themselves instead of fixed seconds
+    	double lock_s = wait_for_lo_locked(usrp_rx_bb, "rx", rx_channels) + wait_for_lo_locked(usrp_rx_lo, "tx", {0});
+    	if (ref == "external") lock_s += wait_for_ref_locked(usrp_rx_bb) + wait_for_ref_locked(usrp_rx_lo);
+    	std::cout << boost::format("USRP-RX locked in %.3f s") % lock_s << std::endl;
+    	if (not sync_time_on_pps({usrp_rx_bb})){
+    		std::cout << boost::format("No PPS edge on the %s source, setting the time now") % pps << std::endl;
+    		usrp_rx_bb->set_time_now(0.0);
+    	}
+    }
+    else{
+	    // allow for some setup time
+	    std::this_thread::sleep_for(std::chrono::seconds(1)); 
+	    usrp_rx_bb->set_time_unknown_pps(uhd::time_spec_t(0.0));
+	    std::this_thread::sleep_for(std::chrono::seconds(1)); // wait for pps sync pulse
+	    usrp_rx_bb->set_time_now(0.0);
+    }
     
     // Check Ref and LO Lock detect
     std::vector<std::string> sensor_names;
-    sensor_names = usrp_rx_bb->get_rx_sensor_names(0);
-    if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked")
-        != sensor_names.end()) {
-        uhd::sensor_value_t lo_locked = usrp_rx_bb->get_rx_sensor("lo_locked", 0);
-        std::cout << boost::format("Checking RX: %s ...") % lo_locked.to_pp_string() << std::endl;
-        UHD_ASSERT_THROW(lo_locked.to_bool());
+    for (size_t i = 0; i < rx_channels.size(); i++){
+	    sensor_names = usrp_rx_bb->get_rx_sensor_names(rx_channels[i]);
+	    if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked")
+	        != sensor_names.end()) {
+	        uhd::sensor_value_t lo_locked = usrp_rx_bb->get_rx_sensor("lo_locked", rx_channels[i]);
+	        std::cout << boost::format("Checking RX: %s ...") % lo_locked.to_pp_string() << std::endl;
+	        UHD_ASSERT_THROW(lo_locked.to_bool());
+	    }
     }
     sensor_names = usrp_rx_lo->get_tx_sensor_names(0);
     if (std::find(sensor_names.begin(), sensor_names.end(), "lo_locked")
@@ -262,15 +393,13 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     
     
     // Generate LO signals to transmit
-    std::vector<std::complex<float>> data_lo(10000);
-    for (size_t i = 0; i < data_lo.size(); i++){
-        data_lo[i] = 1.0;
-    }
+    waveform_source::sptr data_lo = waveform_source::from_samples(constant_waveform(10000), "constant length=10000 amplitude=1");
     
     // create a transmit streamer
     std::vector<size_t> channel_nums = {0};
     uhd::stream_args_t stream_args("fc32", "sc16");
     stream_args.channels = channel_nums;
+    if (high_rate) tune_stream_args(stream_args, transport);
     uhd::tx_streamer::sptr tx_stream = usrp_rx_lo->get_tx_stream(stream_args);
     
     // ================================
@@ -278,155 +407,143 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // ================================
     std::cout << boost::format("Starting LO transmitter thread...") << std::endl;
     boost::thread_group transmit_thread;
-    transmit_thread.create_thread(boost::bind(&lo_transmit_worker, data_lo, tx_stream));
+    boost::thread* lo_thread = transmit_thread.create_thread(boost::bind(&lo_transmit_worker, data_lo, tx_stream, &arena));
+    apply_thread_role(threads, ROLE_LO, lo_thread->native_handle());
+    tx_async_monitor lo_monitor("lo", tx_stream);
     
       
-    // create a receive streamer
-    uhd::rx_streamer::sptr rx_stream = usrp_rx_bb->get_rx_stream(stream_args);
-    
-	
-    //meta-data will be filled in by recv()
-    uhd::rx_metadata_t md;
-    
-    // allocate a buffer which we re-use for each channel
-    size_t spb = rx_stream->get_max_num_samps(); 
-    std::vector<std::complex<float>> buff_bb(spb);
-    std::vector<std::complex<float>*> buffs(1);
-    buffs[0] = &buff_bb.front(); 
+    // create the receive streamers: one for all channels, or one per channel
+    std::vector<capture_stream_t> rx_streams;
+    if (stream_per_channel){
+    	for (size_t i = 0; i < rx_channels.size(); i++){
+    		uhd::stream_args_t stream_args_rx("fc32", "sc16");
+    		stream_args_rx.channels = {rx_channels[i]};
+    		if (high_rate) tune_stream_args(stream_args_rx, transport);
+    		capture_stream_t rx = {str(boost::format("rx%u") % rx_channels[i]), usrp_rx_bb->get_rx_stream(stream_args_rx)};
+    		rx_streams.push_back(rx);
+    	}
+    }
+    else{
+    	uhd::stream_args_t stream_args_rx("fc32", "sc16");
+    	stream_args_rx.channels = rx_channels;
+    	if (high_rate) tune_stream_args(stream_args_rx, transport);
+    	capture_stream_t rx = {"rx", usrp_rx_bb->get_rx_stream(stream_args_rx)};
+    	rx_streams.push_back(rx);
+    }
+    sessions.print_report();
     
     //the first call to recv() will block this many seconds before receiving
     double timeout = seconds_in_future + 0.1; //timeout 
+    std::unique_ptr<rx_capture> receiver;
+    std::unique_ptr<capture_engine> captures;
+    if (multi_channel){
+    	captures.reset(new capture_engine(rx_streams, capture, layout, usrp_rx_bb->get_rx_rate(), recv_batch, &arena));
+    	for (size_t i = 0; i < captures->num_streams(); i++){
+    		apply_thread_role(threads, ROLE_RX, captures->recv_thread(i));
+    	}
+    	for (size_t i = 0; i < captures->num_writers(); i++){
+    		apply_thread_role(threads, ROLE_WRITER, captures->writer(i).writer_thread());
+    		std::cout << boost::format("Output file %s opened correctly.") % captures->writer(i).current_file() << std::endl;
+    	}
+    }
+    else{
+    	receiver.reset(new rx_capture(rx_streams[0].stream, *outfile, usrp_rx_bb->get_rx_rate(), timeout, max_recaptures, recv_batch, &arena));
+    	receiver->add_tx_monitor(&lo_monitor);
+    	
+    	// the recv loop runs on the main thread
+    	apply_thread_role(threads, ROLE_RX);
+    }
+    print_thread_report();
     
     //setup streaming
-	total_num_samps = nbr_samps_per_direction ;
+	total_num_samps = 0;
+	for (size_t i = 0; i < plans.size(); i++){
+		total_num_samps += sweep_plan_samps(plans[i]);
+	}
 	std::cout << boost::format("Begin streaming %u samples, %f seconds in the future...") % total_num_samps % seconds_in_future << std::endl;
 	uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
 	//stream_cmd.num_samps = total_num_samps;
 	stream_cmd.stream_now = false;
 	stream_cmd.time_spec = uhd::time_spec_t(seconds_in_future);
-	rx_stream->issue_stream_cmd(stream_cmd);
+	for (size_t i = 0; i < rx_streams.size(); i++){
+		rx_streams[i].stream->issue_stream_cmd(stream_cmd);
+	}
+	startup.report_first_sample(usrp_rx_bb->get_time_now().get_real_secs(), seconds_in_future);
 	
 	
 	// ==============================================================
 	// Start looping over all AiP directions and Rx baseband samples
 	// ==============================================================
-	std::string degrees;
-	std::string angle; 
-	std::string direction;
-	int mode = 2; // 0 for TX/RX off, 1 for TX, 2 for RX
-	direction = possible_directions[0];
-	for (int cpt_directions = 16; cpt_directions > -1; cpt_directions--)
-    //for (int cpt_directions = 0; cpt_directions < nbr_directions; cpt_directions++)
-    {
-    	// Setting AiP beam direction
-    	degrees = possible_degrees[cpt_directions];
-    	angle = possible_angles[cpt_directions];	
-    	float time_now = usrp_rx_bb->get_time_now().get_real_secs() ;    	
-    	std::cout << boost::format("Setting AiP to %s - %s ° at time %f") % direction % angle % time_now << std::endl;
-    	send_to_aip(&my_serial_port, degrees, direction, gain_list, gain, active_list, mode, ver_aip);
-    	
-    	if (outfile.is_open()) {
-			outfile << std::endl << "AiP data" << std::endl ;
-			outfile << boost::format("%s - %s degrees at time %f") % direction % angle % time_now;
-			outfile << std::endl;
-		}
-    	
-    	// Receive "nbr_samps_per_direction" samples
-    	if (outfile.is_open()) {
-			outfile << std::endl << "USRP data" << std::endl ;
-		}
-    	size_t num_acc_samps = 0; //number of accumulated samples
-		while(num_acc_samps < nbr_samps_per_direction){
-		    //receive a single packet
-		    size_t num_rx_samps = rx_stream->recv(&buffs.front(), buffs.size(), md, timeout, true);
-
-		    //use a small timeout for subsequent packets
-		    timeout = 0.1;
-		    
-		    //handle the error code
-		    if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) break;
-		    if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
-		        throw std::runtime_error(str(boost::format(
-		            "Receiver error %s"
-		        ) % md.strerror()));
-		    }
-		    
-		    if (outfile.is_open()) {
-				outfile.write((const char*)&buffs.front(), num_rx_samps*sizeof(std::complex<float>));
-			}
-			
-			num_acc_samps += num_rx_samps;
-		}
-		std::cout << boost::format("  -- Received %f samples") % num_acc_samps << std::endl;
-		if (outfile.is_open()) {
-			outfile << std::endl;
-		}
+	sweep_engine engine(arrays, [usrp_rx_bb](){ return usrp_rx_bb->get_time_now().get_real_secs(); });
+	
+	// Temperature time series of the array in the metadata (of the first output file with several outputs)
+	aip_telemetry telemetry(arrays, temp_interval, [&](const std::string& line){
+		if (multi_channel) captures->writer(0).write_metadata(line);
+		else 			   outfile->write_metadata(line);
+	});
+	if (temp_interval > 0){
+		telemetry.add_array(array, "rx");
+		engine.set_telemetry(&telemetry);
 	}
 	
-	direction = possible_directions[1];
-	for (int cpt_directions = 0; cpt_directions < 17; cpt_directions++)
-    //for (int cpt_directions = 0; cpt_directions < nbr_directions; cpt_directions++)
-    {
-    	// Setting AiP beam direction
-    	degrees = possible_degrees[cpt_directions];
-    	angle = possible_angles[cpt_directions];	
-    	float time_now = usrp_rx_bb->get_time_now().get_real_secs() ;    	
-    	std::cout << boost::format("Setting AiP to %s - %s ° at time %f") % direction % angle % time_now << std::endl;
-    	send_to_aip(&my_serial_port, degrees, direction, gain_list, gain, active_list, mode, ver_aip);
-    	
-    	if (outfile.is_open()) {
-			outfile << std::endl << "AiP data" << std::endl ;
-			outfile << boost::format("%s - %s degrees at time %f") % direction % angle % time_now;
-			outfile << std::endl;
-		}
-    	
-    	// Receive "nbr_samps_per_direction" samples
-    	if (outfile.is_open()) {
-			outfile << std::endl << "USRP data" << std::endl ;
-		}
-    	size_t num_acc_samps = 0; //number of accumulated samples
-		while(num_acc_samps < nbr_samps_per_direction){
-		    //receive a single packet
-		    size_t num_rx_samps = rx_stream->recv(&buffs.front(), buffs.size(), md, timeout, true);
-
-		    //use a small timeout for subsequent packets
-		    timeout = 0.1;
-		    
-		    //handle the error code
-		    if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) break;
-		    if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
-		        throw std::runtime_error(str(boost::format(
-		            "Receiver error %s"
-		        ) % md.strerror()));
-		    }
-		    
-		    if (outfile.is_open()) {
-				outfile.write((const char*)&buffs.front(), num_rx_samps*sizeof(std::complex<float>));
-			}
-			
-			num_acc_samps += num_rx_samps;
-		}
-		std::cout << boost::format("  -- Received %f samples") % num_acc_samps << std::endl;
-		if (outfile.is_open()) {
-			outfile << std::endl;
+	if (settling.switches > 0){
+		// the Rx power of the BB chain shows when each switch took effect, nothing is written
+		settling_result_t settled = run_settling_test(rx_streams[0].stream, usrp_rx_bb->get_rx_rate(), arrays, array,
+													  plans[0].steps[0], plans[0].steps[1], mode,
+													  [usrp_rx_bb](){ return usrp_rx_bb->get_time_now().get_real_secs(); }, settling, timeout);
+		print_settling_report(settled);
+	}
+	else{
+		for (size_t cpt_plan = 0; cpt_plan < plans.size(); cpt_plan++){
+			engine.run(array, plans[cpt_plan], [&](size_t, const sweep_step_t& step, double time_now){
+		    	// Receive "step.dwell_samps" samples
+		    	std::string header = str(boost::format("\nAiP data\n%s - %s degrees at time %f\n") % step.direction % step.angle % time_now);
+		    	std::string beam = str(boost::format("%s - %s") % step.direction % step.angle);
+		    	if (multi_channel){
+		    		// all channels from the same device time: after the switch (time_now is read before it), once streaming has started
+		    		double window_start = usrp_rx_bb->get_time_now().get_real_secs() + switch_guard;
+		    		captures->capture_segment(header, beam, std::max<double>(window_start, seconds_in_future), step.dwell_samps);
+		    	}
+		    	else{
+		    		receiver->capture_segment(header, beam, time_now, step.dwell_samps);
+		    	}
+			});
 		}
 	}
 	
 	// Stop streaming from USRP
 	stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
 	stream_cmd.stream_now = true;
-	rx_stream->issue_stream_cmd(stream_cmd);
+	for (size_t i = 0; i < rx_streams.size(); i++){
+		rx_streams[i].stream->issue_stream_cmd(stream_cmd);
+	}
+	
+	// Flush the capture files
+	if (multi_channel){
+		captures->close();
+		captures->print_report();
+		std::cout << boost::format("Wrote %u capture output(s) to %s") % captures->num_writers() % capture.out_dir << std::endl;
+	}
+	else{
+		outfile->close();
+		receiver->print_report();
+		outfile->print_compression_report();
+		std::cout << boost::format("Wrote %u capture file(s) to %s") % outfile->num_files() % capture.out_dir << std::endl;
+	}
+	lo_monitor.print_report();
+	if (temp_interval > 0) telemetry.print_report();
     
     // Disable AiP
-    disable_aip(&my_serial_port, ver_aip);
+    arrays.disable(array).get();
     
     // Close serial port
     std::cout << std::endl << "Close serial port ..." << std::endl << std::endl;
-    my_serial_port.Close();
+    arrays.close();
     
     
     // Stopping LO transmitter thread
     stop_signal_called = true;
+    transmit_thread.join_all();
     
     // finished
     std::cout << std::endl << "Done!" << std::endl << std::endl;
@@ -22,29 +22,41 @@
 
 #include "constants.h"
 #include "aip_functions.h"
-#include "/usr/local/include/libserial/SerialPort.h"
-using namespace LibSerial ;
+#include "stream_functions.h"
+#include "aip_controller.h"
+#include "sweep_plan.h"
+#include "sweep_engine.h"
+#include "fast_start.h"
+#include "tx_monitor.h"
+#include "thread_config.h"
+#include "buffer_arena.h"
+#include "transport_tuning.h"
+#include "waveform.h"
+#include "waveform_source.h"
 
 namespace po = boost::program_options;
 
 bool stop_signal_called = false;
 
+// room for the streaming buffers in the arena
+const size_t ARENA_HEADROOM = 4*1024*1024;
+
 /***********************************************************************
  * lo_transmit_worker function
  * A function to be used as a boost::thread_group thread for transmitting
  **********************************************************************/
-void transmit_worker(std::vector<std::complex<float>> data_bb,
-    std::vector<std::complex<float>> data_lo,
-    uhd::tx_streamer::sptr tx_stream)
+void transmit_worker(waveform_source::sptr data_bb,
+    waveform_source::sptr data_lo,
+    uhd::tx_streamer::sptr tx_stream, buffer_arena* arena, double start_time, bool loop)
 {
 
-	// allocate a buffer which we re-use for each channel
+	// take a buffer from the arena which we re-use for each channel
     size_t spb = tx_stream->get_max_num_samps(); 
-    std::vector<std::complex<float>> buff_bb(spb);
-    std::vector<std::complex<float>> buff_lo(spb);
+    std::complex<float>* buff_bb = arena->allocate<std::complex<float>>(spb);
+    std::complex<float>* buff_lo = arena->allocate<std::complex<float>>(spb);
     std::vector<std::complex<float>*> buffs(2);
-    buffs[0] = &buff_bb.front(); 
-	buffs[1] = &buff_lo.front(); 
+    buffs[0] = buff_bb; 
+	buffs[1] = buff_lo; 
 
 	
 	// setup the metadata flags
@@ -52,26 +64,16 @@ void transmit_worker(std::vector<std::complex<float>> data_bb,
     md.start_of_burst = true;
     md.end_of_burst   = false;
     md.has_time_spec  = true;
-    md.time_spec = uhd::time_spec_t(1.0); // give us 1.0 seconds to fill the tx buffers
+    md.time_spec = uhd::time_spec_t(start_time); // sample 0 of the waveform goes out at start_time, leaving time to fill the tx buffers
     
-    size_t index_bb = 0;
-	size_t index_lo = 0;
+    waveform_player player_bb(data_bb, loop);
+	waveform_player player_lo(data_lo);
     // send data until the signal handler gets called
     while (not stop_signal_called) {
     
         // fill the buffer with the data file
-        for (size_t n = 0; n < spb; n++) {
-		    buff_bb[n] = data_bb[index_bb];
-		    buff_lo[n] = data_lo[index_lo];
-		    index_bb++;
-		    index_lo++;
-		    if (index_bb == data_bb.size()){
-		    	index_bb = 0;
-			}
-		    if (index_lo == data_lo.size()){
-		    	index_lo = 0;
-			}
-		}
+        player_bb.fill(buff_bb, spb);
+        player_lo.fill(buff_lo, spb);
 
         // send the entire contents of the buffer
         tx_stream->send(buffs, spb, md);
@@ -93,21 +95,27 @@ void transmit_worker(std::vector<std::complex<float>> data_bb,
  **********************************************************************/
 int UHD_SAFE_MAIN(int argc, char* argv[])
 {
+    startup_timer startup;
+    
     // variables to be set by po
     std::string args, file, ant_bb, ant_lo, subdev_tx, ref, pps, channel_list, name_serial_port;
+    aip_transport_config_t serial_config;
     uint64_t total_num_samps;
     double rate, freq_bb, gain_bb, freq_lo, gain_lo;
     
     
-    uint64_t 	nbr_samps_per_direction = 500000;
-    int 		nbr_directions = 9;
+    uint64_t 	nbr_samps_per_direction;
+    std::vector<std::string> plan_files;
     int 		ver_aip = 0;
+    std::string thread_cpus, thread_realtime;
+    bool 		lock_memory;
+    arena_config_t arena_config;
+    bool 		high_rate;
+    double 		tx_start;
+    bool 		loop;
+    double 		self_test;
+    bool 		fast_start;
     
-    // The following vector contains the phase shift between antennas (in degrees)
-    std::string possible_degrees[17] = {"DEG_0","DEG_11_25","DEG_22_25","DEG_33_75","DEG_45","DEG_56_25","DEG_67_5","DEG_78_75","DEG_90","DEG_101_2","DEG_112_5","DEG_123_7","DEG_135","DEG_146_2","DEG_157_5","DEG_168_7","DEG_180"};	
-    // The beam directions corresponding to the previous phase shifts are given below (in degrees)
-    std::string possible_angles[17] = {"0.00", "4.00", "8.00", "11.50", "15.50", "19.50", "23.50", "28.00", "32.50", "37.00", "41.50", "46.50", "52.00", "57.50", "64.50", "72.00", "78.00"};			
-    std::string possible_directions[4] = {"LEFT", "RIGHT", "UP", "DOWN"};
     int gain = 0; 
     int gain_list[4] = {0,0,0,0};
     std::string active_list[4] = {"1111", "1111", "1111", "1111"};
@@ -119,7 +127,9 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     desc.add_options()
 		("help", "help message")
 		("args", po::value<std::string>(&args)->default_value("addr=192.168.192.50"), "single uhd device address args")
-		("file", po::value<std::string>(&file)->default_value(""), "name of the file to read binary samples from (if empty, LO signal is sent)")
+		("file", po::value<std::string>(&file)->default_value(""), "waveform file of the BB chain, see generate_tx_signal (default: QPSK burst of srand(1))")
+		("loop", po::value<bool>(&loop)->default_value(true), "play the waveform in a loop (false: once, then zeros)")
+		("tx-start", po::value<double>(&tx_start)->default_value(1.0), "device time in seconds at which sample 0 of the waveform is sent")
 		("nsamps", po::value<uint64_t>(&total_num_samps)->default_value(0), "total number of samples to transmit (0 for infinite)")
 		("rate", po::value<double>(&rate)->default_value(1000000), "rate of outgoing samples")
 		("freq-bb", po::value<double>(&freq_bb)->default_value(4000000000), "RF chain 1 center frequency in Hz")
@@ -132,7 +142,20 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 		("ref", po::value<std::string>(&ref)->default_value("external"), "clock reference (internal, external, gpsdo)")
 		("pps", po::value<std::string>(&pps)->default_value("external"), "PPS source (internal, external, gpsdo)")
 		("channels", po::value<std::string>(&channel_list)->default_value("0,1"), "which channels to use (specify \"0\", \"1\", \"0,1\", etc)")
-		("serialport", po::value<std::string>(&name_serial_port)->default_value("/dev/ttyUSB0"), "Serial port of the mmWave array")
+		("serialport", po::value<std::string>(&name_serial_port)->default_value("/dev/ttyUSB0"), "Serial port of the mmWave array (/dev/ttyUSBx, tcp://host:port of a serial bridge or mock:// for an in-process array)")
+		("baud", po::value<int>(&serial_config.baud)->default_value(115200), "baud rate of the serial ports of the arrays (8N1, set on the bridge for tcp://)")
+		("batch-writes", po::bool_switch(&serial_config.batch_writes), "write the commands of a beam switch at once, then read the responses (the array must buffer them)")
+		("serial-timeout-ms", po::value<int>(&serial_config.timeout_ms)->default_value(20), "timeout in ms after which the response of an array is complete (no byte for that long; raise it for a slow tcp:// bridge)")
+		("plan", po::value<std::vector<std::string>>(&plan_files)->composing(), "sweep plan file (CSV), may be repeated to run several plans back-to-back (default: LEFT then RIGHT sweep)")
+		("nsamps-per-beam", po::value<uint64_t>(&nbr_samps_per_direction)->default_value(500000), "number of samples per beam for plan steps without a dwell")
+		("cpus", po::value<std::string>(&thread_cpus)->default_value(""), "CPU cores per thread role, e.g. \"tx=2,serial=1\"")
+		("realtime", po::value<std::string>(&thread_realtime)->default_value(""), "thread roles run with SCHED_FIFO, e.g. \"tx\"")
+		("mlock", po::bool_switch(&lock_memory), "lock all memory of the process in RAM")
+		("hugepages", po::value<bool>(&arena_config.hugepages)->default_value(true), "allocate the streaming and capture buffers on 2 MB hugepages (falls back to regular pages)")
+		("numa-node", po::value<int>(&arena_config.numa_node)->default_value(-1), "NUMA node of the buffers (default: node of the NIC that reaches the USRP)")
+		("high-rate", po::bool_switch(&high_rate), "size frames, socket buffers and samples per packet for the rate and check the host limits")
+		("self-test", po::value<double>(&self_test)->default_value(0), "seconds of Tx streaming self-test before the sweep (0: none, 1 s with --high-rate)")
+		("fast-start", po::bool_switch(&fast_start), "poll the LO lock and the PPS edge instead of fixed sleeps, configure the array once with verified responses")
         
     ;
     // clang-format on
@@ -146,31 +169,62 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
         return ~0;
     }
     
+    // Read and validate the sweep plans before touching the hardware
+    std::vector<sweep_plan_t> plans;
+    for (size_t i = 0; i < plan_files.size(); i++){
+    	plans.push_back(load_sweep_plan(plan_files[i], 1, nbr_samps_per_direction));
+    }
+    if (plans.empty()){
+    	plans.push_back(default_sweep_plan(1, nbr_samps_per_direction));
+    }
+    
+    // Threading configuration (memory is locked before the buffers are allocated)
+    thread_config_t threads = parse_thread_config(thread_cpus, thread_realtime, lock_memory);
+    lock_process_memory(threads);
+    
+    // All streaming buffers come from one hugepage-backed arena, local to the NIC of the USRP
+    if (arena_config.numa_node < 0){
+    	uhd::device_addr_t dev_addr(args);
+    	arena_config.numa_node = dev_addr.has_key("addr") ? address_numa_node(dev_addr["addr"]) : -1;
+    }
+    buffer_arena arena(ARENA_HEADROOM, arena_config);
+    std::cout << boost::format("Buffer arena: %s") % arena.describe() << std::endl;
+    
     
     // ======================================
     // Open serial port of the mmWave array
     // ======================================
     // Create and open the serial port for communication with the mmWave array.
     std::cout << boost::format("Create and open the serial port for mmWave array on %s...") % name_serial_port << std::endl;
-    SerialPort my_serial_port( name_serial_port );
-    std::string my_string;  
-    // Set serial port parameters 
-    std::cout << boost::format("Set serial port parameters ...") << std::endl;
-    my_serial_port.SetBaudRate( LibSerial::BaudRate::BAUD_115200 );
-    my_serial_port.SetCharacterSize( LibSerial::CharacterSize::CHAR_SIZE_8 );
-    my_serial_port.SetStopBits( LibSerial::StopBits::STOP_BITS_1 ) ;
-    my_serial_port.SetParity( LibSerial::Parity::PARITY_NONE );
+    aip_controller arrays(ver_aip);
+    size_t array = arrays.add_array(name_serial_port, serial_config);
+    arrays.submit(array, [&](aip_transport*){ apply_thread_role(threads, ROLE_SERIAL); }).get();
     
     int mode_init = 1;
-	std::cout << boost::format("Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
-    send_to_aip(&my_serial_port, "DEG_0", "UP", gain_list, gain, active_list, mode_init, ver_aip);
-    std::cout << boost::format("Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
-    send_to_aip(&my_serial_port, "DEG_0", "UP", gain_list, gain, active_list, mode_init, ver_aip);
-    std::cout << boost::format("Setting AiP to %s - %s °") % "LEFT" % "0"  << std::endl;
-    send_to_aip(&my_serial_port, "DEG_0", "LEFT", gain_list, gain, active_list, mode_init, ver_aip);
+    if (fast_start){
+    	// one configuration, repeated only if the array does not acknowledge it
+    	std::cout << boost::format("Setting AiP to %s - %s ° (verified)") % "LEFT" % "0"  << std::endl;
+    	arrays.configure_verified(array, make_aip_beam("DEG_0", "LEFT", gain_list, gain, active_list, mode_init)).get();
+    }
+    else{
+		std::cout << boost::format("Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
+	    arrays.configure(array, make_aip_beam("DEG_0", "UP", gain_list, gain, active_list, mode_init)).get();
+	    std::cout << boost::format("Setting AiP to %s - %s °") % "UP" % "0"  << std::endl;
+	    arrays.configure(array, make_aip_beam("DEG_0", "UP", gain_list, gain, active_list, mode_init)).get();
+	    std::cout << boost::format("Setting AiP to %s - %s °") % "LEFT" % "0"  << std::endl;
+	    arrays.configure(array, make_aip_beam("DEG_0", "LEFT", gain_list, gain, active_list, mode_init)).get();
+    }
 
     
     
+    // High-rate mode: transport sized for the rate (BB and LO channels), checked against the host limits
+    transport_params_t transport = transport_params_for_rate(rate, 2);
+    if (high_rate){
+    	args = tune_device_args(args, transport);
+    	check_transport_limits(transport);
+    	if (vm["self-test"].defaulted()) self_test = 1.0;
+    }
+    
     // create usrp TX device
     std::cout << boost::format("Creating the USRP-TX device with: %s...") % args << std::endl;
     uhd::usrp::multi_usrp::sptr usrp_tx = uhd::usrp::multi_usrp::make(args);
@@ -213,15 +267,36 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     std::cout << boost::format("Actual USRP-TX LO Gain: %f dB...") % usrp_tx->get_tx_gain(1) << std::endl;
     usrp_tx->set_tx_antenna(ant_lo, 1);
     
-    // allow for some setup time
-    std::this_thread::sleep_for(std::chrono::seconds(1)); 
+    // Streaming self-test at the sweep rate, on a temporary streamer
+    if (self_test > 0){
+    	uhd::stream_args_t stream_args_test("fc32", "sc16");
+    	stream_args_test.channels = {0, 1};
+    	if (high_rate) tune_stream_args(stream_args_test, transport);
+    	print_self_test(tx_self_test(usrp_tx->get_tx_stream(stream_args_test), usrp_tx->get_tx_rate(), self_test));
+    }
+    
+    std::vector<size_t> channel_nums = {0, 1}; // BB and LO chains
     
     // Setting timestamp and time source
     std::cout << boost::format("Setting USRP-TX timestamp to 0...") << std::endl;
     usrp_tx->set_time_source(pps);
-    usrp_tx->set_time_unknown_pps(uhd::time_spec_t(0.0));
-    std::this_thread::sleep_for(std::chrono::seconds(1)); // wait for pps sync pulse
-    usrp_tx->set_time_now(0.0);
+    if (fast_start){
+    	// wait for the LOs and the PPS edge themselves instead of fixed seconds
+    	double lock_s = wait_for_lo_locked(usrp_tx, "tx", channel_nums);
+    	if (ref == "external") lock_s += wait_for_ref_locked(usrp_tx);
+    	std::cout << boost::format("USRP-TX locked in %.3f s") % lock_s << std::endl;
+    	if (not sync_time_on_pps({usrp_tx})){
+    		std::cout << boost::format("No PPS edge on the %s source, setting the time now") % pps << std::endl;
+    		usrp_tx->set_time_now(0.0);
+    	}
+    }
+    else{
+	    // allow for some setup time
+	    std::this_thread::sleep_for(std::chrono::seconds(1)); 
+	    usrp_tx->set_time_unknown_pps(uhd::time_spec_t(0.0));
+	    std::this_thread::sleep_for(std::chrono::seconds(1)); // wait for pps sync pulse
+	    usrp_tx->set_time_now(0.0);
+    }
 
     // Check Ref and LO Lock detect 
     std::vector<std::string> sensor_names;
@@ -244,25 +319,23 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
         UHD_ASSERT_THROW(ref_locked.to_bool());
     }
     
-    // Generate BB and LO signals to transmit
-    // BB data
-    std::vector<std::complex<float>> data_bb(10000);
-    for (size_t i = 0; i < 1000; i++){
-        data_bb[i] = (2*(rand() % 2) -1) + (2*(rand() % 2) -1)*1j ;
+    // BB and LO signals to transmit
+    // BB data: waveform file, or the QPSK burst of srand(1) shared with mmwave_joint_txrx
+    waveform_source::sptr data_bb;
+    if (file.empty()){
+    	data_bb = waveform_source::from_samples(legacy_qpsk_burst(1), "legacy-qpsk seed=1 symbols=1000 length=10000");
     }
-    for (size_t i = 1000; i < data_bb.size(); i++){
-        data_bb[i] = 0.0;
+    else{
+    	data_bb = waveform_source::map_file(file);
+    	std::cout << boost::format("BB waveform %s: %s (%u samples, mapped)") % file % data_bb->description() % data_bb->size() << std::endl;
     }
     //LO data
-    std::vector<std::complex<float>> data_lo(10000);
-    for (size_t i = 0; i < data_lo.size(); i++){
-        data_lo[i] = 1.0;
-    }
+    waveform_source::sptr data_lo = waveform_source::from_samples(constant_waveform(10000), "constant length=10000 amplitude=1");
     
     // create a transmit streamer
-    std::vector<size_t> channel_nums = {0, 1};
     uhd::stream_args_t stream_args("fc32", "sc16");
     stream_args.channels = channel_nums;
+    if (high_rate) tune_stream_args(stream_args, transport);
     uhd::tx_streamer::sptr tx_stream = usrp_tx->get_tx_stream(stream_args);
 
     
@@ -270,76 +343,46 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // start transmit worker thread
     // =============================
     boost::thread_group transmit_thread;
-    transmit_thread.create_thread(boost::bind(&transmit_worker, data_bb, data_lo, tx_stream));
+    boost::thread* tx_thread = transmit_thread.create_thread(boost::bind(&transmit_worker, data_bb, data_lo, tx_stream, &arena, tx_start, loop));
+    apply_thread_role(threads, ROLE_TX, tx_thread->native_handle());
+    print_thread_report();
+    tx_async_monitor tx_monitor("tx", tx_stream);
+    startup.report_first_sample(usrp_tx->get_time_now().get_real_secs(), tx_start);
 
 	// =====================================
 	// Start looping over all AiP directions
 	// =====================================
-	float time_next_direction = 1.0; 	// initial time of first transmission
-	std::string degrees;
-	std::string angle; 
-	std::string direction;
-	int mode = 0; // 0 for TX/RX off, 1 for TX, 2 for RX
-	
-	
-	//for (int cpt_leftright = 0; cpt_leftright < 1; cpt_leftright++)
-	for (int cpt_leftright = 0; cpt_leftright < 2; cpt_leftright++)
-	{
-		if (cpt_leftright == 0)
-		{
-			direction = possible_directions[0];
-			//for (int cpt_directions = 2; cpt_directions > -1; cpt_directions--)
-			for (int cpt_directions = 16; cpt_directions > -1; cpt_directions--)
-			{
-				// Setting AiP beam direction
-				degrees = possible_degrees[cpt_directions];
-				angle = possible_angles[cpt_directions];
-				
-				mode = 1;     	
-				std::cout << boost::format("Setting AiP to %s - %s ° at time %f") % direction % angle % usrp_tx->get_time_now().get_real_secs() << std::endl;
-				send_to_aip(&my_serial_port, degrees, direction, gain_list, gain, active_list, mode, ver_aip);
-				//std::cout << boost::format("  -- time now: %f") % usrp_tx->get_time_now().get_real_secs() << std::endl;
-				
-				// Blocking call to let USRP transmit until it's time for next direction
-				time_next_direction += nbr_samps_per_direction/rate; 
-				while(usrp_tx->get_time_now().get_real_secs()<time_next_direction){
-					// wait
-				}
+	double time_next_direction = tx_start; 	// initial time of first transmission (double: sample precision over long sweeps)
+	sweep_engine engine(arrays, [usrp_tx](){ return usrp_tx->get_time_now().get_real_secs(); });
+	for (size_t cpt_plan = 0; cpt_plan < plans.size(); cpt_plan++){
+		engine.run(array, plans[cpt_plan], [&](size_t, const sweep_step_t& step, double){
+			// Blocking call to let USRP transmit until it's time for next direction
+			tx_event_counts_t start = tx_monitor.counts();
+			time_next_direction += step.dwell_samps/rate; 
+			while(usrp_tx->get_time_now().get_real_secs()<time_next_direction){
+				// wait
+			}
+			tx_event_counts_t events = tx_monitor.counts() - start;
+			if (events.total() > 0){
+				std::cout << boost::format("  -- Beam degraded: %u underflows, %u sequence errors, %u late packets") 
+					% events.underflows % events.seq_errors % events.time_errors << std::endl;
 			}
-		}
-		else
-		{
-			direction = possible_directions[1];
-			for (int cpt_directions = 0; cpt_directions < 17; cpt_directions++)
-				{
-					// Setting AiP beam direction
-					degrees = possible_degrees[cpt_directions];
-					angle = possible_angles[cpt_directions];
-					
-					mode = 1;     	
-					std::cout << boost::format("Setting AiP to %s - %s ° at time %f") % direction % angle % usrp_tx->get_time_now().get_real_secs() << std::endl;
-					send_to_aip(&my_serial_port, degrees, direction, gain_list, gain, active_list, mode, ver_aip);
-					
-					// Blocking call to let USRP transmit until it's time for next direction
-					time_next_direction += nbr_samps_per_direction/rate; 
-					while(usrp_tx->get_time_now().get_real_secs()<time_next_direction){
-						// wait
-					}
-				}
-		}
+		});
 	}
+	tx_monitor.print_report();
 
     
     // Disable AiP
-    disable_aip(&my_serial_port, ver_aip);
+    arrays.disable(array).get();
     
     // Close serial port
     std::cout << std::endl << "Close serial port ..." << std::endl << std::endl;
-    my_serial_port.Close();
+    arrays.close();
     
     
     // Stopping LO transmitter thread
     stop_signal_called = true;
+    transmit_thread.join_all();
     
     // finished
     std::cout << std::endl << "Done!" << std::endl << std::endl;
@@ -0,0 +1,327 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "replay.h"
+#include <boost/algorithm/string/join.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+static double thread_cpu_seconds()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6*(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+
+
+/***********************************************************************
+ * Capture files
+ **********************************************************************/
+capture_file::capture_file(const std::string& path, double rate, size_t channels, bool use_index) :
+	_path(path), _base(NULL), _bytes(0), _index_secs(0), _index_loaded(false)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot open capture file %s: %s") % path % std::strerror(errno)));
+	}
+	struct stat st;
+	fstat(fd, &st);
+	_bytes = st.st_size;
+	if (_bytes > 0){
+		_base = mmap(NULL, _bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	int err = errno;
+	close(fd);
+	if (_base == MAP_FAILED){
+		_base = NULL;
+		throw std::runtime_error(str(boost::format("Cannot map capture file %s: %s") % path % std::strerror(err)));
+	}
+	if (_base != NULL){
+		madvise(_base, _bytes, MADV_SEQUENTIAL);
+	}
+	channels = std::max<size_t>(channels, 1);
+	_index_loaded = use_index and load_index(rate, channels);
+	if (not _index_loaded) index(rate, channels);
+	_index_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+capture_file::~capture_file()
+{
+	if (_base != NULL) munmap(_base, _bytes);
+}
+
+
+std::string capture_file::header(size_t segment) const
+{
+	const char* data = (const char*)_base;
+	return std::string(data + _segments[segment].header_offset, data + data_offset(segment));
+}
+
+
+void capture_file::release(uint64_t offset, uint64_t bytes) const
+{
+	if (_base == NULL or bytes == 0) return;
+	size_t page = sysconf(_SC_PAGESIZE);
+	uint64_t begin = offset / page * page;
+	uint64_t end = std::min<uint64_t>(offset + bytes, _bytes);
+	madvise((char*)_base + begin, end - begin, MADV_DONTNEED);
+}
+
+
+uint64_t capture_file::total_samps() const
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < _segments.size(); i++){
+		total += _segments[i].num_samps;
+	}
+	return total;
+}
+
+
+// Beam and switch time from the AiP lines of a segment header
+static void parse_header(const std::string& header, segment_info_t& info)
+{
+	std::vector<std::string> beams;
+	std::string prefix;
+	size_t begin = 0;
+	while (begin < header.size()){
+		size_t end = header.find('\n', begin);
+		if (end == std::string::npos) end = header.size();
+		std::string line = header.substr(begin, end - begin);
+		begin = end + 1;
+
+		if (line == "AiP Tx data") 		prefix = "Tx ";
+		else if (line == "AiP Rx data") prefix = "Rx ";
+		else if (line == "AiP data") 	prefix = "";
+		size_t degrees = line.find(" degrees at time ");
+		if (degrees != std::string::npos){
+			beams.push_back(prefix + line.substr(0, degrees));
+			info.time = std::atof(line.c_str() + degrees + 17);
+		}
+	}
+	info.beam = boost::algorithm::join(beams, " / ");
+}
+
+
+void capture_file::add_segment(uint64_t header_offset, uint64_t data_offset, uint64_t data_bytes, double rate, size_t channels)
+{
+	const char* data = (const char*)_base;
+	segment_t segment;
+	segment.info.file 	  = _path;
+	segment.info.index 	  = _segments.size();
+	segment.info.time 	  = 0;
+	segment.info.rate 	  = rate;
+	segment.info.channels = channels;
+	// the header text runs up to the samples, marker included
+	parse_header(std::string(data + header_offset, data + data_offset), segment.info);
+	segment.header_offset = header_offset;
+	segment.samps 		  = (const std::complex<float>*)(data + data_offset);
+	segment.data_bytes 	  = data_bytes;
+	segment.num_samps 	  = data_bytes / sizeof(std::complex<float>) / channels * channels;
+	_segments.push_back(segment);
+}
+
+
+void capture_file::index(double rate, size_t channels)
+{
+	static const char usrp_marker[] = "USRP data\n";
+	static const char next_marker[] = "\n\nAiP ";
+	const size_t samp_bytes = sizeof(std::complex<float>);
+	const char* data = (const char*)_base;
+
+	size_t pos = 0;
+	while (pos < _bytes){
+		const char* marker = (const char*)memmem(data + pos, _bytes - pos, usrp_marker, sizeof(usrp_marker) - 1);
+		if (marker == NULL) break;
+		size_t start = (marker - data) + sizeof(usrp_marker) - 1;
+
+		// the next header after a whole number of samples, else the end of the file
+		size_t end = _bytes, next = _bytes;
+		for (size_t search = start; search < _bytes; ){
+			const char* found = (const char*)memmem(data + search, _bytes - search, next_marker, sizeof(next_marker) - 1);
+			if (found == NULL) break;
+			size_t at = found - data;
+			if ((at - start) % samp_bytes == 0){
+				end  = at;
+				next = at + 1;
+				break;
+			}
+			search = at + 1;
+		}
+		if (end == _bytes and end > start and data[end - 1] == '\n' and (end - 1 - start) % samp_bytes == 0) end--;
+
+		add_segment(pos, start, end - start, rate, channels);
+		release(pos, next - pos);
+		pos = next;
+	}
+}
+
+
+void capture_file::save_index() const
+{
+	std::vector<index_entry_t> entries;
+	for (size_t i = 0; i < _segments.size(); i++){
+		index_entry_t entry = {_segments[i].header_offset, data_offset(i), _segments[i].data_bytes};
+		entries.push_back(entry);
+	}
+	save_index(_path, _bytes, entries);
+}
+
+
+void capture_file::save_index(const std::string& path, uint64_t file_bytes, const std::vector<index_entry_t>& entries)
+{
+	std::string idx_path = index_path(path);
+	std::ofstream out((idx_path + ".part").c_str());
+	out << boost::format("mmwave capture index %u") % file_bytes << std::endl;
+	for (size_t i = 0; i < entries.size(); i++){
+		out << boost::format("%u %u %u") % entries[i].header_offset % entries[i].data_offset % entries[i].data_bytes << std::endl;
+	}
+	out.close();
+	if (not out or std::rename((idx_path + ".part").c_str(), idx_path.c_str()) != 0){
+		std::remove((idx_path + ".part").c_str());
+		throw std::runtime_error(str(boost::format("Cannot write the index %s") % idx_path));
+	}
+}
+
+
+bool capture_file::load_index(double rate, size_t channels)
+{
+	std::ifstream in(index_path(_path).c_str());
+	std::string line;
+	unsigned long long file_bytes;
+	if (not std::getline(in, line) or std::sscanf(line.c_str(), "mmwave capture index %llu", &file_bytes) != 1 or file_bytes != _bytes){
+		return false;
+	}
+	while (std::getline(in, line)){
+		unsigned long long header_offset, data_offset, data_bytes;
+		if (std::sscanf(line.c_str(), "%llu %llu %llu", &header_offset, &data_offset, &data_bytes) != 3
+			or header_offset > data_offset or data_offset + data_bytes > _bytes){
+			_segments.clear();
+			return false;
+		}
+		add_segment(header_offset, data_offset, data_bytes, rate, channels);
+	}
+	return true;
+}
+
+/***********************************************************************
+ * Replay
+ **********************************************************************/
+replay_stats_t replay_captures(const std::vector<capture_file*>& files, const std::vector<analysis_stage*>& stages, const replay_config_t& config)
+{
+	// segments in file order, with the time each one is complete at the capture rate
+	struct item_t
+	{
+		const capture_file* file;
+		size_t 				segment;
+		double 				release;
+	};
+	std::vector<item_t> items;
+	double capture_secs = 0;
+	replay_stats_t stats;
+	for (size_t pass = 0; pass < config.repeat; pass++){
+		const segment_info_t* last = NULL;
+		for (size_t f = 0; f < files.size(); f++){
+			for (size_t s = 0; s < files[f]->num_segments(); s++){
+				const segment_info_t& info = files[f]->info(s);
+				capture_secs += files[f]->num_samps(s) / info.channels / info.rate;
+				item_t item = {files[f], s, capture_secs};
+				// a re-capture repeats the header of the bad copy before it (same beam, same switch time): it replaces it
+				if (last != NULL and not info.beam.empty() and info.beam == last->beam and info.time == last->time){
+					stats.samps -= items.back().file->num_samps(items.back().segment);
+					items.back() = item;
+					stats.superseded++;
+				}
+				else{
+					items.push_back(item);
+				}
+				stats.samps += files[f]->num_samps(s);
+				last = &info;
+			}
+		}
+	}
+	stats.segments = items.size();
+	stats.threads  = config.threads ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+
+	std::atomic<size_t> next(0);
+	std::vector<double> cpu(stats.threads, 0.0);
+	std::mutex error_mutex;
+	std::exception_ptr error;
+	std::atomic<bool> failed(false);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < stats.threads; t++){
+		workers.push_back(std::thread([&, t](){
+			double cpu_start = thread_cpu_seconds();
+			std::vector<std::complex<float>> aligned;
+			try{
+				for (size_t i = next++; i < items.size() and not failed; i = next++){
+					const item_t& item = items[i];
+					if (config.paced){
+						std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(item.release)));
+					}
+					const std::complex<float>* samps = item.file->samples(item.segment);
+					uint64_t num_samps = item.file->num_samps(item.segment);
+					// the header lengths vary: most segments do not start on a float boundary of the mapping
+					if ((uintptr_t)samps % alignof(std::complex<float>) != 0){
+						aligned.resize(num_samps);
+						std::memcpy(&aligned.front(), samps, num_samps * sizeof(std::complex<float>));
+						samps = &aligned.front();
+					}
+					for (size_t k = 0; k < stages.size(); k++){
+						stages[k]->process(item.file->info(item.segment), samps, num_samps);
+					}
+				}
+			}
+			catch (...){
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (not error) error = std::current_exception();
+				failed = true;
+			}
+			cpu[t] = thread_cpu_seconds() - cpu_start;
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++){
+		workers[t].join();
+	}
+	if (error) std::rethrow_exception(error);
+
+	stats.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (size_t t = 0; t < cpu.size(); t++){
+		stats.cpu += cpu[t];
+	}
+	return stats;
+}
+
+
+void print_replay_report(const replay_stats_t& stats, std::ostream& out)
+{
+	out << boost::format("Replayed %u segments, %u samples in %.3f s on %u threads: %.1f Msps, %.1f Msps per core (%.2f CPU s)")
+		% stats.segments % stats.samps % stats.wall % stats.threads % stats.msps() % stats.msps_per_core() % stats.cpu << std::endl;
+	if (stats.superseded > 0){
+		out << boost::format("  %u superseded segments skipped (bad copies received again)") % stats.superseded << std::endl;
+	}
+}
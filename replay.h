@@ -0,0 +1,136 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_REPLAY_H
+#define INCLUDED_MMWAVE_REPLAY_H
+
+#include "analysis.h"
+#include <stdint.h>
+#include <complex>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * capture_file
+ * Read-only mapping of a capture file and the index of its segments.
+ * Reads the layout of capture_writer and of the original tools
+ * (outfile.dat), which is the same text-delimited sequence:
+ *
+ *   \nAiP data\n<direction> - <angle> degrees at time <t>\n
+ *   \nUSRP data\n<fc32 samples>\n
+ *
+ * with "AiP Tx data" and "AiP Rx data" headers for the joint tool.
+ * The samples carry no length: a segment ends where "\n\nAiP " follows
+ * a whole number of samples, or at the end of the file (a truncated
+ * last sample is dropped). Segments point into the mapping, nothing is
+ * copied.
+ * Finding the segments reads the whole file: the index can be saved
+ * next to the capture (<file>.idx, one text line per segment) and is
+ * then loaded instead, as long as the file size still matches.
+ **********************************************************************/
+class capture_file
+{
+public:
+	// rate is not in the file: it is passed on to the stages, channels are interleaved per sample
+	capture_file(const std::string& path, double rate, size_t channels = 1, bool use_index = true);
+	~capture_file();
+
+	const std::string& path() const { return _path; }
+	uint64_t size() const { return _bytes; }
+
+	size_t num_segments() const { return _segments.size(); }
+
+	const segment_info_t& info(size_t segment) const { return _segments[segment].info; }
+
+	// Samples of a segment (all channels interleaved)
+	const std::complex<float>* samples(size_t segment) const { return _segments[segment].samps; }
+	uint64_t num_samps(size_t segment) const { return _segments[segment].num_samps; }
+
+	// Text before the samples of a segment (AiP lines and the USRP data marker) and its file offsets
+	std::string header(size_t segment) const;
+	uint64_t header_offset(size_t segment) const { return _segments[segment].header_offset; }
+	uint64_t data_offset(size_t segment) const { return (const char*)_segments[segment].samps - (const char*)_base; }
+
+	uint64_t total_samps() const;
+
+	// Seconds spent mapping and indexing the file, and whether the index came from <file>.idx
+	double index_secs() const { return _index_secs; }
+	bool index_loaded() const { return _index_loaded; }
+
+	// Write the index to <file>.idx
+	struct index_entry_t
+	{
+		uint64_t header_offset;
+		uint64_t data_offset;
+		uint64_t data_bytes;
+	};
+	void save_index() const;
+	static void save_index(const std::string& path, uint64_t file_bytes, const std::vector<index_entry_t>& entries);
+	static std::string index_path(const std::string& path) { return path + ".idx"; }
+
+	// Drop the pages of a byte range once read, to bound the memory taken by large files
+	void release(uint64_t offset, uint64_t bytes) const;
+
+private:
+	struct segment_t
+	{
+		segment_info_t 				info;
+		uint64_t 					header_offset;
+		const std::complex<float>* 	samps;
+		uint64_t 					data_bytes;		// as found in the file
+		uint64_t 					num_samps;		// whole samples of all channels
+	};
+
+	void index(double rate, size_t channels);
+	bool load_index(double rate, size_t channels);
+	void add_segment(uint64_t header_offset, uint64_t data_offset, uint64_t data_bytes, double rate, size_t channels);
+
+	std::string 			_path;
+	void* 					_base;
+	size_t 					_bytes;
+	std::vector<segment_t> 	_segments;
+	double 					_index_secs;
+	bool 					_index_loaded;
+};
+
+
+
+/***********************************************************************
+ * Replay of capture files through analysis stages
+ * Worker threads take the segments in file order and run every stage on
+ * each. Paced, a segment is released when it would have been complete
+ * at the capture rate (as the capture loop would hand it over), else
+ * the segments go through as fast as the workers take them.
+ * A segment received again by rx_capture follows its bad copy with the
+ * same header: only the last copy goes through the stages.
+ **********************************************************************/
+struct replay_config_t
+{
+	size_t 	threads = 0;		// worker threads (0: one per core)
+	bool 	paced 	= false;	// release the segments at the sample rate of the files
+	size_t 	repeat 	= 1;		// passes over the files (benchmarks)
+};
+
+struct replay_stats_t
+{
+	size_t 		segments 	= 0;
+	size_t 		superseded 	= 0;		// bad copies of re-captured segments, skipped
+	uint64_t 	samps 		= 0;		// samples of all channels
+	double 		wall 		= 0;
+	double 		cpu 		= 0;		// CPU seconds of the workers
+	size_t 		threads 	= 0;
+
+	double msps() const 			{ return (wall > 0) ? samps / wall / 1e6 : 0; }
+	double msps_per_core() const 	{ return (cpu > 0) ? samps / cpu / 1e6 : 0; }
+};
+
+replay_stats_t replay_captures(const std::vector<capture_file*>& files, const std::vector<analysis_stage*>& stages, const replay_config_t& config);
+
+// Segments, samples, wall and CPU time, Msps overall and per core
+void print_replay_report(const replay_stats_t& stats, std::ostream& out = std::cout);
+
+#endif /* INCLUDED_MMWAVE_REPLAY_H */
@@ -0,0 +1,209 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "rx_capture.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <sys/resource.h>
+
+
+
+// CPU time (user + system) of the calling thread or of the whole process
+static double cpu_seconds(int who)
+{
+	struct rusage usage;
+	getrusage(who, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6*(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+static double wall_seconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void align_capture_blocks(capture_config_t& capture, size_t batch_samps)
+{
+	if (batch_samps == 0) return;
+	size_t batch_bytes = batch_samps*sizeof(std::complex<float>);
+	capture.block_size = batch_bytes * std::max<size_t>(1, capture.block_size / batch_bytes);
+}
+
+
+
+void rx_segment_stats_t::add(const rx_segment_stats_t& other)
+{
+	requested_samps += other.requested_samps;
+	received_samps 	+= other.received_samps;
+	lost_samps 		+= other.lost_samps;
+	overflows 		+= other.overflows;
+	timeouts 		+= other.timeouts;
+	bad_packets 	+= other.bad_packets;
+	tx_events 		+= other.tx_events;
+	recv_calls 		+= other.recv_calls;
+	skipped_samps 	+= other.skipped_samps;
+}
+
+
+
+rx_capture::rx_capture(uhd::rx_streamer::sptr rx_stream, capture_writer& out, double rate, double first_timeout,
+					   size_t max_recaptures, size_t batch_samps, buffer_arena* arena, size_t max_consecutive_timeouts) :
+	_rx_stream(rx_stream), _out(out), _rate(rate), _timeout(first_timeout), _max_recaptures(max_recaptures),
+	_max_consecutive_timeouts(max_consecutive_timeouts), _spb(batch_samps > 0 ? batch_samps : rx_stream->get_max_num_samps()),
+	_one_packet(batch_samps == 0), _has_next_tick(false), _next_tick(0), _segment(0), _recaptures(0), _started(false),
+	_wall_start(0), _thread_cpu_start(0), _process_cpu_start(0)
+{
+	if (arena != NULL){
+		_buff = arena->allocate<std::complex<float>>(_spb);
+	}
+	else{
+		_own_buff.resize(_spb);
+		_buff = &_own_buff.front();
+	}
+}
+
+
+void rx_capture::add_tx_monitor(const tx_async_monitor* monitor)
+{
+	_tx_monitors.push_back(monitor);
+}
+
+
+rx_segment_stats_t rx_capture::capture_segment(const std::string& header, const std::string& beam, double time_switch, uint64_t nsamps,
+											   double window_start)
+{
+	if (not _started){
+		_started 			= true;
+		_wall_start 		= wall_seconds();
+		_thread_cpu_start 	= cpu_seconds(RUSAGE_THREAD);
+		_process_cpu_start 	= cpu_seconds(RUSAGE_SELF);
+	}
+
+	for (size_t attempt = 0; ; attempt++){
+		std::vector<tx_event_counts_t> tx_start(_tx_monitors.size());
+		for (size_t i = 0; i < _tx_monitors.size(); i++){
+			tx_start[i] = _tx_monitors[i]->counts();
+		}
+
+		_out.begin_segment();
+		_out.write_text(header);
+		_out.write_text("\nUSRP data\n");
+		rx_segment_stats_t stats = receive(nsamps, (window_start >= 0 and attempt == 0) ? uhd::time_spec_t(window_start).to_ticks(_rate) : -1);
+		_out.write_text("\n");
+		_out.end_segment();
+
+		std::string tx_json;
+		for (size_t i = 0; i < _tx_monitors.size(); i++){
+			tx_event_counts_t tx = _tx_monitors[i]->counts() - tx_start[i];
+			stats.tx_events += tx.total();
+			tx_json += str(boost::format("%s\"%s\": {\"underflows\": %u, \"seq_errors\": %u, \"time_errors\": %u}")
+				% (i > 0 ? ", " : "") % _tx_monitors[i]->name() % tx.underflows % tx.seq_errors % tx.time_errors);
+		}
+
+		bool recapture = not stats.ok() and attempt < _max_recaptures;
+		_out.write_metadata(str(boost::format(
+			"{\"segment\": %u, \"file\": \"%s\", \"beam\": \"%s\", \"time\": %f, \"attempt\": %u, \"requested\": %u, \"received\": %u, "
+			"\"lost\": %u, \"overflows\": %u, \"timeouts\": %u, \"bad_packets\": %u, \"recv_calls\": %u, \"tx\": {%s}, \"status\": \"%s\", \"superseded\": %s}")
+			% _segment % _out.current_file() % beam % time_switch % attempt % stats.requested_samps % stats.received_samps
+			% stats.lost_samps % stats.overflows % stats.timeouts % stats.bad_packets % stats.recv_calls % tx_json % stats.status() % (recapture ? "true" : "false")));
+		_totals.add(stats);
+		_segment++;
+
+		std::cout << boost::format("  -- Received %f samples") % stats.received_samps << std::endl;
+		if (not stats.ok()){
+			std::cout << boost::format("  -- Segment degraded: %u overflows, %u lost samples, %u bad packets, %u Tx events%s")
+				% stats.overflows % stats.lost_samps % stats.bad_packets % stats.tx_events % (recapture ? ", capturing again" : "") << std::endl;
+		}
+		if (not recapture) return stats;
+		_recaptures++;
+	}
+}
+
+
+rx_segment_stats_t rx_capture::receive(uint64_t nsamps, long long start_tick)
+{
+	rx_segment_stats_t stats;
+	stats.requested_samps = nsamps;
+	uhd::rx_metadata_t md;
+	size_t consecutive_timeouts = 0;
+
+	while (stats.received_samps < nsamps){
+		//receive a single packet, or a batch of packets (not beyond the end of the segment)
+		size_t num_rx_samps = _one_packet ? _rx_stream->recv(_buff, _spb, md, _timeout, true)
+										  : _rx_stream->recv(_buff, std::min<uint64_t>(_spb, nsamps - stats.received_samps), md, _timeout, false);
+		stats.recv_calls++;
+
+		//use a small timeout for subsequent packets (plus the duration of a batch)
+		_timeout = _one_packet ? 0.1 : 0.1 + _spb/_rate;
+
+		//handle the error code
+		switch (md.error_code){
+		case uhd::rx_metadata_t::ERROR_CODE_NONE:
+			break;
+
+		case uhd::rx_metadata_t::ERROR_CODE_TIMEOUT:
+			stats.timeouts++;
+			if (++consecutive_timeouts >= _max_consecutive_timeouts){
+				throw std::runtime_error(str(boost::format("Receiver stalled: %u consecutive timeouts") % consecutive_timeouts));
+			}
+			continue;
+
+		case uhd::rx_metadata_t::ERROR_CODE_OVERFLOW:
+			// continuous streaming restarts by itself, the gap is measured on the next packet
+			stats.overflows++;
+			continue;
+
+		case uhd::rx_metadata_t::ERROR_CODE_ALIGNMENT:
+		case uhd::rx_metadata_t::ERROR_CODE_BAD_PACKET:
+			stats.bad_packets++;
+			continue;
+
+		default:
+			throw std::runtime_error(str(boost::format("Receiver error %s") % md.strerror()));
+		}
+		consecutive_timeouts = 0;
+
+		// samples missing between the previous packet and this one
+		size_t skip = 0;
+		if (md.has_time_spec){
+			long long tick = md.time_spec.to_ticks(_rate);
+			if (_has_next_tick and tick > _next_tick){
+				stats.lost_samps += tick - _next_tick;
+			}
+			_next_tick 		= tick + num_rx_samps;
+			_has_next_tick 	= true;
+
+			// before the window: dropped, not lost
+			if (start_tick > tick) skip = std::min<long long>(num_rx_samps, start_tick - tick);
+		}
+		if (skip == num_rx_samps) continue;
+
+		_out.write_samples(_buff + skip, num_rx_samps - skip);
+		stats.received_samps += num_rx_samps - skip;
+	}
+	return stats;
+}
+
+
+void rx_capture::print_report() const
+{
+	double wall 		= _started ? wall_seconds() - _wall_start : 0;
+	double thread_cpu 	= _started ? cpu_seconds(RUSAGE_THREAD) - _thread_cpu_start : 0;
+	double process_cpu 	= _started ? cpu_seconds(RUSAGE_SELF) - _process_cpu_start : 0;
+	double msps 		= (wall > 0) ? _totals.received_samps / wall / 1e6 : 0;
+	std::cout << boost::format("Recv: %u calls, %.0f samples per call (%s), %.2f Msps over %.1f s")
+		% _totals.recv_calls % (_totals.recv_calls > 0 ? (double)_totals.received_samps / _totals.recv_calls : 0.0)
+		% (_one_packet ? "one packet per call" : str(boost::format("batches of %u") % _spb)) % msps % wall << std::endl;
+	if (wall > 0 and msps > 0){
+		std::cout << boost::format("CPU: recv thread %.1f%% (%.2f%% per Msps), process %.1f%% (%.2f%% per Msps)")
+			% (100*thread_cpu/wall) % (100*thread_cpu/wall/msps) % (100*process_cpu/wall) % (100*process_cpu/wall/msps) << std::endl;
+	}
+
+	std::cout << boost::format("Rx report: %u segments (%u captured again), %u samples received, %u lost, %u overflows, %u timeouts, %u bad packets, %u Tx events during segments")
+		% _segment % _recaptures % _totals.received_samps % _totals.lost_samps % _totals.overflows % _totals.timeouts % _totals.bad_packets % _totals.tx_events << std::endl;
+}
@@ -0,0 +1,116 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_RX_CAPTURE_H
+#define INCLUDED_MMWAVE_RX_CAPTURE_H
+
+#include <uhd/stream.hpp>
+#include <stdint.h>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "buffer_arena.h"
+#include "capture_writer.h"
+#include "tx_monitor.h"
+
+
+
+/***********************************************************************
+ * Receive statistics of one segment (or of a whole run)
+ **********************************************************************/
+struct rx_segment_stats_t
+{
+	uint64_t 	requested_samps = 0;
+	uint64_t 	received_samps 	= 0;
+	uint64_t 	lost_samps 		= 0;	// samples missing from the time_spec sequence
+	uint64_t 	overflows 		= 0;
+	uint64_t 	timeouts 		= 0;
+	uint64_t 	bad_packets 	= 0;	// alignment and bad packet errors (packet dropped)
+	uint64_t 	tx_events 		= 0;	// underflows, sequence and time errors of the monitored Tx streamers
+	uint64_t 	recv_calls 		= 0;
+	uint64_t 	skipped_samps 	= 0;	// window samples received before the segment was posted (capture_engine, zero-filled, not lost)
+
+	bool ok() const { return lost_samps == 0 and overflows == 0 and bad_packets == 0 and tx_events == 0; }
+	std::string status() const { return ok() ? "ok" : "degraded"; }
+	void add(const rx_segment_stats_t& other);
+};
+
+
+
+/***********************************************************************
+ * rx_capture
+ * Receives the segments of a sweep from one Rx streamer into a capture
+ * writer. Overflows, dropped packets and timeouts do not stop the sweep:
+ * they are counted, the number of lost samples is measured from the
+ * time_spec of the packets, and the segment is marked in the metadata
+ * file. A bad segment can be received again on the same beam (the bad
+ * copy stays in the file, flagged as superseded in the metadata). Only
+ * late commands, broken chains and a stream that stops delivering
+ * samples (max_consecutive_timeouts timeouts in a row) are fatal.
+ * The events of the Tx streamers feeding the measurement (LO, Tx BB)
+ * are attributed to the segments through their tx_async_monitor.
+ * By default every recv call returns one network packet. With a batch
+ * size, each call fills a block of up to batch_samps samples covering
+ * many packets (fewer library calls and writes per second at high rates).
+ **********************************************************************/
+class rx_capture
+{
+public:
+	// batch_samps = 0: one packet per recv call. The recv buffer comes from the arena if one is given
+	rx_capture(uhd::rx_streamer::sptr rx_stream, capture_writer& out, double rate, double first_timeout,
+			   size_t max_recaptures = 0, size_t batch_samps = 0, buffer_arena* arena = NULL, size_t max_consecutive_timeouts = 10);
+
+	// Attribute the events of a Tx streamer to the segments (the monitor must outlive the captures)
+	void add_tx_monitor(const tx_async_monitor* monitor);
+
+	// Write header, "USRP data" marker and nsamps samples as one segment (plus re-captures if needed).
+	// With a window start (device time), the samples received before it are dropped: the segment is the
+	// window of a sweep schedule rather than what follows the switch (a re-capture starts right away)
+	rx_segment_stats_t capture_segment(const std::string& header, const std::string& beam, double time_switch, uint64_t nsamps,
+									   double window_start = -1);
+
+	const rx_segment_stats_t& totals() const { return _totals; }
+	size_t num_segments() const { return _segment; }
+
+	// Number the next segment as segment (continuing the segments of an interrupted capture)
+	void set_next_segment(size_t segment) { _segment = segment; }
+	size_t num_recaptures() const { return _recaptures; }
+
+	// Print the totals of the run, with recv calls and CPU use per Msps
+	void print_report() const;
+
+private:
+	rx_segment_stats_t receive(uint64_t nsamps, long long start_tick);
+
+	uhd::rx_streamer::sptr 				_rx_stream;
+	capture_writer& 					_out;
+	double 								_rate;
+	double 								_timeout;
+	size_t 								_max_recaptures;
+	size_t 								_max_consecutive_timeouts;
+	std::vector<std::complex<float>> 	_own_buff;
+	std::complex<float>* 				_buff;
+	size_t 								_spb;
+	bool 								_one_packet;
+	std::vector<const tx_async_monitor*> _tx_monitors;
+
+	bool 					_has_next_tick;
+	long long 				_next_tick;		// expected time of the next packet, in samples
+	size_t 					_segment;
+	size_t 					_recaptures;
+	rx_segment_stats_t 		_totals;
+
+	// CPU use, from the first segment on
+	bool 					_started;
+	double 					_wall_start;
+	double 					_thread_cpu_start;
+	double 					_process_cpu_start;
+};
+
+// Make the writer blocks a multiple of the recv batch, so that a batch never straddles more than two blocks
+void align_capture_blocks(capture_config_t& capture, size_t batch_samps);
+
+#endif /* INCLUDED_MMWAVE_RX_CAPTURE_H */
@@ -0,0 +1,214 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "settling.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+
+
+
+/***********************************************************************
+ * Power windows
+ **********************************************************************/
+power_meter::power_meter(size_t window, double rate) :
+	_window(std::max<size_t>(window, 1)), _rate(rate), _sum(0), _count(0), _window_time(0), _next_time(NAN)
+{
+}
+
+
+void power_meter::add(const std::complex<float>* samps, size_t nsamps, double time_first)
+{
+	// samples lost since the last call: the incomplete window would mix both sides of the gap
+	if (_count > 0 and std::abs(time_first - _next_time) > 0.5 / _rate){
+		_sum 	= 0;
+		_count 	= 0;
+	}
+	for (size_t i = 0; i < nsamps; i++){
+		if (_count == 0) _window_time = time_first + i / _rate;
+		_sum += std::norm(samps[i]);
+		if (++_count == _window){
+			power_window_t window = {_window_time, (float)(10*std::log10(_sum / _count + 1e-20))};
+			_windows.push_back(window);
+			_sum 	= 0;
+			_count 	= 0;
+		}
+	}
+	_next_time = time_first + nsamps / _rate;
+}
+
+
+
+/***********************************************************************
+ * Detection of the power steps
+ **********************************************************************/
+// Median power of the second half of windows [first, last)
+static double beam_level(const std::vector<power_window_t>& windows, size_t first, size_t last)
+{
+	if (last <= first) return NAN;
+	std::vector<float> powers;
+	for (size_t i = first + (last - first) / 2; i < last; i++){
+		powers.push_back(windows[i].power_db);
+	}
+	std::nth_element(powers.begin(), powers.begin() + powers.size() / 2, powers.end());
+	return powers[powers.size() / 2];
+}
+
+
+// First window starting at or after a time
+static size_t window_at(const std::vector<power_window_t>& windows, double time)
+{
+	return std::lower_bound(windows.begin(), windows.end(), time, [](const power_window_t& window, double t){
+		return window.time < t;
+	}) - windows.begin();
+}
+
+
+void detect_settling(const std::vector<power_window_t>& windows, std::vector<settling_event_t>& events, const settling_config_t& config)
+{
+	double previous = events.empty() ? NAN : beam_level(windows, 0, window_at(windows, events[0].issue));
+	for (size_t k = 0; k < events.size(); k++){
+		settling_event_t& event = events[k];
+		size_t first = window_at(windows, event.issue);
+		size_t last  = (k + 1 < events.size()) ? window_at(windows, events[k + 1].issue) : windows.size();
+		double level = beam_level(windows, first, last);
+
+		event.settled = NAN;
+		event.step_db = level - previous;
+		previous 	  = level;
+		if (std::isnan(event.step_db) or std::abs(event.step_db) < config.min_step_db) continue;
+
+		// settled from the window after the last one outside the tolerance
+		size_t settled = first;
+		for (size_t i = last; i > first; i--){
+			if (std::abs(windows[i - 1].power_db - level) > config.tolerance_db){
+				settled = i;
+				break;
+			}
+		}
+		if (settled < last) event.settled = windows[settled].time;
+	}
+}
+
+
+
+/***********************************************************************
+ * Runner
+ **********************************************************************/
+settling_result_t run_settling_test(uhd::rx_streamer::sptr rx_stream, double rate, aip_controller& arrays, size_t array,
+									const sweep_step_t& beam_a, const sweep_step_t& beam_b, int mode,
+									std::function<double()> time_now, const settling_config_t& config, double timeout)
+{
+	settling_result_t result;
+	result.resolution = config.window / rate;
+	result.overflows  = 0;
+	result.events.resize(config.switches);
+	const sweep_step_t* beams[2] = {&beam_a, &beam_b};
+	arrays.steer_frames(array, beam_a.frames, mode).get();
+
+	size_t spp = rx_stream->get_max_num_samps();
+	std::vector<std::vector<std::complex<float>>> buffs(rx_stream->get_num_channels(), std::vector<std::complex<float>>(spp));
+	std::vector<void*> buff_ptrs;
+	for (size_t ch = 0; ch < buffs.size(); ch++){
+		buff_ptrs.push_back(&buffs[ch].front());
+	}
+
+	power_meter meter(config.window, rate);
+	std::vector<std::future<void>> pending;
+	uhd::rx_metadata_t md;
+	size_t switches 	= 0;
+	double next_switch 	= NAN;
+	double recv_timeout = timeout;
+	try{
+		while (true){
+			size_t num_rx_samps = rx_stream->recv(buff_ptrs, spp, md, recv_timeout, true);
+			recv_timeout = 0.1;
+			if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW){
+				result.overflows++;
+				continue;
+			}
+			if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
+				throw std::runtime_error(str(boost::format("Receiver error during the settling test: %s") % md.strerror()));
+			}
+			if (num_rx_samps == 0) continue;
+
+			// power of the first channel
+			double time_first = md.time_spec.get_real_secs();
+			meter.add(&buffs[0].front(), num_rx_samps, time_first);
+			if (std::isnan(next_switch)) next_switch = time_first + config.dwell;
+			double time_end = time_first + num_rx_samps / rate;
+			if (time_end < next_switch) continue;
+			if (switches == config.switches) break;
+
+			// queue the switch and a timestamp right behind it on the I/O thread of the array
+			settling_event_t& event = result.events[switches];
+			event.beam 	= (switches + 1) % 2;
+			event.issue = time_now();
+			pending.push_back(arrays.steer_frames(array, beams[event.beam]->frames, mode));
+			pending.push_back(arrays.submit(array, [&event, time_now](aip_transport*){ event.serial_done = time_now(); }));
+			switches++;
+			next_switch += config.dwell;
+		}
+	}
+	catch (...){
+		// the queued timestamps write into the events
+		for (size_t i = 0; i < pending.size(); i++){
+			pending[i].wait();
+		}
+		throw;
+	}
+	wait_all(pending);
+
+	result.windows = meter.windows();
+	detect_settling(result.windows, result.events, config);
+	return result;
+}
+
+
+
+/***********************************************************************
+ * Report
+ **********************************************************************/
+// Nearest-rank percentile of sorted values, in ms
+static double percentile_ms(const std::vector<double>& sorted, double p)
+{
+	size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+	return 1e3 * sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+
+void print_settling_report(const settling_result_t& result, std::ostream& out)
+{
+	std::vector<double> serial, rf, total;
+	for (size_t k = 0; k < result.events.size(); k++){
+		const settling_event_t& event = result.events[k];
+		if (not event.detected()) continue;
+		serial.push_back(event.serial());
+		rf.push_back(event.rf());
+		total.push_back(event.total());
+	}
+	out << boost::format("Beam switch settling: %u of %u switches measured, resolution %.3f ms, %u overflows")
+		% total.size() % result.events.size() % (1e3 * result.resolution) % result.overflows << std::endl;
+	if (total.empty()){
+		out << "  no power step found: check the gains of the two beams and the Rx level" << std::endl;
+		return;
+	}
+
+	const char* names[3] 				= {"serial", "RF settling", "issue to settled"};
+	std::vector<double>* values[3] 		= {&serial, &rf, &total};
+	for (size_t i = 0; i < 3; i++){
+		std::sort(values[i]->begin(), values[i]->end());
+		out << boost::format("  %s: min %.3f ms, median %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms")
+			% names[i] % percentile_ms(*values[i], 0) % percentile_ms(*values[i], 50) % percentile_ms(*values[i], 90)
+			% percentile_ms(*values[i], 99) % percentile_ms(*values[i], 100) << std::endl;
+	}
+	double step = 0;
+	for (size_t k = 0; k < result.events.size(); k++){
+		if (result.events[k].detected()) step += std::abs(result.events[k].step_db);
+	}
+	out << boost::format("  mean power step %.1f dB, guard interval for 99%% of the switches: %.3f ms")
+		% (step / total.size()) % percentile_ms(total, 99) << std::endl;
+}
@@ -0,0 +1,112 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_SETTLING_H
+#define INCLUDED_MMWAVE_SETTLING_H
+
+#include <uhd/stream.hpp>
+#include "aip_controller.h"
+#include "sweep_plan.h"
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Beam switch settling test
+ * The array alternates between two beams of very different gains (e.g.
+ * the beam on the transmitter and the same beam with all antennas off)
+ * while the Rx streams continuously. The power of the Rx samples, in
+ * windows of a few hundred samples, shows when each switch took effect:
+ *
+ *   issue        the device time the switch was queued
+ *   serial_done  the array acknowledged the last command of the switch
+ *   settled      the power entered and stayed within the tolerance of
+ *                the level of the new beam
+ *
+ * serial_done - issue is the serial time, settled - serial_done the RF
+ * settling (negative if the array switched before the last reply).
+ * settled is resolved to one window, later rather than earlier.
+ **********************************************************************/
+struct settling_config_t
+{
+	size_t 	switches 		= 100;		// beam switches, alternating between the two beams
+	double 	dwell 			= 0.02;		// seconds between two switches (more than twice the settling)
+	size_t 	window 			= 256;		// samples per power measurement
+	double 	tolerance_db 	= 1.0;		// settled once the power stays this close to the new level
+	double 	min_step_db 	= 6.0;		// switches with a smaller power step are not measured
+};
+
+struct settling_event_t
+{
+	size_t 	beam;			// beam switched to (0 or 1)
+	double 	issue;
+	double 	serial_done;
+	double 	settled;		// NaN if no power step was found
+	double 	step_db;		// level of the new beam minus level of the previous one
+
+	bool detected() const 	{ return not std::isnan(settled); }
+	double serial() const 	{ return serial_done - issue; }
+	double rf() const 		{ return settled - serial_done; }
+	double total() const 	{ return settled - issue; }
+};
+
+// Mean power of one window of samples
+struct power_window_t
+{
+	double 	time;		// device time of the first sample
+	float 	power_db;
+};
+
+struct settling_result_t
+{
+	std::vector<settling_event_t> 	events;
+	std::vector<power_window_t> 	windows;
+	double 							resolution;	// seconds per window
+	size_t 							overflows;
+};
+
+
+// Mean power of consecutive windows of samples. A gap in the sample times
+// (overflow) drops the incomplete window.
+class power_meter
+{
+public:
+	power_meter(size_t window, double rate);
+
+	void add(const std::complex<float>* samps, size_t nsamps, double time_first);
+
+	const std::vector<power_window_t>& windows() const { return _windows; }
+
+private:
+	size_t 						_window;
+	double 						_rate;
+	std::vector<power_window_t> _windows;
+	double 						_sum;
+	size_t 						_count;
+	double 						_window_time;
+	double 						_next_time;
+};
+
+
+// Settled time and power step of each event from the power windows (events in issue order).
+// The level of a beam is the median power over the second half of its dwell.
+void detect_settling(const std::vector<power_window_t>& windows, std::vector<settling_event_t>& events, const settling_config_t& config);
+
+// Set beam_a, stream one dwell, then alternate config.switches times between beam_b and beam_a every
+// config.dwell seconds while receiving. The stream must have been started (timeout covers the first
+// packet), time_now reads the device time. The beam switches run on the I/O thread of the array while
+// the samples are received.
+settling_result_t run_settling_test(uhd::rx_streamer::sptr rx_stream, double rate, aip_controller& arrays, size_t array,
+									const sweep_step_t& beam_a, const sweep_step_t& beam_b, int mode,
+									std::function<double()> time_now, const settling_config_t& config, double timeout = 0.1);
+
+// Distribution (min, median, 90th and 99th percentiles, max) of the serial, RF and total settling time
+void print_settling_report(const settling_result_t& result, std::ostream& out = std::cout);
+
+#endif /* INCLUDED_MMWAVE_SETTLING_H */
@@ -0,0 +1,34 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "stream_functions.h"
+#include <algorithm>
+#include <cstring>
+
+
+
+// Fill a Tx buffer of spb samples from a waveform played in a loop, starting at index (updated)
+void fill_tx_buffer(std::complex<float>* buff, size_t spb, const std::vector<std::complex<float>>& data, size_t& index)
+{
+	// nothing to wrap around in an empty waveform: send zeros
+	if (data.empty()){
+		std::fill(buff, buff + spb, std::complex<float>(0.0f, 0.0f));
+		index = 0;
+		return;
+	}
+
+	// copy contiguous runs up to the end of the waveform instead of wrapping sample per sample
+	size_t n = 0;
+	while (n < spb){
+		size_t run = std::min(spb - n, data.size() - index);
+		std::memcpy(buff + n, &data[index], run*sizeof(std::complex<float>));
+		n 		+= run;
+		index 	+= run;
+		if (index == data.size()){
+			index = 0;
+		}
+	}
+}
+
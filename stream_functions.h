@@ -0,0 +1,21 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_STREAM_FUNCTIONS_H
+#define INCLUDED_MMWAVE_STREAM_FUNCTIONS_H
+
+#include <complex>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Auxiliary functions for the USRP Tx and Rx streaming paths
+ **********************************************************************/
+
+// Fill a Tx buffer of spb samples from a waveform played in a loop, starting at index (updated); zeros if the waveform is empty
+void fill_tx_buffer(std::complex<float>* buff, size_t spb, const std::vector<std::complex<float>>& data, size_t& index);
+
+#endif /* INCLUDED_MMWAVE_STREAM_FUNCTIONS_H */
@@ -0,0 +1,306 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "stream_standin.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <thread>
+
+// sc16 full scale, as the fc32 <-> sc16 converters of UHD
+static const float SC16_SCALE = 32767.0f;
+
+
+
+// One packet of a QPSK pattern, the content of the Rx wire buffer
+static std::vector<int16_t> make_wire_packet(size_t spp)
+{
+	std::vector<int16_t> wire(2*spp);
+	for (size_t i = 0; i < spp; i++){
+		wire[2*i] 	  = (i % 2) ? 23170 : -23170;
+		wire[2*i + 1] = ((i / 2) % 2) ? 23170 : -23170;
+	}
+	return wire;
+}
+
+
+static double elapsed_secs(const std::chrono::steady_clock::time_point& epoch)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+
+// Sleep until a device time (seconds since the epoch)
+static void sleep_until_device_time(const std::chrono::steady_clock::time_point& epoch, double secs)
+{
+	std::this_thread::sleep_until(epoch + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(secs)));
+}
+
+
+
+/***********************************************************************
+ * Rx stand-in
+ **********************************************************************/
+standin_rx_streamer::standin_rx_streamer(size_t num_channels, double rate, size_t spp, bool paced, double buffer_secs) :
+	_num_channels(num_channels), _rate(rate), _spp(spp), _paced(paced), _buffer_samps(std::llround(buffer_secs * rate)),
+	_epoch(std::chrono::steady_clock::now()), _wire(make_wire_packet(spp)),
+	_streaming(false), _continuous(false), _next_tick(0), _remaining(0), _amplitude(1.0f)
+{
+}
+
+
+double standin_rx_streamer::time_now() const
+{
+	return elapsed_secs(_epoch);
+}
+
+
+void standin_rx_streamer::set_time_now(double time)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_epoch = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(time));
+}
+
+
+void standin_rx_streamer::schedule_gain(double at, double gain_db, double ramp)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	// a new step replaces the ones scheduled after it
+	while (not _gain_steps.empty() and _gain_steps.back().time >= at){
+		_gain_steps.pop_back();
+	}
+	gain_step_t step = {at, ramp, amplitude_at(_amplitude, _gain_steps, at), (float)std::pow(10.0, gain_db / 20)};
+	_gain_steps.push_back(step);
+}
+
+
+float standin_rx_streamer::amplitude_at(float amplitude, const std::vector<gain_step_t>& steps, double time)
+{
+	for (size_t i = 0; i < steps.size() and time >= steps[i].time; i++){
+		double progress = (steps[i].ramp > 0) ? std::min(1.0, (time - steps[i].time) / steps[i].ramp) : 1.0;
+		amplitude = steps[i].from + (steps[i].to - steps[i].from) * (float)progress;
+	}
+	return amplitude;
+}
+
+
+void standin_rx_streamer::issue_stream_cmd(const uhd::stream_cmd_t& stream_cmd)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	long long start = stream_cmd.stream_now ? std::llround(time_now() * _rate) : stream_cmd.time_spec.to_ticks(_rate);
+	switch (stream_cmd.stream_mode){
+	case uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS:
+		_streaming 	= true;
+		_continuous = true;
+		_next_tick 	= start;
+		break;
+
+	case uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS:
+		_streaming = false;
+		break;
+
+	default:
+		_streaming 	= (stream_cmd.num_samps > 0);
+		_continuous = false;
+		_remaining 	= stream_cmd.num_samps;
+		_next_tick 	= start;
+		break;
+	}
+}
+
+
+size_t standin_rx_streamer::recv(const buffs_type& buffs, const size_t nsamps_per_buff, uhd::rx_metadata_t& metadata,
+								 const double timeout, const bool one_packet)
+{
+	metadata.reset();
+	double deadline = time_now() + timeout;
+	size_t nsamps = one_packet ? std::min(nsamps_per_buff, _spp) : nsamps_per_buff;
+
+	// wait for a stream command
+	long long tick;
+	float amplitude;
+	std::vector<gain_step_t> steps;
+	while (true){
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_streaming){
+				tick = _next_tick;
+				if (not _continuous) nsamps = std::min<uint64_t>(nsamps, _remaining);
+				// gain steps completed before these samples set the amplitude, later ones stay
+				while (not _gain_steps.empty() and _gain_steps.front().time + _gain_steps.front().ramp <= tick / _rate){
+					_amplitude = _gain_steps.front().to;
+					_gain_steps.erase(_gain_steps.begin());
+				}
+				amplitude = _amplitude;
+				for (size_t i = 0; i < _gain_steps.size() and _gain_steps[i].time < (tick + nsamps) / _rate; i++){
+					steps.push_back(_gain_steps[i]);
+				}
+				break;
+			}
+		}
+		if (time_now() >= deadline){
+			metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+			return 0;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	if (_paced){
+		// the device buffer is full: the samples the host did not take are dropped
+		long long now = std::llround(time_now() * _rate);
+		if (now - tick > _buffer_samps){
+			std::lock_guard<std::mutex> lock(_mutex);
+			_next_tick = now;
+			metadata.error_code 	= uhd::rx_metadata_t::ERROR_CODE_OVERFLOW;
+			metadata.has_time_spec 	= true;
+			metadata.time_spec 		= uhd::time_spec_t::from_ticks(now, _rate);
+			return 0;
+		}
+		// wait until the last sample of the buffer has been received
+		double ready = (tick + nsamps) / _rate;
+		if (ready > deadline){
+			sleep_until_device_time(_epoch, deadline);
+			metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+			return 0;
+		}
+		sleep_until_device_time(_epoch, ready);
+	}
+
+	// sc16 -> fc32, packet by packet, with the gain of each sample while a gain step is in progress
+	float scale = amplitude / SC16_SCALE;
+	for (size_t ch = 0; ch < _num_channels; ch++){
+		std::complex<float>* out = (std::complex<float>*)buffs[ch];
+		for (size_t offset = 0; offset < nsamps; offset += _spp){
+			size_t count = std::min(_spp, nsamps - offset);
+			if (steps.empty()){
+				for (size_t i = 0; i < count; i++){
+					out[offset + i] = std::complex<float>(_wire[2*i] * scale, _wire[2*i + 1] * scale);
+				}
+				continue;
+			}
+			for (size_t i = 0; i < count; i++){
+				float gain = amplitude_at(amplitude, steps, (tick + offset + i) / _rate) / SC16_SCALE;
+				out[offset + i] = std::complex<float>(_wire[2*i] * gain, _wire[2*i + 1] * gain);
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_next_tick == tick){
+		_next_tick += nsamps;
+		if (not _continuous){
+			_remaining -= nsamps;
+			if (_remaining == 0){
+				_streaming = false;
+				metadata.end_of_burst = true;
+			}
+		}
+	}
+	metadata.has_time_spec 	= true;
+	metadata.time_spec 		= uhd::time_spec_t::from_ticks(tick, _rate);
+	return nsamps;
+}
+
+
+
+/***********************************************************************
+ * Tx stand-in
+ **********************************************************************/
+standin_tx_streamer::standin_tx_streamer(size_t num_channels, double rate, size_t spp, bool paced, double buffer_secs) :
+	_num_channels(num_channels), _rate(rate), _spp(spp), _paced(paced), _buffer_samps(std::llround(buffer_secs * rate)),
+	_epoch(std::chrono::steady_clock::now()), _wire(2*spp), _in_burst(false), _next_tick(0)
+{
+}
+
+
+double standin_tx_streamer::time_now() const
+{
+	return elapsed_secs(_epoch);
+}
+
+
+void standin_tx_streamer::set_time_now(double time)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_epoch = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(time));
+}
+
+
+void standin_tx_streamer::push_event(uhd::async_metadata_t::event_code_t code, long long tick)
+{
+	uhd::async_metadata_t event;
+	event.event_code 	= code;
+	event.has_time_spec = true;
+	event.time_spec 	= uhd::time_spec_t::from_ticks(tick, _rate);
+	std::lock_guard<std::mutex> lock(_mutex);
+	_events.push_back(event);
+	_cond.notify_all();
+}
+
+
+size_t standin_tx_streamer::send(const buffs_type& buffs, const size_t nsamps_per_buff, const uhd::tx_metadata_t& metadata, const double timeout)
+{
+	// fc32 -> sc16, packet by packet
+	for (size_t ch = 0; ch < _num_channels and nsamps_per_buff > 0; ch++){
+		const std::complex<float>* in = (const std::complex<float>*)buffs[ch];
+		for (size_t offset = 0; offset < nsamps_per_buff; offset += _spp){
+			size_t count = std::min(_spp, nsamps_per_buff - offset);
+			for (size_t i = 0; i < count; i++){
+				_wire[2*i] 	   = (int16_t)(in[offset + i].real() * SC16_SCALE);
+				_wire[2*i + 1] = (int16_t)(in[offset + i].imag() * SC16_SCALE);
+			}
+		}
+	}
+
+	long long now = _paced ? std::llround(time_now() * _rate) : _next_tick;
+	if (metadata.start_of_burst or not _in_burst or metadata.has_time_spec){
+		long long start = metadata.has_time_spec ? metadata.time_spec.to_ticks(_rate) : now;
+		if (_paced and start < now){
+			push_event(uhd::async_metadata_t::EVENT_CODE_TIME_ERROR, now);
+			start = now;
+		}
+		_next_tick = start;
+		_in_burst  = true;
+	}
+	else if (_paced and _next_tick < now){
+		// the device played out everything it had
+		push_event(uhd::async_metadata_t::EVENT_CODE_UNDERFLOW, now);
+		_next_tick = now;
+	}
+
+	if (_paced){
+		// wait for room in the device buffer
+		double room = (_next_tick + (long long)nsamps_per_buff - _buffer_samps) / _rate;
+		sleep_until_device_time(_epoch, std::min(room, time_now() + timeout));
+	}
+	_next_tick += nsamps_per_buff;
+
+	if (metadata.end_of_burst){
+		_in_burst = false;
+		push_event(uhd::async_metadata_t::EVENT_CODE_BURST_ACK, _next_tick);
+	}
+	return nsamps_per_buff;
+}
+
+
+bool standin_tx_streamer::recv_async_msg(uhd::async_metadata_t& async_metadata, double timeout)
+{
+	double deadline = time_now() + timeout;
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (not _cond.wait_for(lock, std::chrono::duration<double>(timeout), [this](){ return not _events.empty(); })){
+		return false;
+	}
+	// events are reported when the device gets there, e.g. the ack once the burst is played out
+	if (_paced){
+		double event_time = _events.front().time_spec.get_real_secs();
+		if (event_time > deadline) return false;
+		lock.unlock();
+		sleep_until_device_time(_epoch, event_time);
+		lock.lock();
+	}
+	async_metadata = _events.front();
+	_events.pop_front();
+	return true;
+}
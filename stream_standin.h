@@ -0,0 +1,116 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_STREAM_STANDIN_H
+#define INCLUDED_MMWAVE_STREAM_STANDIN_H
+
+#include <uhd/stream.hpp>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Stand-ins for the USRP streamers
+ * Local Rx and Tx streamers with the behaviour of the X310 streamers that
+ * matters to the host: samples go through an sc16 wire buffer and are
+ * converted to/from fc32 like in UHD, Rx packets carry time_specs, stream
+ * commands (also timed) are honoured and Tx end of bursts are acked.
+ * Paced stand-ins follow the device clock (time 0 at construction, or
+ * set like the time of a USRP, e.g. from the host clock so that the
+ * stand-ins of two processes share a time base): a host that falls
+ * behind by more than the device buffer gets overflows (Rx) or
+ * underflows (Tx), as on the hardware. Unpaced stand-ins run as
+ * fast as the host can consume them, which measures host-side capacity.
+ * The Rx stand-in can model a gain change in front of the receiver (a
+ * beam switch of the array): from a device time, the amplitude of the
+ * samples moves linearly to the new gain over a settling ramp.
+ **********************************************************************/
+class standin_rx_streamer : public uhd::rx_streamer
+{
+public:
+	standin_rx_streamer(size_t num_channels, double rate, size_t spp = 1996, bool paced = true, double buffer_secs = 0.05);
+
+	size_t get_num_channels() const { return _num_channels; }
+	size_t get_max_num_samps() const { return _spp; }
+
+	size_t recv(const buffs_type& buffs, const size_t nsamps_per_buff, uhd::rx_metadata_t& metadata,
+				const double timeout = 0.1, const bool one_packet = false);
+	void issue_stream_cmd(const uhd::stream_cmd_t& stream_cmd);
+
+	// Device time of the stand-in, and setting it (as multi_usrp::set_time_now, before streaming)
+	double time_now() const;
+	void set_time_now(double time);
+
+	// Gain of the samples from device time at, reached after ramp seconds (0 dB: the wire samples as they are)
+	void schedule_gain(double at, double gain_db, double ramp = 0.0);
+
+private:
+	struct gain_step_t
+	{
+		double 	time;
+		double 	ramp;
+		float 	from;
+		float 	to;
+	};
+
+	// Amplitude at a device time, from the amplitude before the steps
+	static float amplitude_at(float amplitude, const std::vector<gain_step_t>& steps, double time);
+
+	size_t 								_num_channels;
+	double 								_rate;
+	size_t 								_spp;
+	bool 								_paced;
+	long long 							_buffer_samps;
+	std::chrono::steady_clock::time_point _epoch;
+	std::vector<int16_t> 				_wire;		// one packet of sc16 samples
+
+	std::mutex 							_mutex;
+	bool 								_streaming;
+	bool 								_continuous;
+	long long 							_next_tick;
+	uint64_t 							_remaining;	// samples left in NUM_SAMPS modes
+	float 								_amplitude;	// before the gain steps
+	std::vector<gain_step_t> 			_gain_steps;
+};
+
+
+class standin_tx_streamer : public uhd::tx_streamer
+{
+public:
+	standin_tx_streamer(size_t num_channels, double rate, size_t spp = 1996, bool paced = true, double buffer_secs = 0.05);
+
+	size_t get_num_channels() const { return _num_channels; }
+	size_t get_max_num_samps() const { return _spp; }
+
+	size_t send(const buffs_type& buffs, const size_t nsamps_per_buff, const uhd::tx_metadata_t& metadata, const double timeout = 0.1);
+	bool recv_async_msg(uhd::async_metadata_t& async_metadata, double timeout = 0.1);
+
+	double time_now() const;
+	void set_time_now(double time);
+
+private:
+	void push_event(uhd::async_metadata_t::event_code_t code, long long tick);
+
+	size_t 								_num_channels;
+	double 								_rate;
+	size_t 								_spp;
+	bool 								_paced;
+	long long 							_buffer_samps;
+	std::chrono::steady_clock::time_point _epoch;
+	std::vector<int16_t> 				_wire;
+	bool 								_in_burst;
+	long long 							_next_tick;
+
+	std::mutex 							_mutex;
+	std::condition_variable 			_cond;
+	std::deque<uhd::async_metadata_t> 	_events;
+};
+
+#endif /* INCLUDED_MMWAVE_STREAM_STANDIN_H */
@@ -0,0 +1,74 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "sweep_engine.h"
+#include <boost/format.hpp>
+#include <iostream>
+
+
+
+sweep_engine::sweep_engine(aip_controller& arrays, clock_fn time_now) :
+	_arrays(arrays), _time_now(time_now), _telemetry(NULL)
+{
+}
+
+
+void sweep_engine::run(size_t array, const sweep_plan_t& plan, dwell_fn dwell)
+{
+	std::cout << boost::format("Running sweep plan %s (%u beams)...") % plan.name % plan.steps.size() << std::endl;
+	for (size_t i = 0; i < plan.steps.size(); i++){
+		const sweep_step_t& step = plan.steps[i];
+
+		// Setting AiP beam direction
+		double time_switch = _time_now();
+		std::cout << boost::format("Setting AiP to %s - %s ° at time %f") % step.direction % step.angle % time_switch << std::endl;
+		std::vector<std::future<void>> pending;
+		if (_telemetry != NULL) _telemetry->poll(time_switch, pending);
+		pending.push_back(_arrays.steer_frames(array, step.frames, plan.mode));
+		wait_all(pending);
+		if (_telemetry != NULL) _telemetry->flush();
+
+		dwell(i, step, time_switch);
+	}
+}
+
+
+void sweep_engine::run_joint(size_t array_tx, const sweep_plan_t& plan_tx, size_t array_rx, const sweep_plan_t& plan_rx, joint_dwell_fn dwell)
+{
+	std::cout << boost::format("Running joint sweep plans %s x %s (%u x %u beams)...") 
+		% plan_tx.name % plan_rx.name % plan_tx.steps.size() % plan_rx.steps.size() << std::endl;
+	std::vector<std::future<void>> pending;
+	for (size_t i = 0; i < plan_tx.steps.size(); i++){
+		const sweep_step_t& step_tx = plan_tx.steps[i];
+		size_t todo = 0;
+		for (size_t j = 0; j < plan_rx.steps.size(); j++){
+			if (not _done or not _done(i, j)) todo++;
+		}
+		if (todo == 0) continue;
+		if (todo < plan_rx.steps.size()){
+			std::cout << boost::format("Tx beam %s - %s °: %u of %u Rx beams already captured") 
+				% step_tx.direction % step_tx.angle % (plan_rx.steps.size() - todo) % plan_rx.steps.size() << std::endl;
+		}
+
+		// Setting Tx AiP (applied together with the first Rx beam below)
+		std::cout << boost::format("Setting Tx AiP to %s - %s ° at time %f") % step_tx.direction % step_tx.angle % _time_now() << std::endl;
+		pending.push_back(_arrays.steer_frames(array_tx, step_tx.frames, plan_tx.mode));
+
+		for (size_t j = 0; j < plan_rx.steps.size(); j++){
+			const sweep_step_t& step_rx = plan_rx.steps[j];
+			if (_done and _done(i, j)) continue;
+
+			// Setting Rx AiP
+			double time_switch = _time_now();
+			std::cout << boost::format("Setting Rx AiP to %s - %s ° at time %f") % step_rx.direction % step_rx.angle % time_switch << std::endl;
+			if (_telemetry != NULL) _telemetry->poll(time_switch, pending);
+			pending.push_back(_arrays.steer_frames(array_rx, step_rx.frames, plan_rx.mode));
+			wait_all(pending);
+			if (_telemetry != NULL) _telemetry->flush();
+
+			dwell(i, step_tx, j, step_rx, time_switch);
+		}
+	}
+}
@@ -0,0 +1,54 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_SWEEP_ENGINE_H
+#define INCLUDED_MMWAVE_SWEEP_ENGINE_H
+
+#include "aip_controller.h"
+#include "aip_telemetry.h"
+#include "sweep_plan.h"
+#include <functional>
+
+
+
+/***********************************************************************
+ * sweep_engine
+ * Walks the arrays of an aip_controller through sweep plans. After each
+ * beam switch the tool's dwell callback records or transmits for the
+ * step, with the device time read just before the switch. The same
+ * engine (and the same open arrays) can run any number of plans in a row.
+ * With telemetry, the temperature readings due are taken together with
+ * the switch, in the gap between two dwells.
+ **********************************************************************/
+class sweep_engine
+{
+public:
+	typedef std::function<double()> clock_fn;
+	typedef std::function<void(size_t index, const sweep_step_t& step, double time_switch)> dwell_fn;
+	typedef std::function<void(size_t tx, const sweep_step_t& step_tx, size_t rx, const sweep_step_t& step_rx, double time_switch)> joint_dwell_fn;
+	typedef std::function<bool(size_t tx, size_t rx)> done_fn;
+
+	sweep_engine(aip_controller& arrays, clock_fn time_now);
+
+	void set_telemetry(aip_telemetry* telemetry) { _telemetry = telemetry; }
+
+	// Pairs of a joint sweep captured before (by an interrupted run): neither switched to nor dwelt on
+	void set_done(done_fn done) { _done = done; }
+
+	// Steer one array through a plan
+	void run(size_t array, const sweep_plan_t& plan, dwell_fn dwell);
+
+	// Steer array_tx through plan_tx and, for every Tx beam, array_rx through plan_rx.
+	// The Tx switch is applied together with the first Rx beam of each Tx step (that is not done).
+	void run_joint(size_t array_tx, const sweep_plan_t& plan_tx, size_t array_rx, const sweep_plan_t& plan_rx, joint_dwell_fn dwell);
+
+private:
+	aip_controller& _arrays;
+	clock_fn 		_time_now;
+	aip_telemetry* 	_telemetry;
+	done_fn 		_done;
+};
+
+#endif /* INCLUDED_MMWAVE_SWEEP_ENGINE_H */
@@ -0,0 +1,146 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "sweep_journal.h"
+#include <boost/format.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+static void write_line(int fd, const std::string& line, const std::string& path)
+{
+	size_t off = 0;
+	while (off < line.size()){
+		ssize_t n = ::write(fd, line.data() + off, line.size() - off);
+		if (n < 0){
+			if (errno == EINTR) continue;
+			throw std::runtime_error(str(boost::format("Write to %s failed: %s") % path % std::strerror(errno)));
+		}
+		off += n;
+	}
+	if (fdatasync(fd) != 0){
+		throw std::runtime_error(str(boost::format("Sync of %s failed: %s") % path % std::strerror(errno)));
+	}
+}
+
+
+// One pair, false if the line is not a whole entry
+static bool parse_entry(const std::string& line, journal_entry_t& entry)
+{
+	unsigned long long tx, rx, segments, file_index, file_segments, raw_bytes, stored_bytes, meta_bytes;
+	int end = -1;
+	if (std::sscanf(line.c_str(), "%llu %llu %llu %lf %lf %llu %llu %llu %llu %llu%n", &tx, &rx, &segments, &entry.time, &entry.wall,
+					&file_index, &file_segments, &raw_bytes, &stored_bytes, &meta_bytes, &end) != 10 or end != (int)line.size()){
+		return false;
+	}
+	entry.tx 						= tx;
+	entry.rx 						= rx;
+	entry.segments 					= segments;
+	entry.position.file_index 		= file_index;
+	entry.position.file_segments 	= file_segments;
+	entry.position.raw_bytes 		= raw_bytes;
+	entry.position.stored_bytes 	= stored_bytes;
+	entry.position.meta_bytes 		= meta_bytes;
+	return true;
+}
+
+
+
+sweep_journal::sweep_journal(const capture_config_t& capture, const sweep_plan_t& plan_tx, const sweep_plan_t& plan_rx, bool resume) :
+	_path(str(boost::format("%s/%s.journal") % capture.out_dir % capture.prefix)), _fd(-1),
+	_num_rx(plan_rx.steps.size()), _done(plan_tx.steps.size()*plan_rx.steps.size(), false), _num_done(0), _has_last(false)
+{
+	// the capture files and their settings must be the same for the positions to hold
+	std::string header = str(boost::format("mmwave sweep journal %016x %016x %u %u %s %u %u")
+		% sweep_plan_hash(plan_tx) % sweep_plan_hash(plan_rx) % plan_tx.steps.size() % plan_rx.steps.size()
+		% capture.compression % capture.rotate_bytes % capture.rotate_segments);
+
+	if (not resume){
+		if (mkdir(capture.out_dir.c_str(), 0755) != 0 and errno != EEXIST){
+			throw std::runtime_error(str(boost::format("Cannot create output directory %s: %s") % capture.out_dir % std::strerror(errno)));
+		}
+		_fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (_fd < 0){
+			throw std::runtime_error(str(boost::format("Cannot open journal %s: %s") % _path % std::strerror(errno)));
+		}
+		write_line(_fd, header + "\n", _path);
+		return;
+	}
+
+	std::ifstream in(_path.c_str(), std::ios::binary);
+	if (not in){
+		throw std::runtime_error(str(boost::format("Nothing to resume: cannot read journal %s") % _path));
+	}
+	std::stringstream contents;
+	contents << in.rdbuf();
+	std::string text = contents.str();
+
+	size_t eol = text.find('\n');
+	if (eol == std::string::npos or text.compare(0, eol, header) != 0){
+		throw std::runtime_error(str(boost::format("Journal %s was written for another sweep (plans or capture settings differ)") % _path));
+	}
+
+	// whole lines only: the last one may have been cut by the interruption
+	size_t valid = eol + 1;
+	while (valid < text.size()){
+		eol = text.find('\n', valid);
+		journal_entry_t entry;
+		if (eol == std::string::npos or not parse_entry(text.substr(valid, eol - valid), entry) or entry.tx >= plan_tx.steps.size() or entry.rx >= _num_rx){
+			std::cerr << boost::format("Journal %s: ignoring %u bytes after the last whole entry") % _path % (text.size() - valid) << std::endl;
+			break;
+		}
+		if (not _done[entry.tx*_num_rx + entry.rx]) _num_done++;
+		_done[entry.tx*_num_rx + entry.rx] = true;
+		_last 	  = entry;
+		_has_last = true;
+		valid 	  = eol + 1;
+	}
+
+	if (truncate(_path.c_str(), valid) != 0){
+		throw std::runtime_error(str(boost::format("Cannot truncate journal %s: %s") % _path % std::strerror(errno)));
+	}
+	_fd = ::open(_path.c_str(), O_WRONLY | O_APPEND);
+	if (_fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot open journal %s: %s") % _path % std::strerror(errno)));
+	}
+}
+
+
+sweep_journal::~sweep_journal()
+{
+	if (_fd >= 0){
+		::close(_fd);
+	}
+}
+
+
+double sweep_journal::time_offset(double device_time) const
+{
+	if (not _has_last) return 0;
+	return _last.time + (wall_time() - _last.wall) - device_time;
+}
+
+
+void sweep_journal::append(const journal_entry_t& entry)
+{
+	write_line(_fd, str(boost::format("%u %u %u %.6f %.6f %u %u %u %u %u\n") % entry.tx % entry.rx % entry.segments % entry.time % entry.wall
+		% entry.position.file_index % entry.position.file_segments % entry.position.raw_bytes % entry.position.stored_bytes % entry.position.meta_bytes), _path);
+}
+
+
+double sweep_journal::wall_time()
+{
+	return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
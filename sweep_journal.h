@@ -0,0 +1,82 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_SWEEP_JOURNAL_H
+#define INCLUDED_MMWAVE_SWEEP_JOURNAL_H
+
+#include "capture_writer.h"
+#include "sweep_plan.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Checkpoint journal of a joint sweep
+ * <out_dir>/<prefix>.journal records every Tx/Rx beam pair once its
+ * segments are on disk:
+ *
+ *   mmwave sweep journal <Tx plan hash> <Rx plan hash> <Tx steps> <Rx steps> <compression> <rotate bytes> <rotate segments>
+ *   <tx> <rx> <segments> <time> <wall> <file> <file segments> <raw bytes> <stored bytes> <meta bytes>
+ *   ...
+ *
+ * with the step numbers of the pair in both plans, the segments written
+ * so far, the sweep time and the host time (Unix seconds) once the pair
+ * was captured, and the position of the capture after it (see
+ * capture_position_t). Every line goes to disk with a single write and
+ * is synced before the next pair is recorded; a line cut short by a
+ * crash is ignored, so the journal always holds whole pairs whose data
+ * is on disk. A resumed run checks that the plans and the capture
+ * settings are the same, continues the capture from the position of
+ * the last pair and skips the pairs of the journal.
+ **********************************************************************/
+struct journal_entry_t
+{
+	size_t 				tx 		 = 0;	// step of the Tx plan
+	size_t 				rx 		 = 0;	// step of the Rx plan
+	uint64_t 			segments = 0;	// segments written so far (re-captures included)
+	double 				time 	 = 0;	// sweep time once the pair was captured
+	double 				wall 	 = 0;	// host time at the same moment
+	capture_position_t 	position;		// of the capture after the pair
+};
+
+class sweep_journal
+{
+public:
+	// Start a new journal, or with resume load the one of the interrupted run (throws if missing or of another sweep)
+	sweep_journal(const capture_config_t& capture, const sweep_plan_t& plan_tx, const sweep_plan_t& plan_rx, bool resume);
+	~sweep_journal();
+
+	const std::string& path() const { return _path; }
+
+	// Pairs captured by the interrupted run
+	bool done(size_t tx, size_t rx) const { return _done[tx*_num_rx + rx]; }
+	size_t num_done() const { return _num_done; }
+	size_t num_pairs() const { return _done.size(); }
+
+	// Last pair of the interrupted run (NULL: none, start over)
+	const journal_entry_t* last() const { return _has_last ? &_last : NULL; }
+
+	// Offset to add to the device time for the sweep time to go on from the last pair, the interruption included
+	double time_offset(double device_time) const;
+
+	// Write and sync one pair (from any single thread, typically the writer thread through a checkpoint)
+	void append(const journal_entry_t& entry);
+
+	// Host time for journal_entry_t::wall
+	static double wall_time();
+
+private:
+	std::string 		_path;
+	int 				_fd;
+	size_t 				_num_rx;
+	std::vector<bool> 	_done;
+	size_t 				_num_done;
+	bool 				_has_last;
+	journal_entry_t 	_last;
+};
+
+#endif /* INCLUDED_MMWAVE_SWEEP_JOURNAL_H */
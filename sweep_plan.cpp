@@ -0,0 +1,214 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "sweep_plan.h"
+#include "constants.h"
+#include "aip_functions.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <fstream>
+#include <stdexcept>
+
+
+
+// Index of a value in one of the constant tables, or -1
+static int find_index(const std::string* table, int size, const std::string& value)
+{
+	for (int i = 0; i < size; i++){
+		if (table[i] == value) return i;
+	}
+	return -1;
+}
+
+
+// Parse a non-negative integer field, throwing a located error otherwise
+static uint64_t parse_uint(const std::string& field, const std::string& where)
+{
+	if (field.empty() or field.find_first_not_of("0123456789") != std::string::npos){
+		throw std::runtime_error(str(boost::format("%s: '%s' is not a non-negative integer") % where % field));
+	}
+	return std::stoull(field);
+}
+
+
+// Build the register frames of a validated step
+static void build_frames(sweep_step_t& step, int mode)
+{
+	std::string* register_list = create_register_list(step.degrees, step.direction, step.gain_list, step.gain, step.active_list, mode);
+	step.frames.resize(4);
+	for (int i = 0; i < 4; i++){
+		step.frames[i] = make_reg_command(register_list[i]);
+	}
+	delete[] register_list;
+}
+
+
+
+sweep_plan_t load_sweep_plan(const std::string& file, int mode, uint64_t default_dwell)
+{
+	std::ifstream infile(file.c_str());
+	if (not infile.is_open()){
+		throw std::runtime_error(str(boost::format("Cannot open sweep plan %s") % file));
+	}
+
+	sweep_plan_t plan;
+	plan.name = file;
+	plan.mode = mode;
+
+	std::string line;
+	int line_nbr = 0;
+	while (std::getline(infile, line)){
+		line_nbr++;
+		boost::algorithm::trim(line);
+		if (line.empty() or line[0] == '#') continue;
+
+		std::string where = str(boost::format("%s:%d") % file % line_nbr);
+		std::vector<std::string> fields;
+		boost::algorithm::split(fields, line, boost::is_any_of(","));
+		for (size_t i = 0; i < fields.size(); i++){
+			boost::algorithm::trim(fields[i]);
+		}
+		if (fields[0] == "direction") continue; // header line
+		if (fields.size() < 2 or fields.size() > 6){
+			throw std::runtime_error(str(boost::format("%s: expected direction,degrees[,gain,gain_list,active_list,dwell]") % where));
+		}
+		fields.resize(6);
+
+		sweep_step_t step;
+
+		// beam
+		step.direction = boost::algorithm::to_upper_copy(fields[0]);
+		if (find_index(AIP_DIRECTIONS, 4, step.direction) < 0){
+			throw std::runtime_error(str(boost::format("%s: unknown direction '%s'") % where % fields[0]));
+		}
+		int k = find_index(AIP_DEGREES, 17, fields[1]);
+		if (k < 0) k = find_index(AIP_ANGLES, 17, fields[1]);
+		if (k < 0){
+			throw std::runtime_error(str(boost::format("%s: unknown phase shift or angle '%s'") % where % fields[1]));
+		}
+		step.degrees 	= AIP_DEGREES[k];
+		step.angle 		= AIP_ANGLES[k];
+
+		// gain of the array (single register digit) and of each chip
+		step.gain = fields[2].empty() ? 0 : (int)parse_uint(fields[2], where);
+		if (step.gain > 9){
+			throw std::runtime_error(str(boost::format("%s: array gain must be between 0 and 9") % where));
+		}
+		std::vector<std::string> values;
+		if (fields[3].empty()){
+			values.assign(4, "0");
+		}
+		else{
+			boost::algorithm::split(values, fields[3], boost::is_any_of(" "), boost::token_compress_on);
+		}
+		if (values.size() != 4){
+			throw std::runtime_error(str(boost::format("%s: gain_list needs 4 values") % where));
+		}
+		for (int i = 0; i < 4; i++){
+			step.gain_list[i] = (int)parse_uint(values[i], where);
+			if (step.gain_list[i] > 15){
+				throw std::runtime_error(str(boost::format("%s: chip gain must be between 0 and 15") % where));
+			}
+		}
+
+		// active antennas of each chip
+		if (fields[4].empty()){
+			values.assign(4, "1111");
+		}
+		else{
+			boost::algorithm::split(values, fields[4], boost::is_any_of(" "), boost::token_compress_on);
+		}
+		if (values.size() != 4){
+			throw std::runtime_error(str(boost::format("%s: active_list needs 4 masks") % where));
+		}
+		for (int i = 0; i < 4; i++){
+			if (values[i].size() != 4 or values[i].find_first_not_of("01") != std::string::npos){
+				throw std::runtime_error(str(boost::format("%s: active mask '%s' must be 4 binary digits") % where % values[i]));
+			}
+			step.active_list[i] = values[i];
+		}
+
+		// dwell
+		step.dwell_samps = fields[5].empty() ? default_dwell : parse_uint(fields[5], where);
+		if (step.dwell_samps == 0){
+			throw std::runtime_error(str(boost::format("%s: dwell must be positive") % where));
+		}
+
+		build_frames(step, mode);
+		plan.steps.push_back(step);
+	}
+
+	if (plan.steps.empty()){
+		throw std::runtime_error(str(boost::format("Sweep plan %s has no steps") % file));
+	}
+	return plan;
+}
+
+
+
+sweep_plan_t default_sweep_plan(int mode, uint64_t dwell, int nbr_directions, int nbr_degrees)
+{
+	sweep_plan_t plan;
+	plan.name = "default";
+	plan.mode = mode;
+	for (int cpt_direction = 0; cpt_direction < nbr_directions; cpt_direction++){
+		for (int cpt_degrees = 0; cpt_degrees < nbr_degrees; cpt_degrees++){
+			// sweep towards broadside on the LEFT, away from broadside on the other directions
+			int k = (cpt_direction == 0) ? nbr_degrees-1-cpt_degrees : cpt_degrees;
+			sweep_step_t step;
+			step.direction 		= AIP_DIRECTIONS[cpt_direction];
+			step.degrees 		= AIP_DEGREES[k];
+			step.angle 			= AIP_ANGLES[k];
+			step.gain 			= 0;
+			step.dwell_samps 	= dwell;
+			for (int i = 0; i < 4; i++){
+				step.gain_list[i] 	= 0;
+				step.active_list[i] = "1111";
+			}
+			build_frames(step, mode);
+			plan.steps.push_back(step);
+		}
+	}
+	return plan;
+}
+
+
+
+uint64_t sweep_plan_samps(const sweep_plan_t& plan)
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < plan.steps.size(); i++){
+		total += plan.steps[i].dwell_samps;
+	}
+	return total;
+}
+
+
+
+// FNV-1a over the fields that make a step, each followed by a separator
+static void hash_field(uint64_t& hash, const std::string& field)
+{
+	for (size_t i = 0; i <= field.size(); i++){
+		hash ^= (i < field.size()) ? (unsigned char)field[i] : 0x1f;
+		hash *= 0x100000001b3ULL;
+	}
+}
+
+
+uint64_t sweep_plan_hash(const sweep_plan_t& plan)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash_field(hash, std::to_string(plan.mode));
+	for (size_t i = 0; i < plan.steps.size(); i++){
+		const sweep_step_t& step = plan.steps[i];
+		hash_field(hash, step.direction);
+		hash_field(hash, step.degrees);
+		hash_field(hash, std::to_string(step.dwell_samps));
+		for (size_t k = 0; k < step.frames.size(); k++){
+			hash_field(hash, step.frames[k]);
+		}
+	}
+	return hash;
+}
@@ -0,0 +1,60 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_SWEEP_PLAN_H
+#define INCLUDED_MMWAVE_SWEEP_PLAN_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Sweep plans
+ * A sweep plan is a list of beam steps read from a CSV file:
+ *
+ *   # direction,degrees,gain,gain_list,active_list,dwell
+ *   LEFT,DEG_180,0,0 0 0 0,1111 1111 1111 1111,500000
+ *   RIGHT,32.50,,,,
+ *
+ * degrees is a phase shift (DEG_xx) or a beam angle from AIP_ANGLES,
+ * dwell is in samples. Empty fields take the plan defaults (gain 0, all
+ * antennas active, the dwell given on the command line). The plan is
+ * validated once and the AiP register frames of every step are built
+ * up front, so that the sweep loop only writes pre-built frames.
+ **********************************************************************/
+struct sweep_step_t
+{
+	std::string 				direction;
+	std::string 				degrees;
+	std::string 				angle;
+	int 						gain;
+	int 						gain_list[4];
+	std::string 				active_list[4];
+	uint64_t 					dwell_samps;
+	std::vector<std::string> 	frames; // AT+REG commands for the 4 chips
+};
+
+struct sweep_plan_t
+{
+	std::string 				name;
+	int 						mode; // 1 for TX, 2 for RX
+	std::vector<sweep_step_t> 	steps;
+};
+
+// Read and validate a sweep plan file, building the register frames for the given mode
+sweep_plan_t load_sweep_plan(const std::string& file, int mode, uint64_t default_dwell);
+
+// Built-in plan of the original tools: LEFT from 78° to broadside, then RIGHT from broadside to 78°
+sweep_plan_t default_sweep_plan(int mode, uint64_t dwell, int nbr_directions = 2, int nbr_degrees = 17);
+
+// Total number of samples of a plan
+uint64_t sweep_plan_samps(const sweep_plan_t& plan);
+
+// Fingerprint of the steps of a plan (beams, dwells and register frames), to recognise the same sweep again
+uint64_t sweep_plan_hash(const sweep_plan_t& plan);
+
+#endif /* INCLUDED_MMWAVE_SWEEP_PLAN_H */
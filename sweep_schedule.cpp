@@ -0,0 +1,44 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "sweep_schedule.h"
+#include <boost/format.hpp>
+#include <cmath>
+#include <stdexcept>
+
+
+
+std::vector<schedule_slot_t> make_sweep_schedule(const sweep_plan_t& plan_tx, const sweep_plan_t& plan_rx, double rate, double start_time, double guard)
+{
+	if (rate <= 0 or guard <= 0){
+		throw std::runtime_error(str(boost::format("Bad sweep schedule: rate %f and guard %f must be positive") % rate % guard));
+	}
+	long long guard_ticks 	= std::llround(guard*rate);
+	long long tick 			= std::llround(start_time*rate);
+
+	std::vector<schedule_slot_t> schedule;
+	schedule.reserve(plan_tx.steps.size()*plan_rx.steps.size());
+	for (size_t i = 0; i < plan_tx.steps.size(); i++){
+		for (size_t j = 0; j < plan_rx.steps.size(); j++){
+			schedule_slot_t slot;
+			slot.tx 			= i;
+			slot.rx 			= j;
+			slot.tx_switch 		= (j == 0);
+			slot.switch_time 	= tick/rate;
+			slot.start 			= (tick + guard_ticks)/rate;
+			slot.samps 			= plan_rx.steps[j].dwell_samps;
+			schedule.push_back(slot);
+			tick += guard_ticks + (long long)slot.samps;
+		}
+	}
+	return schedule;
+}
+
+
+double sweep_schedule_end(const std::vector<schedule_slot_t>& schedule, double rate)
+{
+	if (schedule.empty()) return 0;
+	return schedule.back().start + schedule.back().samps/rate;
+}
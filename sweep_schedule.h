@@ -0,0 +1,41 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_SWEEP_SCHEDULE_H
+#define INCLUDED_MMWAVE_SWEEP_SCHEDULE_H
+
+#include "sweep_plan.h"
+#include <stdint.h>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Sweep schedule
+ * The joint sweep of two plans laid out on the device time line, for
+ * agents on different hosts that cannot wait for each other between two
+ * beams. Every Tx/Rx pair gets a slot: the arrays are switched at
+ * switch_time, the Rx window (the dwell of the Rx step) starts a guard
+ * time later, when both switches are over. The Tx array only switches in
+ * the first slot of each Tx step. Both agents compute the same schedule
+ * from the plans, the rate, the start time and the guard; the times are
+ * counted in samples so that they do not drift over long sweeps.
+ **********************************************************************/
+struct schedule_slot_t
+{
+	size_t 		tx;
+	size_t 		rx;
+	bool 		tx_switch; 		// first slot of a Tx step
+	double 		switch_time;	// device time of the beam switches
+	double 		start; 			// device time of the first sample of the window
+	uint64_t 	samps;
+};
+
+std::vector<schedule_slot_t> make_sweep_schedule(const sweep_plan_t& plan_tx, const sweep_plan_t& plan_rx, double rate, double start_time, double guard);
+
+// Device time at which the last window of a schedule ends
+double sweep_schedule_end(const std::vector<schedule_slot_t>& schedule, double rate);
+
+#endif /* INCLUDED_MMWAVE_SWEEP_SCHEDULE_H */
@@ -0,0 +1,254 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "thread_config.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <malloc.h>
+#include <mutex>
+#include <sched.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+// Default SCHED_FIFO priority of each role: the recv loop first, the writer last
+static const int ROLE_PRIORITIES[ROLE_COUNT] = {85, 85, 90, 50, 70};
+static const char* ROLE_NAMES[ROLE_COUNT] 	 = {"tx", "lo", "rx", "writer", "serial"};
+
+// Startup report
+static std::mutex 				 report_mutex;
+static std::vector<std::string>  report_lines;
+
+static void add_report_line(const std::string& line)
+{
+	std::lock_guard<std::mutex> lock(report_mutex);
+	report_lines.push_back(line);
+}
+
+
+static thread_role_t role_from_name(const std::string& name)
+{
+	for (int i = 0; i < ROLE_COUNT; i++){
+		if (name == ROLE_NAMES[i]) return (thread_role_t)i;
+	}
+	throw std::runtime_error(str(boost::format("Unknown thread role %s (expected tx, lo, rx, writer or serial)") % name));
+}
+
+
+// "2", "2-5" or "2-3+6" (the comma separates roles)
+static std::vector<int> parse_cpu_list(const std::string& text)
+{
+	std::vector<int> cpus;
+	std::vector<std::string> parts;
+	boost::split(parts, text, boost::is_any_of("+"));
+	for (size_t i = 0; i < parts.size(); i++){
+		int first, last;
+		char extra;
+		int n = sscanf(parts[i].c_str(), "%d-%d%c", &first, &last, &extra);
+		if (n == 1 and sscanf(parts[i].c_str(), "%d%c", &first, &extra) == 1){
+			last = first;
+		}
+		else if (n != 2){
+			throw std::runtime_error(str(boost::format("Bad CPU list %s") % text));
+		}
+		// both forms: CPU_SET must stay within the cpu_set_t
+		if (first < 0 or last < first or last >= CPU_SETSIZE){
+			throw std::runtime_error(str(boost::format("Bad CPU list %s (CPUs 0 to %d)") % text % (CPU_SETSIZE - 1)));
+		}
+		for (int cpu = first; cpu <= last; cpu++){
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+
+const char* thread_role_name(thread_role_t role)
+{
+	return ROLE_NAMES[role];
+}
+
+
+thread_config_t parse_thread_config(const std::string& cpus, const std::string& realtime, bool lock_memory)
+{
+	thread_config_t config;
+	config.lock_memory = lock_memory;
+	for (int i = 0; i < ROLE_COUNT; i++){
+		config.roles[i].priority = ROLE_PRIORITIES[i];
+	}
+
+	std::vector<std::string> items;
+	if (not cpus.empty()){
+		boost::split(items, cpus, boost::is_any_of(","));
+		for (size_t i = 0; i < items.size(); i++){
+			size_t pos = items[i].find('=');
+			if (pos == std::string::npos){
+				throw std::runtime_error(str(boost::format("Bad CPU assignment %s (expected role=cpus)") % items[i]));
+			}
+			thread_role_t role = role_from_name(boost::trim_copy(items[i].substr(0, pos)));
+			config.roles[role].cpus = parse_cpu_list(boost::trim_copy(items[i].substr(pos + 1)));
+		}
+	}
+
+	if (not realtime.empty()){
+		boost::split(items, realtime, boost::is_any_of(","));
+		for (size_t i = 0; i < items.size(); i++){
+			config.roles[role_from_name(boost::trim_copy(items[i]))].realtime = true;
+		}
+	}
+	return config;
+}
+
+
+// "CPU 2 3" for the report
+static std::string cpu_set_name(const cpu_set_t& cpuset)
+{
+	std::string name = "CPU";
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		if (CPU_ISSET(cpu, &cpuset)) name += str(boost::format(" %d") % cpu);
+	}
+	return name;
+}
+
+
+static const char* policy_name(int policy)
+{
+	switch (policy){
+	case SCHED_OTHER: 	return "SCHED_OTHER";
+	case SCHED_FIFO: 	return "SCHED_FIFO";
+	case SCHED_RR: 		return "SCHED_RR";
+	case SCHED_BATCH: 	return "SCHED_BATCH";
+	case SCHED_IDLE: 	return "SCHED_IDLE";
+	default: 			return "policy";
+	}
+}
+
+
+bool apply_thread_role(const thread_config_t& config, thread_role_t role, pthread_t thread)
+{
+	const thread_role_config_t& role_config = config.roles[role];
+	bool granted = true;
+	std::string affinity = "any CPU", scheduling = "default";
+
+	if (not role_config.cpus.empty()){
+		cpu_set_t requested, actual;
+		CPU_ZERO(&requested);
+		for (size_t i = 0; i < role_config.cpus.size(); i++){
+			CPU_SET(role_config.cpus[i], &requested);
+		}
+		int err = pthread_setaffinity_np(thread, sizeof(requested), &requested);
+		if (err != 0){
+			affinity = str(boost::format("pinning DENIED (%s)") % std::strerror(err));
+			granted = false;
+		}
+		else if ((err = pthread_getaffinity_np(thread, sizeof(actual), &actual)) != 0){
+			affinity = str(boost::format("pinning UNVERIFIED (%s)") % std::strerror(err));
+			granted = false;
+		}
+		else if (not CPU_EQUAL(&requested, &actual)){
+			// e.g. a cpuset of the container that does not include the requested CPUs
+			affinity = str(boost::format("pinning MISMATCH (%s requested, %s set)") % cpu_set_name(requested) % cpu_set_name(actual));
+			granted = false;
+		}
+		else{
+			affinity = cpu_set_name(actual);
+		}
+	}
+
+	if (role_config.realtime){
+		struct sched_param param;
+		param.sched_priority = role_config.priority;
+		int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+		int policy;
+		if (err != 0){
+			scheduling = str(boost::format("SCHED_FIFO DENIED (%s, needs CAP_SYS_NICE or an rtprio limit)") % std::strerror(err));
+			granted = false;
+		}
+		else if ((err = pthread_getschedparam(thread, &policy, &param)) != 0){
+			scheduling = str(boost::format("SCHED_FIFO UNVERIFIED (%s)") % std::strerror(err));
+			granted = false;
+		}
+		else if (policy != SCHED_FIFO or param.sched_priority != role_config.priority){
+			scheduling = str(boost::format("SCHED_FIFO MISMATCH (SCHED_FIFO %d requested, %s %d set)")
+				% role_config.priority % policy_name(policy) % param.sched_priority);
+			granted = false;
+		}
+		else{
+			scheduling = str(boost::format("SCHED_FIFO %d") % param.sched_priority);
+		}
+	}
+
+	add_report_line(str(boost::format("  %-7s %-30s %s") % ROLE_NAMES[role] % affinity % scheduling));
+	return granted;
+}
+
+
+bool lock_process_memory(const thread_config_t& config)
+{
+	if (not config.lock_memory) return true;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+		add_report_line(str(boost::format("  memory  mlockall DENIED (%s, needs CAP_IPC_LOCK or a memlock limit)") % std::strerror(errno)));
+		return false;
+	}
+
+	// keep freed memory in the process (no new page faults when it is reused), no mmap for large blocks
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	// fault in the stack of the calling thread
+	volatile char stack[512*1024];
+	for (size_t i = 0; i < sizeof(stack); i += 4096){
+		stack[i] = 0;
+	}
+
+	add_report_line("  memory  locked (mlockall current and future pages)");
+	return true;
+}
+
+
+void prefault_memory(void* data, size_t nbytes)
+{
+	volatile char* bytes = (volatile char*)data;
+	size_t page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < nbytes; i += page){
+		bytes[i] = bytes[i];
+	}
+}
+
+
+void print_thread_report()
+{
+	std::lock_guard<std::mutex> lock(report_mutex);
+	std::cout << "Thread configuration:" << std::endl;
+	for (size_t i = 0; i < report_lines.size(); i++){
+		std::cout << report_lines[i] << std::endl;
+	}
+}
+
+
+process_usage_t read_process_usage()
+{
+	process_usage_t usage;
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)){
+		if (line.compare(0, 6, "VmRSS:") == 0){
+			usage.rss_bytes = std::strtoull(line.c_str() + 6, NULL, 10) * 1024;	// in kB
+		}
+		else if (line.compare(0, 8, "Threads:") == 0){
+			usage.threads = std::strtoull(line.c_str() + 8, NULL, 10);
+		}
+	}
+	return usage;
+}
@@ -0,0 +1,77 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_THREAD_CONFIG_H
+#define INCLUDED_MMWAVE_THREAD_CONFIG_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Thread roles of the streaming tools
+ **********************************************************************/
+enum thread_role_t
+{
+	ROLE_TX = 0,	// Tx worker (BB and LO of the Tx USRP)
+	ROLE_LO,		// LO worker of the Rx USRP
+	ROLE_RX,		// recv loop
+	ROLE_WRITER,	// capture file writer
+	ROLE_SERIAL,	// serial I/O threads of the arrays
+	ROLE_COUNT
+};
+
+const char* thread_role_name(thread_role_t role);
+
+
+
+/***********************************************************************
+ * Threading configuration
+ * cpus: 		CPU cores per role, e.g. "tx=2,lo=3,rx=4-5,writer=6,serial=1"
+ * realtime: 	roles run with SCHED_FIFO, e.g. "tx,lo,rx"
+ * lock_memory: mlockall() and keep freed heap memory in the process
+ **********************************************************************/
+struct thread_role_config_t
+{
+	std::vector<int> 	cpus;				// empty: no pinning
+	bool 				realtime = false;
+	int 				priority = 0;		// SCHED_FIFO priority (1-99)
+};
+
+struct thread_config_t
+{
+	thread_role_config_t roles[ROLE_COUNT];
+	bool 				 lock_memory = false;
+};
+
+// Parse the command line strings, throws on unknown roles or bad CPU lists
+thread_config_t parse_thread_config(const std::string& cpus, const std::string& realtime, bool lock_memory);
+
+// Pin a thread and set its scheduling as configured for its role (may be called on another thread).
+// Failures are not fatal: the outcome is recorded for the startup report. Returns true if all was granted.
+bool apply_thread_role(const thread_config_t& config, thread_role_t role, pthread_t thread = pthread_self());
+
+// Lock current and future pages in RAM and prefault the stack (if configured)
+bool lock_process_memory(const thread_config_t& config);
+
+// Touch every page of a buffer so that the first use does not take page faults
+void prefault_memory(void* data, size_t nbytes);
+
+// Print what was requested and what was actually granted
+void print_thread_report();
+
+// Resident memory and number of threads of the process (from /proc/self/status, 0 if unavailable)
+struct process_usage_t
+{
+	size_t rss_bytes = 0;
+	size_t threads 	 = 0;
+};
+
+process_usage_t read_process_usage();
+
+#endif /* INCLUDED_MMWAVE_THREAD_CONFIG_H */
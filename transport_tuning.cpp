@@ -0,0 +1,244 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "transport_tuning.h"
+#include <uhd/types/device_addr.hpp>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+static const size_t STANDARD_FRAME_SIZE = 1472;		// fits a 1500-byte MTU
+static const size_t JUMBO_FRAME_SIZE 	= 8000;		// needs a 9000-byte MTU on the NIC
+static const double JUMBO_FRAME_RATE 	= 10e6;		// from this rate on, standard frames mean too many packets per second
+static const size_t CHDR_OVERHEAD 		= 16;		// CHDR header and time stamp of a data packet
+static const size_t SC16_BYTES 			= 4;
+static const double BUFFER_SECS 		= 0.1;		// socket buffers hold this much of the stream
+static const size_t MIN_BUFF_SIZE 		= 2*1024*1024;
+static const size_t MAX_BUFF_SIZE 		= 512*1024*1024;
+static const size_t MIN_NUM_FRAMES 		= 32;
+static const double LINK_10GBE 			= 1.25e9;	// bytes per second
+
+
+
+transport_params_t transport_params_for_rate(double rate, size_t num_channels)
+{
+	transport_params_t params;
+	params.rate 		= rate;
+	params.num_channels = num_channels;
+	params.frame_size 	= (rate >= JUMBO_FRAME_RATE) ? JUMBO_FRAME_SIZE : STANDARD_FRAME_SIZE;
+	params.spp 			= (params.frame_size - CHDR_OVERHEAD) / SC16_BYTES;
+
+	params.link_bytes_per_sec = rate * num_channels * SC16_BYTES;
+	double wanted = params.link_bytes_per_sec * BUFFER_SECS;
+	params.buff_size 	= std::min<size_t>(std::max<size_t>((size_t)wanted, MIN_BUFF_SIZE), MAX_BUFF_SIZE);
+	params.num_frames 	= std::max<size_t>(params.buff_size / params.frame_size, MIN_NUM_FRAMES);
+	return params;
+}
+
+
+std::string tune_device_args(const std::string& args, const transport_params_t& params)
+{
+	uhd::device_addr_t dev_addr(args);
+	const char* frame_keys[] = {"recv_frame_size", "send_frame_size"};
+	const char* num_keys[] 	 = {"num_recv_frames", "num_send_frames"};
+	const char* buff_keys[]  = {"recv_buff_size", "send_buff_size"};
+	for (size_t i = 0; i < 2; i++){
+		if (not dev_addr.has_key(frame_keys[i])) dev_addr[frame_keys[i]] = str(boost::format("%u") % params.frame_size);
+		if (not dev_addr.has_key(num_keys[i])) 	 dev_addr[num_keys[i]] 	 = str(boost::format("%u") % params.num_frames);
+		if (not dev_addr.has_key(buff_keys[i]))  dev_addr[buff_keys[i]]  = str(boost::format("%u") % params.buff_size);
+	}
+	return dev_addr.to_string();
+}
+
+
+void tune_stream_args(uhd::stream_args_t& stream_args, const transport_params_t& params)
+{
+	if (not stream_args.args.has_key("spp")){
+		stream_args.args["spp"] = str(boost::format("%u") % params.spp);
+	}
+}
+
+
+static size_t read_sysctl(const std::string& path)
+{
+	std::ifstream file(path.c_str());
+	size_t value = 0;
+	file >> value;
+	return value;
+}
+
+
+bool check_transport_limits(const transport_params_t& params)
+{
+	std::cout << boost::format("Transport for %.1f Msps x %u channel(s): %u-byte frames, %u samples per packet, %u frames, %.1f MB socket buffers, %.1f MB/s on the link")
+		% (params.rate / 1e6) % params.num_channels % params.frame_size % params.spp % params.num_frames
+		% (params.buff_size / 1e6) % (params.link_bytes_per_sec / 1e6) << std::endl;
+	if (params.frame_size == JUMBO_FRAME_SIZE){
+		std::cout << "  jumbo frames: the MTU of the USRP interface must be 9000 (ip link set <if> mtu 9000)" << std::endl;
+	}
+
+	bool ok = true;
+	const char* names[] = {"rmem_max", "wmem_max"};
+	for (size_t i = 0; i < 2; i++){
+		size_t limit = read_sysctl(str(boost::format("/proc/sys/net/core/%s") % names[i]));
+		if (limit < params.buff_size){
+			std::cout << boost::format("  WARNING: net.core.%s is %u bytes, %u needed: sudo sysctl -w net.core.%s=%u")
+				% names[i] % limit % params.buff_size % names[i] % params.buff_size << std::endl;
+			ok = false;
+		}
+	}
+	if (params.link_bytes_per_sec > 0.95 * LINK_10GBE){
+		std::cout << boost::format("  WARNING: %.1f MB/s does not fit on one 10 GbE link, use both SFP+ ports (second_addr) or fewer channels")
+			% (params.link_bytes_per_sec / 1e6) << std::endl;
+		ok = false;
+	}
+	return ok;
+}
+
+
+
+/***********************************************************************
+ * Self-tests
+ **********************************************************************/
+self_test_result_t rx_self_test(uhd::rx_streamer::sptr rx_stream, double rate, double seconds)
+{
+	self_test_result_t result;
+	result.name 	 = "rx";
+	result.rate 	 = rate;
+	result.requested = std::llround(rate * seconds);
+
+	// recv several packets per call, as the capture loops do at high rates
+	size_t spb = 16 * rx_stream->get_max_num_samps();
+	std::vector<std::vector<std::complex<float>>> buffs(rx_stream->get_num_channels(), std::vector<std::complex<float>>(spb));
+	std::vector<std::complex<float>*> buff_ptrs;
+	for (size_t ch = 0; ch < buffs.size(); ch++){
+		buff_ptrs.push_back(&buffs[ch].front());
+	}
+
+	uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+	stream_cmd.stream_now = true;
+	rx_stream->issue_stream_cmd(stream_cmd);
+
+	uhd::rx_metadata_t md;
+	bool started = false, has_next_tick = false;
+	long long next_tick = 0;
+	std::chrono::steady_clock::time_point start;
+	while (result.samps + result.lost_samps < result.requested){
+		size_t num_rx_samps = rx_stream->recv(buff_ptrs, spb, md, 0.5, false);
+		if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT){
+			if (++result.timeouts >= 5) break;
+			continue;
+		}
+		if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW){
+			result.overflows++;
+			continue;
+		}
+		if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE){
+			rx_stream->issue_stream_cmd(uhd::stream_cmd_t(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS));
+			throw std::runtime_error(str(boost::format("Rx self-test: %s") % md.strerror()));
+		}
+		if (not started){
+			start 	= std::chrono::steady_clock::now();
+			started = true;
+		}
+		if (md.has_time_spec){
+			long long tick = md.time_spec.to_ticks(rate);
+			if (has_next_tick and tick > next_tick) result.lost_samps += tick - next_tick;
+			next_tick 	  = tick;
+			has_next_tick = true;
+		}
+		next_tick 	 += num_rx_samps;
+		result.samps += num_rx_samps;
+	}
+	if (started){
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// stop and drain the packets in flight
+	rx_stream->issue_stream_cmd(uhd::stream_cmd_t(uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS));
+	while (rx_stream->recv(buff_ptrs, spb, md, 0.1, false) > 0 or md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW){
+	}
+	return result;
+}
+
+
+static void count_async_event(const uhd::async_metadata_t& md, self_test_result_t& result)
+{
+	switch (md.event_code){
+	case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW:
+	case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW_IN_PACKET:
+		result.underflows++;
+		break;
+	case uhd::async_metadata_t::EVENT_CODE_SEQ_ERROR:
+	case uhd::async_metadata_t::EVENT_CODE_SEQ_ERROR_IN_BURST:
+		result.seq_errors++;
+		break;
+	case uhd::async_metadata_t::EVENT_CODE_TIME_ERROR:
+		result.time_errors++;
+		break;
+	default:
+		break;
+	}
+}
+
+
+self_test_result_t tx_self_test(uhd::tx_streamer::sptr tx_stream, double rate, double seconds)
+{
+	self_test_result_t result;
+	result.name 	 = "tx";
+	result.rate 	 = rate;
+	result.requested = std::llround(rate * seconds);
+
+	// zeros: nothing goes on the air during the test
+	size_t spb = 16 * tx_stream->get_max_num_samps();
+	std::vector<std::complex<float>> buff(spb);
+	std::vector<std::complex<float>*> buff_ptrs(tx_stream->get_num_channels(), &buff.front());
+
+	uhd::tx_metadata_t md;
+	md.start_of_burst = true;
+	md.end_of_burst   = false;
+	md.has_time_spec  = false;
+	uhd::async_metadata_t async_md;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while (result.samps < result.requested){
+		size_t nsamps = std::min<uint64_t>(spb, result.requested - result.samps);
+		result.samps += tx_stream->send(buff_ptrs, nsamps, md, 1.0);
+		md.start_of_burst = false;
+		while (tx_stream->recv_async_msg(async_md, 0)){
+			count_async_event(async_md, result);
+		}
+	}
+	md.end_of_burst = true;
+	tx_stream->send("", 0, md);
+
+	// the burst is done when its end is acknowledged
+	while (tx_stream->recv_async_msg(async_md, 1.0)){
+		if (async_md.event_code == uhd::async_metadata_t::EVENT_CODE_BURST_ACK) break;
+		count_async_event(async_md, result);
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+
+void print_self_test(const self_test_result_t& result)
+{
+	std::cout << boost::format("Self-test %s: %.3f Msps sustained over %.2f s (%.3f Msps requested), %u/%u samples")
+		% result.name % result.msps() % result.seconds % (result.rate / 1e6) % result.samps % result.requested << std::endl;
+	if (result.ok()){
+		std::cout << "  no drops" << std::endl;
+	}
+	else{
+		std::cout << boost::format("  WARNING: %u overflows, %u lost samples, %u timeouts, %u underflows, %u sequence errors, %u late packets: "
+			"the host cannot sustain this rate") % result.overflows % result.lost_samps % result.timeouts % result.underflows
+			% result.seq_errors % result.time_errors << std::endl;
+	}
+}
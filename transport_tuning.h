@@ -0,0 +1,78 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_TRANSPORT_TUNING_H
+#define INCLUDED_MMWAVE_TRANSPORT_TUNING_H
+
+#include <uhd/stream.hpp>
+#include <stdint.h>
+#include <string>
+
+
+
+/***********************************************************************
+ * Transport parameters of a USRP on 10 GbE (X310)
+ * The UHD defaults are sized for a few Msps: at high rates the host needs
+ * jumbo frames (fewer packets per second), socket buffers covering a
+ * fraction of a second of samples and matching samples per packet.
+ **********************************************************************/
+struct transport_params_t
+{
+	double 	rate;
+	size_t 	num_channels;
+	size_t 	frame_size;			// recv_frame_size and send_frame_size in bytes
+	size_t 	num_frames;			// num_recv_frames and num_send_frames
+	size_t 	buff_size;			// recv_buff_size and send_buff_size in bytes
+	size_t 	spp;				// samples per packet
+	double 	link_bytes_per_sec;	// sc16 payload on the link, both channels included
+};
+
+// Parameters for a rate (samples per second per channel) and number of channels
+transport_params_t transport_params_for_rate(double rate, size_t num_channels = 1);
+
+// Device args with the transport parameters added (keys already in the args are kept)
+std::string tune_device_args(const std::string& args, const transport_params_t& params);
+
+// Samples per packet of a streamer
+void tune_stream_args(uhd::stream_args_t& stream_args, const transport_params_t& params);
+
+// Print the parameters and check them against the host limits (socket buffers, 10 GbE link).
+// Returns false and prints the sysctl to run when a limit is too low.
+bool check_transport_limits(const transport_params_t& params);
+
+
+
+/***********************************************************************
+ * Streaming self-test
+ * A short burst at the requested rate before the sweep: reports the
+ * sustained rate and the drops, so that a host unable to keep up is
+ * caught before any capture. Against unpaced stand-in streamers it
+ * measures the capacity of the host side alone.
+ **********************************************************************/
+struct self_test_result_t
+{
+	std::string name;
+	double 		rate 		= 0;	// requested rate
+	double 		seconds 	= 0;	// wall time of the burst
+	uint64_t 	requested 	= 0;	// samples per channel
+	uint64_t 	samps 		= 0;	// samples per channel received or sent
+	uint64_t 	lost_samps 	= 0;	// Rx samples missing from the time_specs
+	size_t 		overflows 	= 0;
+	size_t 		timeouts 	= 0;
+	size_t 		underflows 	= 0;
+	size_t 		seq_errors 	= 0;
+	size_t 		time_errors = 0;
+
+	double msps() const { return seconds > 0 ? samps / seconds / 1e6 : 0; }
+	size_t drops() const { return overflows + timeouts + underflows + seq_errors + time_errors; }
+	bool ok() const { return drops() == 0 and lost_samps == 0 and samps >= requested; }
+};
+
+self_test_result_t rx_self_test(uhd::rx_streamer::sptr rx_stream, double rate, double seconds);
+self_test_result_t tx_self_test(uhd::tx_streamer::sptr tx_stream, double rate, double seconds);
+
+void print_self_test(const self_test_result_t& result);
+
+#endif /* INCLUDED_MMWAVE_TRANSPORT_TUNING_H */
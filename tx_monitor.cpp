@@ -0,0 +1,86 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "tx_monitor.h"
+#include <boost/format.hpp>
+#include <iostream>
+
+
+
+tx_event_counts_t tx_event_counts_t::operator-(const tx_event_counts_t& other) const
+{
+	tx_event_counts_t diff;
+	diff.underflows 	= underflows - other.underflows;
+	diff.seq_errors 	= seq_errors - other.seq_errors;
+	diff.time_errors 	= time_errors - other.time_errors;
+	return diff;
+}
+
+
+
+tx_async_monitor::tx_async_monitor(const std::string& name, uhd::tx_streamer::sptr tx_stream) :
+	_name(name), _tx_stream(tx_stream), _stop(false), _underflows(0), _seq_errors(0), _time_errors(0)
+{
+	_thread = std::thread(&tx_async_monitor::monitor_loop, this);
+}
+
+
+tx_async_monitor::~tx_async_monitor()
+{
+	stop();
+}
+
+
+tx_event_counts_t tx_async_monitor::counts() const
+{
+	tx_event_counts_t counts;
+	counts.underflows 	= _underflows;
+	counts.seq_errors 	= _seq_errors;
+	counts.time_errors 	= _time_errors;
+	return counts;
+}
+
+
+void tx_async_monitor::stop()
+{
+	_stop = true;
+	if (_thread.joinable()){
+		_thread.join();
+	}
+}
+
+
+void tx_async_monitor::print_report() const
+{
+	tx_event_counts_t total = counts();
+	std::cout << boost::format("Tx report (%s): %u underflows, %u sequence errors, %u late packets")
+		% _name % total.underflows % total.seq_errors % total.time_errors << std::endl;
+}
+
+
+void tx_async_monitor::monitor_loop()
+{
+	uhd::async_metadata_t md;
+	while (not _stop){
+		// short timeout so that stop() returns quickly
+		if (not _tx_stream->recv_async_msg(md, 0.1)) continue;
+
+		switch (md.event_code){
+		case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW:
+		case uhd::async_metadata_t::EVENT_CODE_UNDERFLOW_IN_PACKET:
+			_underflows++;
+			break;
+		case uhd::async_metadata_t::EVENT_CODE_SEQ_ERROR:
+		case uhd::async_metadata_t::EVENT_CODE_SEQ_ERROR_IN_BURST:
+			_seq_errors++;
+			break;
+		case uhd::async_metadata_t::EVENT_CODE_TIME_ERROR:
+			_time_errors++;
+			break;
+		default:
+			break;
+		}
+	}
+}
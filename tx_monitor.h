@@ -0,0 +1,67 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_TX_MONITOR_H
+#define INCLUDED_MMWAVE_TX_MONITOR_H
+
+#include <uhd/stream.hpp>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+
+
+/***********************************************************************
+ * Tx async events (counted since the start of the stream or over a segment)
+ **********************************************************************/
+struct tx_event_counts_t
+{
+	uint64_t underflows 	= 0;	// underflows, also inside a packet
+	uint64_t seq_errors 	= 0;	// sequence errors, also inside a burst
+	uint64_t time_errors 	= 0;	// packets arriving after their time_spec (late)
+
+	uint64_t total() const { return underflows + seq_errors + time_errors; }
+	tx_event_counts_t operator-(const tx_event_counts_t& other) const;
+};
+
+
+
+/***********************************************************************
+ * tx_async_monitor
+ * Reads the async messages of one Tx streamer from a dedicated thread,
+ * so that underflows and late packets of the BB and LO chains are no
+ * longer lost. The counters are cumulative: a capture loop takes
+ * counts() at both ends of a segment to get the events of that segment.
+ **********************************************************************/
+class tx_async_monitor
+{
+public:
+	tx_async_monitor(const std::string& name, uhd::tx_streamer::sptr tx_stream);
+	~tx_async_monitor();
+
+	const std::string& name() const { return _name; }
+
+	tx_event_counts_t counts() const;
+
+	// Stop the monitor thread (called by the destructor)
+	void stop();
+
+	// Print the totals of the run
+	void print_report() const;
+
+private:
+	void monitor_loop();
+
+	std::string 			_name;
+	uhd::tx_streamer::sptr 	_tx_stream;
+	std::atomic<bool> 		_stop;
+	std::atomic<uint64_t> 	_underflows;
+	std::atomic<uint64_t> 	_seq_errors;
+	std::atomic<uint64_t> 	_time_errors;
+	std::thread 			_thread;
+};
+
+#endif /* INCLUDED_MMWAVE_TX_MONITOR_H */
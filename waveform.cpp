@@ -0,0 +1,263 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "waveform.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+static const char 	WAVEFORM_MAGIC[4] 		= {'M', 'M', 'W', 'F'};
+static const size_t WAVEFORM_FIELDS_BYTES 	= 64;		// fixed fields, the description follows
+static const size_t MIN_PARALLEL_SAMPS 		= 1 << 16;	// shorter waveforms are generated on one thread
+static const double TWO_PI 					= 6.283185307179586;
+
+
+
+/***********************************************************************
+ * Files
+ **********************************************************************/
+void write_waveform(const std::string& path, const std::vector<std::complex<float>>& samples, double rate, const std::string& description)
+{
+	if (description.size() > WAVEFORM_HEADER_BYTES - WAVEFORM_FIELDS_BYTES){
+		throw std::runtime_error("Waveform description too long");
+	}
+	std::vector<char> header(WAVEFORM_HEADER_BYTES, 0);
+	uint32_t version = WAVEFORM_VERSION, offset = WAVEFORM_HEADER_BYTES, format = WAVEFORM_FORMAT_FC32;
+	uint64_t num_samps = samples.size();
+	uint32_t description_bytes = description.size();
+	std::memcpy(&header[0], WAVEFORM_MAGIC, 4);
+	std::memcpy(&header[4], &version, 4);
+	std::memcpy(&header[8], &offset, 4);
+	std::memcpy(&header[12], &format, 4);
+	std::memcpy(&header[16], &num_samps, 8);
+	std::memcpy(&header[24], &rate, 8);
+	std::memcpy(&header[32], &description_bytes, 4);
+	std::memcpy(&header[WAVEFORM_FIELDS_BYTES], description.data(), description.size());
+
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	file.write(&header.front(), header.size());
+	if (not samples.empty()){
+		file.write((const char*)&samples.front(), samples.size()*sizeof(std::complex<float>));
+	}
+	file.close();
+	if (not file){
+		throw std::runtime_error(str(boost::format("Cannot write waveform file %s") % path));
+	}
+}
+
+
+waveform_info_t read_waveform_info(const std::string& path)
+{
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	if (not file.is_open()){
+		throw std::runtime_error(str(boost::format("Cannot open waveform file %s") % path));
+	}
+	char fields[WAVEFORM_FIELDS_BYTES];
+	if (not file.read(fields, sizeof(fields)) or std::memcmp(fields, WAVEFORM_MAGIC, 4) != 0){
+		throw std::runtime_error(str(boost::format("%s is not a waveform file") % path));
+	}
+
+	waveform_info_t info;
+	uint32_t format, description_bytes;
+	std::memcpy(&info.version, &fields[4], 4);
+	std::memcpy(&info.data_offset, &fields[8], 4);
+	std::memcpy(&format, &fields[12], 4);
+	std::memcpy(&info.num_samps, &fields[16], 8);
+	std::memcpy(&info.rate, &fields[24], 8);
+	std::memcpy(&description_bytes, &fields[32], 4);
+	if (info.version == 0 or info.version > WAVEFORM_VERSION){
+		throw std::runtime_error(str(boost::format("Waveform file %s has version %u, this build reads up to version %u") % path % info.version % WAVEFORM_VERSION));
+	}
+	if (format != WAVEFORM_FORMAT_FC32){
+		throw std::runtime_error(str(boost::format("Waveform file %s has an unknown sample format %u") % path % format));
+	}
+	if (description_bytes > info.data_offset - WAVEFORM_FIELDS_BYTES or info.data_offset < WAVEFORM_FIELDS_BYTES){
+		throw std::runtime_error(str(boost::format("Waveform file %s has a corrupted header") % path));
+	}
+	info.description.resize(description_bytes);
+	if (description_bytes > 0 and not file.read(&info.description[0], description_bytes)){
+		throw std::runtime_error(str(boost::format("Waveform file %s has a corrupted header") % path));
+	}
+
+	file.seekg(0, std::ios::end);
+	uint64_t file_bytes = file.tellg();
+	if (file_bytes < info.data_offset + info.num_samps*sizeof(std::complex<float>)){
+		throw std::runtime_error(str(boost::format("Waveform file %s is truncated: %u samples announced, %u bytes in the file") % path % info.num_samps % file_bytes));
+	}
+	return info;
+}
+
+
+std::vector<std::complex<float>> read_waveform(const std::string& path, waveform_info_t* info)
+{
+	waveform_info_t file_info = read_waveform_info(path);
+	std::vector<std::complex<float>> samples(file_info.num_samps);
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	file.seekg(file_info.data_offset);
+	if (not samples.empty() and not file.read((char*)&samples.front(), samples.size()*sizeof(std::complex<float>))){
+		throw std::runtime_error(str(boost::format("Cannot read the samples of waveform file %s") % path));
+	}
+	if (info != NULL) *info = file_info;
+	return samples;
+}
+
+
+
+/***********************************************************************
+ * Generators
+ **********************************************************************/
+// Run body(begin, end) over [0, length) in one chunk per thread
+static void parallel_chunks(size_t length, unsigned threads, std::function<void(size_t, size_t)> body)
+{
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	if (length < MIN_PARALLEL_SAMPS or threads == 1){
+		body(0, length);
+		return;
+	}
+	size_t chunk = (length + threads - 1) / threads;
+	std::vector<std::thread> workers;
+	for (size_t begin = 0; begin < length; begin += chunk){
+		workers.push_back(std::thread(body, begin, std::min(begin + chunk, length)));
+	}
+	for (size_t i = 0; i < workers.size(); i++){
+		workers[i].join();
+	}
+}
+
+
+// splitmix64 of a counter: random bits of symbol i, independent of the generation order
+static inline uint64_t counter_random(uint64_t seed, uint64_t i)
+{
+	uint64_t z = seed * 0x9E3779B97F4A7C15ULL + (i + 1) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+
+std::vector<std::complex<float>> psk_burst(int bits_per_symbol, uint64_t seed, size_t num_symbols, size_t sps, size_t length,
+										   float amplitude, unsigned threads)
+{
+	if (bits_per_symbol != 1 and bits_per_symbol != 2){
+		throw std::runtime_error("Only BPSK and QPSK bursts are supported");
+	}
+	if (sps == 0 or num_symbols * sps > length){
+		throw std::runtime_error(str(boost::format("A burst of %u symbols at %u samples per symbol does not fit in %u samples") % num_symbols % sps % length));
+	}
+	std::vector<std::complex<float>> samples(length);
+	size_t burst = num_symbols * sps;
+	parallel_chunks(length, threads, [&](size_t begin, size_t end){
+		for (size_t n = begin; n < end; n++){
+			if (n >= burst){
+				samples[n] = 0.0f;
+				continue;
+			}
+			uint64_t bits = counter_random(seed, n / sps);
+			float i = amplitude * (2.0f * (bits & 1) - 1.0f);
+			float q = (bits_per_symbol == 2) ? amplitude * (2.0f * ((bits >> 1) & 1) - 1.0f) : 0.0f;
+			samples[n] = std::complex<float>(i, q);
+		}
+	});
+	return samples;
+}
+
+
+std::vector<std::complex<float>> legacy_qpsk_burst(unsigned seed, size_t num_symbols, size_t length)
+{
+	std::vector<std::complex<float>> samples(length);
+	srand(seed);
+	for (size_t i = 0; i < num_symbols and i < length; i++){
+		float re = 2*(rand() % 2) - 1;
+		float im = 2*(rand() % 2) - 1;
+		samples[i] = std::complex<float>(re, im);
+	}
+	return samples;
+}
+
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	while (b != 0){
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+
+std::vector<std::complex<float>> zadoff_chu(uint64_t root, size_t length, float amplitude, unsigned threads)
+{
+	if (length == 0 or root == 0 or root >= length or gcd(root, length) != 1){
+		throw std::runtime_error(str(boost::format("Zadoff-Chu root %u must be in [1, %u) and coprime with the length") % root % length));
+	}
+	std::vector<std::complex<float>> samples(length);
+	uint64_t modulo = 2 * length;
+	bool odd = (length % 2 == 1);
+	parallel_chunks(length, threads, [&](size_t begin, size_t end){
+		for (size_t n = begin; n < end; n++){
+			// exp(-j pi u n (n + cf) / N), the exponent reduced modulo 2N in integers to stay exact on long sequences
+			unsigned __int128 k = (unsigned __int128)n * (n + (odd ? 1 : 0)) % modulo;
+			k = k * root % modulo;
+			double phase = -M_PI * (double)k / length;
+			samples[n] = std::complex<float>(amplitude * std::cos(phase), amplitude * std::sin(phase));
+		}
+	});
+	return samples;
+}
+
+
+std::vector<std::complex<float>> linear_chirp(double f0, double f1, double rate, size_t length, float amplitude, unsigned threads)
+{
+	if (rate <= 0 or length == 0){
+		throw std::runtime_error("A chirp needs a positive rate and length");
+	}
+	std::vector<std::complex<float>> samples(length);
+	double slope = (f1 - f0) * rate / length;	// Hz per second
+	parallel_chunks(length, threads, [&](size_t begin, size_t end){
+		for (size_t n = begin; n < end; n++){
+			double t = n / rate;
+			double cycles = f0 * t + 0.5 * slope * t * t;
+			double phase = TWO_PI * (cycles - std::floor(cycles));
+			samples[n] = std::complex<float>(amplitude * std::cos(phase), amplitude * std::sin(phase));
+		}
+	});
+	return samples;
+}
+
+
+std::vector<std::complex<float>> multitone(const std::vector<double>& freqs, double rate, size_t length, float amplitude, unsigned threads)
+{
+	if (freqs.empty() or rate <= 0){
+		throw std::runtime_error("A multi-tone needs at least one tone and a positive rate");
+	}
+	std::vector<std::complex<float>> samples(length);
+	float scale = amplitude / freqs.size();
+	parallel_chunks(length, threads, [&](size_t begin, size_t end){
+		for (size_t n = begin; n < end; n++){
+			double re = 0, im = 0;
+			for (size_t k = 0; k < freqs.size(); k++){
+				double cycles = freqs[k] * n / rate;
+				double phase = TWO_PI * (cycles - std::floor(cycles));
+				re += std::cos(phase);
+				im += std::sin(phase);
+			}
+			samples[n] = std::complex<float>(scale * re, scale * im);
+		}
+	});
+	return samples;
+}
+
+
+std::vector<std::complex<float>> constant_waveform(size_t length, float value)
+{
+	return std::vector<std::complex<float>>(length, std::complex<float>(value, 0.0f));
+}
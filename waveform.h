@@ -0,0 +1,77 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_WAVEFORM_H
+#define INCLUDED_MMWAVE_WAVEFORM_H
+
+#include <stdint.h>
+#include <complex>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * Waveform files
+ * A page-sized header followed by the fc32 samples, so that the samples
+ * of a mapped file start on a page boundary:
+ *   0   "MMWF"
+ *   4   version (uint32)
+ *   8   offset of the samples in bytes (uint32)
+ *   12  sample format (uint32, 0: fc32)
+ *   16  number of samples (uint64)
+ *   24  sample rate the waveform was generated for (double, 0: any)
+ *   32  length of the description (uint32), description text from 64
+ * All fields are little-endian.
+ **********************************************************************/
+const uint32_t WAVEFORM_VERSION 	 = 1;
+const uint32_t WAVEFORM_FORMAT_FC32  = 0;
+const size_t   WAVEFORM_HEADER_BYTES = 4096;
+
+struct waveform_info_t
+{
+	uint32_t 	version 	= WAVEFORM_VERSION;
+	uint32_t 	data_offset = WAVEFORM_HEADER_BYTES;
+	uint64_t 	num_samps 	= 0;
+	double 		rate 		= 0;
+	std::string description;	// generator and parameters, e.g. "qpsk seed=1 symbols=1000 sps=1 length=10000"
+};
+
+void write_waveform(const std::string& path, const std::vector<std::complex<float>>& samples, double rate, const std::string& description);
+
+// Parse and check the header of a waveform file (throws on a bad or truncated file)
+waveform_info_t read_waveform_info(const std::string& path);
+
+std::vector<std::complex<float>> read_waveform(const std::string& path, waveform_info_t* info = NULL);
+
+
+
+/***********************************************************************
+ * Generators
+ * Every sample is a function of its index only (the PRNG is counter
+ * based), so that long sequences are generated in parallel chunks and
+ * the output does not depend on the number of threads (0: all cores).
+ **********************************************************************/
+
+// Burst of random symbols (QPSK: +-1 +-1j, BPSK: +-1), sps samples per symbol, zero-padded to length
+std::vector<std::complex<float>> psk_burst(int bits_per_symbol, uint64_t seed, size_t num_symbols, size_t sps, size_t length,
+										   float amplitude = 1.0f, unsigned threads = 0);
+
+// The QPSK burst of the original tools: srand(seed), 1000 rand() symbols in 10000 samples
+std::vector<std::complex<float>> legacy_qpsk_burst(unsigned seed = 1, size_t num_symbols = 1000, size_t length = 10000);
+
+// Zadoff-Chu sequence of a root and length (root and length coprime)
+std::vector<std::complex<float>> zadoff_chu(uint64_t root, size_t length, float amplitude = 1.0f, unsigned threads = 0);
+
+// Linear chirp from f0 to f1 (Hz) over length samples at rate
+std::vector<std::complex<float>> linear_chirp(double f0, double f1, double rate, size_t length, float amplitude = 1.0f, unsigned threads = 0);
+
+// Sum of equal tones (Hz), scaled so that the peak stays within amplitude
+std::vector<std::complex<float>> multitone(const std::vector<double>& freqs, double rate, size_t length, float amplitude = 1.0f, unsigned threads = 0);
+
+// Constant carrier, the LO signal
+std::vector<std::complex<float>> constant_waveform(size_t length, float value = 1.0f);
+
+#endif /* INCLUDED_MMWAVE_WAVEFORM_H */
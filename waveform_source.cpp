@@ -0,0 +1,167 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#include "waveform_source.h"
+#include "waveform.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+
+waveform_source::waveform_source() :
+	_data(NULL), _num_samps(0), _base(NULL), _mapped_bytes(0)
+{
+}
+
+
+waveform_source::~waveform_source()
+{
+	if (_base != NULL){
+		munmap(_base, _mapped_bytes);
+	}
+}
+
+
+waveform_source::sptr waveform_source::map_file(const std::string& path)
+{
+	waveform_info_t info = read_waveform_info(path);
+	if (info.num_samps == 0){
+		throw std::runtime_error(str(boost::format("Waveform file %s is empty") % path));
+	}
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0){
+		throw std::runtime_error(str(boost::format("Cannot open waveform file %s: %s") % path % std::strerror(errno)));
+	}
+	size_t bytes = info.data_offset + info.num_samps*sizeof(std::complex<float>);
+	void* base = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	int err = errno;
+	close(fd);
+	if (base == MAP_FAILED){
+		throw std::runtime_error(str(boost::format("Cannot map waveform file %s: %s") % path % std::strerror(err)));
+	}
+	madvise(base, bytes, MADV_SEQUENTIAL);
+
+	std::shared_ptr<waveform_source> source(new waveform_source);
+	source->_base 			= base;
+	source->_mapped_bytes 	= bytes;
+	source->_data 			= (const std::complex<float>*)((const char*)base + info.data_offset);
+	source->_num_samps 		= info.num_samps;
+	source->_description 	= info.description;
+	return source;
+}
+
+
+waveform_source::sptr waveform_source::from_samples(const std::vector<std::complex<float>>& samples, const std::string& description)
+{
+	if (samples.empty()){
+		throw std::runtime_error("Empty waveform");
+	}
+	std::shared_ptr<waveform_source> source(new waveform_source);
+	source->_samples 		= samples;
+	source->_data 			= &source->_samples.front();
+	source->_num_samps 		= samples.size();
+	source->_description 	= description;
+	return source;
+}
+
+
+void waveform_source::advise(size_t first, size_t count, int advice) const
+{
+	if (_base == NULL or count == 0) return;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin = (const char*)(_data + first) - (const char*)_base;
+	size_t end = std::min(begin + count*sizeof(std::complex<float>), _mapped_bytes);
+	begin = begin / page * page;
+	madvise((char*)_base + begin, end - begin, advice);
+}
+
+
+void waveform_source::prefetch(size_t first, size_t count) const
+{
+	advise(first, count, MADV_WILLNEED);
+}
+
+
+void waveform_source::release(size_t first, size_t count) const
+{
+	advise(first, count, MADV_DONTNEED);
+}
+
+
+
+/***********************************************************************
+ * waveform_player
+ **********************************************************************/
+waveform_player::waveform_player(waveform_source::sptr source, bool loop, size_t window_samps) :
+	_source(source), _loop(loop), _window(window_samps), _index(0), _prefetched(0), _released(0), _loops(0), _done(false)
+{
+	// a waveform that fits in two windows simply stays resident
+	_streamed = source->mapped() and source->size() > 2*window_samps;
+	seek(0);
+}
+
+
+void waveform_player::seek(uint64_t index)
+{
+	size_t size = _source->size();
+	_index = _loop ? index % size : std::min<uint64_t>(index, size);
+	_done  = (_index == size);
+	_prefetched = _released = _index;
+	size_t count = _streamed ? std::min<uint64_t>(_window, size - _index) : size;
+	_source->prefetch(_index, count);
+	_prefetched = _index + count;
+}
+
+
+void waveform_player::fill(std::complex<float>* buff, size_t spb)
+{
+	size_t size = _source->size();
+	const std::complex<float>* data = _source->data();
+	size_t n = 0;
+	while (n < spb){
+		if (_done){
+			std::fill(buff + n, buff + spb, std::complex<float>(0.0f, 0.0f));
+			return;
+		}
+
+		// copy contiguous runs up to the end of the waveform instead of wrapping sample per sample
+		size_t run = std::min<uint64_t>(spb - n, size - _index);
+		std::memcpy(buff + n, data + _index, run*sizeof(std::complex<float>));
+		n 	   += run;
+		_index += run;
+
+		if (_streamed){
+			// keep one window read ahead of the cursor and drop what is more than one window behind
+			if (_index + _window/2 > _prefetched and _prefetched < size){
+				size_t count = std::min<uint64_t>(_window, size - _prefetched);
+				_source->prefetch(_prefetched, count);
+				_prefetched += count;
+			}
+			if (_index > _released + 2*_window){
+				_source->release(_released, _index - _window - _released);
+				_released = _index - _window;
+			}
+		}
+
+		if (_index == size){
+			if (not _loop){
+				_done = true;
+				continue;
+			}
+			_loops++;
+			if (_streamed){
+				_source->release(_released, size - _released);
+			}
+			seek(0);
+		}
+	}
+}
@@ -0,0 +1,97 @@
+//
+// Copyright ULB BEAMS-EE
+// Author: François QUITIN
+//
+
+#ifndef INCLUDED_MMWAVE_WAVEFORM_SOURCE_H
+#define INCLUDED_MMWAVE_WAVEFORM_SOURCE_H
+
+#include <stdint.h>
+#include <complex>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+
+/***********************************************************************
+ * waveform_source
+ * Read-only samples of a waveform shared by the Tx workers: a waveform
+ * file mapped in memory (nothing is read at startup, pages come in as
+ * they are played), or samples held in memory for the built-in signals.
+ **********************************************************************/
+class waveform_source
+{
+public:
+	typedef std::shared_ptr<const waveform_source> sptr;
+
+	// Map a waveform file (see waveform.h)
+	static sptr map_file(const std::string& path);
+
+	// Samples generated in the program
+	static sptr from_samples(const std::vector<std::complex<float>>& samples, const std::string& description);
+
+	~waveform_source();
+
+	const std::complex<float>* data() const { return _data; }
+	size_t size() const { return _num_samps; }
+	const std::string& description() const { return _description; }
+	bool mapped() const { return _base != NULL; }
+
+	// Read ahead / drop the pages of samples [first, first + count) of a mapped file (no-op in memory)
+	void prefetch(size_t first, size_t count) const;
+	void release(size_t first, size_t count) const;
+
+private:
+	waveform_source();
+	waveform_source(const waveform_source&);
+	waveform_source& operator=(const waveform_source&);
+
+	void advise(size_t first, size_t count, int advice) const;
+
+	const std::complex<float>* 			_data;
+	size_t 								_num_samps;
+	std::string 						_description;
+	void* 								_base;		// file mapping, NULL in memory
+	size_t 								_mapped_bytes;
+	std::vector<std::complex<float>> 	_samples;
+};
+
+
+
+/***********************************************************************
+ * waveform_player
+ * Cursor of one Tx worker over a waveform source: fills the send buffers
+ * with copies of contiguous runs, loops seamlessly (the sample after the
+ * last one is sample 0 again) or plays once followed by zeros. On a
+ * mapped file it reads ahead of the cursor and drops the pages it has
+ * played, so that a multi-gigabyte waveform streams at a constant RSS.
+ **********************************************************************/
+class waveform_player
+{
+public:
+	waveform_player(waveform_source::sptr source, bool loop = true, size_t window_samps = 1 << 21);
+
+	// Fill spb samples
+	void fill(std::complex<float>* buff, size_t spb);
+
+	// Position in the waveform, e.g. to align a timed start on a later sample
+	void seek(uint64_t index);
+	uint64_t index() const { return _index; }
+
+	uint64_t loops() const { return _loops; }
+	bool done() const { return _done; }
+
+private:
+	waveform_source::sptr 	_source;
+	bool 					_loop;
+	size_t 					_window;
+	bool 					_streamed;		// the waveform is larger than the read-ahead window
+	uint64_t 				_index;
+	uint64_t 				_prefetched;	// samples up to here have been read ahead
+	uint64_t 				_released;		// samples up to here have been dropped
+	uint64_t 				_loops;
+	bool 					_done;
+};
+
+#endif /* INCLUDED_MMWAVE_WAVEFORM_SOURCE_H */